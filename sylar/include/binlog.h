@@ -0,0 +1,321 @@
+#ifndef __SYLAR_BINLOG_H__
+#define __SYLAR_BINLOG_H__
+
+#include "log.h"
+#include "clock.h"
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/*
+    二进制日志(延迟格式化)
+    1. 每个调用点的格式串、文件名、行号、参数类型只在第一次调用时注册一次
+    2. 运行时只把调用点id、时间戳(TSC)和参数的原始字节写入当前线程的环形缓冲区，不做任何格式化
+    3. 后台线程定期把各线程的缓冲区原样写入文件，用sylar_logdecode离线还原成文本
+    4. BinLog没有打开或者单条记录太大时退回普通的文本日志
+    example:
+        sylar::BinLog::Open("app.binlog");
+        SYLAR_BINLOG_FMT_INFO(g_logger, "user %s login, retry=%d", name.c_str(), retry);
+    编译时定义SYLAR_LOG_BINARY则SYLAR_LOG_FMT_*也走二进制日志
+*/
+#define SYLAR_BINLOG_FMT_LEVEL(logger, level, fmt, ...) \
+    do { \
+        SYLAR_LOG_ENABLED(logger, level) { \
+            static sylar::BinLogSite s_sylar_binlog_site = {level, __FILE__, __LINE__, fmt, {0}}; \
+            if(!sylar::BinLog::IsOpen() \
+                    || !sylar::BinLog::Write(s_sylar_binlog_site, logger __VA_OPT__(,) __VA_ARGS__)) { \
+                sylar::LogEventWrap(logger, level, __FILE__, __LINE__).getEvent().format(fmt __VA_OPT__(,) __VA_ARGS__); \
+            } \
+        } \
+    } while(0)
+
+#define SYLAR_BINLOG_FMT_DEBUG(logger, fmt, ...) SYLAR_BINLOG_FMT_LEVEL(logger, sylar::LogLevel::DEBUG, fmt __VA_OPT__(,) __VA_ARGS__)
+#define SYLAR_BINLOG_FMT_INFO(logger, fmt, ...) SYLAR_BINLOG_FMT_LEVEL(logger, sylar::LogLevel::INFO, fmt __VA_OPT__(,) __VA_ARGS__)
+#define SYLAR_BINLOG_FMT_WARN(logger, fmt, ...) SYLAR_BINLOG_FMT_LEVEL(logger, sylar::LogLevel::WARN, fmt __VA_OPT__(,) __VA_ARGS__)
+#define SYLAR_BINLOG_FMT_ERROR(logger, fmt, ...) SYLAR_BINLOG_FMT_LEVEL(logger, sylar::LogLevel::ERROR, fmt __VA_OPT__(,) __VA_ARGS__)
+#define SYLAR_BINLOG_FMT_FATAL(logger, fmt, ...) SYLAR_BINLOG_FMT_LEVEL(logger, sylar::LogLevel::FATAL, fmt __VA_OPT__(,) __VA_ARGS__)
+
+#ifdef SYLAR_LOG_BINARY
+#undef SYLAR_LOG_FMT_LEVEL
+#define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...) SYLAR_BINLOG_FMT_LEVEL(logger, level, fmt __VA_OPT__(,) __VA_ARGS__)
+#endif
+
+namespace sylar {
+
+// 调用点，宏里的静态变量，常量初始化不需要加锁
+struct BinLogSite {
+    LogLevel::Level level;
+    const char* file;
+    uint32_t line;
+    const char* format;
+    std::atomic<uint32_t> id;       // 0表示还没有注册
+};
+
+/*
+    参数类型，整数统一存8字节，浮点数存double，字符串存长度和内容
+    类型字节的低4位是类型，整数的高4位是参数原本的字节数，还原时按printf的规则截断到这个宽度(0表示8字节)
+*/
+enum BinLogType : uint8_t {
+    BINLOG_INT = 1,
+    BINLOG_UINT = 2,
+    BINLOG_DOUBLE = 3,
+    BINLOG_STRING = 4,
+    BINLOG_POINTER = 5,
+    BINLOG_TYPE_MASK = 0x0f
+};
+
+template<class T, class Enable = void>
+struct BinLogArg;
+
+template<class T>
+struct BinLogArg<T, typename std::enable_if<(std::is_integral<T>::value && std::is_signed<T>::value)
+                                            || std::is_enum<T>::value>::type> {
+    static constexpr uint8_t type = BINLOG_INT | (sizeof(T) << 4);
+    static size_t size(T) { return 8;}
+    static char* encode(char* p, T v) {
+        int64_t x = (int64_t)v;
+        memcpy(p, &x, 8);
+        return p + 8;
+    }
+};
+
+template<class T>
+struct BinLogArg<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type> {
+    static constexpr uint8_t type = BINLOG_UINT | (sizeof(T) << 4);
+    static size_t size(T) { return 8;}
+    static char* encode(char* p, T v) {
+        uint64_t x = (uint64_t)v;
+        memcpy(p, &x, 8);
+        return p + 8;
+    }
+};
+
+template<class T>
+struct BinLogArg<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+    static constexpr uint8_t type = BINLOG_DOUBLE;
+    static size_t size(T) { return 8;}
+    static char* encode(char* p, T v) {
+        double x = (double)v;
+        memcpy(p, &x, 8);
+        return p + 8;
+    }
+};
+
+template<class T>
+struct BinLogArg<T, typename std::enable_if<std::is_same<typename std::decay<T>::type, const char*>::value
+                                            || std::is_same<typename std::decay<T>::type, char*>::value>::type> {
+    static constexpr uint8_t type = BINLOG_STRING;
+    static size_t size(const char* v) { return 4 + (v ? strlen(v) : 6);}
+    static char* encode(char* p, const char* v) {
+        if(!v) {
+            v = "(null)";
+        }
+        uint32_t len = strlen(v);
+        memcpy(p, &len, 4);
+        memcpy(p + 4, v, len);
+        return p + 4 + len;
+    }
+};
+
+template<class T>
+struct BinLogArg<T, typename std::enable_if<std::is_pointer<typename std::decay<T>::type>::value
+                                            && !std::is_same<typename std::decay<T>::type, const char*>::value
+                                            && !std::is_same<typename std::decay<T>::type, char*>::value>::type> {
+    static constexpr uint8_t type = BINLOG_POINTER;
+    static size_t size(const void*) { return 8;}
+    static char* encode(char* p, const void* v) {
+        uint64_t x = (uint64_t)(uintptr_t)v;
+        memcpy(p, &x, 8);
+        return p + 8;
+    }
+};
+
+template<>
+struct BinLogArg<std::string, void> {
+    static constexpr uint8_t type = BINLOG_STRING;
+    static size_t size(const std::string& v) { return 4 + v.size();}
+    static char* encode(char* p, const std::string& v) {
+        uint32_t len = v.size();
+        memcpy(p, &len, 4);
+        memcpy(p + 4, v.data(), len);
+        return p + 4 + len;
+    }
+};
+
+/*
+    每个线程一个单生产者单消费者的字节环形缓冲区
+    记录按8字节对齐：[调用点id 4][记录长度 4][时间戳 8][参数]
+    尾部放不下一条记录时写一条PAD记录占满剩余空间，从头开始写
+*/
+class BinLogRing {
+public:
+    static const uint32_t PAD = 0xffffffff;
+    static const size_t HEADER_SIZE = 16;
+
+    BinLogRing(uint32_t id, size_t capacity);
+    ~BinLogRing();
+
+    // 预留n字节(已对齐)，空间不足时等待后台线程写出，BinLog已经关闭时返回nullptr
+    char* reserve(size_t n) {
+        uint64_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t off = tail & m_mask;
+        size_t need = n;
+        if(m_capacity - off < n) {
+            need += m_capacity - off;
+        }
+        if(__builtin_expect(tail + need - m_headCache > m_capacity, 0) && !wait(tail + need)) {
+            return nullptr;
+        }
+        if(need != n) {
+            uint32_t pad[2] = {PAD, (uint32_t)(m_capacity - off)};
+            memcpy(m_data + off, pad, sizeof(pad));
+            tail += m_capacity - off;
+            off = 0;
+        }
+        m_reserved = tail;
+        return m_data + off;
+    }
+
+    void commit(size_t n) {
+        m_tail.store(m_reserved + n, std::memory_order_release);
+    }
+
+    uint32_t getId() const { return m_id;}
+    size_t getCapacity() const { return m_capacity;}
+    uint64_t getWaitCount() const { return m_waits;}
+    // 所属线程退出
+    void retire() { m_retired = true;}
+private:
+    bool wait(uint64_t end);
+private:
+    friend class BinLogWriter;
+    char* m_data;
+    size_t m_capacity;
+    size_t m_mask;
+    uint32_t m_id;
+    pid_t m_tid;
+    std::string m_threadName;
+    std::atomic<bool> m_retired = {false};      // 线程已经退出，写完之后删除
+    bool m_described = false;                   // 线程信息已经写入当前文件
+
+    // 生产者
+    alignas(64) std::atomic<uint64_t> m_tail = {0};
+    uint64_t m_reserved = 0;
+    uint64_t m_headCache = 0;
+    uint64_t m_waits = 0;
+    // 消费者
+    alignas(64) std::atomic<uint64_t> m_head = {0};
+};
+
+class BinLog {
+friend class BinLogWriter;
+public:
+    // <文件路径，每个线程缓冲区的字节数，后台线程写出的间隔>
+    static bool Open(const std::string& path, size_t ring_size = 1 << 20, uint64_t flush_interval_ms = 10);
+    // 写完所有缓冲区之后关闭文件
+    static void Close();
+    // 等待调用之前写入的记录都写到文件中
+    static void Flush();
+    static bool IsOpen() { return s_open.load(std::memory_order_relaxed);}
+
+    // 时间戳：x86上是TSC，其他平台是纳秒
+    static uint64_t Clock() { return sylar::Clock::Ticks();}
+    static double GetTicksPerNs();
+
+    // 记录太大(超过缓冲区的1/4)时返回false，由调用方输出文本日志
+    template<class... Args>
+    static bool Write(BinLogSite& site, const std::shared_ptr<Logger>& logger, const Args&... args) {
+        uint32_t id = site.id.load(std::memory_order_acquire);
+        if(__builtin_expect(!id, 0)) {
+            static const uint8_t types[] = {0, BinLogArg<Args>::type...};
+            id = Register(site, logger, types + 1, sizeof...(Args));
+        }
+        BinLogRing* ring = t_ring;
+        if(__builtin_expect(!ring, 0)) {
+            ring = CreateRing();
+        }
+        size_t size = (BinLogRing::HEADER_SIZE + ArgsSize(args...) + 7) & ~(size_t)7;
+        if(size > ring->getCapacity() / 4) {
+            return false;
+        }
+        char* p = ring->reserve(size);
+        if(!p) {
+            return false;
+        }
+        uint32_t header[2] = {id, (uint32_t)size};
+        uint64_t now = Clock();
+        memcpy(p, header, sizeof(header));
+        memcpy(p + 8, &now, sizeof(now));
+        Encode(p + BinLogRing::HEADER_SIZE, args...);
+        ring->commit(size);
+        return true;
+    }
+private:
+    static size_t ArgsSize() { return 0;}
+    template<class T, class... Args>
+    static size_t ArgsSize(const T& v, const Args&... args) {
+        return BinLogArg<T>::size(v) + ArgsSize(args...);
+    }
+    static void Encode(char*) {}
+    template<class T, class... Args>
+    static void Encode(char* p, const T& v, const Args&... args) {
+        Encode(BinLogArg<T>::encode(p, v), args...);
+    }
+
+    static uint32_t Register(BinLogSite& site, const std::shared_ptr<Logger>& logger, const uint8_t* types, size_t nargs);
+    static BinLogRing* CreateRing();
+private:
+    inline static std::atomic<bool> s_open = {false};
+    inline static thread_local BinLogRing* t_ring = nullptr;
+};
+
+/*
+    读取二进制日志文件
+    文件由若干条目组成：调用点定义、线程信息、时钟同步、某个线程缓冲区的一段数据
+    后台线程每一轮先写时钟同步，同一轮内的记录按时间戳排序后输出
+*/
+class BinLogReader {
+public:
+    struct Site {
+        LogLevel::Level level = LogLevel::UNKNOWN;
+        std::string file;
+        uint32_t line = 0;
+        std::string format;
+        std::string logger;
+        std::vector<uint8_t> types;
+    };
+
+    struct Record {
+        const Site* site;
+        uint32_t threadId;
+        const std::string* threadName;
+        uint64_t time;              // 纳秒时间戳(CLOCK_REALTIME)
+        uint32_t elapse;            // 进程启动后的毫秒数，版本1的文件为0
+        std::string message;        // 格式化之后的内容
+    };
+
+    BinLogReader(const std::string& path);
+    bool isValid() const { return m_valid;}
+    // 按顺序回调每一条记录，文件损坏时返回false
+    bool read(std::function<void(const Record&)> cb);
+    // 按LogFormatter的格式把每一条记录还原成文本，时间精确到纳秒(%N)，%r是进程启动后的毫秒数
+    bool format(LogFormatter::ptr formatter, std::ostream& os);
+
+    // 按printf格式串和记录中的参数还原内容
+    static std::string Render(const Site& site, const char* args, size_t len);
+private:
+    std::string m_path;
+    std::string m_data;
+    uint32_t m_version = 0;
+    bool m_valid = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __SYLAR_CLOCK_H__
+#define __SYLAR_CLOCK_H__
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace sylar {
+
+/*
+    进程级的时钟服务，日志、定时器、调度器共用
+    1. 精确时间走vDSO的clock_gettime，粗粒度时间(一个时钟节拍)用*_COARSE，都不进内核
+    2. Now系列在x86上用TSC外推：每个线程缓存一组(TSC, 实时时钟, 单调时钟)基准，
+       超过同步间隔之后重新读一次clock_gettime对齐，同一线程内单调时钟不会倒退
+    3. 内核没有用TSC作为时钟源(TSC不可靠)时Now系列直接读clock_gettime
+    example:
+        uint64_t ns = sylar::Clock::NowNS();
+        uint64_t ms = sylar::Clock::ElapsedMS();
+*/
+class Clock {
+public:
+    // 重新和系统时钟对齐的间隔
+    static const uint64_t RESYNC_NS = 1000000;
+
+    // CPU时间戳：x86上是TSC，其他平台是实时时钟的纳秒数
+    static uint64_t Ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return RealtimeNS();
+#endif
+    }
+    // 每纳秒的tick数，启动后的前几毫秒还没校准时返回0
+    static double TicksPerNs();
+    // 是否在用TSC外推
+    static bool IsTscEnabled();
+
+    // 实时时钟(1970年以来)和单调时钟的纳秒数，TSC外推，同一次读取
+    static void Now(uint64_t* realtime_ns, uint64_t* monotonic_ns);
+    static uint64_t NowNS();
+    static uint64_t NowMonotonicNS();
+
+    // 直接读系统时钟
+    static uint64_t RealtimeNS() { return Read(CLOCK_REALTIME);}
+    static uint64_t MonotonicNS() { return Read(CLOCK_MONOTONIC);}
+    static uint64_t MonotonicUS() { return MonotonicNS() / 1000;}
+    static uint64_t MonotonicMS() { return MonotonicNS() / 1000000;}
+    static uint64_t CoarseRealtimeNS() { return Read(CLOCK_REALTIME_COARSE);}
+    static uint64_t CoarseMonotonicMS() { return Read(CLOCK_MONOTONIC_COARSE) / 1000000;}
+
+    // 进程启动时的单调时钟纳秒数，以及到现在经过的毫秒数
+    static uint64_t StartMonotonicNS();
+    static uint64_t ElapsedMS() { return (NowMonotonicNS() - StartMonotonicNS()) / 1000000;}
+private:
+    static uint64_t Read(clockid_t id) {
+        struct timespec ts;
+        clock_gettime(id, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+};
+
+}
+
+#endif
@@ -12,6 +12,11 @@
 #include<unordered_set>
 #include<list>
 #include<functional>
+#include<type_traits>
+#include<atomic>
+#include<mutex>
+#include<shared_mutex>
+#include<thread>
 
 #include "log.h"
 #include "thread.h"
@@ -28,7 +33,8 @@ public:
     using ptr = std::shared_ptr<ConfigVarBase>;
     ConfigVarBase(const std::string& name, const std::string& description = "")
         :m_name(name)
-        ,m_description(description) {
+        ,m_description(description)
+        ,m_id(s_next_id++) {
             std::transform(m_name.begin(), m_name.end(), m_name.begin(), ::tolower);
         }
     virtual ~ConfigVarBase() {}
@@ -38,10 +44,33 @@ public:
 
     virtual std::string toString() = 0; // 将配置值转化为字符串
     virtual bool fromString(const std::string& val) = 0; // 从字符串解析配置值
+    virtual bool fromYaml(const YAML::Node& node) = 0; // 直接从yaml节点解析配置值
     virtual std::string getTypeName() const = 0;
+protected:
+    friend class Config;
+    /*
+        批量更新分三步，由Config::LoadFromYaml调用
+        parse只转换不修改配置项，失败返回空
+        publish发布转换好的值但不通知，值没有变化返回空，否则返回旧值
+        notify在整批发布之后通知监听者
+    */
+    virtual std::shared_ptr<const void> parse(const YAML::Node& node) = 0;
+    virtual std::shared_ptr<const void> publish(const std::shared_ptr<const void>& value) = 0;
+    virtual void notify(const std::shared_ptr<const void>& old_value, const std::shared_ptr<const void>& new_value) = 0;
+
+    // 线程缓存中的一项：最近读到的快照和它的版本号
+    struct CachedValue {
+        uint64_t version = 0;
+        std::shared_ptr<const void> value;
+    };
+    // 当前线程的缓存，按配置项的编号索引，编号不复用
+    static std::vector<CachedValue>& GetThreadCache();
 protected:
     std::string m_name;
     std::string m_description;
+    uint64_t m_id;
+private:
+    static inline std::atomic<uint64_t> s_next_id = {0};
 };
 
 // 类型转换模板类(F 源类型, T 目标类型)
@@ -54,34 +83,208 @@ public:
     }
 };
 
-// 通过偏特化实现std::string和STL容器之间的转化
-// vector
+/*
+    YAML::Node和类型之间直接转换(F 源类型, T 目标类型，其中一个是YAML::Node)
+    嵌套的容器只遍历一次节点树，不再逐层序列化成字符串再解析
+    没有特化的类型(基本类型、只特化了LexicalCast的自定义类型)经过字符串用LexicalCast转换
+*/
+template<class F, class T>
+class YamlCast;
+
 template<class T>
-class LexicalCast<std::string, std::vector<T>> {
+class YamlCast<YAML::Node, T> {
 public:
-    std::vector<T> operator() (const std::string& v) {
-        YAML::Node node = YAML::Load(v);
-        typename std::vector<T> vec;
+    T operator() (const YAML::Node& node) {
+        if(node.IsScalar()) {
+            return LexicalCast<std::string, T>()(node.Scalar());
+        }
         std::stringstream ss;
-        for(size_t i = 0; i < node.size(); i++) {
-            ss.str("");
-            ss << node[i];
-            vec.push_back(LexicalCast<std::string, T>()(ss.str()));
+        ss << node;
+        return LexicalCast<std::string, T>()(ss.str());
+    }
+};
+
+template<class T>
+class YamlCast<T, YAML::Node> {
+public:
+    YAML::Node operator() (const T& v) {
+        // 基本类型和字符串是标量，不用再解析一遍(字符串中的": "之类不会被当成YAML语法)
+        if constexpr(std::is_arithmetic<T>::value || std::is_same<T, std::string>::value) {
+            return YAML::Node(LexicalCast<T, std::string>()(v));
+        } else {
+            return YAML::Load(LexicalCast<T, std::string>()(v));
+        }
+    }
+};
+
+// vector
+template<class T>
+class YamlCast<YAML::Node, std::vector<T>> {
+public:
+    std::vector<T> operator() (const YAML::Node& node) {
+        std::vector<T> vec;
+        vec.reserve(node.size());
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            vec.push_back(YamlCast<YAML::Node, T>()(*it));
         }
         return vec;
     }
 };
 
 template<class T>
-class LexicalCast<std::vector<T>, std::string> {
+class YamlCast<std::vector<T>, YAML::Node> {
 public:
-    std::string operator() (const std::vector<T>& v) {
-        YAML::Node node;
+    YAML::Node operator() (const std::vector<T>& v) {
+        YAML::Node node(YAML::NodeType::Sequence);
+        for(auto& i : v) {
+            node.push_back(YamlCast<T, YAML::Node>()(i));
+        }
+        return node;
+    }
+};
+
+// list
+template<class T>
+class YamlCast<YAML::Node, std::list<T>> {
+public:
+    std::list<T> operator() (const YAML::Node& node) {
+        std::list<T> vec;
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            vec.push_back(YamlCast<YAML::Node, T>()(*it));
+        }
+        return vec;
+    }
+};
+
+template<class T>
+class YamlCast<std::list<T>, YAML::Node> {
+public:
+    YAML::Node operator() (const std::list<T>& v) {
+        YAML::Node node(YAML::NodeType::Sequence);
+        for(auto& i : v) {
+            node.push_back(YamlCast<T, YAML::Node>()(i));
+        }
+        return node;
+    }
+};
+
+// set
+template<class T>
+class YamlCast<YAML::Node, std::set<T>> {
+public:
+    std::set<T> operator() (const YAML::Node& node) {
+        std::set<T> vec;
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            vec.insert(YamlCast<YAML::Node, T>()(*it));
+        }
+        return vec;
+    }
+};
+
+template<class T>
+class YamlCast<std::set<T>, YAML::Node> {
+public:
+    YAML::Node operator() (const std::set<T>& v) {
+        YAML::Node node(YAML::NodeType::Sequence);
         for(auto& i : v) {
-            node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
+            node.push_back(YamlCast<T, YAML::Node>()(i));
         }
+        return node;
+    }
+};
+
+// unordered_set
+template<class T>
+class YamlCast<YAML::Node, std::unordered_set<T>> {
+public:
+    std::unordered_set<T> operator() (const YAML::Node& node) {
+        std::unordered_set<T> vec;
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            vec.insert(YamlCast<YAML::Node, T>()(*it));
+        }
+        return vec;
+    }
+};
+
+template<class T>
+class YamlCast<std::unordered_set<T>, YAML::Node> {
+public:
+    YAML::Node operator() (const std::unordered_set<T>& v) {
+        YAML::Node node(YAML::NodeType::Sequence);
+        for(auto& i : v) {
+            node.push_back(YamlCast<T, YAML::Node>()(i));
+        }
+        return node;
+    }
+};
+
+// map
+template<class T>
+class YamlCast<YAML::Node, std::map<std::string, T>> {
+public:
+    std::map<std::string, T> operator() (const YAML::Node& node) {
+        std::map<std::string, T> vec;
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            vec.emplace_hint(vec.end(), it->first.Scalar(), YamlCast<YAML::Node, T>()(it->second));
+        }
+        return vec;
+    }
+};
+
+template<class T>
+class YamlCast<std::map<std::string, T>, YAML::Node> {
+public:
+    YAML::Node operator() (const std::map<std::string, T>& v) {
+        YAML::Node node(YAML::NodeType::Map);
+        for(auto& i : v) {
+            node.force_insert(i.first, YamlCast<T, YAML::Node>()(i.second));
+        }
+        return node;
+    }
+};
+
+// unordered_map
+template<class T>
+class YamlCast<YAML::Node, std::unordered_map<std::string, T>> {
+public:
+    std::unordered_map<std::string, T> operator() (const YAML::Node& node) {
+        std::unordered_map<std::string, T> vec;
+        vec.reserve(node.size());
+        for(auto it = node.begin(); it != node.end(); ++it) {
+            vec.emplace(it->first.Scalar(), YamlCast<YAML::Node, T>()(it->second));
+        }
+        return vec;
+    }
+};
+
+template<class T>
+class YamlCast<std::unordered_map<std::string, T>, YAML::Node> {
+public:
+    YAML::Node operator() (const std::unordered_map<std::string, T>& v) {
+        YAML::Node node(YAML::NodeType::Map);
+        for(auto& i : v) {
+            node.force_insert(i.first, YamlCast<T, YAML::Node>()(i.second));
+        }
+        return node;
+    }
+};
+
+// 通过偏特化实现std::string和STL容器之间的转化，保留给按字符串读写的调用方
+// 整个字符串只解析一次，元素通过YamlCast在节点树上转换
+template<class T>
+class LexicalCast<std::string, std::vector<T>> {
+public:
+    std::vector<T> operator() (const std::string& v) {
+        return YamlCast<YAML::Node, std::vector<T>>()(YAML::Load(v));
+    }
+};
+
+template<class T>
+class LexicalCast<std::vector<T>, std::string> {
+public:
+    std::string operator() (const std::vector<T>& v) {
         std::stringstream ss;
-        ss << node;
+        ss << YamlCast<std::vector<T>, YAML::Node>()(v);
         return ss.str();
     }
 };
@@ -91,15 +294,7 @@ template<class T>
 class LexicalCast<std::string, std::list<T>> {
 public:
     std::list<T> operator() (const std::string& v) {
-        YAML::Node node = YAML::Load(v);
-        typename std::list<T> vec;
-        std::stringstream ss;
-        for(size_t i = 0; i < node.size(); i++) {
-            ss.str("");
-            ss << node[i];
-            vec.push_back(LexicalCast<std::string, T>()(ss.str()));
-        }
-        return vec;
+        return YamlCast<YAML::Node, std::list<T>>()(YAML::Load(v));
     }
 };
 
@@ -107,12 +302,8 @@ template<class T>
 class LexicalCast<std::list<T>, std::string> {
 public:
     std::string operator() (const std::list<T>& v) {
-        YAML::Node node;
-        for(auto& i : v) {
-            node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
-        }
         std::stringstream ss;
-        ss << node;
+        ss << YamlCast<std::list<T>, YAML::Node>()(v);
         return ss.str();
     }
 };
@@ -122,15 +313,7 @@ template<class T>
 class LexicalCast<std::string, std::set<T>> {
 public:
     std::set<T> operator() (const std::string& v) {
-        YAML::Node node = YAML::Load(v);
-        typename std::set<T> vec;
-        std::stringstream ss;
-        for(size_t i = 0; i < node.size(); i++) {
-            ss.str("");
-            ss << node[i];
-            vec.insert(LexicalCast<std::string, T>()(ss.str()));
-        }
-        return vec;
+        return YamlCast<YAML::Node, std::set<T>>()(YAML::Load(v));
     }
 };
 
@@ -138,12 +321,8 @@ template<class T>
 class LexicalCast<std::set<T>, std::string> {
 public:
     std::string operator() (const std::set<T>& v) {
-        YAML::Node node;
-        for(auto& i : v) {
-            node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
-        }
         std::stringstream ss;
-        ss << node;
+        ss << YamlCast<std::set<T>, YAML::Node>()(v);
         return ss.str();
     }
 };
@@ -153,15 +332,7 @@ template<class T>
 class LexicalCast<std::string, std::unordered_set<T>> {
 public:
     std::unordered_set<T> operator() (const std::string& v) {
-        YAML::Node node = YAML::Load(v);
-        typename std::unordered_set<T> vec;
-        std::stringstream ss;
-        for(size_t i = 0; i < node.size(); i++) {
-            ss.str("");
-            ss << node[i];
-            vec.insert(LexicalCast<std::string, T>()(ss.str()));
-        }
-        return vec;
+        return YamlCast<YAML::Node, std::unordered_set<T>>()(YAML::Load(v));
     }
 };
 
@@ -169,12 +340,8 @@ template<class T>
 class LexicalCast<std::unordered_set<T>, std::string> {
 public:
     std::string operator() (const std::unordered_set<T>& v) {
-        YAML::Node node;
-        for(auto& i : v) {
-            node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
-        }
         std::stringstream ss;
-        ss << node;
+        ss << YamlCast<std::unordered_set<T>, YAML::Node>()(v);
         return ss.str();
     }
 };
@@ -183,16 +350,8 @@ public:
 template<class T>
 class LexicalCast<std::string, std::map<std::string, T>> {
 public:
-std::map<std::string, T> operator() (const std::string& v) {
-        YAML::Node node = YAML::Load(v);
-        typename std::map<std::string, T> vec;
-        std::stringstream ss;
-        for(auto it = node.begin(); it != node.end(); it++) {
-            ss.str("");
-            ss << it->second;
-            vec.insert(std::make_pair(it->first.Scalar(),LexicalCast<std::string, T>()(ss.str())));
-        }
-        return vec;
+    std::map<std::string, T> operator() (const std::string& v) {
+        return YamlCast<YAML::Node, std::map<std::string, T>>()(YAML::Load(v));
     }
 };
 
@@ -200,12 +359,8 @@ template<class T>
 class LexicalCast<std::map<std::string, T>, std::string> {
 public:
     std::string operator() (const std::map<std::string, T>& v) {
-        YAML::Node node;
-        for(auto& i : v) {
-            node[i.first] = YAML::Load(LexicalCast<T, std::string>()(i.second));
-        }
         std::stringstream ss;
-        ss << node;
+        ss << YamlCast<std::map<std::string, T>, YAML::Node>()(v);
         return ss.str();
     }
 };
@@ -214,16 +369,8 @@ public:
 template<class T>
 class LexicalCast<std::string, std::unordered_map<std::string, T>> {
 public:
-std::unordered_map<std::string, T> operator() (const std::string& v) {
-        YAML::Node node = YAML::Load(v);
-        typename std::unordered_map<std::string, T> vec;
-        std::stringstream ss;
-        for(auto it = node.begin(); it != node.end(); it++) {
-            ss.str("");
-            ss << it->second;
-            vec.insert(std::make_pair(it->first.Scalar(),LexicalCast<std::string, T>()(ss.str())));
-        }
-        return vec;
+    std::unordered_map<std::string, T> operator() (const std::string& v) {
+        return YamlCast<YAML::Node, std::unordered_map<std::string, T>>()(YAML::Load(v));
     }
 };
 
@@ -231,17 +378,20 @@ template<class T>
 class LexicalCast<std::unordered_map<std::string, T>, std::string> {
 public:
     std::string operator() (const std::unordered_map<std::string, T>& v) {
-        YAML::Node node;
-        for(auto& i : v) {
-            node[i.first] = YAML::Load(LexicalCast<T, std::string>()(i.second));
-        }
         std::stringstream ss;
-        ss << node;
+        ss << YamlCast<std::unordered_map<std::string, T>, YAML::Node>()(v);
         return ss.str();
     }
 };
 
-// 模版化配置项
+/*
+    模版化配置项
+    值保存为不可变的快照，修改时整体替换(RCU)：
+    1. getRef()读当前线程缓存的快照，版本号没变时只有一次普通读，不加锁、不分配、不写共享的缓存行
+    2. getSnapshot()返回可以长期持有的shared_ptr，也从线程缓存中取
+    3. 写入方之间用rw_mutex串行，先发布新快照再增加版本号
+    4. 变更回调在新值发布之后执行，回调中读配置项得到的是新值
+*/
 template<class T, class FromStr = LexicalCast<std::string, T>, class ToStr = LexicalCast<T, std::string>>
 class ConfigVar : public ConfigVarBase
 {
@@ -249,16 +399,15 @@ public:
     using ptr = std::shared_ptr<ConfigVar>;
     using  on_change_cb = std::function<void (const T& old_value, const T& new_value)>;
     ConfigVar(const std::string& name, const T& default_value, const std::string& description = "")
-            :ConfigVarBase(name, description), m_val(default_value) {
+            :ConfigVarBase(name, description), m_val(std::make_shared<const T>(default_value)) {
     }
     
     std::string toString() override {
         try {
-            std::shared_lock<std::shared_mutex> lock(rw_mutex);
-            return ToStr()(m_val);
+            return ToStr()(*getSnapshot());
         } catch (std::exception& e) {
                 SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::toString exception" 
-                << e.what() << "convert: " << typeid(m_val).name() << " to string";
+                << e.what() << "convert: " << typeid(T).name() << " to string";
             }
             return "";
 
@@ -268,31 +417,51 @@ public:
         try {
             // m_val = boost::lexical_cast<T>(val);
             setValue(FromStr()(val));
+            return true;
         } catch (std::exception& e) {
                 SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::toString exception" 
-                << e.what() << "convert: string to" << typeid(m_val).name();
+                << e.what() << "convert: string to" << typeid(T).name();
             }
             return false;
     }
 
+    bool fromYaml(const YAML::Node& node) override {
+        std::shared_ptr<const void> value = parse(node);
+        if(!value) {
+            return false;
+        }
+        std::unique_lock<std::shared_mutex> lck(rw_mutex);
+        std::shared_ptr<const void> old = publishLocked(std::static_pointer_cast<const T>(value));
+        if(old) {
+            notifyLocked(*std::static_pointer_cast<const T>(old), *std::static_pointer_cast<const T>(value));
+        }
+        return true;
+    }
+
     const T getValue() { 
-        std::shared_lock<std::shared_mutex> lck(rw_mutex);
-        return m_val;
+        return getRef();
+    }
+
+    // 当前值的只读引用，在本线程下一次读取这个配置项之前有效
+    const T& getRef() {
+        return *static_cast<const T*>(getCached().value.get());
+    }
+
+    // 当前值的快照，可以跨线程长期持有，比getRef多一次引用计数的原子操作
+    std::shared_ptr<const T> getSnapshot() {
+        return std::static_pointer_cast<const T>(getCached().value);
     }
     
+    // 先发布新值再通知，回调中读到的已经是新值
     void setValue(const T& v) { 
-        {
-            std::shared_lock<std::shared_mutex> lck(rw_mutex);
-            if(v == m_val) {    // 值没有变化直接返回
-                return;
-            }
-            // 遍历回调映射表，执行回调
-            for(auto& i : m_cbs) {  
-                i.second(m_val, v);
-            }
-        }
         std::unique_lock<std::shared_mutex> lck(rw_mutex);
-        m_val = v;
+        std::shared_ptr<const T> old = m_val.load(std::memory_order_relaxed);
+        if(v == *old) {    // 值没有变化直接返回
+            return;
+        }
+        m_val.store(std::make_shared<const T>(v), std::memory_order_release);
+        m_version.fetch_add(1, std::memory_order_release);
+        notifyLocked(*old, v);
     }
     std::string getTypeName() const override {return typeid(T).name();}
 
@@ -320,77 +489,265 @@ public:
         std::unique_lock<std::shared_mutex> lck(rw_mutex);
         m_cbs.clear();
     }
+protected:
+    std::shared_ptr<const void> parse(const YAML::Node& node) override {
+        try {
+            // 自定义了FromStr时按字符串解析，保持原来的行为
+            if constexpr(std::is_same<FromStr, LexicalCast<std::string, T>>::value) {
+                return std::make_shared<const T>(YamlCast<YAML::Node, T>()(node));
+            } else if(node.IsScalar()) {
+                return std::make_shared<const T>(FromStr()(node.Scalar()));
+            } else {
+                std::stringstream ss;
+                ss << node;
+                return std::make_shared<const T>(FromStr()(ss.str()));
+            }
+        } catch (std::exception& e) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::fromYaml exception " 
+                << e.what() << " convert: yaml to " << typeid(T).name() << " name=" << m_name;
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<const void> publish(const std::shared_ptr<const void>& value) override {
+        std::unique_lock<std::shared_mutex> lck(rw_mutex);
+        return publishLocked(std::static_pointer_cast<const T>(value));
+    }
+
+    void notify(const std::shared_ptr<const void>& old_value, const std::shared_ptr<const void>& new_value) override {
+        std::unique_lock<std::shared_mutex> lck(rw_mutex);
+        notifyLocked(*std::static_pointer_cast<const T>(old_value), *std::static_pointer_cast<const T>(new_value));
+    }
 private:
-    T m_val;
+    // 调用方持有rw_mutex的写锁
+    std::shared_ptr<const T> publishLocked(std::shared_ptr<const T> value) {
+        std::shared_ptr<const T> old = m_val.load(std::memory_order_relaxed);
+        if(*value == *old) {
+            return nullptr;
+        }
+        m_val.store(std::move(value), std::memory_order_release);
+        m_version.fetch_add(1, std::memory_order_release);
+        return old;
+    }
+
+    // 调用方持有rw_mutex的写锁
+    void notifyLocked(const T& old_value, const T& new_value) {
+        for(auto& i : m_cbs) {  
+            i.second(old_value, new_value);
+        }
+    }
+
+    // 版本号没变时直接用线程缓存，否则重新取一次快照
+    const CachedValue& getCached() {
+        std::vector<CachedValue>& cache = GetThreadCache();
+        uint64_t version = m_version.load(std::memory_order_acquire);
+        if(__builtin_expect(m_id < cache.size() && cache[m_id].version == version, 1)) {
+            return cache[m_id];
+        }
+        if(m_id >= cache.size()) {
+            cache.resize(m_id + 1);
+        }
+        // 先取版本号再取快照，快照至少和版本号一样新
+        cache[m_id].value = m_val.load(std::memory_order_acquire);
+        cache[m_id].version = version;
+        return cache[m_id];
+    }
+private:
+    std::atomic<std::shared_ptr<const T>> m_val;
+    std::atomic<uint64_t> m_version = {1};     // 每次修改加一，线程缓存中的0表示没有缓存
     std::shared_mutex rw_mutex;
     // 变更回调函数组
     std::map<uint64_t, on_change_cb> m_cbs;
 };
 
+template<class T>
+class TypedConfigKey;
+
+/*
+    配置项句柄：配置名在全局注册表中的稠密编号
+    名字只在Config::Key时解析一次(加锁、查哈希表)，之后按编号直接取平铺数组，不加锁、不处理字符串
+    名字可以在配置项注册之前解析，注册之后句柄自动生效，在此之前get返回空
+    example:
+        static sylar::ConfigKey s_key = sylar::Config::Key("tcp.connect.timeout");
+        sylar::ConfigVarBase* var = s_key.get();
+*/
+class ConfigKey {
+public:
+    static const uint32_t INVALID = UINT32_MAX;
+    ConfigKey() = default;
+
+    bool isValid() const { return m_index != INVALID;}
+    uint32_t getIndex() const { return m_index;}
+    // 配置项还没有注册或者句柄无效时返回空
+    ConfigVarBase* get() const;
+protected:
+    friend class Config;
+    explicit ConfigKey(uint32_t index) :m_index(index) {}
+protected:
+    uint32_t m_index = INVALID;
+};
+
+// 带类型的句柄，只能由已注册且类型匹配的配置项得到，get不再做类型转换
+template<class T>
+class TypedConfigKey : public ConfigKey {
+public:
+    TypedConfigKey() = default;
+
+    ConfigVar<T>* get() const { return static_cast<ConfigVar<T>*>(ConfigKey::get());}
+    ConfigVar<T>* operator->() const { return get();}
+    const T& getRef() const { return get()->getRef();}
+private:
+    friend class Config;
+    explicit TypedConfigKey(uint32_t index) :ConfigKey(index) {}
+};
+
 // 配置管理器
 class Config {
 public:
-    // 通过多态统一管理，进行类型擦除
-    using ConfigVarMap = std::map<std::string, ConfigVarBase::ptr>;
-
     // 带默认值的查找
     template<class T>
     static typename ConfigVar<T>::ptr Lookup(const std::string& name,
             const T& default_value, const std::string& description = "") {
             std::unique_lock<std::shared_mutex> lock(GetMutex());
-            auto it = GetDatas().find(name);
-            if(it != GetDatas().end()) { // 
-                auto tmp = std::dynamic_pointer_cast<ConfigVar<T>>(it->second); // ​​将基类指针ConfigVarBase::ptr安全地向下转型为派生类指针 ConfigVar<T>::ptr​​, dynamic_cast 仅支持裸指针
+            Slot* slot = FindSlot(name);
+            if(slot && slot->owner) { // 
+                auto tmp = std::dynamic_pointer_cast<ConfigVar<T>>(slot->owner); // ​​将基类指针ConfigVarBase::ptr安全地向下转型为派生类指针 ConfigVar<T>::ptr​​, dynamic_cast 仅支持裸指针
                 if(tmp) {   // 如果存在且类型匹配，返回现有配置项。
                     SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "Lookup name = " << name << " exists";
                     return tmp;
                 } else {    // 如果存在但类型不匹配，返回 nullptr 并记录错误日志。
                     SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Lookup name = " << name << " exists but type not " 
-                                << typeid(T).name() << " real_type=" << it->second->getTypeName()
-                                << " " << it->second->toString();
+                                << typeid(T).name() << " real_type=" << slot->owner->getTypeName()
+                                << " " << slot->owner->toString();
                     return nullptr;
                 }
             }
             
             // 验证名称的合法性
-            if(name.find_first_not_of("abcdefghijklmnopqrstuvwxyz._0123456789") != std::string::npos) {
+            if(!IsValidName(name)) {
                 SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Lookup name invalid " << name;
                 throw std::invalid_argument(name);
             }
-            // 创建新配置项并注册到全局 ConfigVarMap
+            // 创建新配置项并注册到全局注册表，已经解析过的句柄随之生效
             // 嵌套从属类型名称, 依赖模板参数T的名称， 前面用typename, 用于告诉编译器 ​​ConfigVar<T>::ptr 是一个类型名​​，而不是静态成员变量或其他名称。
             typename ConfigVar<T>::ptr v(new ConfigVar<T>(name, default_value, description));
-            GetDatas()[name] = v;
+            Register(slot ? slot : InternSlot(name), v);
             return v; 
             }
     
     // 不带默认值的查找
     template<class T>
     static typename ConfigVar<T>::ptr Lookup(const std::string& name) {
+        return std::dynamic_pointer_cast<ConfigVar<T>>(LookupBase(name));
+    }
+
+    // 解析配置名得到句柄，名字不合法时返回无效句柄
+    static ConfigKey Key(const std::string& name);
+
+    // 解析已注册的配置项得到带类型的句柄，没有注册或者类型不匹配时返回无效句柄
+    template<class T>
+    static TypedConfigKey<T> Key(const std::string& name) {
         std::shared_lock<std::shared_mutex> lock(GetMutex());
-        auto it = GetDatas().find(name);
-        if(it == GetDatas().end()) {
+        Slot* slot = FindSlot(name);
+        if(!slot || !std::dynamic_pointer_cast<ConfigVar<T>>(slot->owner)) {
+            return TypedConfigKey<T>();
+        }
+        return TypedConfigKey<T>(slot->index);
+    }
+
+    // 按句柄取配置项，不加锁
+    static ConfigVarBase* Get(ConfigKey key) {
+        if(!key.isValid()) {
             return nullptr;
         }
-        return std::dynamic_pointer_cast<ConfigVar<T>>(it->second);
+        Slot* segment = s_segments[key.m_index / SEGMENT_SIZE].load(std::memory_order_acquire);
+        return segment[key.m_index % SEGMENT_SIZE].var.load(std::memory_order_acquire);
+    }
+
+    /*
+        用yaml节点树批量更新已注册的配置项，整批生效或者整批不生效
+        1. 遍历一次节点树，在一次加锁内找到所有配置项
+        2. 先全部转换，有一个失败就整批放弃，返回false
+        3. 在一个批次内发布所有新值，期间批次号为奇数，ReadConsistent据此重试
+        4. 全部发布之后再调用各配置项的变更回调，最后调用一次批量回调，回调中看到的是整批生效后的配置
+        last不为空时保存每个配置项上一次加载的yaml文本，只更新文本有变化的配置项
+    */
+    static bool LoadFromYaml(const YAML::Node& root, std::unordered_map<std::string, std::string>* last = nullptr);
+
+    // 批量回调：每批生效之后调用一次，参数是值有变化的配置项
+    using batch_cb = std::function<void (const std::vector<ConfigVarBase::ptr>& changed)>;
+    static uint64_t AddBatchListener(batch_cb cb);
+    static void DelBatchListener(uint64_t key);
+
+    /*
+        读多个配置项时保证读到的是同一批次的值，读的过程中有批次在发布就重试
+        cb可能被调用多次，只应该读配置
+    */
+    template<class F>
+    static void ReadConsistent(F cb) {
+        std::atomic<uint64_t>& gen = GetGeneration();
+        while(true) {
+            uint64_t g = gen.load(std::memory_order_acquire);
+            if(g & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            cb();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(gen.load(std::memory_order_relaxed) == g) {
+                return;
+            }
+        }
     }
 
-    static void LoadFromYaml(const YAML::Node& root);
     static ConfigVarBase::ptr LookupBase(const std::string& name);
 
+    // 按注册顺序遍历平铺的注册表
     static void Visit(std::function<void(ConfigVarBase::ptr)> cb);
 private:
-   // 使用静态局部变量 GetDatas() 和 GetMutex() 保证线程安全的延迟初始化
-    static ConfigVarMap& GetDatas() {
-        static ConfigVarMap s_datas;
-        return s_datas;
+    // 注册表中的一项，编号只增不减，没有注册的名字只占编号
+    struct Slot {
+        std::atomic<ConfigVarBase*> var = {nullptr};
+        ConfigVarBase::ptr owner;   // 写锁下修改
+        uint32_t index = 0;
+    };
+    // 注册表分段分配，已经分配的段不移动，按编号读不需要加锁
+    static const uint32_t SEGMENT_SIZE = 1024;
+    static const uint32_t MAX_SEGMENTS = 1024;
+
+    static bool IsValidName(const std::string& name) {
+        return name.find_first_not_of("abcdefghijklmnopqrstuvwxyz._0123456789") == std::string::npos;
+    }
+    // 以下调用方持有GetMutex()，Intern和Register要求写锁
+    static Slot* FindSlot(const std::string& name);
+    static Slot* InternSlot(const std::string& name);
+    static void Register(Slot* slot, ConfigVarBase::ptr var);
+    // 遍历yaml节点树收集已注册的配置项，调用方持有读锁
+    static void CollectVars(std::string& path, const YAML::Node& node
+                            , std::vector<std::pair<ConfigVarBase::ptr, YAML::Node>>& output);
+
+    // 名字到编号
+    static std::unordered_map<std::string, uint32_t>& GetNames() {
+        static std::unordered_map<std::string, uint32_t> s_names;
+        return s_names;
     }
     static std::shared_mutex& GetMutex() {
         static std::shared_mutex s_mutex;
         return s_mutex;
     }
+    // 批次号，发布一批配置期间为奇数
+    static std::atomic<uint64_t>& GetGeneration() {
+        static std::atomic<uint64_t> s_generation = {0};
+        return s_generation;
+    }
+
+    static inline std::atomic<Slot*> s_segments[MAX_SEGMENTS];
+    static inline std::atomic<uint32_t> s_count = {0};  // 已分配的编号数
 };
 
+inline ConfigVarBase* ConfigKey::get() const {
+    return Config::Get(*this);
+}
 
 } // end sylar
 
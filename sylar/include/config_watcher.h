@@ -0,0 +1,77 @@
+#ifndef __SYLAR_CONFIG_WATCHER_H__
+#define __SYLAR_CONFIG_WATCHER_H__
+
+#include "config.h"
+#include "iomanager.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sylar {
+
+/*
+    配置文件热加载
+    1. inotify的fd注册到IOManager的读事件上，没有轮询线程
+    2. 监视文件所在的目录，编辑器先写临时文件再rename替换的方式也能收到
+    3. 一批文件事件在安静debounce_ms之后合并处理，只重新解析变化的文件
+    4. 和这个文件上一次加载的内容逐项比较，只对文本变化的配置项调用fromYaml，
+       值没有真正变化时setValue不会通知监听器
+    5. 解析失败(例如文件只写了一半)时保留原来的值，等下一次变化
+    example:
+        sylar::IOManager iom(1, false);
+        sylar::ConfigWatcher::ptr watcher(new sylar::ConfigWatcher(&iom));
+        watcher->addFile("conf/log.yml");
+        watcher->start();
+        ...
+        watcher->stop();    // IOManager停止之前，否则读事件一直挂着
+*/
+class ConfigWatcher : public std::enable_shared_from_this<ConfigWatcher> {
+public:
+    using ptr = std::shared_ptr<ConfigWatcher>;
+    ConfigWatcher(IOManager* iom, uint64_t debounce_ms = 100);
+    ~ConfigWatcher();
+
+    // 监视文件，并立即加载一次；文件不存在时等它被创建
+    bool addFile(const std::string& path);
+    // 注册读事件，开始接收文件变化
+    bool start();
+    // 取消读事件，之后不再加载
+    void stop();
+
+    // 成功重新加载过的文件次数
+    uint64_t getReloadCount() const { return m_reloads;}
+    bool isValid() const { return m_fd >= 0;}
+private:
+    struct FileInfo {
+        std::string path;
+        // 每个配置项上一次加载的yaml文本
+        std::unordered_map<std::string, std::string> values;
+    };
+    // inotify可读：读出所有事件，标记变化的文件，(重新)开始防抖计时
+    void onReadable();
+    bool waitReadable();
+    // 防抖结束：重新加载标记过的文件
+    void reload();
+    void load(FileInfo& info);
+private:
+    IOManager* m_iom;
+    uint64_t m_debounce;
+    int m_fd = -1;
+    bool m_started = false;
+    bool m_stopped = false;
+    std::mutex m_mutex;
+    // 监视的目录(wd) -> 目录下监视的文件名 -> 文件
+    std::unordered_map<int, std::unordered_map<std::string, FileInfo> > m_files;
+    std::set<std::pair<int, std::string> > m_dirty;
+    Timer::ptr m_timer;
+    std::mutex m_loadMutex;     // 加载串行进行
+    std::atomic<uint64_t> m_reloads = {0};
+};
+
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef __SYLAR_CONTEXT_H__
+#define __SYLAR_CONTEXT_H__
+
+#include <stddef.h>
+
+/*
+    协程上下文切换后端
+    1. 默认使用手写汇编只保存callee-saved寄存器和栈指针(类似boost.context的fcontext)，切换时不进入内核
+    2. 定义SYLAR_FIBER_UCONTEXT(或在不支持的架构上)时回退到ucontext，swapcontext每次切换都会调用rt_sigprocmask
+*/
+#if !defined(SYLAR_FIBER_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define SYLAR_FIBER_UCONTEXT
+#endif
+
+#ifdef SYLAR_FIBER_UCONTEXT
+#include <ucontext.h>
+#else
+extern "C" {
+// 保存当前的callee-saved寄存器到当前栈上，将栈指针写入*from，然后切换到to指向的栈并恢复寄存器
+void sylar_swap_context(void** from, void* to);
+}
+#endif
+
+namespace sylar {
+
+class Context {
+public:
+    using Entry = void (*)();
+
+    // 初始化线程主协程的上下文，不需要分配栈
+    bool init();
+    // 在[stack, stack + size)上构造初始栈帧，第一次切换到该上下文时从fn开始执行，fn不能返回
+    bool make(void* stack, size_t size, Entry fn);
+
+    // 保存当前执行上下文到this，切换到to
+    bool swap(Context& to) {
+#ifdef SYLAR_FIBER_UCONTEXT
+        return swapcontext(&m_ctx, &to.m_ctx) == 0;
+#else
+        sylar_swap_context(&m_sp, to.m_sp);
+        return true;
+#endif
+    }
+
+#ifndef SYLAR_FIBER_UCONTEXT
+    // 共享栈模式下需要知道切出时的栈指针，以便只拷贝栈上实际使用的部分
+    void* getSp() const { return m_sp;}
+    void setSp(void* sp) { m_sp = sp;}
+#endif
+
+    static const char* BackendName();
+private:
+#ifdef SYLAR_FIBER_UCONTEXT
+    ucontext_t m_ctx;
+#else
+    void* m_sp = nullptr;   // 切出时保存的栈指针，寄存器保存在该栈顶
+#endif
+};
+
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef __SYLAR_FD_MANAGER_H__
+#define __SYLAR_FD_MANAGER_H__
+
+#include <memory>
+#include <vector>
+#include <shared_mutex>
+
+#include "singleton.h"
+
+namespace sylar {
+
+/*
+    文件句柄上下文，记录hook需要的句柄状态
+    1. 是否socket，socket在创建时被设置成系统层面的非阻塞
+    2. 用户是否主动设置了非阻塞，用户设置了非阻塞时hook直接调用原函数，由用户自己处理EAGAIN
+    3. SO_RCVTIMEO/SO_SNDTIMEO设置的超时时间，hook中用定时器实现
+*/
+class FdCtx : public std::enable_shared_from_this<FdCtx> {
+public:
+    using ptr = std::shared_ptr<FdCtx>;
+
+    FdCtx(int fd);
+    ~FdCtx();
+
+    bool isInit() const { return m_isInit;}
+    bool isSocket() const { return m_isSocket;}
+    bool isClose() const { return m_isClosed;}
+
+    void setUserNonblock(bool v) { m_userNonblock = v;}
+    bool getUserNonblock() const { return m_userNonblock;}
+
+    void setSysNonblock(bool v) { m_sysNonblock = v;}
+    bool getSysNonblock() const { return m_sysNonblock;}
+
+    // type为SO_RCVTIMEO或SO_SNDTIMEO，单位毫秒，-1表示不超时
+    void setTimeout(int type, uint64_t v);
+    uint64_t getTimeout(int type);
+private:
+    bool init();
+private:
+    bool m_isInit: 1;
+    bool m_isSocket: 1;
+    bool m_sysNonblock: 1;
+    bool m_userNonblock: 1;
+    bool m_isClosed: 1;
+    int m_fd;
+    uint64_t m_recvTimeout;
+    uint64_t m_sendTimeout;
+};
+
+class FdManager {
+public:
+    FdManager();
+
+    // 获取fd的上下文，auto_create为true时不存在则创建
+    FdCtx::ptr get(int fd, bool auto_create = false);
+    void del(int fd);
+private:
+    std::shared_mutex m_mutex;
+    std::vector<FdCtx::ptr> m_datas;
+};
+
+using FdMgr = Singleton<FdManager>;
+
+}
+
+#endif
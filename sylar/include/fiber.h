@@ -1,15 +1,18 @@
 #ifndef __SYLAR_FIBER_H__
 #define __SYLAR_FIBER_H__
-#include <ucontext.h>
+#include "context.h"
+#include "task.h"
 #include <memory>
 #include <functional>
 
 namespace sylar {
 
 class Scheduler;
+struct SharedStack;
 
 class Fiber : public std::enable_shared_from_this<Fiber> {
 friend class Scheduler;
+friend struct SharedStack;
 public:
     using ptr = std::shared_ptr<Fiber>;
 
@@ -26,11 +29,11 @@ private:
     Fiber();    
     
 public:
-    // 子协程构造函数 (协程执行的函数， 协程栈的大小, 是否在MainFiber上调度)
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+    // 子协程构造函数 (协程执行的函数， 协程栈的大小, 是否在MainFiber上调度, 是否运行在线程共享栈上)
+    Fiber(Task cb, size_t stacksize = 0, bool use_caller = false, bool shared_stack = false);
     ~Fiber();
     
-    void reset(std::function<void()> cb);   // 重置协程函数，并设置状态
+    void reset(Task cb);                    // 重置协程函数，并设置状态
     void swapIn();      // 切换到当前协程执行
     void swapOut();     // 切换到后台执行
 
@@ -39,6 +42,8 @@ public:
 
     uint64_t getId() const {return m_id;}
     State getState() const { return m_state;}
+    bool isSharedStack() const { return m_sharedStack;}
+    size_t getSavedStackSize() const { return m_saveSize;}
 public:
     static void SetThis(Fiber* f);      // 设置当前线程正在执行的协程
     static Fiber::ptr GetThis();        // 返回当前协程
@@ -48,13 +53,36 @@ public:
     static void MainFunc();             // 协程的主执行函数，执行完成返回线程主协程
     static void CallerMainFunc();       // 协程执行函数，执行完成返回到线程调度协程
     static uint64_t GetFiberId();
+    // [p, p+len)是否落在当前线程的共享栈上，当前协程切出后这段内存会被其他共享栈协程覆盖
+    static bool OnSharedStack(const void* p, size_t len);
+
+    // 从当前线程的协程池中取出一个已结束的协程并reset为cb，池为空时新建
+    static Fiber::ptr Create(Task cb);
+    // 只被调用方持有的已结束协程放回当前线程的协程池，否则只释放引用
+    static void Recycle(Fiber::ptr& fiber);
+private:
+    void initSharedContext(Context::Entry fn);      // 在保存区中构造共享栈协程的初始栈帧
+    void switchSharedStack();                       // 切入前把自己的栈内容恢复到线程共享栈上
+    void saveSharedStack(char* sp, char* top);      // 将[sp, top)的栈内容保存到堆上
 private:
     uint64_t m_id = 0;          // 协程id
     uint32_t m_stacksize = 0;   // 协程运行栈大小
     State m_state = INIT;       // 协程状态
-    ucontext_t m_ctx;           // 协程上下文
+    Context m_ctx;              // 协程上下文
     void* m_stack = nullptr;    // 协程运行栈指针
-    std::function<void()> m_cb; // 协程执行的函数对象
+    Task m_cb;                  // 协程执行的函数对象
+
+    /*
+        共享栈模式(类似libco的copy stack)：同一线程的共享栈协程都在线程共享栈上运行，
+        切出后只有在其他协程需要使用共享栈时，才把实际使用的栈内容拷贝到大小刚好的堆内存中。
+        栈上保存的是绝对地址，所以协程第一次运行后就绑定在该线程上，调度器会把它固定调度到该线程
+    */
+    bool m_sharedStack = false;             // 是否运行在共享栈上
+    int m_stackThread = -1;                 // 共享栈协程绑定的线程id，-1表示未绑定
+    SharedStack* m_sharedOwner = nullptr;   // 当前占用的共享栈
+    char* m_saveBuffer = nullptr;           // 切出后保存的栈内容
+    size_t m_saveSize = 0;
+    size_t m_saveCapacity = 0;
 };
 
 }
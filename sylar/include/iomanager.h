@@ -2,18 +2,39 @@
 #define __IOMANAGER_H__
 
 
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include "scheduler.h"
+#include "timer.h"
+
+struct io_uring_sqe;
 
 namespace sylar {
 
-class IOManager : public Scheduler {
+class IoUring;
+
+/*
+    基于事件的协程调度器，支持两种后端
+    1. EPOLL: 就绪通知，addEvent通过epoll_ctl注册，事件就绪后由协程自己调用read/write
+    2. URING: 完成通知，addEvent提交一次性的POLL_ADD，协程也可以通过read/write/accept/connect
+       直接等待io_uring完成，数据拷贝在内核中完成
+    3. URING后端中工作线程准备的请求只写入提交队列，在该线程进入idle时与等待合并成一次io_uring_enter
+    4. 后端在构造时指定，DEFAULT时由配置iomanager.backend决定，io_uring不可用时回退到epoll
+*/
+class IOManager : public Scheduler, public TimerManager {
 public:
     using ptr = std::shared_ptr<IOManager>;
     
     enum Event {
         NONE = 0x0,
-        READ = 0x1,
-        WRITE = 0x2
+        READ = 0x1,     // EPOLLIN
+        WRITE = 0x4     // EPOLLOUT
+    };
+
+    enum Backend {
+        DEFAULT = 0,    // 由配置iomanager.backend决定
+        EPOLL = 1,
+        URING = 2
     };
 
 private:    
@@ -35,9 +56,12 @@ private:
     };
 
 public:
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = "");
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = ""
+              ,Backend backend = DEFAULT);
     ~IOManager();
 
+    Backend getBackend() const { return m_backend;}
+
     // 1 success, 0 retry, -1 error
     int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
     bool delEvent(int fd, Event event);
@@ -45,18 +69,87 @@ public:
 
     bool cancelAll(int fd);
 
+    /*
+        在当前协程中等待IO完成，返回值和errno同对应的系统调用
+        1. URING后端直接提交对应的io_uring操作，挂起协程直到完成
+        2. EPOLL后端先尝试系统调用，EAGAIN时注册事件挂起协程，fd需要是非阻塞的
+        3. offset为-1时使用文件当前偏移，socket忽略
+    */
+    ssize_t read(int fd, void* buf, size_t len, int64_t offset = -1);
+    ssize_t write(int fd, const void* buf, size_t len, int64_t offset = -1);
+    int accept(int fd, struct sockaddr* addr, socklen_t* addrlen);
+    int connect(int fd, const struct sockaddr* addr, socklen_t addrlen);
+
+    // 使用registerBuffers注册的第buf_index个缓冲区，buf必须落在该缓冲区内
+    ssize_t readFixed(int fd, void* buf, size_t len, int buf_index, int64_t offset = -1);
+    ssize_t writeFixed(int fd, const void* buf, size_t len, int buf_index, int64_t offset = -1);
+
+    /*
+        注册固定缓冲区和文件，只在URING后端生效，EPOLL后端直接返回true
+        注册过的fd在提交请求时自动换成下标，省去内核每次查找和引用计数文件
+        重复注册会替换之前的注册，调用时不能有使用它们的请求在执行
+    */
+    bool registerBuffers(const struct iovec* iovs, size_t nr);
+    bool registerFiles(const std::vector<int>& fds);
+
+    // 本IOManager发起的系统调用次数(事件循环、事件注册和上面的IO接口)
+    uint64_t getSyscallCount() const { return m_syscallCount;}
+
     static IOManager* GetThis();
 
 protected:
     void tickle() override;
     bool stopping() override;
     void idle() override;
+    void onTimerInsertedAtFront() override;
+
+    // timeout返回距离下一个定时器到期的毫秒数
+    bool stopping(uint64_t& timeout);
 
     void contextResize(size_t size);
+    // 获取fd对应的上下文，auto_create为true时按需扩容
+    FdContext* getFdContext(int fd, bool auto_create);
+private:
+    struct UringOp;
+
+    bool initUring();
+    void idleEpoll();
+    void idleUring();
+    // 结束一轮事件分发，分发期间被推迟的唤醒在这里合并成一次
+    void endDispatch();
+
+    // 以下在m_sqMutex中调用
+    io_uring_sqe* getSqe();
+    void prepSqe(io_uring_sqe* sqe, int op, int fd, uint64_t user_data);
+    void commitSqe();
+
+    // URING后端的事件注册，调用方持有fd_ctx->mutex
+    void submitPoll(FdContext* fd_ctx, Event event);
+    void submitPollRemove(FdContext* fd_ctx, Event event);
+    void onPollComplete(FdContext* fd_ctx, Event event, int res);
+
+    /*
+        提交一个io_uring请求并挂起当前协程直到完成，返回值和errno同系统调用
+        fd是非阻塞的时候内核可能返回EAGAIN，此时等待event就绪后重新提交
+    */
+    template<class Prep>
+    int awaitUring(int op, int fd, Event event, Prep prep);
+    // EPOLL后端：调用fun直到不再返回EAGAIN，期间等待event就绪
+    template<class Fun>
+    ssize_t awaitReady(int fd, Event event, Fun fun);
+    // 等待非阻塞connect完成
+    int finishConnect(int fd, int rt);
 private:
+    Backend m_backend = EPOLL;
     int m_epfd = 0;
     int m_tickleFds[2];
 
+    std::unique_ptr<IoUring> m_ring;
+    std::mutex m_sqMutex;               // 保护提交队列和注册文件表
+    std::mutex m_cqMutex;               // 保护完成队列的消费
+    std::vector<int> m_fixedFiles;      // fd到注册文件下标的映射，-1表示未注册
+    std::atomic<uint64_t> m_syscallCount = {0};
+
     std::atomic<size_t> m_pendingEventCount = {0};
     std::shared_mutex m_mutex;
     std::vector<FdContext*> m_fdContexts;
@@ -6,6 +6,8 @@
 #include "thread.h"
 
 #include <string>
+#include <type_traits>
+#include <string_view>
 #include <stdint.h>
 #include <memory>
 #include <list>
@@ -15,11 +17,29 @@
 #include <stdarg.h>
 #include <map>
 #include <mutex>
+#include <atomic>
+#include <deque>
+#include <condition_variable>
+#include <functional>
+
+struct iovec;
+
+// 编译期最低级别(1=DEBUG ... 5=FATAL)，低于它的日志语句整条去掉
+#ifndef SYLAR_MIN_LOG_LEVEL
+#define SYLAR_MIN_LOG_LEVEL 0
+#endif
+
+// 日志语句是否输出：先按编译期级别，再看调用点缓存的结果
+#define SYLAR_LOG_ENABLED(logger, level) \
+    if((level) < SYLAR_MIN_LOG_LEVEL) {} \
+    else if(static sylar::LogSite s_sylar_log_site; !s_sylar_log_site.isEnabled(logger, level)) {} \
+    else
+
 // 通过宏封装简化调用
+// LogEvent取自线程内复用的缓存，不分配内存
 #define SYLAR_LOG_LEVEL(logger, level) \
-    if(logger->getLevel() <= level) \
-        sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level, __FILE__, __LINE__, 0, sylar::GetThreadId(),\
-            sylar::GetFiberId(), time(0), sylar::Thread::GetName()))).getSS()
+    SYLAR_LOG_ENABLED(logger, level) \
+        sylar::LogEventWrap(logger, level, __FILE__, __LINE__).getSS()
 
 #define SYLAR_LOG_DEBUG(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::DEBUG)
 #define SYLAR_LOG_INFO(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::INFO)
@@ -34,10 +54,9 @@ Output:
     User Alice logged in from 192.168.1.1 (attempt 3)
 */
 
-#define SYLAR_LOG_FMT_LEVEL(log, level, fmt, ...) \
-    if(logger->getLevel() <= level) \
-        sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level, __FILE__, __LINE__, 0, sylar::GetThreadId(),\
-            sylar::GetFiberId(), time(0), sylar::Thread::GetName()))).getEvent()->format(fmt, __VA_ARGS__)
+#define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...) \
+    SYLAR_LOG_ENABLED(logger, level) \
+        sylar::LogEventWrap(logger, level, __FILE__, __LINE__).getEvent().format(fmt, __VA_ARGS__)
 
 #define SYLAR_LOG_FMT_DEBUG(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::DEBUG, fmt, __VA_ARGS__)
 #define SYLAR_LOG_FMT_INFO(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::INFO, fmt, __VA_ARGS__)
@@ -45,6 +64,37 @@ Output:
 #define SYLAR_LOG_FMT_ERROR(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::ERROR, fmt, __VA_ARGS__)
 #define SYLAR_LOG_FMT_FATAL(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::FATAL, fmt, __VA_ARGS__)
 
+/*
+    限流：每个调用点独立计数，被抑制的语句只做几次原子操作，不格式化
+    SYLAR_LOG_EVERY_N      每n条输出一条
+    SYLAR_LOG_FIRST_N      只输出前n条
+    SYLAR_LOG_PER_SECOND   每秒最多输出n条
+    被抑制的条数每秒最多汇总输出一次："suppressed 12345 similar messages"
+    调用点再次执行时顺便汇总，不再执行时由后台线程(log_limiter)在一到两个间隔内补上最后的汇总
+    example:
+        SYLAR_LOG_PER_SECOND(g_logger, sylar::LogLevel::ERROR, 10) << "connect " << addr << " failed";
+*/
+#define SYLAR_LOG_LIMITED(logger, level, allow, n) \
+    SYLAR_LOG_ENABLED(logger, level) \
+    if(static sylar::LogLimiter s_sylar_log_limiter(n); \
+            !s_sylar_log_limiter.allow(logger, level, __FILE__, __LINE__)) {} \
+    else sylar::LogEventWrap(logger, level, __FILE__, __LINE__).getSS()
+
+#define SYLAR_LOG_EVERY_N(logger, level, n) SYLAR_LOG_LIMITED(logger, level, allowEveryN, n)
+#define SYLAR_LOG_FIRST_N(logger, level, n) SYLAR_LOG_LIMITED(logger, level, allowFirstN, n)
+#define SYLAR_LOG_PER_SECOND(logger, level, n) SYLAR_LOG_LIMITED(logger, level, allowPerSecond, n)
+
+/*
+    结构化日志：消息加上若干键值对，值按类型保存(整数、浮点数、布尔、字符串)，输出时才序列化
+    字段直接引用调用方的数据，不拷贝，日志在这个调用内输出完
+    example:
+        SYLAR_LOG_KV(g_logger, INFO, "request done", "latency_us", us, "fd", fd, "path", path);
+    %J格式输出一行JSON，%K输出logfmt，%m在消息后面追加 key=value
+*/
+#define SYLAR_LOG_KV(logger, level, msg, ...) \
+    SYLAR_LOG_ENABLED(logger, sylar::LogLevel::level) \
+        sylar::LogKV(logger, sylar::LogLevel::level, __FILE__, __LINE__, msg __VA_OPT__(,) __VA_ARGS__)
+
 #define SYLAR_LOG_ROOT() sylar::LoggerMgr::GetInstance()->getRoot()
 #define SYLAR_LOG_NAME(name) sylar::LoggerMgr::GetInstance()->getLogger(name)
 
@@ -68,79 +118,265 @@ public:
     static const char* ToString(LogLevel::Level level);
 };
 
-// 日志事件
+// 日志缓冲区：先用内置的定长数组，超长时换到堆上，扩容后的内存留着下次复用
+class LogBuffer : public std::streambuf {
+public:
+    LogBuffer();
+    ~LogBuffer();
+
+    const char* data() const { return pbase();}
+    size_t size() const { return pptr() - pbase();}
+    size_t available() const { return epptr() - pptr();}
+    // 清空内容，过大的堆内存在这里释放
+    void clear();
+    // 保证至少有n字节可写，返回写入位置，写完用commit提交实际写入的长度
+    char* reserve(size_t n);
+    void commit(size_t n);
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+private:
+    void grow(size_t n);
+private:
+    static const size_t INLINE_SIZE = 1024;
+    static const size_t KEEP_SIZE = 64 * 1024;
+    char m_inline[INLINE_SIZE];
+    char* m_data;
+    size_t m_capacity;
+};
+
+// 写入LogBuffer的输出流，同一个线程内重复使用
+class LogStream : public std::ostream {
+public:
+    LogStream();
+
+    const char* data() const { return m_buf.data();}
+    size_t size() const { return m_buf.size();}
+    LogBuffer& getBuffer() { return m_buf;}
+    // 清空内容并恢复默认的格式状态
+    void reset();
+private:
+    LogBuffer m_buf;
+};
+
+// 结构化日志的一个字段，字符串只保存指针和长度
+struct LogField {
+    enum Type : uint8_t {
+        INT = 0,
+        UINT,
+        DOUBLE,
+        BOOL,
+        STRING
+    };
+    std::string_view key;
+    Type type = INT;
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        bool b;
+    };
+    std::string_view str;
+};
+
+/*
+    日志事件
+    宏里使用的LogEvent来自每个线程的缓存，日志语句结束后交还，整个过程不分配内存
+    以引用的方式传给Logger和Appender，不能在日志语句结束之后继续持有
+*/
 class LogEvent {
+friend class LogEventWrap;
 public:
     using ptr = std::shared_ptr<LogEvent>;
+    LogEvent();
     LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
             , const char* file, uint32_t line, uint32_t elapse
             , uint32_t thread_id, uint32_t fiber_id, uint64_t time
             , const std::string& thread_name);
 
+    // 复用时重新设置，内容缓冲区清空
+    void reset(std::shared_ptr<Logger> logger, LogLevel::Level level
+            , const char* file, uint32_t line, uint32_t elapse
+            , uint32_t thread_id, uint32_t fiber_id, uint64_t time
+            , const std::string& thread_name);
+
     const char* getFile() const { return m_file;}
     uint32_t getLine() const { return m_line;}
     uint32_t getElapse() const { return m_elapse;}
     uint32_t getThreadId() const { return m_threadId;}
     uint32_t getFiberId() const { return m_fiberId;}
     uint64_t getTime() const { return m_time;}
+    uint32_t getNanoseconds() const { return m_nsec;}
+    uint64_t getTimeUS() const { return m_time * 1000000ull + m_nsec / 1000;}
+    uint64_t getTimeNS() const { return m_time * 1000000000ull + m_nsec;}
+    void setTimeNS(uint64_t ns) { m_time = ns / 1000000000ull; m_nsec = ns % 1000000000ull;}
     const std::string& getThreadName() const {return m_threadName;}
-    std::string getContent() const { return m_ss.str();}
-    std::shared_ptr<Logger> getLogger() const { return m_logger;}
-    std::stringstream& getSS() { return m_ss;}
+    std::string getContent() const { return std::string(m_ss.data(), m_ss.size());}
+    const char* getContentData() const { return m_ss.data();}
+    size_t getContentSize() const { return m_ss.size();}
+    const std::shared_ptr<Logger>& getLogger() const { return m_logger;}
+    std::ostream& getSS() { return m_ss;}
     LogLevel::Level getLevel() const { return m_level;}
 
     void format(const char* fmt, ...);
     void format(const char* fmt, va_list al);
+
+    // 结构化字段，指向调用方的数组，只在这一条日志输出期间有效
+    const LogField* getFields() const { return m_fields;}
+    size_t getFieldCount() const { return m_fieldCount;}
+    void setFields(const LogField* fields, size_t count) { m_fields = fields; m_fieldCount = count;}
 private:
     const char* m_file = nullptr;   // 文件名
     uint32_t m_line = 0;            // 行号
     uint32_t m_elapse = 0;          // 程序启动到现在的毫秒数
     uint32_t m_threadId = 0;        // 线程id
     uint32_t m_fiberId = 0;         // 协程id
-    uint64_t m_time;                // 时间戳
-    std::stringstream m_ss;         
+    uint64_t m_time = 0;            // 时间戳(秒)
+    uint32_t m_nsec = 0;            // 秒内的纳秒数
+    LogStream m_ss;
 
     std::shared_ptr<Logger> m_logger;
-    LogLevel::Level m_level;
-    std::string m_threadName;       // 线程名称
+    LogLevel::Level m_level = LogLevel::UNKNOWN;
+    std::string m_threadName;       // 线程名称，同一线程复用时赋值不会重新分配
+    const LogField* m_fields = nullptr;
+    size_t m_fieldCount = 0;
 };
 
 // 日志事件包装器
 class LogEventWrap {
 public:
+    // 从当前线程的缓存中取一个LogEvent，缓存用完(嵌套太深)时才new
+    LogEventWrap(std::shared_ptr<Logger> logger, LogLevel::Level level, const char* file, uint32_t line);
     LogEventWrap(LogEvent::ptr e);
     ~LogEventWrap();    // 日志在语句结束时自动提交，无需手动提交，即使发生异常也不会丢失日志
-    LogEvent::ptr getEvent() const {return m_event;}
-    std::stringstream& getSS(); 
+    LogEvent& getEvent() const {return *m_event;}
+    std::ostream& getSS();
 private:
-    LogEvent::ptr m_event;
+    LogEvent* m_event;
+    LogEvent::ptr m_holder;     // 不是来自线程缓存的LogEvent
+    bool* m_busy = nullptr;     // 线程缓存中的占用标记，语句结束时清除
 };
 
-// 日志格式器
+template<class T>
+void SetLogField(LogField& field, const T& v) {
+    if constexpr(std::is_same<T, bool>::value) {
+        field.type = LogField::BOOL;
+        field.b = v;
+    } else if constexpr(std::is_enum<T>::value) {
+        field.type = LogField::INT;
+        field.i = (int64_t)v;
+    } else if constexpr(std::is_integral<T>::value && std::is_signed<T>::value) {
+        field.type = LogField::INT;
+        field.i = v;
+    } else if constexpr(std::is_integral<T>::value) {
+        field.type = LogField::UINT;
+        field.u = v;
+    } else if constexpr(std::is_floating_point<T>::value) {
+        field.type = LogField::DOUBLE;
+        field.d = v;
+    } else if constexpr(std::is_pointer<T>::value
+                        && std::is_convertible<T, std::string_view>::value) {
+        field.type = LogField::STRING;
+        field.str = v ? std::string_view(v) : std::string_view("(null)");
+    } else {
+        static_assert(std::is_convertible<const T&, std::string_view>::value, "unsupported SYLAR_LOG_KV value type");
+        field.type = LogField::STRING;
+        field.str = std::string_view(v);
+    }
+}
+
+inline void SetLogFields(LogField*) {}
+
+template<class K, class V, class... Args>
+void SetLogFields(LogField* fields, const K& key, const V& value, const Args&... args) {
+    fields->key = std::string_view(key);
+    SetLogField(*fields, value);
+    SetLogFields(fields + 1, args...);
+}
+
+// SYLAR_LOG_KV的实现，字段数组在栈上，参数在整个调用期间有效，输出完才返回
+template<class... Args>
+void LogKV(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const char* file, uint32_t line
+            , std::string_view msg, const Args&... args) {
+    static_assert(sizeof...(Args) % 2 == 0, "SYLAR_LOG_KV takes key, value pairs");
+    LogField fields[sizeof...(Args) / 2 + 1];
+    SetLogFields(fields, args...);
+    LogEventWrap wrap(logger, level, file, line);
+    LogEvent& event = wrap.getEvent();
+    event.getSS().write(msg.data(), msg.size());
+    event.setFields(fields, sizeof...(Args) / 2);
+}
+
+/*
+    日志格式器
+    构造时把模式串编译成一段操作码，相邻的普通文本、%T、%n合并成一段字面量，
+    格式化时顺序执行，直接写入平坦的字符缓冲区
+    %m 消息        %p 日志级别     %r 启动后的毫秒数   %c 日志名称
+    %t 线程id      %F 协程id       %N 线程名称         %d{fmt} 时间(strftime格式)
+    %f 文件名      %l 行号         %T Tab              %n 换行         %% 百分号
+    %J{fmt} 整条日志输出成一个JSON对象    %K{fmt} 整条日志输出成logfmt    fmt是时间格式，默认ISO 8601(微秒)
+    结构化字段在%m后面追加 key=value，在%J、%K中是单独的键
+    时间格式除strftime之外支持秒以下的部分(同date命令)：%3N 毫秒  %6N 微秒  %N或%9N 纳秒
+    时间按线程缓存：同一秒直接拷贝，同一分钟内只改写秒的两位数字，秒以下的部分每次填写
+*/
 class LogFormatter {
 public:
     using ptr = std::shared_ptr<LogFormatter>;
     LogFormatter(const std::string& pattern);
-    std::string format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
-    std::ostream& format(std::ostream& ofs, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event);
-public:
-    class FormatItem {
-    public:
-        using ptr = std::shared_ptr<FormatItem>;
-        virtual ~FormatItem() {}
-        virtual void format(std::ostream& os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
-    };
+    std::string format(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event);
+    std::ostream& format(std::ostream& ofs, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event);
+    // 追加到buf的末尾
+    void format(LogBuffer& buf, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event);
+    // 格式化到当前线程复用的LogStream中，返回的内容在本线程下一次调用之前有效
+    LogStream& formatThreadLocal(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event);
 
     void init();
     bool isError() const { return m_error;}
     const std::string getPattern() const { return m_pattern;}
+private:
+    enum OpCode : uint8_t {
+        OP_LITERAL = 0,
+        OP_MESSAGE,
+        OP_LEVEL,
+        OP_ELAPSE,
+        OP_NAME,
+        OP_THREAD_ID,
+        OP_FIBER_ID,
+        OP_THREAD_NAME,
+        OP_DATETIME,
+        OP_FILENAME,
+        OP_LINE,
+        OP_JSON,
+        OP_LOGFMT
+    };
+
+    struct Op {
+        OpCode code;
+        uint32_t offset;    // 字面量在m_literals中的位置，时间格式在m_dates中的下标
+        uint32_t len;
+    };
+
+    struct DateFormat {
+        std::string format;     // 秒以下的部分换成了占位符
+        std::string marked;     // %S换成标记之后的格式，为空表示不能只改写秒
+    };
+
+    void addLiteral(const std::string& str);
+    void addOp(OpCode code, const std::string& fmt);
+    size_t writeDate(char* out, uint32_t index, time_t time, uint32_t nsec);
+    // 整条日志输出成JSON或logfmt，调用前按各字段的长度预留好空间
+    char* writeRecord(char* out, bool json, uint32_t date, const std::shared_ptr<Logger>& logger
+                        , LogLevel::Level level, const LogEvent& event);
 private:
     std::string m_pattern;
-    std::vector<FormatItem::ptr> m_items;
+    std::vector<Op> m_ops;
+    std::string m_literals;
+    std::vector<DateFormat> m_dates;
+    size_t m_fixedSize = 0;     // 长度固定(有上限)的部分最多占用的字节数
+    uint64_t m_id;              // 区分线程时间缓存里不同的格式器
     bool m_error = false;
 };
 
-
 // 日志输出地
 class LogAppender {
 friend class Logger;
@@ -148,18 +384,21 @@ public:
     using ptr = std::shared_ptr<LogAppender>;
     virtual ~LogAppender() {}
 
-    virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) = 0;
+    virtual void log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event) = 0;
+    // 直接输出已经格式化好的数据，AsyncLogAppender在后台线程中批量写出时使用
+    virtual void write(const struct iovec* iov, int iovcnt) = 0;
 
     void setFormatter(LogFormatter::ptr val);
-    LogFormatter::ptr getFormatter();
+    // 不加锁，格式器整体替换，正在使用旧格式器的线程用完之后才释放
+    LogFormatter::ptr getFormatter() const { return m_formatter.load(std::memory_order_acquire);}
 
     LogLevel::Level getLevel() const { return m_level;}
     void setLevel(LogLevel::Level val) {m_level = val;}
 protected:
     LogLevel::Level m_level = LogLevel::DEBUG;
     sylar::CASLock m_mutex;
-    LogFormatter::ptr m_formatter;
-    bool m_hasFormatter;
+    std::atomic<LogFormatter::ptr> m_formatter;
+    bool m_hasFormatter = false;                // 单独设置过格式，不跟随Logger的格式(m_mutex保护)
 };
     
 // 日志输出器
@@ -169,40 +408,162 @@ public:
     using ptr = std::shared_ptr<Logger>;
 
     Logger(const std::string& name = "root");
-    void log(LogLevel::Level level, LogEvent::ptr event);
+    void log(LogLevel::Level level, const LogEvent& event);
 
-    void debug(LogEvent::ptr event);
-    void info(LogEvent::ptr event);
-    void warn(LogEvent::ptr event);
-    void error(LogEvent::ptr event);
-    void fatal(LogEvent::ptr event);
+    void debug(const LogEvent& event);
+    void info(const LogEvent& event);
+    void warn(const LogEvent& event);
+    void error(const LogEvent& event);
+    void fatal(const LogEvent& event);
 
     void addAppender(LogAppender::ptr appender);
     void delAppender(LogAppender::ptr appender);
+    ~Logger();
     LogLevel::Level getLevel() const { return m_level; }
-    void setLevel (LogLevel::Level val) { m_level = val;}
+    // 修改级别之后各调用点缓存的判断结果失效
+    void setLevel(LogLevel::Level val);
 
     const std::string& getName() const { return m_name;}
 
     void setFormatter(LogFormatter::ptr val);
     void setFormatter(const std::string& val);
-    LogFormatter::ptr getFormatter();
+    LogFormatter::ptr getFormatter() const { return m_formatter.load(std::memory_order_acquire);}
 private:
+    /*
+        Appender集合是不可变的快照，log()只取一次快照，不加锁
+        add/del/setFormatter在m_mutex下复制一份修改后整体替换，旧快照在最后一个读者用完之后释放
+    */
+    using Appenders = std::vector<LogAppender::ptr>;
+
     std::string m_name;                         // 日志名称
     LogLevel::Level m_level;                    // 日志级别
-    sylar::CASLock m_mutex;
-    std::list<LogAppender::ptr> m_appenders;    // Appender集合
-    LogFormatter::ptr m_formatter;
+    sylar::CASLock m_mutex;                     // 只串行化修改者
+    std::atomic<std::shared_ptr<const Appenders>> m_appenders;
+    std::atomic<LogFormatter::ptr> m_formatter;
     Logger::ptr m_root;
 
 };
 
+/*
+    日志调用点，宏里的静态变量(常量初始化，没有guard)
+    1. 第一次执行时按Logger的级别算出是否输出，和Logger的地址、语句的级别一起缓存在一个字里，
+       之后级别不够的语句只读一个字比较一次
+    2. 任何Logger修改级别或析构时递增全局代数并清空所有调用点的缓存，
+       计算期间代数变化说明结果可能过期，不缓存
+    3. 同一个调用点用到多个Logger或多个级别时不再缓存，每次读Logger的级别
+*/
+class LogSite {
+public:
+    static const uintptr_t UNKNOWN = 0;
+    static const uintptr_t DYNAMIC = 1;
+
+    constexpr LogSite() {}
+
+    bool isEnabled(const std::shared_ptr<Logger>& logger, LogLevel::Level level) {
+        uintptr_t key = m_key.load(std::memory_order_relaxed);
+        uintptr_t base = MakeKey(logger.get(), level);
+        if(key == base) {
+            return false;
+        }
+        return key == (base | 1) || check(logger.get(), level);
+    }
+
+    // 清空所有调用点的缓存
+    static void Invalidate();
+private:
+    // 用户态地址不超过48位，左移4位之后放级别(3位)和是否输出(1位)
+    static uintptr_t MakeKey(const Logger* logger, LogLevel::Level level) {
+        return ((uintptr_t)logger << 4) | ((uintptr_t)level << 1);
+    }
+    bool check(Logger* logger, LogLevel::Level level);
+private:
+    std::atomic<uintptr_t> m_key = {UNKNOWN};
+    std::atomic<bool> m_registered = {false};
+    LogSite* m_next = nullptr;
+};
+
+/*
+    调用点的限流计数器，宏里的静态变量(n是常量时常量初始化)
+    计数器和被抑制的条数都是无锁的原子变量，超过限额之后FIRST_N和PER_SECOND只读不写
+*/
+class LogLimiter {
+public:
+    static constexpr uint64_t SUMMARY_INTERVAL_MS = 1000;
+
+    constexpr LogLimiter(uint64_t n) : m_n(n ? n : 1) {}
+
+    bool allowEveryN(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const char* file, uint32_t line) {
+        bool ok = m_count.fetch_add(1, std::memory_order_relaxed) % m_n == 0;
+        return check(ok, 0, logger, level, file, line);
+    }
+
+    bool allowFirstN(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const char* file, uint32_t line) {
+        bool ok = m_count.load(std::memory_order_relaxed) < m_n
+                    && m_count.fetch_add(1, std::memory_order_relaxed) < m_n;
+        return check(ok, 0, logger, level, file, line);
+    }
+
+    // 高32位是当前的秒数，低32位是这一秒已经输出的条数
+    bool allowPerSecond(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const char* file, uint32_t line) {
+        uint64_t now = GetMonotonicCoarseMS();
+        uint32_t sec = now / 1000;
+        uint64_t v = m_count.load(std::memory_order_relaxed);
+        bool ok = false;
+        while((uint32_t)(v >> 32) != sec) {
+            if(m_count.compare_exchange_weak(v, ((uint64_t)sec << 32) | 1, std::memory_order_relaxed)) {
+                ok = true;
+                break;
+            }
+        }
+        if(!ok && (uint32_t)v < m_n) {
+            ok = (uint32_t)m_count.fetch_add(1, std::memory_order_relaxed) < m_n;
+        }
+        return check(ok, now, logger, level, file, line);
+    }
+
+    uint64_t getSuppressed() const { return m_suppressed.load(std::memory_order_relaxed);}
+
+    // 汇总所有到期的登记过的调用点，后台线程每个间隔调用一次
+    static void FlushSuppressed();
+private:
+    bool check(bool ok, uint64_t now, const std::shared_ptr<Logger>& logger
+                , LogLevel::Level level, const char* file, uint32_t line) {
+        if(!ok) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            if(!m_enrolled.load(std::memory_order_relaxed)) {
+                enroll(logger, level, file, line);
+            }
+        } else if(!m_suppressed.load(std::memory_order_relaxed)) {
+            return true;
+        }
+        if(!now) {
+            now = GetMonotonicCoarseMS();
+        }
+        if(now >= m_nextSummary.load(std::memory_order_relaxed)) {
+            summary(now, logger, level, file, line);
+        }
+        return ok;
+    }
+    // 输出被抑制的条数，每个间隔只有一个线程输出
+    void summary(uint64_t now, const std::shared_ptr<Logger>& logger
+                , LogLevel::Level level, const char* file, uint32_t line);
+    // 第一次抑制时把调用点登记给后台线程，之后调用点不再执行也能输出汇总
+    void enroll(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const char* file, uint32_t line);
+private:
+    uint64_t m_n;
+    std::atomic<uint64_t> m_count = {0};
+    std::atomic<uint64_t> m_suppressed = {0};
+    std::atomic<uint64_t> m_nextSummary = {0};
+    std::atomic<bool> m_enrolled = {false};
+};
+
 // 输出到控制台的Appender
 class StdoutLogAppender : public LogAppender {
 public:
     using ptr = std::shared_ptr<StdoutLogAppender>;
 
-    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    void log(const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) override;
+    void write(const struct iovec* iov, int iovcnt) override;
 };
 
 // 输出到文件的Appender
@@ -211,14 +572,242 @@ public:
     using ptr = std::shared_ptr<FileLogAppender>;
 
     FileLogAppender(const std::string& filename);
-    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    void log(const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) override;
+    void write(const struct iovec* iov, int iovcnt) override;
 
-    // 重新打开文件，文件打开成功返回true
+    // 重新打开文件(追加模式)，文件打开成功返回true
     bool reopen();
 private:
     std::string m_filename;
     std::ofstream m_filestream;
-    uint64_t m_lastTime = 0;
+};
+
+/*
+    按大小或时间滚动的文件Appender
+    1. 始终持有一个O_APPEND打开的fd，日志直接writev，不经过用户态缓冲
+    2. 文件超过大小或者跨过整点/零点时，由后台线程把当前文件rename成历史文件再打开新文件，
+       日志线程只设置一个标志，换fd时等待正在写旧fd的线程(writers)退出
+    3. 历史文件命名为 文件名.打开时间[.序号]，后台线程负责gzip压缩和删除超出数量的旧文件
+    4. fsync策略：不主动刷盘、按时间间隔刷盘、累计写入N字节后刷盘，刷盘都在后台线程完成
+*/
+class RollingFileLogAppender : public LogAppender {
+public:
+    using ptr = std::shared_ptr<RollingFileLogAppender>;
+
+    enum Period {
+        NEVER = 0,
+        HOURLY = 1,
+        DAILY = 2
+    };
+
+    enum Fsync {
+        FSYNC_NONE = 0,
+        FSYNC_INTERVAL = 1,     // 每隔value毫秒
+        FSYNC_BYTES = 2         // 每写入value字节
+    };
+
+    // <文件名，按时间滚动的周期，单个文件的最大字节数(0不限制)，保留的历史文件个数(0不删除)，历史文件是否压缩>
+    RollingFileLogAppender(const std::string& filename, Period period = DAILY
+                            ,uint64_t max_size = 0, size_t max_files = 0, bool compress = false);
+    ~RollingFileLogAppender();
+
+    void log(const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) override;
+    void write(const struct iovec* iov, int iovcnt) override;
+
+    void setFsync(Fsync policy, uint64_t value);
+    // 立即滚动一次，等待后台线程完成
+    void roll();
+    // 完成剩余的滚动、压缩和刷盘后停止后台线程
+    void stop();
+
+    const std::string& getFilename() const { return m_filename;}
+    uint64_t getRollCount() const { return m_rollCount;}
+    uint64_t getSyncCount() const { return m_syncCount;}
+private:
+    struct File {
+        int fd = -1;
+        time_t openTime = 0;
+        std::atomic<int> writers = {0};
+    };
+
+    File* acquire();
+    void writeData(const struct iovec* iov, int iovcnt, time_t now);
+    void notify(std::atomic<bool>& flag);
+
+    // 以下在后台线程中调用
+    void run();
+    bool doRoll(time_t now);
+    void doSync();
+    void compress(const std::string& path);
+    void prune();
+    void loadSegments();
+private:
+    std::string m_filename;
+    Period m_period;
+    uint64_t m_maxSize;
+    size_t m_maxFiles;
+    bool m_compress;
+    std::atomic<int> m_fsync = {FSYNC_NONE};
+    std::atomic<uint64_t> m_fsyncValue = {0};
+
+    std::atomic<File*> m_file = {nullptr};
+    std::atomic<uint64_t> m_size = {0};         // 当前文件已写入的字节数
+    std::atomic<uint64_t> m_unsynced = {0};     // 上次刷盘之后写入的字节数
+    std::atomic<int64_t> m_nextRoll = {0};      // 下一次按时间滚动的时刻
+    std::atomic<bool> m_rollRequest = {false};
+    std::atomic<bool> m_syncRequest = {false};
+
+    std::mutex m_bgMutex;
+    std::condition_variable m_cond;
+    std::condition_variable m_rollCond;         // roll()等待滚动完成
+    bool m_stopping = false;
+    std::atomic<uint64_t> m_rollCount = {0};
+    std::atomic<uint64_t> m_syncCount = {0};
+    uint64_t m_lastSync = 0;
+    std::deque<std::string> m_segments;         // 历史文件，旧的在前
+    std::unique_ptr<Thread> m_thread;
+};
+
+/*
+    写入mmap文件的环形缓冲区，进程崩溃后日志仍在文件(页缓存)中
+    1. 文件开头一页是文件头，记录容量和累计写入的字节数(tail)，之后是容量大小的环形数据区
+    2. 写日志时fetch_add预留位置，直接拷贝到映射的内存中，没有write系统调用
+    3. 每条记录8字节对齐：[魔数4][长度4][位置8][内容]，位置字段最后写入，
+       读取时位置字段和实际位置一致才是完整的记录，写到一半的记录会被跳过
+    4. 空间用完之后覆盖最旧的记录，用MmapLogReader或sylar_mmaplog工具读出
+    5. 重新打开同样容量的文件时接着原来的位置写
+*/
+class MmapLogAppender : public LogAppender {
+public:
+    using ptr = std::shared_ptr<MmapLogAppender>;
+
+    static const uint32_t RECORD_MAGIC = 0x474f4c4d;    // "MLOG"
+    static const size_t RECORD_HEADER_SIZE = 16;
+    static const size_t FILE_HEADER_SIZE = 4096;
+
+    // 文件头，位于映射区域的开头
+    struct FileHeader {
+        char magic[8];                          // "SYLMLOG1"
+        uint32_t version;
+        uint32_t headerSize;
+        uint64_t capacity;
+        alignas(64) std::atomic<uint64_t> tail; // 累计预留的字节数
+    };
+
+    // 容量向上取整到页大小
+    MmapLogAppender(const std::string& filename, size_t capacity = 16 << 20);
+    ~MmapLogAppender();
+
+    void log(const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) override;
+    void write(const struct iovec* iov, int iovcnt) override;
+
+    bool isValid() const { return m_data != nullptr;}
+    // 刷到磁盘，只有需要防止系统崩溃时才用
+    void sync();
+    const std::string& getFilename() const { return m_filename;}
+    size_t getCapacity() const { return m_capacity;}
+    uint64_t getTail() const { return m_header ? m_header->tail.load(std::memory_order_relaxed) : 0;}
+private:
+    void append(const struct iovec* iov, int iovcnt, size_t len);
+    void copyIn(uint64_t pos, const void* data, size_t len);
+private:
+    std::string m_filename;
+    size_t m_capacity = 0;
+    int m_fd = -1;
+    FileHeader* m_header = nullptr;
+    char* m_data = nullptr;
+};
+
+// 按写入顺序读出MmapLogAppender文件中完整的记录，可以在写入进程崩溃之后使用
+class MmapLogReader {
+public:
+    MmapLogReader(const std::string& filename);
+    bool isValid() const { return m_valid;}
+    uint64_t getTail() const { return m_tail;}
+    size_t getCapacity() const { return m_capacity;}
+    // 返回读出的记录数，不完整的记录(写入时进程崩溃、被覆盖了一部分)计入skipped
+    size_t read(std::function<void(const char* data, size_t len)> cb, size_t* skipped = nullptr);
+private:
+    void copyOut(uint64_t pos, void* data, size_t len) const;
+private:
+    std::string m_data;
+    size_t m_capacity = 0;
+    uint64_t m_tail = 0;
+    bool m_valid = false;
+};
+
+/*
+    异步输出的Appender，包装任意一个Appender
+    1. 业务线程只把格式化好的日志追加到当前缓冲区：CAS预留空间后拷贝，不加锁也不做IO
+    2. 缓冲区写满或者超过刷新间隔时由后台线程换下来，多个缓冲区合并成一次writev交给被包装的Appender
+    3. 换下缓冲区前要等正在往里拷贝的线程(writers)全部退出
+    4. 所有缓冲区都在等待刷出时按策略处理：阻塞、丢弃、只丢弃DEBUG
+*/
+class AsyncLogAppender : public LogAppender {
+public:
+    using ptr = std::shared_ptr<AsyncLogAppender>;
+
+    enum Policy {
+        BLOCK = 0,          // 等待后台线程腾出缓冲区
+        DROP = 1,           // 直接丢弃
+        DROP_DEBUG = 2      // 丢弃DEBUG级别，其他级别等待
+    };
+
+    // <被包装的Appender，缓冲区满时的策略，单个缓冲区字节数，缓冲区个数(至少2个)，刷新间隔毫秒>
+    AsyncLogAppender(LogAppender::ptr appender, Policy policy = BLOCK
+                    ,size_t buffer_size = 1024 * 1024, size_t buffer_count = 4
+                    ,uint64_t flush_interval_ms = 1000);
+    ~AsyncLogAppender();
+
+    void log(const Logger::ptr& logger, LogLevel::Level level, const LogEvent& event) override;
+    void write(const struct iovec* iov, int iovcnt) override;
+
+    // 等待调用之前提交的日志全部写出
+    void flush();
+    // 写出剩余日志并停止后台线程，之后的日志被丢弃
+    void stop();
+
+    LogAppender::ptr getAppender() const { return m_appender;}
+    Policy getPolicy() const { return m_policy;}
+    // 已提交还没写出的日志条数和字节数
+    uint64_t getPendingRecords() const { return m_appendRecords - m_writtenRecords;}
+    uint64_t getPendingBytes() const { return m_appendBytes - m_writtenBytes;}
+    uint64_t getDropped() const { return m_dropped;}
+    // 后台线程调用被包装Appender的write次数
+    uint64_t getWriteCount() const { return m_writeCount;}
+private:
+    struct Buffer;
+
+    bool append(const char* data, size_t len, LogLevel::Level level);
+    // 取得当前缓冲区并登记为写者，没有可用缓冲区时返回nullptr
+    Buffer* acquire();
+    // 在m_bufMutex中调用，换下当前缓冲区
+    void rotate();
+    void run();
+private:
+    LogAppender::ptr m_appender;
+    Policy m_policy;
+    uint64_t m_interval;
+    std::vector<std::unique_ptr<Buffer> > m_buffers;
+    std::atomic<Buffer*> m_current = {nullptr};
+
+    std::mutex m_bufMutex;
+    std::condition_variable m_cond;         // 唤醒后台线程
+    std::condition_variable m_freeCond;     // 唤醒等待缓冲区或者flush的线程
+    std::vector<Buffer*> m_full;            // 等待写出
+    std::vector<Buffer*> m_free;
+    bool m_stopping = false;
+    bool m_flushRequest = false;
+    bool m_busy = false;                    // 后台线程正在写出一轮
+    uint64_t m_round = 0;                   // 已经完成的写出轮数
+
+    std::atomic<uint64_t> m_appendRecords = {0};
+    std::atomic<uint64_t> m_appendBytes = {0};
+    std::atomic<uint64_t> m_writtenRecords = {0};
+    std::atomic<uint64_t> m_writtenBytes = {0};
+    std::atomic<uint64_t> m_dropped = {0};
+    std::atomic<uint64_t> m_writeCount = {0};
+    std::unique_ptr<Thread> m_thread;
 };
 
 // 日志管理器：集中管理所有Logger实例
@@ -238,4 +827,9 @@ private:
 using LoggerMgr = sylar::Singleton<LoggerManager>;
 
 } // namespace sylar  
+// 二进制日志模式下SYLAR_LOG_FMT_*改用binlog.h中的实现
+#ifdef SYLAR_LOG_BINARY
+#include "binlog.h"
+#endif
+
 #endif
\ No newline at end of file
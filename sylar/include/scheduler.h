@@ -4,10 +4,10 @@
 #include <mutex>
 #include <atomic>
 #include <vector>
-#include <list>
 
 #include "fiber.h"
 #include "thread.h"
+#include "workqueue.h"
 
 namespace sylar {
 
@@ -15,8 +15,10 @@ namespace sylar {
     N-M的协程调度器，内部有一个线程池，支持协程在线程池里面切换
     1. N个工作线程调度M个协程任务
     2. 使用std::vector<Thread::ptr> m_threads管理工作线程
-    3. 使用std::list<FiberAndThread> m_fibers管理待执行任务
-    4. 支持指定线程执行任务
+    3. 每个工作线程有一个Chase–Lev无锁双端队列，工作线程内产生的任务放入自己的队列，空闲时随机挑选其他线程窃取
+    4. 非工作线程产生的任务以及yield后重新就绪的协程放入全局注入队列
+    5. 指定线程执行的任务直接投递到目标线程的邮箱(无锁MPSC)，不会被其他线程窃取
+    6. 回调任务以Task保存，小的回调不需要堆分配，队列节点和结束的协程都会缓存复用
 */
 class Scheduler {
 public:
@@ -36,13 +38,7 @@ public:
     // 单个任务调度
     template<class FiberOrCb>
     void schedule(FiberOrCb fc, int thread = -1) {
-        bool need_tickle = false;
-        {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            need_tickle = schedulerNoLock(fc, thread);
-        }
-
-        if(need_tickle) {
+        if(scheduleTask(std::move(fc), thread)) {
             tickle();
         }
     }
@@ -51,11 +47,9 @@ public:
     template<class InputIterator>
     void schedule(InputIterator begin, InputIterator end) {
         bool need_tickle = false;
-        {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            while(begin != end) {
-                need_tickle = schedulerNoLock(&*begin, -1) || need_tickle;
-            }
+        while(begin != end) {
+            need_tickle = scheduleTask(&*begin, -1) || need_tickle;
+            ++begin;
         }
         if(need_tickle) {
             tickle();
@@ -72,42 +66,76 @@ protected:
 
     void setThis();
     bool hasIdleThread() {return m_idleThreadCount > 0;}
-private:
-
-    // 把任务封装为FiberAndThread添加到队列，返回是否需要唤醒工作线程
-    template<class FiberOrCb>
-    bool schedulerNoLock(FiberOrCb fc, int thread) {
-        bool need_tickle = m_fibers.empty();
-        FiberAndThread ft(fc, thread);
-        if(ft.fiber || ft.cb) {
-            m_fibers.push_back(ft);
-        }
-        return need_tickle;
-    }
+    size_t getIdleThreadCount() const {return m_idleThreadCount;}
 private:
     // 封装任务
     struct FiberAndThread {
         Fiber::ptr fiber;
-        std::function<void()> cb;
+        Task cb;
         int thread;
+        FiberAndThread* next = nullptr;     // 在各个队列中的链接
 
         // 多种构造方式
         // 统一封装调度任务，支持两种任务形式：协程对象和回调函数，并可制定目标执行线程
-        FiberAndThread(Fiber::ptr f, int thr):fiber(f), thread(thr) {}
+        FiberAndThread(Fiber::ptr f, int thr):fiber(std::move(f)), thread(thr) {}
         FiberAndThread(Fiber::ptr* f, int thr):thread(thr) { fiber.swap(*f); }
-        FiberAndThread(std::function<void()> f, int thr):cb(f), thread(thr) {}
-        FiberAndThread(std::function<void()>* f, int thr):thread(thr) { cb.swap(*f); }
+        FiberAndThread(Task f, int thr):cb(std::move(f)), thread(thr) {}
+        FiberAndThread(std::function<void()>* f, int thr):cb(std::move(*f)), thread(thr) { *f = nullptr; }
         FiberAndThread():thread(-1) {}
 
+        FiberAndThread(FiberAndThread&&) = default;
+        FiberAndThread& operator=(FiberAndThread&&) = default;
+
         void reset() {
             fiber = nullptr;
             cb = nullptr;
             thread = -1;
         }
     };
+
+    // 每个工作线程(包括use_caller时的调用线程)一份
+    struct Worker {
+        WorkStealingQueue<FiberAndThread*> queue;   // 本线程产生的任务
+        MpscStack<FiberAndThread> mailbox;          // 指定由本线程执行的任务
+        IntrusiveQueue<FiberAndThread> inbox;       // 从mailbox取出还没执行的任务，只由本线程访问
+        std::atomic<int> thread = {-1};             // 线程id，start()时确定
+        std::atomic<bool> sleeping = {false};       // 是否在idle协程中等待
+        uint32_t seed;                              // 选择窃取目标的随机数状态
+        uint32_t tick = 0;                          // 调度次数，定期优先检查全局队列
+
+        explicit Worker(uint32_t s):seed(s) {}
+    };
+
+    struct TaskPool;
+
+    // 把任务封装为FiberAndThread添加到队列，返回是否需要唤醒工作线程
+    template<class FiberOrCb>
+    bool scheduleTask(FiberOrCb&& fc, int thread, bool inject = false) {
+        FiberAndThread ft(std::forward<FiberOrCb>(fc), thread);
+        if(ft.fiber && ft.thread == -1) {
+            ft.thread = ft.fiber->m_stackThread;    // 运行过的共享栈协程只能回到原线程执行
+        }
+        if(!ft.fiber && !ft.cb) {
+            return false;
+        }
+        return pushTask(std::move(ft), inject);
+    }
+
+    // inject为true时不放入当前线程的本地队列，用于重新就绪的协程，避免后进先出导致其他任务饥饿
+    bool pushTask(FiberAndThread&& ft, bool inject);
+    bool pushNode(FiberAndThread* ft, bool inject);
+    FiberAndThread* nextTask(Worker* w, bool& tickle_me);
+    FiberAndThread* popInject();
+    FiberAndThread* stealTask(Worker* w, bool& tickle_me);
+    bool hasTask(Worker* w);
+    Worker* getWorker(int thread);
+    Worker* currentWorker();
 private:
     std::vector<Thread::ptr> m_threads;     // 工作线程池
-    std::list<FiberAndThread> m_fibers;     // 任务队列
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    IntrusiveQueue<FiberAndThread> m_injectQueue;   // 全局注入队列，由m_mutex保护
+    std::atomic<size_t> m_injectSize = {0};         // 注入队列长度，空的时候不用加锁
+    std::atomic<size_t> m_taskCount = {0};          // 所有队列中的任务总数
     Fiber::ptr m_rootFiber;
     std::mutex m_mutex;                     
     std::string m_name;
@@ -2,12 +2,18 @@
 #define __SYLAR_SYLAR_H__
 
 #include "log.h"
+#include "binlog.h"
 #include "util.h"
+#include "clock.h"
 #include "macro.h"
 #include "config.h"
+#include "config_watcher.h"
 #include "thread.h"
 #include "singleton.h"
 #include "fiber.h"
 #include "scheduler.h"
+#include "iomanager.h"
+#include "hook.h"
+#include "fd_manager.h"
 
 #endif
\ No newline at end of file
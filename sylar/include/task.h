@@ -0,0 +1,141 @@
+#ifndef __SYLAR_TASK_H__
+#define __SYLAR_TASK_H__
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <functional>
+#include <type_traits>
+
+namespace sylar {
+
+/*
+    只能移动的void()可调用对象封装，用来替代调度路径上的std::function<void()>
+    1. 大小不超过kInlineSize、可以无异常移动的可调用对象直接构造在对象内部，不需要堆分配
+    2. 更大的可调用对象退化为一次堆分配
+    3. std::function也能直接放进来(libstdc++中为32字节)，空的std::function/函数指针构造出空Task
+*/
+class Task {
+public:
+    static constexpr size_t kInlineSize = 48;
+
+    Task() = default;
+    Task(std::nullptr_t) {}
+
+    template<class F, class D = std::decay_t<F>
+            , class = std::enable_if_t<!std::is_same_v<D, Task> && std::is_invocable_r_v<void, D&>>>
+    Task(F&& f) {
+        init<D>(std::forward<F>(f));
+    }
+
+    Task(Task&& other) noexcept {
+        moveFrom(other);
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if(this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        reset();
+    }
+
+    void operator()() {
+        m_ops->invoke(m_buf);
+    }
+
+    explicit operator bool() const { return m_ops != nullptr;}
+
+    void reset() {
+        if(m_ops) {
+            m_ops->destroy(m_buf);
+            m_ops = nullptr;
+        }
+    }
+
+    void swap(Task& other) {
+        Task tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+private:
+    struct Ops {
+        void (*invoke)(void* buf);
+        void (*move)(void* dst, void* src);     // 移动到dst并析构src
+        void (*destroy)(void* buf);
+    };
+
+    template<class D>
+    static constexpr bool IsInline = sizeof(D) <= kInlineSize
+                && alignof(D) <= alignof(std::max_align_t)
+                && std::is_nothrow_move_constructible_v<D>;
+
+    template<class D>
+    struct InlineOps {
+        static void Invoke(void* buf) { (*static_cast<D*>(buf))();}
+        static void Move(void* dst, void* src) {
+            new (dst) D(std::move(*static_cast<D*>(src)));
+            static_cast<D*>(src)->~D();
+        }
+        static void Destroy(void* buf) { static_cast<D*>(buf)->~D();}
+        static constexpr Ops s_ops = {&Invoke, &Move, &Destroy};
+    };
+
+    template<class D>
+    struct HeapOps {
+        static void Invoke(void* buf) { (**static_cast<D**>(buf))();}
+        static void Move(void* dst, void* src) { *static_cast<D**>(dst) = *static_cast<D**>(src);}
+        static void Destroy(void* buf) { delete *static_cast<D**>(buf);}
+        static constexpr Ops s_ops = {&Invoke, &Move, &Destroy};
+    };
+
+    template<class D>
+    struct IsFunction : std::false_type {};
+    template<class R, class... Args>
+    struct IsFunction<std::function<R(Args...)>> : std::true_type {};
+
+    template<class D, class F>
+    void init(F&& f) {
+        // 空函数指针和空std::function构造出空Task，直接传入的函数名不可能为空
+        if constexpr ((std::is_pointer_v<D> && !std::is_function_v<std::remove_reference_t<F>>)
+                || IsFunction<D>::value) {
+            if(!f) {
+                return;
+            }
+        }
+        if constexpr (IsInline<D>) {
+            new (m_buf) D(std::forward<F>(f));
+            m_ops = &InlineOps<D>::s_ops;
+        } else {
+            *reinterpret_cast<D**>(m_buf) = new D(std::forward<F>(f));
+            m_ops = &HeapOps<D>::s_ops;
+        }
+    }
+
+    void moveFrom(Task& other) {
+        if(other.m_ops) {
+            other.m_ops->move(m_buf, other.m_buf);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+private:
+    alignas(std::max_align_t) unsigned char m_buf[kInlineSize];
+    const Ops* m_ops = nullptr;
+};
+
+}
+
+#endif
@@ -91,7 +91,7 @@ public:
 
     void join();
     static Thread* GetThis();
-    static const std::string GetName();
+    static const std::string& GetName();
     static void SetName (const std::string& name);
     static void* run(void* arg);
 private:
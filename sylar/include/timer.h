@@ -0,0 +1,89 @@
+#ifndef __SYLAR_TIMER_H__
+#define __SYLAR_TIMER_H__
+
+#include <memory>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <atomic>
+
+namespace sylar {
+
+class TimerManager;
+
+/*
+    定时器，只能通过TimerManager创建
+    1. 支持一次性和循环定时器
+    2. 在TimerManager的堆中记录自己的下标，取消和重置都是O(log n)
+*/
+class Timer : public std::enable_shared_from_this<Timer> {
+friend class TimerManager;
+public:
+    using ptr = std::shared_ptr<Timer>;
+
+    bool cancel();                          // 取消定时器
+    bool refresh();                         // 从当前时间开始重新计时
+    bool reset(uint64_t ms, bool from_now); // 修改间隔，from_now为false时从原来的起点计算
+
+    uint64_t getNext() const { return m_next;}
+private:
+    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager);
+private:
+    bool m_recurring = false;               // 是否循环
+    uint64_t m_ms = 0;                      // 执行周期(毫秒)
+    uint64_t m_next = 0;                    // 下一次到期的单调时钟毫秒数
+    uint64_t m_seq = 0;                     // 到期时间相同时按加入顺序触发
+    int64_t m_index = -1;                   // 在堆中的下标，-1表示不在堆中
+    std::function<void()> m_cb;
+    TimerManager* m_manager = nullptr;
+};
+
+/*
+    定时器管理器，用4叉小顶堆按到期时间组织定时器
+    1. 添加、取消、重置O(log n)，4叉堆比二叉堆层数少一半，下沉时比较的子节点在同一条cache line上
+    2. 堆顶的到期时间缓存在原子变量中，没有到期的定时器时触发路径不需要加锁
+    3. 新的定时器成为堆顶时调用onTimerInsertedAtFront，让IOManager缩短epoll_wait的等待时间
+*/
+class TimerManager {
+friend class Timer;
+public:
+    TimerManager();
+    virtual ~TimerManager();
+
+    // 添加定时器，ms毫秒后执行cb，recurring为true时每隔ms执行一次
+    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+    // 添加条件定时器，触发时weak_cond已经失效则不执行cb
+    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb
+                                ,std::weak_ptr<void> weak_cond, bool recurring = false);
+
+    // 距离最近一个定时器到期的毫秒数，没有定时器时返回~0ull
+    uint64_t getNextTimer();
+    // 取出所有已到期定时器的回调，循环定时器重新加入堆
+    void listExpiredCallbacks(std::vector<std::function<void()> >& cbs);
+    bool hasTimer();
+protected:
+    virtual void onTimerInsertedAtFront() = 0;
+private:
+    // 以下函数需要持有m_mutex
+    bool insert(const Timer::ptr& timer);   // 返回是否成为堆顶
+    void erase(Timer* timer);
+    void update(Timer* timer);              // m_next变化后调整位置
+    void siftUp(size_t index);
+    void siftDown(size_t index);
+    void place(size_t index, Timer::ptr&& timer);
+    void updateNextExpiry();
+
+    static bool Less(const Timer* a, const Timer* b) {
+        return a->m_next < b->m_next || (a->m_next == b->m_next && a->m_seq < b->m_seq);
+    }
+private:
+    std::mutex m_mutex;
+    std::vector<Timer::ptr> m_heap;                 // 4叉小顶堆
+    uint64_t m_seq = 0;
+    std::atomic<uint64_t> m_nextExpiry = {~0ull};   // 堆顶的到期时间
+    std::atomic<bool> m_tickled = {false};          // 已经通知过堆顶变化，getNextTimer之后才会再次通知
+};
+
+}
+
+#endif
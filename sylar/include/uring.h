@@ -0,0 +1,79 @@
+#ifndef __SYLAR_URING_H__
+#define __SYLAR_URING_H__
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "noncopyable.h"
+
+namespace sylar {
+
+/*
+    io_uring的最小封装，直接使用系统调用，不依赖liburing
+    1. 提交队列和完成队列通过mmap与内核共享，准备请求和取完成事件都不需要系统调用
+    2. 本类不加锁，多线程使用时由调用方保证：getSqe到advance之间互斥，peek之间互斥
+    3. advance之后请求对内核可见，任何线程调用enter都能把它提交出去
+*/
+class IoUring : Noncopyable {
+public:
+    IoUring();
+    ~IoUring();
+
+    // entries为提交队列长度，失败返回false并设置errno
+    bool init(unsigned entries);
+    bool isValid() const { return m_fd >= 0;}
+    int getFd() const { return m_fd;}
+    unsigned getEntries() const { return m_sqEntries;}
+
+    // 取一个空闲的提交项，队列满时返回nullptr
+    io_uring_sqe* getSqe();
+    // 把getSqe取出的提交项发布给内核
+    void advance();
+    // 已发布但内核还没有取走的提交项数量
+    unsigned pending() const;
+
+    /*
+        提交所有已发布的请求，wait_nr>0时等待至少wait_nr个完成事件
+        timeout_ms为~0ull时不超时，返回值同io_uring_enter
+    */
+    int enter(unsigned wait_nr = 0, uint64_t timeout_ms = ~0ull);
+
+    // 取出最多count个完成事件并归还给内核，返回取出的数量
+    unsigned peek(io_uring_cqe* cqes, unsigned count);
+
+    // 固定缓冲区和注册文件，重复注册会先注销之前的
+    int registerBuffers(const struct iovec* iovs, unsigned nr);
+    int unregisterBuffers();
+    int registerFiles(const int* fds, unsigned nr);
+    int unregisterFiles();
+private:
+    int m_fd = -1;
+    unsigned m_features = 0;
+
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void* m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    unsigned* m_sqArray = nullptr;
+    unsigned m_sqeTail = 0;         // 本地尾指针，advance时写回共享的m_sqTail
+
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    bool m_hasBuffers = false;
+    bool m_hasFiles = false;
+};
+
+}
+
+#endif
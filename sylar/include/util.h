@@ -6,11 +6,21 @@
 #include <string>
 #include <stdint.h>
 #include <execinfo.h>
+
+struct iovec;
 namespace sylar {
 
     pid_t GetThreadId();
     uint32_t GetFiberId();
 
+    // 单调时钟的毫秒数，不受系统时间调整影响，用于定时器
+    uint64_t GetMonotonicMS();
+    // 粗粒度(一个时钟节拍，通常1~4ms)的单调时钟毫秒数，不进内核，用于日志限流这类高频计时
+    uint64_t GetMonotonicCoarseMS();
+
+    // 处理部分写入和IOV_MAX，写完所有数据返回true，出错返回false
+    bool WritevAll(int fd, const struct iovec* iov, int iovcnt);
+
     void Backtrace(std::vector<std::string>& bt, int size, int skip); 
     std::string BacktraceToString(int size = 64, int skip = 2, const std::string& prefix = "");
 }
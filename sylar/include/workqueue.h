@@ -0,0 +1,224 @@
+#ifndef __SYLAR_WORKQUEUE_H__
+#define __SYLAR_WORKQUEUE_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+namespace sylar {
+
+/*
+    调度器使用的几种任务队列，节点类型T需要有T* next成员
+    1. IntrusiveQueue: 侵入式单链表FIFO，不加锁，由调用方保证互斥
+    2. MpscStack: 多生产者单消费者，生产者CAS压栈，消费者一次取走全部并恢复成FIFO顺序
+    3. WorkStealingQueue: Chase–Lev双端队列，所有者在bottom端push/pop，其他线程在top端steal
+*/
+template<class T>
+class IntrusiveQueue {
+public:
+    bool empty() const { return m_head == nullptr;}
+    size_t size() const { return m_size;}
+
+    void push(T* node) {
+        node->next = nullptr;
+        if(m_tail) {
+            m_tail->next = node;
+        } else {
+            m_head = node;
+        }
+        m_tail = node;
+        ++m_size;
+    }
+
+    T* pop() {
+        T* node = m_head;
+        if(node) {
+            m_head = node->next;
+            if(!m_head) {
+                m_tail = nullptr;
+            }
+            node->next = nullptr;
+            --m_size;
+        }
+        return node;
+    }
+
+    // 把other整体接到队尾，other被清空
+    void append(IntrusiveQueue& other) {
+        if(other.empty()) {
+            return;
+        }
+        if(m_tail) {
+            m_tail->next = other.m_head;
+        } else {
+            m_head = other.m_head;
+        }
+        m_tail = other.m_tail;
+        m_size += other.m_size;
+        other.m_head = other.m_tail = nullptr;
+        other.m_size = 0;
+    }
+private:
+    T* m_head = nullptr;
+    T* m_tail = nullptr;
+    size_t m_size = 0;
+};
+
+template<class T>
+class MpscStack {
+public:
+    bool empty() const { return m_head.load(std::memory_order_relaxed) == nullptr;}
+
+    void push(T* node) {
+        node->next = m_head.load(std::memory_order_relaxed);
+        while(!m_head.compare_exchange_weak(node->next, node
+                    , std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // 只能由消费者调用，按push的顺序追加到out
+    void takeAll(IntrusiveQueue<T>& out) {
+        T* node = m_head.exchange(nullptr, std::memory_order_acquire);
+        T* reversed = nullptr;
+        while(node) {
+            T* next = node->next;
+            node->next = reversed;
+            reversed = node;
+            node = next;
+        }
+        while(reversed) {
+            T* next = reversed->next;
+            out.push(reversed);
+            reversed = next;
+        }
+    }
+private:
+    std::atomic<T*> m_head{nullptr};
+};
+
+/*
+    Chase–Lev work-stealing deque，按"Correct and Efficient Work-Stealing for Weak Memory Models"的C11版本实现
+    1. T必须是可以放进std::atomic的平凡类型，调度器里放的是节点指针
+    2. 容量不足时由所有者扩容为两倍，旧数组可能还在被steal读取，放到m_retired里直到析构才释放
+*/
+template<class T>
+class WorkStealingQueue {
+public:
+    // capacity必须是2的幂
+    explicit WorkStealingQueue(int64_t capacity = 256)
+        :m_array(new Array(capacity)) {
+    }
+
+    ~WorkStealingQueue() {
+        delete m_array.load(std::memory_order_relaxed);
+        for(auto i : m_retired) {
+            delete i;
+        }
+    }
+
+    WorkStealingQueue(const WorkStealingQueue&) = delete;
+    WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+
+    bool empty() const {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b <= t;
+    }
+
+    size_t size() const {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+    // 只能由所有者调用
+    void push(T item) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        Array* a = m_array.load(std::memory_order_relaxed);
+        if(b - t > a->capacity - 1) {
+            a = grow(a, b, t);
+        }
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // 只能由所有者调用，后进先出
+    bool pop(T& item) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = m_array.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        if(t > b) {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = a->get(b);
+        if(t == b) {
+            // 只剩最后一个元素，和steal竞争top
+            bool won = m_top.compare_exchange_strong(t, t + 1
+                        , std::memory_order_seq_cst, std::memory_order_relaxed);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // 任意线程调用，先进先出，和其他steal或pop竞争失败时返回false
+    bool steal(T& item) {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if(t >= b) {
+            return false;
+        }
+        Array* a = m_array.load(std::memory_order_acquire);
+        T tmp = a->get(t);
+        if(!m_top.compare_exchange_strong(t, t + 1
+                    , std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return false;
+        }
+        item = tmp;
+        return true;
+    }
+private:
+    struct Array {
+        int64_t capacity;
+        int64_t mask;
+        std::atomic<T>* buffer;
+
+        explicit Array(int64_t c)
+            :capacity(c), mask(c - 1), buffer(new std::atomic<T>[c]) {
+        }
+        ~Array() {
+            delete[] buffer;
+        }
+
+        T get(int64_t i) const {
+            return buffer[i & mask].load(std::memory_order_relaxed);
+        }
+        void put(int64_t i, T item) {
+            buffer[i & mask].store(item, std::memory_order_relaxed);
+        }
+    };
+
+    Array* grow(Array* a, int64_t b, int64_t t) {
+        Array* na = new Array(a->capacity * 2);
+        for(int64_t i = t; i < b; ++i) {
+            na->put(i, a->get(i));
+        }
+        m_retired.push_back(a);
+        m_array.store(na, std::memory_order_release);
+        return na;
+    }
+private:
+    alignas(64) std::atomic<int64_t> m_top{0};
+    alignas(64) std::atomic<int64_t> m_bottom{0};
+    alignas(64) std::atomic<Array*> m_array;
+    std::vector<Array*> m_retired;   // 只由所有者访问
+};
+
+}
+
+#endif
@@ -0,0 +1,830 @@
+#include "binlog.h"
+#include "thread.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace sylar {
+
+static Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+/*
+    文件格式(本机字节序)：
+    文件头   [magic 8][version 4][保留 4]
+    SITE    [1][id 4][level 1][line 4][参数个数 2][参数类型...][file][format][logger]
+    THREAD  [2][缓冲区id 4][线程id 4][线程名称]
+    SYNC    [3][tsc 8][纳秒 8][每纳秒的tick数 8][进程启动后的纳秒数 8(版本2)]
+    DATA    [4][缓冲区id 4][字节数 4][缓冲区中的原始记录...]
+    字符串都是[长度 4][内容]
+*/
+enum EntryType : uint8_t {
+    ENTRY_SITE = 1,
+    ENTRY_THREAD = 2,
+    ENTRY_SYNC = 3,
+    ENTRY_DATA = 4
+};
+
+static const char s_magic[8] = {'S', 'Y', 'L', 'B', 'L', 'O', 'G', '1'};
+static const uint32_t s_version = 2;
+
+static uint64_t realtime_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t steady_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+template<class T>
+static void put(std::string& buf, const T& v) {
+    buf.append((const char*)&v, sizeof(v));
+}
+
+static void put_string(std::string& buf, const std::string& str) {
+    put(buf, (uint32_t)str.size());
+    buf += str;
+}
+
+// 后台写文件的线程以及调用点、缓冲区的登记
+class BinLogWriter {
+public:
+    BinLogWriter();
+    ~BinLogWriter();
+
+    bool open(const std::string& path, size_t ring_size, uint64_t interval);
+    void close();
+    void flush();
+    void wakeup() { m_cond.notify_one();}
+
+    uint32_t registerSite(BinLogSite& site, const std::shared_ptr<Logger>& logger, const uint8_t* types, size_t nargs);
+    BinLogRing* createRing();
+    double getTicksPerNs() const { return m_ticksPerNs;}
+private:
+    struct SiteInfo {
+        LogLevel::Level level;
+        std::string file;
+        uint32_t line;
+        std::string format;
+        std::string logger;
+        std::vector<uint8_t> types;
+    };
+
+    void run();
+    void writePass();
+    void calibrate();
+private:
+    // 调用点和缓冲区
+    std::mutex m_mutex;
+    std::vector<SiteInfo> m_sites;          // 下标是id-1
+    size_t m_sitesWritten = 0;
+    std::vector<BinLogRing*> m_rings;
+    uint32_t m_ringId = 0;
+    size_t m_ringSize = 1 << 20;
+
+    // 后台线程
+    std::mutex m_condMutex;
+    std::condition_variable m_cond;
+    std::condition_variable m_flushCond;
+    bool m_stopping = false;
+    bool m_flushRequest = false;
+    bool m_busy = false;
+    uint64_t m_round = 0;
+    uint64_t m_interval = 10;
+    int m_fd = -1;
+    std::unique_ptr<Thread> m_thread;
+
+    // 时钟：用单调时钟校准TSC的频率
+    uint64_t m_baseTsc = 0;
+    uint64_t m_baseSteady = 0;
+    std::atomic<double> m_ticksPerNs = {1.0};
+};
+
+using BinLogWriterMgr = Singleton<BinLogWriter>;
+
+// 线程退出时标记它的缓冲区，由后台线程写完之后删除
+namespace {
+struct RingHolder {
+    BinLogRing* ring = nullptr;
+    ~RingHolder() {
+        if(ring) {
+            ring->retire();
+        }
+    }
+};
+}
+
+static thread_local RingHolder t_ring_holder;
+
+BinLogRing::BinLogRing(uint32_t id, size_t capacity)
+    :m_capacity(capacity)
+    ,m_mask(capacity - 1)
+    ,m_id(id)
+    ,m_tid(GetThreadId())
+    ,m_threadName(Thread::GetName()) {
+    m_data = new char[capacity];
+}
+
+BinLogRing::~BinLogRing() {
+    delete[] m_data;
+}
+
+bool BinLogRing::wait(uint64_t end) {
+    while(true) {
+        m_headCache = m_head.load(std::memory_order_acquire);
+        if(end - m_headCache <= m_capacity) {
+            return true;
+        }
+        if(!BinLog::IsOpen()) {
+            return false;
+        }
+        ++m_waits;
+        BinLogWriterMgr::GetInstance()->wakeup();
+        std::this_thread::yield();
+    }
+}
+
+BinLogWriter::BinLogWriter() {
+    calibrate();
+}
+
+BinLogWriter::~BinLogWriter() {
+    close();
+}
+
+void BinLogWriter::calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+    // 时钟服务已经校准过时直接用，否则先粗略估计一次，之后每一轮用更长的时间间隔修正
+    m_baseTsc = BinLog::Clock();
+    m_baseSteady = steady_ns();
+    double tpn = Clock::TicksPerNs();
+    if(tpn > 0) {
+        m_ticksPerNs = tpn;
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    uint64_t ticks = BinLog::Clock() - m_baseTsc;
+    uint64_t ns = steady_ns() - m_baseSteady;
+    m_ticksPerNs = ns ? (double)ticks / ns : 1.0;
+#endif
+}
+
+bool BinLogWriter::open(const std::string& path, size_t ring_size, uint64_t interval) {
+    std::unique_lock<std::mutex> lock(m_condMutex);
+    if(m_fd >= 0) {
+        SYLAR_LOG_ERROR(g_logger) << "BinLog already opened";
+        return false;
+    }
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        SYLAR_LOG_ERROR(g_logger) << "BinLog open " << path << " failed, errno="
+            << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    std::string header(s_magic, sizeof(s_magic));
+    put(header, s_version);
+    put(header, (uint32_t)0);
+    struct iovec iov = {(void*)header.data(), header.size()};
+    if(!WritevAll(fd, &iov, 1)) {
+        ::close(fd);
+        return false;
+    }
+
+    {
+        // 新文件需要重新写入所有调用点和线程信息
+        std::lock_guard<std::mutex> lock2(m_mutex);
+        size_t size = 4096;
+        while(size < ring_size) {
+            size <<= 1;
+        }
+        m_ringSize = size;
+        m_sitesWritten = 0;
+        for(auto i : m_rings) {
+            i->m_described = false;
+        }
+    }
+    m_fd = fd;
+    m_interval = interval ? interval : 1;
+    m_stopping = false;
+    m_thread.reset(new Thread(std::bind(&BinLogWriter::run, this), "binlog"));
+    BinLog::s_open = true;
+    return true;
+}
+
+void BinLogWriter::close() {
+    {
+        std::lock_guard<std::mutex> lock(m_condMutex);
+        if(m_fd < 0 || m_stopping) {
+            return;
+        }
+        BinLog::s_open = false;
+        m_stopping = true;
+    }
+    m_cond.notify_one();
+    m_thread->join();
+    m_thread.reset();
+    std::lock_guard<std::mutex> lock(m_condMutex);
+    ::close(m_fd);
+    m_fd = -1;
+    m_flushCond.notify_all();
+}
+
+void BinLogWriter::flush() {
+    std::unique_lock<std::mutex> lock(m_condMutex);
+    if(m_fd < 0 || m_stopping) {
+        return;
+    }
+    // 正在进行的一轮可能没有包含刚写入的记录，需要再等一轮
+    uint64_t target = m_round + (m_busy ? 2 : 1);
+    m_flushRequest = true;
+    m_cond.notify_one();
+    m_flushCond.wait(lock, [this, target](){
+        return m_stopping || m_fd < 0 || m_round >= target;
+    });
+}
+
+uint32_t BinLogWriter::registerSite(BinLogSite& site, const std::shared_ptr<Logger>& logger, const uint8_t* types, size_t nargs) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint32_t id = site.id.load(std::memory_order_relaxed);
+    if(id) {
+        return id;
+    }
+    SiteInfo info;
+    info.level = site.level;
+    info.file = site.file;
+    info.line = site.line;
+    info.format = site.format;
+    // 同一个调用点只记录第一次使用的Logger
+    info.logger = logger->getName();
+    info.types.assign(types, types + nargs);
+    m_sites.push_back(std::move(info));
+    id = m_sites.size();
+    site.id.store(id, std::memory_order_release);
+    return id;
+}
+
+BinLogRing* BinLogWriter::createRing() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    BinLogRing* ring = new BinLogRing(++m_ringId, m_ringSize);
+    m_rings.push_back(ring);
+    return ring;
+}
+
+void BinLogWriter::run() {
+    while(true) {
+        bool stopping = false;
+        {
+            std::unique_lock<std::mutex> lock(m_condMutex);
+            if(!m_stopping && !m_flushRequest) {
+                m_cond.wait_for(lock, std::chrono::milliseconds(m_interval));
+            }
+            stopping = m_stopping;
+            m_flushRequest = false;
+            m_busy = true;
+        }
+        writePass();
+        {
+            std::lock_guard<std::mutex> lock(m_condMutex);
+            m_busy = false;
+            ++m_round;
+        }
+        m_flushCond.notify_all();
+        if(stopping) {
+            break;
+        }
+    }
+}
+
+void BinLogWriter::writePass() {
+    std::string meta;
+    std::vector<std::pair<BinLogRing*, uint64_t> > work;
+    std::vector<BinLogRing*> retired;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        // 先取各缓冲区的tail再取调用点：tail之前的记录用到的调用点一定已经登记
+        for(auto ring : m_rings) {
+            bool dead = ring->m_retired.load(std::memory_order_acquire);
+            uint64_t tail = ring->m_tail.load(std::memory_order_acquire);
+            work.emplace_back(ring, tail);
+            if(dead) {
+                retired.push_back(ring);
+            }
+        }
+
+        // 实时时钟对应两次取TSC的中点，中间被抢占(间隔超过10us)时重取
+        uint64_t tsc = 0;
+        uint64_t now = 0;
+        for(int i = 0; i < 5; ++i) {
+            uint64_t t0 = BinLog::Clock();
+            now = realtime_ns();
+            uint64_t t1 = BinLog::Clock();
+            tsc = t0 + (t1 - t0) / 2;
+            if(t1 - t0 < 10000 * m_ticksPerNs) {
+                break;
+            }
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        uint64_t steady = steady_ns();
+        if(steady - m_baseSteady > 100000000ull) {
+            m_ticksPerNs = (double)(tsc - m_baseTsc) / (steady - m_baseSteady);
+        }
+#endif
+        meta += (char)ENTRY_SYNC;
+        put(meta, tsc);
+        put(meta, now);
+        put(meta, m_ticksPerNs.load());
+        put(meta, steady_ns() - Clock::StartMonotonicNS());
+
+        for(; m_sitesWritten < m_sites.size(); ++m_sitesWritten) {
+            SiteInfo& site = m_sites[m_sitesWritten];
+            meta += (char)ENTRY_SITE;
+            put(meta, (uint32_t)(m_sitesWritten + 1));
+            put(meta, (uint8_t)site.level);
+            put(meta, site.line);
+            put(meta, (uint16_t)site.types.size());
+            meta.append((const char*)site.types.data(), site.types.size());
+            put_string(meta, site.file);
+            put_string(meta, site.format);
+            put_string(meta, site.logger);
+        }
+        for(auto ring : m_rings) {
+            if(!ring->m_described) {
+                ring->m_described = true;
+                meta += (char)ENTRY_THREAD;
+                put(meta, ring->m_id);
+                put(meta, (uint32_t)ring->m_tid);
+                put_string(meta, ring->m_threadName);
+            }
+        }
+    }
+
+    std::vector<struct iovec> iovs;
+    std::vector<std::string> headers;
+    headers.reserve(work.size());
+    iovs.push_back({(void*)meta.data(), meta.size()});
+    for(auto& i : work) {
+        BinLogRing* ring = i.first;
+        uint64_t head = ring->m_head.load(std::memory_order_relaxed);
+        uint64_t tail = i.second;
+        if(head == tail) {
+            continue;
+        }
+        // 缓冲区里的记录原样写出，跨过结尾时分成两段
+        headers.emplace_back();
+        std::string& header = headers.back();
+        header += (char)ENTRY_DATA;
+        put(header, ring->m_id);
+        put(header, (uint32_t)(tail - head));
+        iovs.push_back({(void*)header.data(), header.size()});
+        size_t off = head & ring->m_mask;
+        size_t len = tail - head;
+        size_t first = std::min(len, ring->m_capacity - off);
+        iovs.push_back({ring->m_data + off, first});
+        if(first < len) {
+            iovs.push_back({ring->m_data, len - first});
+        }
+    }
+    if(!WritevAll(m_fd, iovs.data(), iovs.size())) {
+        SYLAR_LOG_ERROR(g_logger) << "BinLog write failed, errno=" << errno
+            << " errstr=" << strerror(errno);
+    }
+    for(auto& i : work) {
+        i.first->m_head.store(i.second, std::memory_order_release);
+    }
+
+    if(!retired.empty()) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for(auto ring : retired) {
+            // 标记之后线程不会再写，上面已经写完了标记之前的数据
+            if(ring->m_head.load(std::memory_order_relaxed) == ring->m_tail.load(std::memory_order_acquire)) {
+                m_rings.erase(std::find(m_rings.begin(), m_rings.end(), ring));
+                delete ring;
+            }
+        }
+    }
+}
+
+bool BinLog::Open(const std::string& path, size_t ring_size, uint64_t flush_interval_ms) {
+    return BinLogWriterMgr::GetInstance()->open(path, ring_size, flush_interval_ms);
+}
+
+void BinLog::Close() {
+    BinLogWriterMgr::GetInstance()->close();
+}
+
+void BinLog::Flush() {
+    BinLogWriterMgr::GetInstance()->flush();
+}
+
+double BinLog::GetTicksPerNs() {
+    return BinLogWriterMgr::GetInstance()->getTicksPerNs();
+}
+
+uint32_t BinLog::Register(BinLogSite& site, const std::shared_ptr<Logger>& logger, const uint8_t* types, size_t nargs) {
+    return BinLogWriterMgr::GetInstance()->registerSite(site, logger, types, nargs);
+}
+
+BinLogRing* BinLog::CreateRing() {
+    BinLogRing* ring = BinLogWriterMgr::GetInstance()->createRing();
+    t_ring_holder.ring = ring;
+    t_ring = ring;
+    return ring;
+}
+
+BinLogReader::BinLogReader(const std::string& path)
+    :m_path(path) {
+    std::ifstream ifs(path, std::ios::binary);
+    if(!ifs) {
+        return;
+    }
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    m_data = ss.str();
+    m_valid = m_data.size() >= 16 && !memcmp(m_data.data(), s_magic, sizeof(s_magic));
+    if(m_valid) {
+        memcpy(&m_version, m_data.data() + sizeof(s_magic), sizeof(m_version));
+        m_valid = m_version >= 1 && m_version <= s_version;
+    }
+}
+
+namespace {
+
+// 按顺序读取文件内容，越界时置错误标记
+class Cursor {
+public:
+    Cursor(const char* data, size_t size)
+        :m_ptr(data)
+        ,m_end(data + size) {
+    }
+
+    template<class T>
+    T get() {
+        T v = T();
+        if(m_end - m_ptr < (ssize_t)sizeof(T)) {
+            m_error = true;
+            m_ptr = m_end;
+            return v;
+        }
+        memcpy(&v, m_ptr, sizeof(T));
+        m_ptr += sizeof(T);
+        return v;
+    }
+
+    const char* skip(size_t n) {
+        const char* p = m_ptr;
+        if((size_t)(m_end - m_ptr) < n) {
+            m_error = true;
+            m_ptr = m_end;
+            return nullptr;
+        }
+        m_ptr += n;
+        return p;
+    }
+
+    std::string getString() {
+        uint32_t len = get<uint32_t>();
+        const char* p = skip(len);
+        return p ? std::string(p, len) : std::string();
+    }
+
+    bool eof() const { return m_ptr >= m_end;}
+    bool error() const { return m_error;}
+    size_t left() const { return m_end - m_ptr;}
+private:
+    const char* m_ptr;
+    const char* m_end;
+    bool m_error = false;
+};
+
+struct Pending {
+    uint64_t tsc;
+    const BinLogReader::Site* site;
+    uint32_t ring;
+    const char* args;
+    size_t len;
+};
+
+}
+
+bool BinLogReader::read(std::function<void(const Record&)> cb) {
+    if(!m_valid) {
+        return false;
+    }
+    struct ThreadInfo {
+        uint32_t tid = 0;
+        std::string name;
+    };
+    std::map<uint32_t, Site> sites;
+    std::map<uint32_t, ThreadInfo> threads;
+    uint64_t sync_tsc = 0;
+    uint64_t sync_ns = 0;
+    uint64_t sync_elapse = 0;
+    double ticks_per_ns = 1.0;
+    std::vector<Pending> pass;
+    bool truncated = false;
+    uint64_t last_time = 0;
+
+    // 一轮内各线程的记录按时间戳排序
+    auto flush_pass = [&]() {
+        std::stable_sort(pass.begin(), pass.end(), [](const Pending& a, const Pending& b) {
+            return a.tsc < b.tsc;
+        });
+        for(auto& i : pass) {
+            ThreadInfo& thread = threads[i.ring];
+            Record r;
+            r.site = i.site;
+            r.threadId = thread.tid;
+            r.threadName = &thread.name;
+            int64_t delta = (int64_t)((double)(int64_t)(i.tsc - sync_tsc) / ticks_per_ns);
+            r.time = sync_ns + delta;
+            r.elapse = std::max<int64_t>((int64_t)sync_elapse + delta, 0) / 1000000;
+            // 相邻两轮的同步点有误差，换算出的时间不倒退
+            r.time = std::max(r.time, last_time);
+            last_time = r.time;
+            r.message = Render(*i.site, i.args, i.len);
+            cb(r);
+        }
+        pass.clear();
+    };
+
+    Cursor cur(m_data.data() + 16, m_data.size() - 16);
+    while(!cur.eof() && !cur.error()) {
+        uint8_t type = cur.get<uint8_t>();
+        if(type == ENTRY_SITE) {
+            uint32_t id = cur.get<uint32_t>();
+            Site& site = sites[id];
+            site.level = (LogLevel::Level)cur.get<uint8_t>();
+            site.line = cur.get<uint32_t>();
+            uint16_t nargs = cur.get<uint16_t>();
+            const char* types = cur.skip(nargs);
+            if(types) {
+                site.types.assign(types, types + nargs);
+            }
+            site.file = cur.getString();
+            site.format = cur.getString();
+            site.logger = cur.getString();
+        } else if(type == ENTRY_THREAD) {
+            uint32_t id = cur.get<uint32_t>();
+            ThreadInfo& thread = threads[id];
+            thread.tid = cur.get<uint32_t>();
+            thread.name = cur.getString();
+        } else if(type == ENTRY_SYNC) {
+            flush_pass();
+            sync_tsc = cur.get<uint64_t>();
+            sync_ns = cur.get<uint64_t>();
+            ticks_per_ns = cur.get<double>();
+            if(ticks_per_ns <= 0) {
+                ticks_per_ns = 1.0;
+            }
+            // 版本1没有记录启动时间，%r输出0
+            sync_elapse = m_version >= 2 ? cur.get<uint64_t>() : 0;
+        } else if(type == ENTRY_DATA) {
+            uint32_t ring = cur.get<uint32_t>();
+            uint32_t bytes = cur.get<uint32_t>();
+            // 进程崩溃时最后一段可能不完整，完整的记录照常输出
+            if(bytes > cur.left()) {
+                truncated = true;
+                bytes = cur.left();
+            }
+            const char* data = cur.skip(bytes);
+            Cursor rec(data, bytes);
+            while(!rec.eof()) {
+                uint32_t id = rec.get<uint32_t>();
+                uint32_t size = rec.get<uint32_t>();
+                if(rec.error() || size < 8) {
+                    flush_pass();
+                    return false;
+                }
+                if(id == BinLogRing::PAD) {
+                    rec.skip(size - 8);
+                    continue;
+                }
+                const char* body = rec.skip(size - 8);
+                auto it = sites.find(id);
+                if(!body || size < BinLogRing::HEADER_SIZE || it == sites.end()) {
+                    flush_pass();
+                    return false;
+                }
+                uint64_t tsc;
+                memcpy(&tsc, body, sizeof(tsc));
+                pass.push_back({tsc, &it->second, ring, body + 8, size - BinLogRing::HEADER_SIZE});
+            }
+        } else {
+            flush_pass();
+            return false;
+        }
+    }
+    flush_pass();
+    return !cur.error() && !truncated;
+}
+
+bool BinLogReader::format(LogFormatter::ptr formatter, std::ostream& os) {
+    std::map<std::string, Logger::ptr> loggers;
+    return read([&](const Record& r) {
+        Logger::ptr& logger = loggers[r.site->logger];
+        if(!logger) {
+            logger.reset(new Logger(r.site->logger));
+        }
+        LogEvent event(logger, r.site->level, r.site->file.c_str(), r.site->line, r.elapse
+                    , r.threadId, 0, 0, *r.threadName);
+        event.setTimeNS(r.time);
+        event.getSS().write(r.message.data(), r.message.size());
+        formatter->format(os, logger, r.site->level, event);
+    });
+}
+
+namespace {
+
+struct Arg {
+    uint8_t type = 0;
+    uint8_t width = 8;          // 整数参数原本的字节数
+    int64_t i = 0;
+    uint64_t u = 0;
+    double d = 0;
+    std::string s;
+
+    int64_t asInt() const {
+        return type == BINLOG_INT ? i : type == BINLOG_DOUBLE ? (int64_t)d : (int64_t)u;
+    }
+    uint64_t asUint() const {
+        return type == BINLOG_INT ? (uint64_t)i : type == BINLOG_DOUBLE ? (uint64_t)d : u;
+    }
+    double asDouble() const {
+        return type == BINLOG_DOUBLE ? d : type == BINLOG_INT ? (double)i : (double)u;
+    }
+};
+
+}
+
+// 不同的参数类型用不同的C类型传给snprintf
+template<class T>
+static void append_format(std::string& out, const std::string& spec, T v) {
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf), spec.c_str(), v);
+    if(n < 0) {
+        return;
+    }
+    if((size_t)n < sizeof(buf)) {
+        out.append(buf, n);
+        return;
+    }
+    std::string big(n + 1, '\0');
+    snprintf(&big[0], big.size(), spec.c_str(), v);
+    out.append(big.data(), n);
+}
+
+std::string BinLogReader::Render(const Site& site, const char* args, size_t len) {
+    Cursor cur(args, len);
+    size_t index = 0;
+    auto next = [&](Arg& arg) {
+        if(index >= site.types.size()) {
+            return false;
+        }
+        uint8_t type = site.types[index++];
+        arg.type = type & BINLOG_TYPE_MASK;
+        arg.width = (type >> 4) ? (type >> 4) : 8;
+        switch(arg.type) {
+            case BINLOG_INT:
+                arg.i = cur.get<int64_t>();
+                break;
+            case BINLOG_DOUBLE:
+                arg.d = cur.get<double>();
+                break;
+            case BINLOG_STRING:
+                arg.s = cur.getString();
+                break;
+            default:
+                arg.u = cur.get<uint64_t>();
+                break;
+        }
+        return !cur.error();
+    };
+
+    std::string out;
+    const std::string& fmt = site.format;
+    size_t i = 0;
+    while(i < fmt.size()) {
+        char c = fmt[i];
+        if(c != '%') {
+            out += c;
+            ++i;
+            continue;
+        }
+        if(i + 1 < fmt.size() && fmt[i + 1] == '%') {
+            out += '%';
+            i += 2;
+            continue;
+        }
+        // %[flags][width][.precision][length]conversion，长度修饰统一换成参数实际的类型
+        size_t start = i++;
+        std::string spec = "%";
+        Arg arg;
+        while(i < fmt.size() && strchr("-+ #0'", fmt[i])) {
+            spec += fmt[i++];
+        }
+        for(int part = 0; part < 2; ++part) {
+            if(part == 1) {
+                if(i >= fmt.size() || fmt[i] != '.') {
+                    break;
+                }
+                spec += fmt[i++];
+            }
+            if(i < fmt.size() && fmt[i] == '*') {
+                ++i;
+                if(next(arg)) {
+                    spec += std::to_string(arg.asInt());
+                }
+            } else {
+                while(i < fmt.size() && isdigit((unsigned char)fmt[i])) {
+                    spec += fmt[i++];
+                }
+            }
+        }
+        std::string length;
+        while(i < fmt.size() && strchr("hlLqjzt", fmt[i])) {
+            length += fmt[i++];
+        }
+        if(i >= fmt.size()) {
+            out.append(fmt, start, std::string::npos);
+            break;
+        }
+        char conv = fmt[i++];
+        if(conv == 'n') {
+            next(arg);
+            continue;
+        }
+        if(!strchr("diouxXcsfFeEgGaAp", conv)) {
+            out.append(fmt, start, i - start);
+            continue;
+        }
+        if(!next(arg)) {
+            out.append(fmt, start, i - start);
+            continue;
+        }
+        // 和printf一致：整数先按默认提升至少是int，h/hh再截断，然后按宽度截断或者符号扩展
+        size_t bits = 64;
+        if(arg.type == BINLOG_INT || arg.type == BINLOG_UINT) {
+            bits = std::max<size_t>(arg.width, sizeof(int)) * 8;
+        }
+        if(length == "hh") {
+            bits = 8;
+        } else if(length == "h") {
+            bits = 16;
+        }
+        switch(conv) {
+            case 'd':
+            case 'i': {
+                int64_t v = arg.asInt();
+                if(bits < 64) {
+                    v = (int64_t)((uint64_t)v << (64 - bits)) >> (64 - bits);
+                }
+                append_format(out, spec + "ll" + conv, (long long)v);
+                break;
+            }
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X': {
+                uint64_t v = arg.asUint();
+                if(bits < 64) {
+                    v &= (1ull << bits) - 1;
+                }
+                append_format(out, spec + "ll" + conv, (unsigned long long)v);
+                break;
+            }
+            case 'c':
+                append_format(out, spec + conv, (int)arg.asInt());
+                break;
+            case 's':
+                if(arg.type == BINLOG_STRING) {
+                    append_format(out, spec + conv, arg.s.c_str());
+                } else if(arg.type == BINLOG_DOUBLE) {
+                    append_format(out, std::string("%g"), arg.d);
+                } else {
+                    append_format(out, std::string("%lld"), (long long)arg.asInt());
+                }
+                break;
+            case 'p':
+                append_format(out, spec + conv, (void*)(uintptr_t)arg.asUint());
+                break;
+            default:
+                append_format(out, spec + conv, arg.asDouble());
+                break;
+        }
+    }
+    return out;
+}
+
+}
@@ -0,0 +1,139 @@
+#include "clock.h"
+#include <atomic>
+#include <fstream>
+#include <string>
+
+namespace sylar {
+
+namespace {
+
+// 进程启动时的基准，用来校准TSC和计算启动后经过的时间
+struct ClockBase {
+    ClockBase();
+    uint64_t tsc;
+    uint64_t monotonic;
+    bool tscEnabled;
+};
+
+// 每个线程的外推基准
+struct ThreadClock {
+    uint64_t tsc = 0;
+    uint64_t realtime = 0;
+    uint64_t monotonic = 0;
+    uint64_t span = 0;              // 基准有效的tick数，0表示下次要重新对齐
+    double nsPerTick = 0;
+    uint64_t lastRealtime = 0;      // 上一次返回的时间
+    uint64_t lastMonotonic = 0;
+};
+
+}
+
+ClockBase::ClockBase()
+    :tsc(Clock::Ticks())
+    ,monotonic(Clock::MonotonicNS())
+    ,tscEnabled(false) {
+#if defined(__x86_64__) || defined(__i386__)
+    // 内核信任TSC(各CPU同步、频率恒定)时才用它外推
+    std::ifstream ifs("/sys/devices/system/clocksource/clocksource0/current_clocksource");
+    std::string name;
+    ifs >> name;
+    tscEnabled = name == "tsc";
+#endif
+}
+
+static ClockBase& GetBase() {
+    static ClockBase s_base;
+    return s_base;
+}
+
+// 在加载时就记下启动时间，其他模块的静态初始化先用到时由GetBase初始化
+[[maybe_unused]] static ClockBase& s_base_init = GetBase();
+static std::atomic<double> s_ticks_per_ns = {0};
+static thread_local ThreadClock t_clock;
+
+// 用启动到现在的整个区间计算频率，至少10ms才有足够的精度，之后每次对齐都用更长的区间修正
+static void calibrate(uint64_t tsc, uint64_t monotonic) {
+    const ClockBase& base = GetBase();
+    if(monotonic - base.monotonic >= 10000000 && tsc > base.tsc) {
+        s_ticks_per_ns.store((double)(tsc - base.tsc) / (monotonic - base.monotonic)
+                            , std::memory_order_relaxed);
+    }
+}
+
+static void resync(ThreadClock& c) {
+    uint64_t tsc = Clock::Ticks();
+    uint64_t realtime = Clock::RealtimeNS();
+    uint64_t monotonic = Clock::MonotonicNS();
+    calibrate(tsc, monotonic);
+    double tpn = s_ticks_per_ns.load(std::memory_order_relaxed);
+    // 外推的时间比系统时钟略快时不倒退；实时时钟被往回调整(超过一个同步间隔)时跟着调整
+    if(monotonic < c.lastMonotonic) {
+        monotonic = c.lastMonotonic;
+    }
+    if(realtime < c.lastRealtime && c.lastRealtime - realtime < Clock::RESYNC_NS) {
+        realtime = c.lastRealtime;
+    }
+    c.tsc = tsc;
+    c.realtime = realtime;
+    c.monotonic = monotonic;
+    c.nsPerTick = tpn ? 1 / tpn : 0;
+    c.span = tpn * Clock::RESYNC_NS;
+    c.lastRealtime = realtime;
+    c.lastMonotonic = monotonic;
+}
+
+double Clock::TicksPerNs() {
+    if(s_ticks_per_ns.load(std::memory_order_relaxed) == 0) {
+        calibrate(Ticks(), MonotonicNS());
+    }
+    return s_ticks_per_ns.load(std::memory_order_relaxed);
+}
+
+bool Clock::IsTscEnabled() {
+    return GetBase().tscEnabled;
+}
+
+void Clock::Now(uint64_t* realtime_ns, uint64_t* monotonic_ns) {
+    ThreadClock& c = t_clock;
+    uint64_t delta = Ticks() - c.tsc;
+    if(__builtin_expect(delta >= c.span, 0)) {
+        if(!GetBase().tscEnabled) {
+            if(realtime_ns) {
+                *realtime_ns = RealtimeNS();
+            }
+            if(monotonic_ns) {
+                *monotonic_ns = MonotonicNS();
+            }
+            return;
+        }
+        resync(c);
+        delta = 0;
+    }
+    uint64_t ns = delta * c.nsPerTick;
+    c.lastRealtime = c.realtime + ns;
+    c.lastMonotonic = c.monotonic + ns;
+    if(realtime_ns) {
+        *realtime_ns = c.lastRealtime;
+    }
+    if(monotonic_ns) {
+        *monotonic_ns = c.lastMonotonic;
+    }
+}
+
+uint64_t Clock::NowNS() {
+    uint64_t ns;
+    Now(&ns, nullptr);
+    return ns;
+}
+
+uint64_t Clock::NowMonotonicNS() {
+    uint64_t ns;
+    Now(nullptr, &ns);
+    return ns;
+}
+
+uint64_t Clock::StartMonotonicNS() {
+    return GetBase().monotonic;
+}
+
+}
@@ -1,78 +1,231 @@
 #include "config.h"
+#include "macro.h"
 
 namespace sylar {
 
+std::vector<ConfigVarBase::CachedValue>& ConfigVarBase::GetThreadCache() {
+    static thread_local std::vector<CachedValue> t_cache;
+    return t_cache;
+}
+
+Config::Slot* Config::FindSlot(const std::string& name) {
+    auto& names = GetNames();
+    auto it = names.find(name);
+    if(it == names.end()) {
+        return nullptr;
+    }
+    return &s_segments[it->second / SEGMENT_SIZE].load(std::memory_order_relaxed)[it->second % SEGMENT_SIZE];
+}
+
+Config::Slot* Config::InternSlot(const std::string& name) {
+    uint32_t index = s_count.load(std::memory_order_relaxed);
+    SYLAR_ASSERT2(index < SEGMENT_SIZE * MAX_SEGMENTS, "too many config names");
+    Slot* segment = s_segments[index / SEGMENT_SIZE].load(std::memory_order_relaxed);
+    if(!segment) {
+        segment = new Slot[SEGMENT_SIZE];   // 和注册表一样存活到进程退出
+        s_segments[index / SEGMENT_SIZE].store(segment, std::memory_order_release);
+    }
+    Slot* slot = &segment[index % SEGMENT_SIZE];
+    slot->index = index;
+    GetNames().emplace(name, index);
+    s_count.store(index + 1, std::memory_order_release);
+    return slot;
+}
+
+void Config::Register(Slot* slot, ConfigVarBase::ptr var) {
+    slot->var.store(var.get(), std::memory_order_release);
+    slot->owner = std::move(var);
+}
+
+ConfigKey Config::Key(const std::string& name) {
+    {
+        std::shared_lock<std::shared_mutex> lock(GetMutex());
+        Slot* slot = FindSlot(name);
+        if(slot) {
+            return ConfigKey(slot->index);
+        }
+    }
+    if(!IsValidName(name)) {
+        SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config::Key name invalid " << name;
+        return ConfigKey();
+    }
+    std::unique_lock<std::shared_mutex> lock(GetMutex());
+    Slot* slot = FindSlot(name);
+    return ConfigKey(slot ? slot->index : InternSlot(name)->index);
+}
+
 // 通用查找，返回基类指针
 ConfigVarBase::ptr Config::LookupBase(const std::string& name) {
     std::shared_lock<std::shared_mutex> lock(GetMutex());
-    auto it = GetDatas().find(name);
-    return it == GetDatas().end() ? nullptr : it->second;
+    Slot* slot = FindSlot(name);
+    return slot ? slot->owner : nullptr;
+}
+
+// 批次之间串行，回调中再加载配置时可以重入
+static std::recursive_mutex& GetBatchMutex() {
+    static std::recursive_mutex s_mutex;
+    return s_mutex;
+}
+
+struct BatchListeners {
+    std::mutex mutex;
+    uint64_t id = 0;
+    std::map<uint64_t, Config::batch_cb> cbs;
+};
+
+static BatchListeners& GetBatchListeners() {
+    static BatchListeners s_listeners;
+    return s_listeners;
 }
 
 /*
-    递归遍历yaml节点树，将所有叶节点收集到一个列表中，并构建完整的点分割路径名
+    递归遍历yaml节点树，用同一个path缓冲区拼接点分割的路径名，收集已注册的配置项
     示例：
         输入YAML:
             server:
                 port: 8080
                 log_level: info
-        输出列表：
+        已注册server.port时输出：
             [
-                {"server", MapNode},
-                {"server.port", ScalarNode(8080)},
-                {"server.log_level", ScalarNode("info")}
+                {server.port配置项, ScalarNode(8080)}
             ]
+    调用方持有配置表的读锁
 */
-static void ListAllMember(const std::string& prefix, const YAML::Node& node, std::list<std::pair<std::string, const YAML::Node>>& output) {
+void Config::CollectVars(std::string& path, const YAML::Node& node
+                        , std::vector<std::pair<ConfigVarBase::ptr, YAML::Node>>& output) {
+    if(!path.empty()) {
+        Slot* slot = FindSlot(path);
+        if(slot && slot->owner) {
+            output.emplace_back(slot->owner, node);
+        }
+    }
+    if(!node.IsMap()) {
+        return;
+    }
+    for(auto it = node.begin(); it != node.end(); it++) {
+        const std::string& key = it->first.Scalar();
+        // 只检查新拼上的一段，前缀已经检查过
+        if(!IsValidName(key)) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config invalid name: " 
+                << (path.empty() ? key : path + "." + key) << " : " << it->second;
+            continue;
+        }
+        size_t len = path.size();
+        if(len) {
+            path += '.';
+        }
+        path += key;
+        CollectVars(path, it->second, output);
+        path.resize(len);
+    }
+}
 
-    if(prefix.find_first_not_of("abcdefghijklmnopqrstuvwxyz._0123456789") != std::string::npos) {
-        SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config invalid name: " << prefix << " : " << node;
-        return; 
+// 从yaml根节点加载配置，整批更新已注册的配置变量
+bool Config::LoadFromYaml(const YAML::Node& root, std::unordered_map<std::string, std::string>* last) {
+    std::vector<std::pair<ConfigVarBase::ptr, YAML::Node>> vars;
+    {
+        std::shared_lock<std::shared_mutex> lock(GetMutex());
+        std::string path;
+        path.reserve(128);
+        CollectVars(path, root, vars);
     }
 
-    output.push_back(std::make_pair(prefix, node));
-    if(node.IsMap()) {
-        for(auto it = node.begin(); it != node.end(); it++) {
-            ListAllMember(prefix.empty() ? it->first.Scalar() : prefix + "." + it->first.Scalar(), it->second, output);
+    struct Change {
+        ConfigVarBase::ptr var;
+        std::shared_ptr<const void> value;
+        std::shared_ptr<const void> old;
+        std::string text;
+    };
+    std::vector<Change> changes;
+    changes.reserve(vars.size());
+    // 先全部转换，不修改任何配置项
+    for(auto& i : vars) {
+        std::string text;
+        if(last) {
+            std::stringstream ss;
+            ss << i.second;
+            text = ss.str();
+            auto it = last->find(i.first->getName());
+            if(it != last->end() && it->second == text) {
+                continue;
+            }
+        }
+        std::shared_ptr<const void> value = i.first->parse(i.second);
+        if(!value) {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config LoadFromYaml abort: convert "
+                << i.first->getName() << " failed, " << changes.size() << " converted items dropped";
+            return false;
+        }
+        changes.push_back({i.first, std::move(value), nullptr, std::move(text)});
+    }
+    if(changes.empty()) {
+        return true;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(GetBatchMutex());
+    // 整批发布，发布期间批次号为奇数
+    std::atomic<uint64_t>& gen = GetGeneration();
+    gen.fetch_add(1, std::memory_order_acq_rel);
+    for(auto& i : changes) {
+        i.old = i.var->publish(i.value);
+    }
+    gen.fetch_add(1, std::memory_order_release);
+
+    // 解析成功的才记录文本，下次有变化时重新比较
+    if(last) {
+        for(auto& i : changes) {
+            (*last)[i.var->getName()] = std::move(i.text);
         }
     }
-}
 
-// 从yaml根节点加载配置，更新已注册的配置变量
-void Config::LoadFromYaml(const YAML::Node& root) {
-    // 递归收集所有节点到列表
-    std::list<std::pair<std::string, const YAML::Node>> all_nodes;
-    ListAllMember("", root, all_nodes);
-
-    // 遍历所有节点，更新配置
-    for(auto& i : all_nodes) {
-        std::string key = i.first;
-        if(key.empty()) continue;   // 跳过根节点
-
-        std::transform(key.begin(), key.end(), key.begin(), ::tolower); // 统一转化为小写
-
-        // 从全局配置表中查找对应名称的变量
-        ConfigVarBase::ptr var = Config::LookupBase(key);
-
-        if(var) {
-            // 节点类型为标量
-            if(i.second.IsScalar()) {
-                var->fromString(i.second.Scalar());
-            } else {   // 节点类型非标量，序列化为字符串再解析配置值
-                std::stringstream ss;
-                ss << i.second;
-                var->fromString(ss.str());
+    // 全部生效之后再通知
+    std::vector<ConfigVarBase::ptr> changed;
+    for(auto& i : changes) {
+        if(i.old) {
+            i.var->notify(i.old, i.value);
+            changed.push_back(i.var);
+        }
+    }
+    if(!changed.empty()) {
+        std::vector<batch_cb> cbs;
+        {
+            BatchListeners& listeners = GetBatchListeners();
+            std::lock_guard<std::mutex> lock(listeners.mutex);
+            for(auto& i : listeners.cbs) {
+                cbs.push_back(i.second);
             }
         }
+        for(auto& cb : cbs) {
+            cb(changed);
+        }
     }
+    return true;
+}
+
+uint64_t Config::AddBatchListener(batch_cb cb) {
+    BatchListeners& listeners = GetBatchListeners();
+    std::lock_guard<std::mutex> lock(listeners.mutex);
+    listeners.cbs[++listeners.id] = std::move(cb);
+    return listeners.id;
+}
+
+void Config::DelBatchListener(uint64_t key) {
+    BatchListeners& listeners = GetBatchListeners();
+    std::lock_guard<std::mutex> lock(listeners.mutex);
+    listeners.cbs.erase(key);
 }
 
 void Config::Visit(std::function<void(ConfigVarBase::ptr)> cb) {
     std::shared_lock<std::shared_mutex> lock(GetMutex());
-    ConfigVarMap& m = GetDatas();
-    for(auto it = m.begin(); it != m.end(); it++) {
-        cb(it->second);
-    }  
+    uint32_t count = s_count.load(std::memory_order_relaxed);
+    for(uint32_t i = 0; i < count; i += SEGMENT_SIZE) {
+        Slot* segment = s_segments[i / SEGMENT_SIZE].load(std::memory_order_relaxed);
+        for(uint32_t j = 0; j < SEGMENT_SIZE && i + j < count; ++j) {
+            if(segment[j].owner) {
+                cb(segment[j].owner);
+            }
+        }
+    }
 }
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,177 @@
+#include "config_watcher.h"
+#include "log.h"
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace sylar {
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+ConfigWatcher::ConfigWatcher(IOManager* iom, uint64_t debounce_ms)
+    :m_iom(iom)
+    ,m_debounce(debounce_ms) {
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(m_fd < 0) {
+        SYLAR_LOG_ERROR(g_logger) << "inotify_init1 errno=" << errno << " " << strerror(errno);
+    }
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    stop();
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool ConfigWatcher::addFile(const std::string& path) {
+    if(m_fd < 0) {
+        return false;
+    }
+    size_t pos = path.rfind('/');
+    std::string dir = pos == std::string::npos ? "." : (pos ? path.substr(0, pos) : "/");
+    std::string name = pos == std::string::npos ? path : path.substr(pos + 1);
+    // 同一个目录只有一个wd，写完关闭或者rename到这里都算变化
+    int wd = inotify_add_watch(m_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if(wd < 0) {
+        SYLAR_LOG_ERROR(g_logger) << "inotify_add_watch " << dir << " errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    FileInfo* info = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        info = &m_files[wd][name];
+        info->path = path;
+    }
+    std::lock_guard<std::mutex> lock(m_loadMutex);
+    load(*info);
+    return true;
+}
+
+bool ConfigWatcher::start() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_fd < 0 || m_started || m_stopped) {
+        return false;
+    }
+    m_started = true;
+    return waitReadable();
+}
+
+void ConfigWatcher::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_stopped) {
+            return;
+        }
+        m_stopped = true;
+        if(m_timer) {
+            m_timer->cancel();
+            m_timer = nullptr;
+        }
+        if(!m_started) {
+            return;
+        }
+    }
+    m_iom->cancelEvent(m_fd, IOManager::READ);
+}
+
+// 调用方持有m_mutex
+bool ConfigWatcher::waitReadable() {
+    std::weak_ptr<ConfigWatcher> weak = shared_from_this();
+    int rt = m_iom->addEvent(m_fd, IOManager::READ, [weak](){
+        ConfigWatcher::ptr self = weak.lock();
+        if(self) {
+            self->onReadable();
+        }
+    });
+    return rt == 0;
+}
+
+void ConfigWatcher::onReadable() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_stopped) {
+        return;
+    }
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool changed = false;
+    while(true) {
+        ssize_t n = read(m_fd, buf, sizeof(buf));
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            break;
+        }
+        for(char* p = buf; p < buf + n; ) {
+            const struct inotify_event* ev = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            // 事件队列溢出时不知道哪些文件变了，全部重新加载
+            if(ev->mask & IN_Q_OVERFLOW) {
+                for(auto& dir : m_files) {
+                    for(auto& file : dir.second) {
+                        m_dirty.emplace(dir.first, file.first);
+                    }
+                }
+                changed = true;
+                continue;
+            }
+            auto it = m_files.find(ev->wd);
+            if(it == m_files.end() || !ev->len || !it->second.count(ev->name)) {
+                continue;
+            }
+            m_dirty.emplace(ev->wd, ev->name);
+            changed = true;
+        }
+    }
+    // 一批事件只加载一次：计时中的定时器从现在重新计时
+    if(changed && !(m_timer && m_timer->refresh())) {
+        std::weak_ptr<ConfigWatcher> weak = shared_from_this();
+        m_timer = m_iom->addTimer(m_debounce, [weak](){
+            ConfigWatcher::ptr self = weak.lock();
+            if(self) {
+                self->reload();
+            }
+        });
+    }
+    if(!waitReadable()) {
+        SYLAR_LOG_ERROR(g_logger) << "ConfigWatcher addEvent fd=" << m_fd << " failed";
+    }
+}
+
+void ConfigWatcher::reload() {
+    std::vector<FileInfo*> files;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_stopped) {
+            return;
+        }
+        for(auto& i : m_dirty) {
+            files.push_back(&m_files[i.first][i.second]);
+        }
+        m_dirty.clear();
+    }
+    std::lock_guard<std::mutex> lock(m_loadMutex);
+    for(auto info : files) {
+        load(*info);
+    }
+}
+
+// 调用方持有m_loadMutex
+void ConfigWatcher::load(FileInfo& info) {
+    YAML::Node root;
+    try {
+        root = YAML::LoadFile(info.path);
+    } catch(std::exception& e) {
+        SYLAR_LOG_ERROR(g_logger) << "ConfigWatcher load " << info.path << " failed: " << e.what();
+        return;
+    }
+    if(!Config::LoadFromYaml(root, &info.values)) {
+        SYLAR_LOG_ERROR(g_logger) << "ConfigWatcher apply " << info.path << " failed, keep old values";
+        return;
+    }
+    ++m_reloads;
+    SYLAR_LOG_INFO(g_logger) << "ConfigWatcher loaded " << info.path;
+}
+
+}
@@ -0,0 +1,141 @@
+#include "context.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef SYLAR_FIBER_UCONTEXT
+
+/*
+    x86-64 (System V): 保存rbp/rbx/r12-r15以及x87控制字和mxcsr
+    栈帧布局(从低地址到高地址): fpu控制字, mxcsr, r15, r14, r13, r12, rbx, rbp, 返回地址
+*/
+#if defined(__x86_64__)
+asm(R"(
+    .pushsection .text
+    .globl sylar_swap_context
+    .type sylar_swap_context,@function
+    .align 16
+sylar_swap_context:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $16, %rsp
+    stmxcsr 8(%rsp)
+    fnstcw (%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    fldcw (%rsp)
+    ldmxcsr 8(%rsp)
+    addq $16, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size sylar_swap_context,.-sylar_swap_context
+    .popsection
+)");
+
+/*
+    AArch64 (AAPCS64): 保存d8-d15, x19-x28, fp(x29), lr(x30)，ret跳转到恢复出来的lr
+*/
+#elif defined(__aarch64__)
+asm(R"(
+    .pushsection .text
+    .globl sylar_swap_context
+    .type sylar_swap_context,%function
+    .align 4
+sylar_swap_context:
+    sub sp, sp, #160
+    stp d8, d9, [sp, #0]
+    stp d10, d11, [sp, #16]
+    stp d12, d13, [sp, #32]
+    stp d14, d15, [sp, #48]
+    stp x19, x20, [sp, #64]
+    stp x21, x22, [sp, #80]
+    stp x23, x24, [sp, #96]
+    stp x25, x26, [sp, #112]
+    stp x27, x28, [sp, #128]
+    stp x29, x30, [sp, #144]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp d8, d9, [sp, #0]
+    ldp d10, d11, [sp, #16]
+    ldp d12, d13, [sp, #32]
+    ldp d14, d15, [sp, #48]
+    ldp x19, x20, [sp, #64]
+    ldp x21, x22, [sp, #80]
+    ldp x23, x24, [sp, #96]
+    ldp x25, x26, [sp, #112]
+    ldp x27, x28, [sp, #128]
+    ldp x29, x30, [sp, #144]
+    add sp, sp, #160
+    ret
+    .size sylar_swap_context,.-sylar_swap_context
+    .popsection
+)");
+#endif
+
+#endif
+
+namespace sylar {
+
+bool Context::init() {
+#ifdef SYLAR_FIBER_UCONTEXT
+    return getcontext(&m_ctx) == 0;
+#else
+    m_sp = nullptr;     // 第一次切出时由sylar_swap_context填充
+    return true;
+#endif
+}
+
+bool Context::make(void* stack, size_t size, Entry fn) {
+#ifdef SYLAR_FIBER_UCONTEXT
+    if(getcontext(&m_ctx)) {
+        return false;
+    }
+    m_ctx.uc_link = nullptr;
+    m_ctx.uc_stack.ss_sp = stack;
+    m_ctx.uc_stack.ss_size = size;
+    makecontext(&m_ctx, fn, 0);
+    return true;
+#else
+    // 栈顶按16字节对齐
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+    uint64_t* sp = (uint64_t*)top;
+    *--sp = 0;                  // fn的返回地址，fn不会返回，置0让栈回溯在此终止
+    *--sp = (uint64_t)fn;       // ret跳转的目标
+    for(int i = 0; i < 6; ++i) {
+        *--sp = 0;              // rbp, rbx, r12-r15
+    }
+    *--sp = 0x1F80;             // mxcsr默认值
+    *--sp = 0x037F;             // x87控制字默认值
+    m_sp = sp;
+#elif defined(__aarch64__)
+    uint64_t* sp = (uint64_t*)(top - 160);
+    memset(sp, 0, 160);
+    sp[19] = (uint64_t)fn;      // x30(lr)，ret跳转的目标
+    m_sp = sp;
+#endif
+    return true;
+#endif
+}
+
+const char* Context::BackendName() {
+#ifdef SYLAR_FIBER_UCONTEXT
+    return "ucontext";
+#elif defined(__x86_64__)
+    return "asm_x86_64";
+#else
+    return "asm_aarch64";
+#endif
+}
+
+}
@@ -5,6 +5,13 @@
 #include "log.h"
 
 #include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
 
 namespace sylar {
 
@@ -17,6 +24,32 @@ static thread_local Fiber* t_fiber = nullptr;               // 指向当前正
 static thread_local Fiber::ptr t_threadFiber = nullptr;     // 保存线程的主协程
 
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size = Config::Lookup<uint32_t>("fiber.stack_size", 1024*1024, "fiber stack size");
+static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_local = Config::Lookup<uint32_t>("fiber.stack_pool.local_size", 64, "fiber stacks cached per thread");
+static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_global = Config::Lookup<uint32_t>("fiber.stack_pool.global_size", 1024, "fiber stacks cached in the global pool");
+
+static ConfigVar<uint32_t>::ptr g_fiber_pool_size = Config::Lookup<uint32_t>("fiber.pool_size", 64, "terminated fibers cached per thread for reuse");
+
+// 分配路径上不能每次都去拿ConfigVar的读写锁，这里缓存一份，配置变更时通过回调更新
+static std::atomic<uint32_t> s_stack_size{1024 * 1024};
+static std::atomic<uint32_t> s_stack_pool_local{64};
+static std::atomic<uint32_t> s_stack_pool_global{1024};
+static std::atomic<uint32_t> s_fiber_pool_size{64};
+
+struct _FiberConfigIniter {
+    _FiberConfigIniter() {
+#define XX(cache, var) \
+        cache = var->getValue(); \
+        var->addListener([](const uint32_t& old_value, const uint32_t& new_value){ \
+            cache = new_value; \
+        });
+        XX(s_stack_size, g_fiber_stack_size);
+        XX(s_stack_pool_local, g_fiber_stack_pool_local);
+        XX(s_stack_pool_global, g_fiber_stack_pool_global);
+        XX(s_fiber_pool_size, g_fiber_pool_size);
+#undef XX
+    }
+};
+static _FiberConfigIniter s_fiber_config_initer;
 
 // 栈分配器，用malloc和free管理协程栈内存
 class MallocStackAllocator {
@@ -30,7 +63,205 @@ public:
     }
 };
 
-using StackAllocator = MallocStackAllocator;
+/*
+    基于mmap的栈分配器
+    1. 每个栈单独mmap，最低地址处的一页设置为PROT_NONE作为保护页，栈溢出时直接触发SIGSEGV，而不是踩坏相邻的内存
+    2. 释放的栈先放入线程本地的空闲链表，超过fiber.stack_pool.local_size后把一半批量归还全局池
+    3. 全局池中的栈用madvise归还物理内存，超过fiber.stack_pool.global_size后才munmap
+    4. 只缓存当前fiber.stack_size大小的栈，其他大小的栈直接mmap/munmap
+    注意：每个栈占用两个VMA，大量协程时需要相应调大vm.max_map_count
+*/
+class PooledStackAllocator {
+public:
+    static void* Alloc(size_t size) {
+        size = RoundUp(size);
+        StackCache* cache = GetCache();
+        if(cache && cache->size == size) {
+            if(cache->stacks.empty()) {
+                Refill(*cache);
+            }
+            if(!cache->stacks.empty()) {
+                void* vp = cache->stacks.back();
+                cache->stacks.pop_back();
+                return vp;
+            }
+        } else if(cache && cache->stacks.empty() && size == RoundUp(s_stack_size)) {
+            cache->size = size;     // fiber.stack_size变化后，空的本地缓存切换到新的大小
+        }
+        return Map(size);
+    }
+
+    static void Dealloc(void* vp, size_t size) {
+        size = RoundUp(size);
+        StackCache* cache = GetCache();
+        if(!cache) {
+            Release(&vp, 1, size);
+            return;
+        }
+        if(cache->size != size) {
+            Unmap(vp, size);
+            return;
+        }
+        cache->stacks.push_back(vp);
+        size_t limit = s_stack_pool_local;
+        if(cache->stacks.size() > limit) {
+            // 本地缓存满了，保留一半，剩下的批量归还全局池
+            size_t keep = limit / 2;
+            Release(cache->stacks.data() + keep, cache->stacks.size() - keep, size);
+            cache->stacks.resize(keep);
+        }
+    }
+private:
+    struct StackCache {
+        size_t size = 0;
+        std::vector<void*> stacks;
+
+        ~StackCache();
+    };
+
+    struct StackPool {
+        std::mutex mutex;
+        size_t size = 0;
+        std::vector<void*> stacks;
+    };
+
+    static size_t PageSize() {
+        static size_t s_page_size = sysconf(_SC_PAGESIZE);
+        return s_page_size;
+    }
+
+    static StackPool& GetPool() {
+        static StackPool s_pool;
+        return s_pool;
+    }
+
+    static StackCache* GetCache();
+
+public:
+    // 栈大小按页对齐，栈顶因此满足上下文切换要求的16字节对齐
+    static size_t RoundUp(size_t size) {
+        size_t page = PageSize();
+        return (size + page - 1) / page * page;
+    }
+
+    // 返回可用栈的起始地址，保护页位于其下方
+    static void* Map(size_t size) {
+        size_t page = PageSize();
+        void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE
+                        , MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if(base == MAP_FAILED) {
+            SYLAR_LOG_ERROR(g_logger) << "mmap fiber stack size=" << size
+                << " errno=" << errno << " errstr=" << strerror(errno);
+            throw std::bad_alloc();
+        }
+        if(mprotect(base, page, PROT_NONE)) {
+            SYLAR_LOG_ERROR(g_logger) << "mprotect fiber stack guard page errno=" << errno
+                << " errstr=" << strerror(errno);
+        }
+        return (char*)base + page;
+    }
+
+    static void Unmap(void* vp, size_t size) {
+        size_t page = PageSize();
+        munmap((char*)vp - page, size + page);
+    }
+
+private:
+    // 从全局池批量取回一半本地容量的栈
+    static void Refill(StackCache& cache) {
+        StackPool& pool = GetPool();
+        size_t want = std::max<size_t>(s_stack_pool_local / 2, 1);
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if(pool.size != cache.size) {
+            return;
+        }
+        size_t n = std::min(want, pool.stacks.size());
+        cache.stacks.insert(cache.stacks.end(), pool.stacks.end() - n, pool.stacks.end());
+        pool.stacks.resize(pool.stacks.size() - n);
+    }
+
+    // 归还一批栈到全局池，全局池放不下的直接munmap
+    static void Release(void** stacks, size_t n, size_t size) {
+        if(!n) {
+            return;
+        }
+        for(size_t i = 0; i < n; ++i) {
+            madvise(stacks[i], size, MADV_DONTNEED);
+        }
+        StackPool& pool = GetPool();
+        size_t moved = 0;
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+            if(pool.stacks.empty()) {
+                pool.size = size;
+            }
+            if(pool.size == size) {
+                size_t limit = s_stack_pool_global;
+                if(pool.stacks.size() < limit) {
+                    moved = std::min(n, limit - pool.stacks.size());
+                    pool.stacks.insert(pool.stacks.end(), stacks, stacks + moved);
+                }
+            }
+        }
+        for(size_t i = moved; i < n; ++i) {
+            Unmap(stacks[i], size);
+        }
+    }
+};
+
+// 线程退出时本地缓存的析构顺序不确定，析构之后再释放的栈直接走全局池
+static thread_local bool t_stack_cache_destroyed = false;
+
+PooledStackAllocator::StackCache::~StackCache() {
+    t_stack_cache_destroyed = true;
+    Release(stacks.data(), stacks.size(), size);
+    stacks.clear();
+}
+
+PooledStackAllocator::StackCache* PooledStackAllocator::GetCache() {
+    if(t_stack_cache_destroyed) {
+        return nullptr;
+    }
+    static thread_local StackCache t_cache;
+    if(!t_cache.size) {
+        t_cache.size = RoundUp(s_stack_size);
+    }
+    return &t_cache;
+}
+
+using StackAllocator = PooledStackAllocator;
+
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size = Config::Lookup<uint32_t>("fiber.shared_stack_size", 1024*1024, "per-thread shared fiber stack size");
+
+// 线程共享栈，第一次有共享栈协程在该线程上运行时才分配
+struct SharedStack {
+    char* stack = nullptr;
+    size_t size = 0;
+    Fiber* occupant = nullptr;  // 当前栈上保存着哪个协程的栈内容
+    int thread = -1;            // 所属线程id
+
+    char* top() const { return stack + size;}
+
+    ~SharedStack() {
+        if(occupant) {
+            occupant->m_sharedOwner = nullptr;
+        }
+        if(stack) {
+            StackAllocator::Unmap(stack, size);
+        }
+    }
+};
+
+static thread_local SharedStack t_sharedStack;
+
+static SharedStack& GetSharedStack() {
+    if(!t_sharedStack.stack) {
+        t_sharedStack.size = StackAllocator::RoundUp(g_fiber_shared_stack_size->getValue());
+        t_sharedStack.stack = (char*)StackAllocator::Map(t_sharedStack.size);
+        t_sharedStack.thread = GetThreadId();
+    }
+    return t_sharedStack;
+}
 
 uint64_t Fiber::GetFiberId() {
     if(t_fiber) {
@@ -39,11 +270,19 @@ uint64_t Fiber::GetFiberId() {
     return 0;
 }
 
+bool Fiber::OnSharedStack(const void* p, size_t len) {
+    if(!t_sharedStack.stack) {
+        return false;
+    }
+    const char* begin = (const char*)p;
+    return begin < t_sharedStack.top() && begin + len > t_sharedStack.stack;
+}
+
 Fiber::Fiber() {
     m_state = EXEC;
     SetThis(this);
 
-    if(getcontext(&m_ctx)) {
+    if(!m_ctx.init()) {
         SYLAR_ASSERT2(false, "getcontext");
     }
     ++s_fiber_count;
@@ -51,29 +290,37 @@ Fiber::Fiber() {
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::main";
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller) 
-    :m_id(++s_fiber_id), m_cb(cb) {
+Fiber::Fiber(Task cb, size_t stacksize, bool use_caller, bool shared_stack) 
+    :m_id(++s_fiber_id), m_cb(std::move(cb)) {
     ++s_fiber_count;
-    m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
+#ifdef SYLAR_FIBER_UCONTEXT
+    shared_stack = false;   // ucontext后端拿不到切出时的栈指针，退化为独立栈
+#endif
+    if(shared_stack) {
+        m_sharedStack = true;
+        initSharedContext(use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc);
+        SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber shared stack id=" << m_id;
+        return;
+    }
+    m_stacksize = stacksize ? stacksize : s_stack_size.load();
 
     m_stack = StackAllocator::Alloc(m_stacksize);   // 分配指定大小的栈空间
-    if(getcontext(&m_ctx)) {                        // getcontext用于获取当前执行上下文并保存到指定的ucontext_t结构中
-        SYLAR_ASSERT2(false, "getcontext");
+    // 在协程栈上构造入口为MainFunc/CallerMainFunc的初始上下文
+    if(!m_ctx.make(m_stack, m_stacksize, use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc)) {
+        SYLAR_ASSERT2(false, "makecontext");
     }
-    m_ctx.uc_link = nullptr;                 // 链接上下文
-    m_ctx.uc_stack.ss_sp = m_stack;          // 栈基址
-    m_ctx.uc_stack.ss_size = m_stacksize;    // 栈大小
-
-    if(!use_caller)
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);       // 用于修改一个已通过getcontext获取的上下文，主要是设置新的入口点和栈信息
-    else
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber id=" << m_id;
 }
 
 Fiber::~Fiber() {
     --s_fiber_count;
-    if(m_stack) {
+    if(m_sharedStack) {
+        SYLAR_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEP);
+        if(m_sharedOwner && m_sharedOwner->occupant == this) {
+            m_sharedOwner->occupant = nullptr;
+        }
+        free(m_saveBuffer);
+    } else if(m_stack) {
         SYLAR_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEP);
         StackAllocator::Dealloc(m_stack, m_stacksize);
     } else {
@@ -88,46 +335,108 @@ Fiber::~Fiber() {
     SYLAR_LOG_DEBUG(g_logger) << "Fiber::~Fiber id=" << m_id << " total=" << s_fiber_count;
 }
 
-void Fiber::reset(std::function<void()> cb) {
-    SYLAR_ASSERT(m_stack);
+void Fiber::reset(Task cb) {
+    SYLAR_ASSERT(m_stack || m_sharedStack);
     SYLAR_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEP);
-    m_cb = cb;
-    if(getcontext(&m_ctx)) {
-        SYLAR_ASSERT2(false, "getcontext");
+    m_cb = std::move(cb);
+    if(m_sharedStack) {
+        // 旧的栈内容已经没用了，解除和线程的绑定，下次运行时可以被调度到任意线程
+        if(m_sharedOwner && m_sharedOwner->occupant == this) {
+            m_sharedOwner->occupant = nullptr;
+        }
+        m_sharedOwner = nullptr;
+        initSharedContext(&Fiber::MainFunc);
+        m_stackThread = -1;
+    } else if(!m_ctx.make(m_stack, m_stacksize, &Fiber::MainFunc)) {
+        SYLAR_ASSERT2(false, "makecontext");
     }
+    m_state = INIT;
+}
 
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
+void Fiber::initSharedContext(Context::Entry fn) {
+#ifndef SYLAR_FIBER_UCONTEXT
+    // 初始栈帧只包含入口地址和清零的寄存器，与所在地址无关，先在临时区构造再保存到堆上
+    alignas(16) char frame[256];
+    if(!m_ctx.make(frame, sizeof(frame), fn)) {
+        SYLAR_ASSERT2(false, "makecontext");
+    }
+    saveSharedStack((char*)m_ctx.getSp(), frame + sizeof(frame));
+#endif
+}
 
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    m_state = INIT;
+void Fiber::saveSharedStack(char* sp, char* top) {
+    size_t size = top - sp;
+    // 保存区按实际使用的栈大小分配，过大时收缩，避免一次深调用后长期占用内存
+    if(size > m_saveCapacity || size < m_saveCapacity / 4) {
+        free(m_saveBuffer);
+        m_saveCapacity = (size + 63) & ~(size_t)63;
+        m_saveBuffer = (char*)malloc(m_saveCapacity);
+        if(!m_saveBuffer) {
+            throw std::bad_alloc();
+        }
+    }
+    memcpy(m_saveBuffer, sp, size);
+    m_saveSize = size;
+}
+
+void Fiber::switchSharedStack() {
+#ifndef SYLAR_FIBER_UCONTEXT
+    SharedStack& ss = GetSharedStack();
+    SYLAR_ASSERT2(m_stackThread == -1 || m_stackThread == ss.thread
+            , "shared stack fiber_id=" + std::to_string(m_id) + " is bound to thread " + std::to_string(m_stackThread));
+    // 拷贝共享栈时不能运行在共享栈上，共享栈协程只能从独立栈的协程切入
+    char probe = 0;
+    SYLAR_ASSERT(&probe < ss.stack || &probe >= ss.top());
+
+    if(ss.occupant != this) {
+        Fiber* prev = ss.occupant;
+        // 只有挂起的协程需要保存，已结束或被reset的协程栈内容已经没用了
+        if(prev && prev->m_state != INIT && prev->m_state != TERM && prev->m_state != EXCEP) {
+            prev->saveSharedStack((char*)prev->m_ctx.getSp(), ss.top());
+        }
+        if(prev) {
+            prev->m_sharedOwner = nullptr;
+        }
+        char* sp = ss.top() - m_saveSize;
+        SYLAR_ASSERT2(m_saveSize <= ss.size, "shared stack overflow fiber_id=" + std::to_string(m_id));
+        memcpy(sp, m_saveBuffer, m_saveSize);
+        m_ctx.setSp(sp);
+        ss.occupant = this;
+        m_sharedOwner = &ss;
+    }
+    m_stackThread = ss.thread;
+#endif
 }
 
 void Fiber::call() {
+    if(m_sharedStack) {
+        switchSharedStack();
+    }
     SetThis(this);
     m_state = EXEC;
-    if(swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
+    if(!t_threadFiber->m_ctx.swap(m_ctx)) {
         SYLAR_ASSERT2(false, "swapcontext");
     }
 }
 
 void Fiber::back() {
     SetThis(t_threadFiber.get());
-    m_state = EXEC;
-    if(swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
+    if(!m_ctx.swap(t_threadFiber->m_ctx)) {
         SYLAR_ASSERT2(false, "swapcontext");
     }
 }
 // 切换到当前协程执行
 void Fiber::swapIn() {
+    if(m_sharedStack) {
+        switchSharedStack();
+    }
     SetThis(this);
     SYLAR_ASSERT(m_state != EXEC);
     m_state = EXEC;
     /*
-        保存当前CPU寄存器到第一个参数，从第二个参数加载之前保存的寄存器值，跳转到目标上下文继续执行
+        保存当前CPU寄存器到调度协程的上下文，加载当前协程之前保存的寄存器值，跳转到当前协程继续执行
     */
-    if(swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {    // 恢复保存的上下文，保存当前上下文到第一个参数，恢复第二参数执行的上下文
+    if(!Scheduler::GetMainFiber()->m_ctx.swap(m_ctx)) {
         SYLAR_ASSERT2(false, "swapcontext");
     }
 }
@@ -136,7 +445,7 @@ void Fiber::swapIn() {
 void Fiber::swapOut() {
     SetThis(Scheduler::GetMainFiber());
 
-    if(swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
+    if(!m_ctx.swap(Scheduler::GetMainFiber()->m_ctx)) {
         SYLAR_ASSERT2(false, "swapcontext");
     }
 }
@@ -173,6 +482,54 @@ void Fiber::YieldToHold() {
     cur->m_state = HOLD;
     cur->swapOut();
 }
+// 线程本地的协程池，线程退出时析构顺序不确定，析构之后不再缓存
+static thread_local bool t_fiber_pool_destroyed = false;
+
+struct FiberPool {
+    std::vector<Fiber::ptr> fibers;
+
+    ~FiberPool() {
+        t_fiber_pool_destroyed = true;
+    }
+};
+
+static FiberPool* GetFiberPool() {
+    if(t_fiber_pool_destroyed) {
+        return nullptr;
+    }
+    static thread_local FiberPool t_pool;
+    return &t_pool;
+}
+
+Fiber::ptr Fiber::Create(Task cb) {
+    FiberPool* pool = GetFiberPool();
+    if(pool && !pool->fibers.empty()) {
+        Fiber::ptr fiber = std::move(pool->fibers.back());
+        pool->fibers.pop_back();
+        fiber->m_id = ++s_fiber_id;
+        fiber->reset(std::move(cb));
+        return fiber;
+    }
+    return Fiber::ptr(new Fiber(std::move(cb)));
+}
+
+void Fiber::Recycle(Fiber::ptr& fiber) {
+    // 还有其他地方持有的协程不能复用，共享栈和非默认栈大小的协程也不进池
+    if(!fiber || fiber.use_count() != 1 || fiber->m_sharedStack || !fiber->m_stack
+            || fiber->m_stacksize != s_stack_size
+            || (fiber->m_state != TERM && fiber->m_state != EXCEP && fiber->m_state != INIT)) {
+        fiber.reset();
+        return;
+    }
+    FiberPool* pool = GetFiberPool();
+    if(!pool || pool->fibers.size() >= s_fiber_pool_size) {
+        fiber.reset();
+        return;
+    }
+    fiber->m_cb = nullptr;  // 尽早释放回调持有的资源
+    pool->fibers.push_back(std::move(fiber));
+}
+
 // 总协程数
 uint64_t Fiber::TotalFibers() {
     return s_fiber_count;
@@ -0,0 +1,494 @@
+#include "hook.h"
+#include "fd_manager.h"
+#include "iomanager.h"
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+#include <dlfcn.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <errno.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+namespace sylar {
+
+static sylar::ConfigVar<int>::ptr g_tcp_connect_timeout =
+    sylar::Config::Lookup("tcp.connect.timeout", 5000, "tcp connect timeout");
+
+static thread_local bool t_hook_enable = false;
+
+#define HOOK_FUN(XX) \
+    XX(sleep) \
+    XX(usleep) \
+    XX(nanosleep) \
+    XX(socket) \
+    XX(connect) \
+    XX(accept) \
+    XX(read) \
+    XX(readv) \
+    XX(recv) \
+    XX(recvfrom) \
+    XX(recvmsg) \
+    XX(write) \
+    XX(writev) \
+    XX(send) \
+    XX(sendto) \
+    XX(sendmsg) \
+    XX(close) \
+    XX(fcntl) \
+    XX(ioctl) \
+    XX(getsockopt) \
+    XX(setsockopt)
+
+void hook_init() {
+    static bool is_inited = false;
+    if(is_inited) {
+        return;
+    }
+#define XX(name) name ## _f = (name ## _fun)dlsym(RTLD_NEXT, #name);
+    HOOK_FUN(XX);
+#undef XX
+    is_inited = true;
+}
+
+// 其他全局对象的构造函数里也可能调用被hook的函数，原函数指针需要最先初始化
+struct _HookIniter {
+    _HookIniter() {
+        hook_init();
+    }
+};
+static _HookIniter s_hook_initer __attribute__((init_priority(101)));
+
+static uint64_t s_connect_timeout = -1;
+
+struct _ConnectTimeoutIniter {
+    _ConnectTimeoutIniter() {
+        s_connect_timeout = g_tcp_connect_timeout->getValue();
+
+        g_tcp_connect_timeout->addListener([](const int& old_value, const int& new_value){
+            SYLAR_LOG_INFO(g_logger) << "tcp connect timeout changed from "
+                                     << old_value << " to " << new_value;
+            s_connect_timeout = new_value;
+        });
+    }
+};
+
+static _ConnectTimeoutIniter s_connect_timeout_initer;
+
+bool is_hook_enable() {
+    return t_hook_enable;
+}
+
+void set_hook_enable(bool flag) {
+    t_hook_enable = flag;
+}
+
+}
+
+// 超时定时器和等待中的协程共享的状态，cancelled非0表示被定时器取消，值为errno
+struct timer_info {
+    int cancelled = 0;
+};
+
+// 没有IOManager时用poll模拟阻塞语义，socket已经被设置为系统层面的非阻塞
+static int wait_without_iomanager(int fd, uint32_t event, uint64_t timeout) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = event == sylar::IOManager::READ ? POLLIN : POLLOUT;
+    pfd.revents = 0;
+    int rt = 0;
+    do {
+        rt = poll(&pfd, 1, timeout == (uint64_t)-1 ? -1 : (int)timeout);
+    } while(rt < 0 && errno == EINTR);
+    if(rt == 0) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    return rt < 0 ? -1 : 0;
+}
+
+// 在IOManager中等待fd上的事件，超时或者被取消返回-1并设置errno
+static int wait_event(sylar::IOManager* iom, int fd, uint32_t event, uint64_t timeout
+                    ,const char* hook_fun_name) {
+    std::shared_ptr<timer_info> tinfo(new timer_info);
+    sylar::Timer::ptr timer;
+    std::weak_ptr<timer_info> winfo(tinfo);
+
+    if(timeout != (uint64_t)-1) {
+        timer = iom->addConditionTimer(timeout, [winfo, fd, iom, event]() {
+            auto t = winfo.lock();
+            if(!t || t->cancelled) {
+                return;
+            }
+            t->cancelled = ETIMEDOUT;
+            iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
+        }, winfo);
+    }
+
+    int rt = iom->addEvent(fd, (sylar::IOManager::Event)(event));
+    if(rt) {
+        SYLAR_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
+            << fd << ", " << event << ")";
+        if(timer) {
+            timer->cancel();
+        }
+        return -1;
+    }
+    sylar::Fiber::YieldToHold();
+    if(timer) {
+        timer->cancel();
+    }
+    if(tinfo->cancelled) {
+        errno = tinfo->cancelled;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    socket读写的统一处理
+    1. 没有开启hook、不是socket或者用户设置了非阻塞时直接调用原函数
+    2. 原函数返回EAGAIN时注册事件让出协程，被唤醒后重试
+*/
+template<typename OriginFun, typename... Args>
+static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name
+        ,uint32_t event, int timeout_so, Args&&... args) {
+    if(!sylar::t_hook_enable) {
+        return fun(fd, std::forward<Args>(args)...);
+    }
+
+    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    if(!ctx) {
+        return fun(fd, std::forward<Args>(args)...);
+    }
+
+    if(ctx->isClose()) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if(!ctx->isSocket() || ctx->getUserNonblock()) {
+        return fun(fd, std::forward<Args>(args)...);
+    }
+
+    uint64_t to = ctx->getTimeout(timeout_so);
+    while(true) {
+        ssize_t n = fun(fd, std::forward<Args>(args)...);
+        while(n == -1 && errno == EINTR) {
+            n = fun(fd, std::forward<Args>(args)...);
+        }
+        if(n != -1 || errno != EAGAIN) {
+            return n;
+        }
+
+        sylar::IOManager* iom = sylar::IOManager::GetThis();
+        int rt = iom ? wait_event(iom, fd, event, to, hook_fun_name)
+                     : wait_without_iomanager(fd, event, to);
+        if(rt) {
+            return -1;
+        }
+    }
+}
+
+// sleep系列：在IOManager中用定时器唤醒当前协程
+static bool sleep_in_fiber(uint64_t ms) {
+    if(!sylar::t_hook_enable) {
+        return false;
+    }
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    if(!iom || sylar::Fiber::GetThis().get() == sylar::Scheduler::GetMainFiber()) {
+        return false;
+    }
+    sylar::Fiber::ptr fiber = sylar::Fiber::GetThis();
+    iom->addTimer(ms, [iom, fiber]() mutable {
+        iom->schedule(std::move(fiber));
+    });
+    sylar::Fiber::YieldToHold();
+    return true;
+}
+
+extern "C" {
+#define XX(name) name ## _fun name ## _f = nullptr;
+    HOOK_FUN(XX);
+#undef XX
+
+unsigned int sleep(unsigned int seconds) {
+    if(!sleep_in_fiber(seconds * 1000ull)) {
+        return sleep_f(seconds);
+    }
+    return 0;
+}
+
+int usleep(useconds_t usec) {
+    if(!sleep_in_fiber(usec / 1000)) {
+        return usleep_f(usec);
+    }
+    return 0;
+}
+
+int nanosleep(const struct timespec* req, struct timespec* rem) {
+    if(!req || !sleep_in_fiber(req->tv_sec * 1000ull + req->tv_nsec / 1000 / 1000)) {
+        return nanosleep_f(req, rem);
+    }
+    return 0;
+}
+
+int socket(int domain, int type, int protocol) {
+    if(!sylar::t_hook_enable) {
+        return socket_f(domain, type, protocol);
+    }
+    int fd = socket_f(domain, type, protocol);
+    if(fd == -1) {
+        return fd;
+    }
+    // fd可能是在没有开启hook的线程中关闭后复用的，丢弃旧的上下文
+    sylar::FdMgr::GetInstance()->del(fd);
+    sylar::FdMgr::GetInstance()->get(fd, true);
+    return fd;
+}
+
+int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms) {
+    if(!sylar::t_hook_enable) {
+        return connect_f(fd, addr, addrlen);
+    }
+    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    if(!ctx || ctx->isClose()) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if(!ctx->isSocket() || ctx->getUserNonblock()) {
+        return connect_f(fd, addr, addrlen);
+    }
+
+    int n = connect_f(fd, addr, addrlen);
+    if(n == 0) {
+        return 0;
+    } else if(n != -1 || errno != EINPROGRESS) {
+        return n;
+    }
+
+    // 连接建立时socket变为可写
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    int rt = iom ? wait_event(iom, fd, sylar::IOManager::WRITE, timeout_ms, "connect")
+                 : wait_without_iomanager(fd, sylar::IOManager::WRITE, timeout_ms);
+    if(rt) {
+        return -1;
+    }
+
+    int error = 0;
+    socklen_t len = sizeof(int);
+    if(-1 == getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len)) {
+        return -1;
+    }
+    if(!error) {
+        return 0;
+    } else {
+        errno = error;
+        return -1;
+    }
+}
+
+int connect(int sockfd, const struct sockaddr* addr, socklen_t addrlen) {
+    return connect_with_timeout(sockfd, addr, addrlen, sylar::s_connect_timeout);
+}
+
+int accept(int s, struct sockaddr* addr, socklen_t* addrlen) {
+    int fd = do_io(s, accept_f, "accept", sylar::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    if(fd >= 0 && sylar::t_hook_enable) {
+        sylar::FdMgr::GetInstance()->del(fd);
+        sylar::FdMgr::GetInstance()->get(fd, true);
+    }
+    return fd;
+}
+
+ssize_t read(int fd, void* buf, size_t count) {
+    return do_io(fd, read_f, "read", sylar::IOManager::READ, SO_RCVTIMEO, buf, count);
+}
+
+ssize_t readv(int fd, const struct iovec* iov, int iovcnt) {
+    return do_io(fd, readv_f, "readv", sylar::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+}
+
+ssize_t recv(int sockfd, void* buf, size_t len, int flags) {
+    return do_io(sockfd, recv_f, "recv", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+}
+
+ssize_t recvfrom(int sockfd, void* buf, size_t len, int flags, struct sockaddr* src_addr, socklen_t* addrlen) {
+    return do_io(sockfd, recvfrom_f, "recvfrom", sylar::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+}
+
+ssize_t recvmsg(int sockfd, struct msghdr* msg, int flags) {
+    return do_io(sockfd, recvmsg_f, "recvmsg", sylar::IOManager::READ, SO_RCVTIMEO, msg, flags);
+}
+
+ssize_t write(int fd, const void* buf, size_t count) {
+    return do_io(fd, write_f, "write", sylar::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+}
+
+ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+    return do_io(fd, writev_f, "writev", sylar::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+}
+
+ssize_t send(int s, const void* msg, size_t len, int flags) {
+    return do_io(s, send_f, "send", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+}
+
+ssize_t sendto(int s, const void* msg, size_t len, int flags, const struct sockaddr* to, socklen_t tolen) {
+    return do_io(s, sendto_f, "sendto", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
+}
+
+ssize_t sendmsg(int s, const struct msghdr* msg, int flags) {
+    return do_io(s, sendmsg_f, "sendmsg", sylar::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+}
+
+int close(int fd) {
+    if(!sylar::t_hook_enable) {
+        return close_f(fd);
+    }
+    sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+    if(ctx) {
+        sylar::IOManager* iom = sylar::IOManager::GetThis();
+        if(iom) {
+            iom->cancelAll(fd);
+        }
+        sylar::FdMgr::GetInstance()->del(fd);
+    }
+    return close_f(fd);
+}
+
+int fcntl(int fd, int cmd, ... /* arg */ ) {
+    va_list va;
+    va_start(va, cmd);
+    switch(cmd) {
+        case F_SETFL:
+            {
+                int arg = va_arg(va, int);
+                va_end(va);
+                sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+                if(!ctx || ctx->isClose() || !ctx->isSocket()) {
+                    return fcntl_f(fd, cmd, arg);
+                }
+                // 记录用户的设置，系统层面保持非阻塞
+                ctx->setUserNonblock(arg & O_NONBLOCK);
+                if(ctx->getSysNonblock()) {
+                    arg |= O_NONBLOCK;
+                } else {
+                    arg &= ~O_NONBLOCK;
+                }
+                return fcntl_f(fd, cmd, arg);
+            }
+            break;
+        case F_GETFL:
+            {
+                va_end(va);
+                int arg = fcntl_f(fd, cmd);
+                sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(fd);
+                if(!ctx || ctx->isClose() || !ctx->isSocket()) {
+                    return arg;
+                }
+                if(ctx->getUserNonblock()) {
+                    return arg | O_NONBLOCK;
+                } else {
+                    return arg & ~O_NONBLOCK;
+                }
+            }
+            break;
+        case F_DUPFD:
+        case F_DUPFD_CLOEXEC:
+        case F_SETFD:
+        case F_SETOWN:
+        case F_SETSIG:
+        case F_SETLEASE:
+        case F_NOTIFY:
+#ifdef F_SETPIPE_SZ
+        case F_SETPIPE_SZ:
+#endif
+            {
+                int arg = va_arg(va, int);
+                va_end(va);
+                return fcntl_f(fd, cmd, arg);
+            }
+            break;
+        case F_GETFD:
+        case F_GETOWN:
+        case F_GETSIG:
+        case F_GETLEASE:
+#ifdef F_GETPIPE_SZ
+        case F_GETPIPE_SZ:
+#endif
+            {
+                va_end(va);
+                return fcntl_f(fd, cmd);
+            }
+            break;
+        case F_SETLK:
+        case F_SETLKW:
+        case F_GETLK:
+            {
+                struct flock* arg = va_arg(va, struct flock*);
+                va_end(va);
+                return fcntl_f(fd, cmd, arg);
+            }
+            break;
+        case F_GETOWN_EX:
+        case F_SETOWN_EX:
+            {
+                struct f_owner_ex* arg = va_arg(va, struct f_owner_ex*);
+                va_end(va);
+                return fcntl_f(fd, cmd, arg);
+            }
+            break;
+        default:
+            {
+                // 其余命令的参数都不超过一个指针大小
+                void* arg = va_arg(va, void*);
+                va_end(va);
+                return fcntl_f(fd, cmd, arg);
+            }
+    }
+}
+
+int ioctl(int d, unsigned long int request, ...) {
+    va_list va;
+    va_start(va, request);
+    void* arg = va_arg(va, void*);
+    va_end(va);
+
+    if(FIONBIO == request) {
+        bool user_nonblock = !!*(int*)arg;
+        sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(d);
+        if(!ctx || ctx->isClose() || !ctx->isSocket()) {
+            return ioctl_f(d, request, arg);
+        }
+        ctx->setUserNonblock(user_nonblock);
+        // 系统层面保持非阻塞
+        int on = 1;
+        return ioctl_f(d, request, &on);
+    }
+    return ioctl_f(d, request, arg);
+}
+
+int getsockopt(int sockfd, int level, int optname, void* optval, socklen_t* optlen) {
+    return getsockopt_f(sockfd, level, optname, optval, optlen);
+}
+
+int setsockopt(int sockfd, int level, int optname, const void* optval, socklen_t optlen) {
+    if(!sylar::t_hook_enable) {
+        return setsockopt_f(sockfd, level, optname, optval, optlen);
+    }
+    if(level == SOL_SOCKET) {
+        if(optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) {
+            sylar::FdCtx::ptr ctx = sylar::FdMgr::GetInstance()->get(sockfd);
+            if(ctx) {
+                const timeval* v = (const timeval*)optval;
+                uint64_t ms = v->tv_sec * 1000 + v->tv_usec / 1000;
+                ctx->setTimeout(optname, ms ? ms : (uint64_t)-1);   // 0表示不超时
+            }
+        }
+    }
+    return setsockopt_f(sockfd, level, optname, optval, optlen);
+}
+
+}
@@ -1,14 +1,55 @@
 #include "iomanager.h"
+#include "uring.h"
+#include "hook.h"
+#include "config.h"
 #include "macro.h"
 #include "log.h"
 #include <sys/epoll.h>
+#include <poll.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <algorithm>
 namespace sylar {
 
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+static ConfigVar<std::string>::ptr g_iomanager_backend =
+    Config::Lookup<std::string>("iomanager.backend", "epoll", "iomanager backend, epoll or io_uring");
+static ConfigVar<uint32_t>::ptr g_uring_entries =
+    Config::Lookup<uint32_t>("iomanager.uring.entries", 1024, "io_uring submission queue size");
+
+/*
+    io_uring请求的user_data，FdContext和UringOp按8字节对齐，低3位用作标记
+    READ/WRITE: addEvent提交的POLL_ADD，高位是FdContext
+    URING_AWAIT: 协程等待的IO请求，高位是UringOp
+*/
+static const uint64_t URING_TICKLE = 0;
+static const uint64_t URING_AWAIT = 2;
+static const uint64_t URING_IGNORE = 3;
+static const uint64_t URING_TAG_MASK = 7;
+
+// 工作线程中积攒的未提交请求达到这个数量时立即提交，不再等到idle
+static const unsigned URING_SUBMIT_BATCH = 64;
+
+// 当前线程正在运行的URING事件循环，在它里面准备的请求留到idle中统一提交
+static thread_local IOManager* t_uring_loop = nullptr;
+// 正在idle中分发事件的IOManager，分发出的任务由本线程接着执行，不需要每次都唤醒
+static thread_local IOManager* t_dispatching = nullptr;
+static thread_local bool t_tickle_deferred = false;
+
+struct IOManager::UringOp {
+    Fiber::ptr fiber;
+    Scheduler* scheduler = nullptr;
+    int res = 0;
+};
+
+// 共享栈协程传入的地址参数在请求执行期间的堆上副本
+struct SockAddrBounce {
+    sockaddr_storage addr;
+    socklen_t len = 0;
+};
 enum EpollCtlOp {
 };
 
@@ -88,33 +129,51 @@ void IOManager::FdContext::triggerEvent(Event event) {
     return;
 }
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
+IOManager::IOManager(size_t threads, bool use_caller, const std::string& name, Backend backend)
     :Scheduler(threads, use_caller, name) {
-        m_epfd = epoll_create(1);
-        SYLAR_ASSERT(m_epfd > 0);
+    if(backend == DEFAULT) {
+        const std::string& v = g_iomanager_backend->getValue();
+        backend = (v == "io_uring" || v == "uring") ? URING : EPOLL;
+    }
+    if(backend == URING && initUring()) {
+        contextResize(32);
+        start();
+        return;
+    }
 
-        int rt = pipe(m_tickleFds);
-        SYLAR_ASSERT(rt);
+    m_epfd = epoll_create(5000);
+    SYLAR_ASSERT(m_epfd > 0);
 
-        epoll_event event;
-        memset(&event, 0, sizeof(epoll_event));
-        event.events = EPOLLIN | EPOLLOUT;
-        event.data.fd = m_tickleFds[0];
+    int rt = pipe(m_tickleFds);
+    SYLAR_ASSERT(!rt);
 
-        rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-        SYLAR_ASSERT(rt);
+    // 读端边缘触发，idle中一次读空；写端非阻塞，管道写满说明已经有未处理的唤醒
+    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
+    SYLAR_ASSERT(!rt);
+    rt = fcntl(m_tickleFds[1], F_SETFL, O_NONBLOCK);
+    SYLAR_ASSERT(!rt);
 
-        rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-        SYLAR_ASSERT(rt);
+    epoll_event event;
+    memset(&event, 0, sizeof(epoll_event));
+    event.events = EPOLLIN | EPOLLET;
+    event.data.ptr = nullptr;           // FdContext指针不会为空，用nullptr标识tickle管道
 
-        contextResize(32);
-        start();
+    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
+    SYLAR_ASSERT(!rt);
+
+    contextResize(32);
+    start();
 }
+
 IOManager::~IOManager() {
     stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
+    if(m_backend == EPOLL) {
+        close(m_epfd);
+        close(m_tickleFds[0]);
+        close(m_tickleFds[1]);
+    }
+    // 关闭ring会取消内核中剩余的请求，之后才能释放FdContext
+    m_ring.reset();
 
     for(size_t i = 0; i < m_fdContexts.size(); i++) {
         if(m_fdContexts[i]) {
@@ -123,6 +182,18 @@ IOManager::~IOManager() {
     }
 }
 
+bool IOManager::initUring() {
+    m_ring.reset(new IoUring);
+    if(!m_ring->init(g_uring_entries->getValue())) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring init failed errno=" << errno
+            << " errstr=" << strerror(errno) << ", fallback to epoll";
+        m_ring.reset();
+        return false;
+    }
+    m_backend = URING;
+    return true;
+}
+
 void IOManager::contextResize(size_t size) {
     m_fdContexts.resize(size);
 
@@ -133,45 +204,65 @@ void IOManager::contextResize(size_t size) {
         }
     }
 }
+
+IOManager::FdContext* IOManager::getFdContext(int fd, bool auto_create) {
+    if(fd < 0) {
+        return nullptr;
+    }
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        if((int)m_fdContexts.size() > fd) {
+            return m_fdContexts[fd];
+        }
+        if(!auto_create) {
+            return nullptr;
+        }
+    }
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    if((int)m_fdContexts.size() <= fd) {
+        contextResize(fd * 1.5 + 1);
+    }
+    return m_fdContexts[fd];
+}
+
 // 1 success, 0 retry, -1 error
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-    FdContext* fd_ctx = nullptr;
-    std::lock_guard<std::shared_mutex> lock(m_mutex);
-    if((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        m_mutex.unlock();
-    } else {
-        m_mutex.unlock_shared();
-        std::unique_lock<std::shared_mutex> lock2(m_mutex);
-        contextResize(m_fdContexts.size() * 1.5);
-        fd_ctx = m_fdContexts[fd];
+    FdContext* fd_ctx = getFdContext(fd, true);
+    if(!fd_ctx) {
+        return -1;
     }
-    std::lock_guard<std::mutex> lock3(fd_ctx->mutex);
+    std::lock_guard<std::mutex> lock(fd_ctx->mutex);
     if(fd_ctx->events & event) {
         SYLAR_LOG_ERROR(g_logger) << "addEvent assert fd = " << fd
-                    << " event=" << event
-                    << " fd_ctx.event=" << fd_ctx->events;
+                    << " event=" << (EPOLL_EVENTS)event
+                    << " fd_ctx.event=" << (EPOLL_EVENTS)fd_ctx->events;
         SYLAR_ASSERT(!(fd_ctx->events & event));
     }
 
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
+    if(m_backend == URING) {
+        submitPoll(fd_ctx, event);
+    } else {
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events = EPOLLET | (int)fd_ctx->events | (int)event;
+        epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << op << "," << fd << "," << epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return -1; 
+        ++m_syscallCount;
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                << (EpollCtlOp)op << "," << fd << "," << (EPOLL_EVENTS)epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return -1;
+        }
     }
 
-    m_pendingEventCount++;
+    ++m_pendingEventCount;
     fd_ctx->events = (Event) (fd_ctx->events | event);
     FdContext::EventContext& event_ctx = fd_ctx->getContext(event);
     SYLAR_ASSERT(!event_ctx.scheduler && !event_ctx.fiber && !event_ctx.cb);
-    event_ctx.scheduler = Scheduler::GetThis();
+    // 在调度器外注册的回调由本IOManager执行
+    event_ctx.scheduler = Scheduler::GetThis() ? Scheduler::GetThis() : this;
     if(cb) {
         event_ctx.cb.swap(cb);
     } else {
@@ -182,29 +273,32 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
 }
 
 bool IOManager::delEvent(int fd, Event event) {
-    std::lock_guard<std::shared_mutex> lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    m_mutex.unlock_shared();
-    std::lock_guard<std::mutex> lock2(fd_ctx->mutex);
+    std::lock_guard<std::mutex> lock(fd_ctx->mutex);
     if(!(fd_ctx->events & event)) {
         return false;
     }
 
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
+    if(m_backend == URING) {
+        submitPollRemove(fd_ctx, event);
+    } else {
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | (int)new_events;
+        epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << op << "," << fd << "," << epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false; 
+        ++m_syscallCount;
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                << (EpollCtlOp)op << "," << fd << "," << (EPOLL_EVENTS)epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
     --m_pendingEventCount;
     fd_ctx->events = new_events;
@@ -214,29 +308,32 @@ bool IOManager::delEvent(int fd, Event event) {
 }
 
 bool IOManager::cancelEvent(int fd, Event event) {
-    std::lock_guard<std::shared_mutex> lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    m_mutex.unlock_shared();
-    std::lock_guard<std::mutex> lock2(fd_ctx->mutex);
+    std::lock_guard<std::mutex> lock(fd_ctx->mutex);
     if(!(fd_ctx->events & event)) {
         return false;
     }
 
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
+    if(m_backend == URING) {
+        submitPollRemove(fd_ctx, event);
+    } else {
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | (int)new_events;
+        epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << op << "," << fd << "," << epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false; 
+        ++m_syscallCount;
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                << (EpollCtlOp)op << "," << fd << "," << (EPOLL_EVENTS)epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
     fd_ctx->triggerEvent(event);
     --m_pendingEventCount;
@@ -244,28 +341,36 @@ bool IOManager::cancelEvent(int fd, Event event) {
 }
 
 bool IOManager::cancelAll(int fd) {
-    std::lock_guard<std::shared_mutex> lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    m_mutex.unlock_shared();
-    std::lock_guard<std::mutex> lock2(fd_ctx->mutex);
+    std::lock_guard<std::mutex> lock(fd_ctx->mutex);
     if(!fd_ctx->events) {
         return false;
     }
 
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = 0;
-    epevent.data.ptr = fd_ctx;
+    if(m_backend == URING) {
+        if(fd_ctx->events & READ) {
+            submitPollRemove(fd_ctx, READ);
+        }
+        if(fd_ctx->events & WRITE) {
+            submitPollRemove(fd_ctx, WRITE);
+        }
+    } else {
+        int op = EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = 0;
+        epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << op << "," << fd << "," << epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false; 
+        ++m_syscallCount;
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if(rt) {
+            SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                << (EpollCtlOp)op << "," << fd << "," << (EPOLL_EVENTS)epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
     if(fd_ctx->events & READ) {
         fd_ctx->triggerEvent(READ);
@@ -276,19 +381,521 @@ bool IOManager::cancelAll(int fd) {
         --m_pendingEventCount;
     }
     SYLAR_ASSERT(fd_ctx->events == 0);
-    return false;
+    return true;
+}
+
+void IOManager::onTimerInsertedAtFront() {
+    tickle();
 }
 
 IOManager* IOManager::GetThis() {
     return dynamic_cast<IOManager*>(Scheduler::GetThis());
 }
+
+// 只有存在阻塞在epoll_wait/io_uring_enter中的线程时才需要唤醒
 void IOManager::tickle() {
+    if(t_dispatching == this) {
+        t_tickle_deferred = true;
+        return;
+    }
+    if(!hasIdleThread()) {
+        return;
+    }
+    if(m_backend == URING) {
+        // 一个NOP请求的完成事件足以唤醒等待中的线程
+        std::lock_guard<std::mutex> lock(m_sqMutex);
+        io_uring_sqe* sqe = getSqe();
+        prepSqe(sqe, IORING_OP_NOP, -1, URING_TICKLE);
+        m_ring->advance();
+        ++m_syscallCount;
+        m_ring->enter();
+        return;
+    }
+    ++m_syscallCount;
+    int rt = ::write(m_tickleFds[1], "T", 1);
+    if(rt != 1 && errno != EAGAIN) {
+        SYLAR_LOG_ERROR(g_logger) << "tickle write errno=" << errno
+            << " errstr=" << strerror(errno);
+    }
+}
 
+void IOManager::endDispatch() {
+    t_dispatching = nullptr;
+    // 当前线程自己也计在空闲线程中，只有还有别的空闲线程时才需要唤醒
+    if(t_tickle_deferred) {
+        t_tickle_deferred = false;
+        if(getIdleThreadCount() > 1) {
+            tickle();
+        }
+    }
 }
-void IOManager::stopping() {
 
+bool IOManager::stopping() {
+    uint64_t timeout = 0;
+    return stopping(timeout);
 }
+
+bool IOManager::stopping(uint64_t& timeout) {
+    timeout = getNextTimer();
+    return timeout == ~0ull
+        && m_pendingEventCount == 0
+        && Scheduler::stopping();
+}
+
 void IOManager::idle() {
-    
+    if(m_backend == URING) {
+        idleUring();
+    } else {
+        idleEpoll();
+    }
+}
+
+void IOManager::idleEpoll() {
+    // 每次epoll_wait最多取回的事件数，剩下的留到下一轮
+    static const int MAX_EVENTS = 256;
+    // epoll_wait的最长等待时间(毫秒)，有定时器时等到最近的定时器到期
+    static const uint64_t MAX_TIMEOUT = 3000;
+    epoll_event events[MAX_EVENTS];
+    std::vector<std::function<void()> > cbs;
+
+    while(true) {
+        uint64_t next_timeout = 0;
+        if(stopping(next_timeout)) {
+            SYLAR_LOG_INFO(g_logger) << "name=" << getName() << " idle stopping exit";
+            tickle();   // 管道只唤醒一个线程，退出前接力唤醒其他还在epoll_wait中的线程
+            break;
+        }
+
+        int rt = 0;
+        do {
+            next_timeout = std::min(next_timeout, MAX_TIMEOUT);
+            ++m_syscallCount;
+            rt = epoll_wait(m_epfd, events, MAX_EVENTS, (int)next_timeout);
+        } while(rt < 0 && errno == EINTR);
+
+        t_dispatching = this;
+        listExpiredCallbacks(cbs);
+        if(!cbs.empty()) {
+            schedule(cbs.begin(), cbs.end());
+            cbs.clear();
+        }
+
+        for(int i = 0; i < rt; ++i) {
+            epoll_event& event = events[i];
+            if(!event.data.ptr) {
+                // 边缘触发，必须把管道读空
+                uint8_t dummy[256];
+                do {
+                    ++m_syscallCount;
+                } while(::read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
+                continue;
+            }
+
+            FdContext* fd_ctx = (FdContext*)event.data.ptr;
+            std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+            // 出错或对端关闭时唤醒该fd上所有等待的事件，由读写操作自己拿到错误
+            if(event.events & (EPOLLERR | EPOLLHUP)) {
+                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+            }
+            int real_events = NONE;
+            if(event.events & EPOLLIN) {
+                real_events |= READ;
+            }
+            if(event.events & EPOLLOUT) {
+                real_events |= WRITE;
+            }
+
+            if((fd_ctx->events & real_events) == NONE) {
+                continue;
+            }
+
+            // 剩下的事件继续监听，触发的事件是一次性的
+            int left_events = (fd_ctx->events & ~real_events);
+            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+            event.events = EPOLLET | left_events;
+
+            ++m_syscallCount;
+            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
+            if(rt2) {
+                SYLAR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                    << (EpollCtlOp)op << "," << fd_ctx->fd << "," << (EPOLL_EVENTS)event.events << "):"
+                    << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
+                continue;
+            }
+
+            if(real_events & READ) {
+                fd_ctx->triggerEvent(READ);
+                --m_pendingEventCount;
+            }
+            if(real_events & WRITE) {
+                fd_ctx->triggerEvent(WRITE);
+                --m_pendingEventCount;
+            }
+        }
+        endDispatch();
+
+        // 回到调度循环执行刚触发的任务
+        Fiber::YieldToHold();
+    }
+}
+
+
+void IOManager::idleUring() {
+    // 每轮最多处理的完成事件数，剩下的继续取
+    static const unsigned MAX_CQES = 256;
+    static const uint64_t MAX_TIMEOUT = 3000;
+    io_uring_cqe cqes[MAX_CQES];
+    std::vector<std::function<void()> > cbs;
+
+    t_uring_loop = this;
+    while(true) {
+        uint64_t next_timeout = 0;
+        if(stopping(next_timeout)) {
+            SYLAR_LOG_INFO(g_logger) << "name=" << getName() << " idle stopping exit";
+            tickle();
+            break;
+        }
+
+        // 提交本轮积攒的请求并等待完成事件，只需要一次系统调用
+        next_timeout = std::min(next_timeout, MAX_TIMEOUT);
+        ++m_syscallCount;
+        int rt = m_ring->enter(1, next_timeout);
+        if(rt < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            SYLAR_LOG_ERROR(g_logger) << "io_uring_enter errno=" << errno
+                << " errstr=" << strerror(errno);
+        }
+
+        t_dispatching = this;
+        listExpiredCallbacks(cbs);
+        if(!cbs.empty()) {
+            schedule(cbs.begin(), cbs.end());
+            cbs.clear();
+        }
+
+        while(true) {
+            unsigned n = 0;
+            {
+                std::lock_guard<std::mutex> lock(m_cqMutex);
+                n = m_ring->peek(cqes, MAX_CQES);
+            }
+            for(unsigned i = 0; i < n; ++i) {
+                uint64_t data = cqes[i].user_data;
+                uint64_t tag = data & URING_TAG_MASK;
+                if(data == URING_TICKLE || data == URING_IGNORE) {
+                    continue;
+                }
+                if(tag == URING_AWAIT) {
+                    // 唤醒之后协程栈上的UringOp随时失效，先取出需要的字段
+                    UringOp* op = (UringOp*)(data & ~URING_TAG_MASK);
+                    op->res = cqes[i].res;
+                    Scheduler* scheduler = op->scheduler;
+                    scheduler->schedule(&op->fiber);
+                    --m_pendingEventCount;
+                } else {
+                    onPollComplete((FdContext*)(data & ~URING_TAG_MASK), (Event)tag, cqes[i].res);
+                }
+            }
+            if(n < MAX_CQES) {
+                break;
+            }
+        }
+        endDispatch();
+
+        Fiber::YieldToHold();
+    }
+    t_uring_loop = nullptr;
+}
+
+io_uring_sqe* IOManager::getSqe() {
+    io_uring_sqe* sqe = m_ring->getSqe();
+    while(!sqe) {
+        // 提交队列满，先把已有的请求交给内核
+        ++m_syscallCount;
+        m_ring->enter();
+        sqe = m_ring->getSqe();
+    }
+    return sqe;
+}
+
+void IOManager::prepSqe(io_uring_sqe* sqe, int op, int fd, uint64_t user_data) {
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+    if(fd >= 0 && fd < (int)m_fixedFiles.size() && m_fixedFiles[fd] >= 0) {
+        sqe->fd = m_fixedFiles[fd];
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
 }
+
+void IOManager::commitSqe() {
+    m_ring->advance();
+    // 事件循环之外准备的请求没有人会在idle中提交，积攒太多也会拉高延迟
+    if(t_uring_loop != this || m_ring->pending() >= URING_SUBMIT_BATCH) {
+        ++m_syscallCount;
+        m_ring->enter();
+    }
+}
+
+void IOManager::submitPoll(FdContext* fd_ctx, Event event) {
+    std::lock_guard<std::mutex> lock(m_sqMutex);
+    io_uring_sqe* sqe = getSqe();
+    prepSqe(sqe, IORING_OP_POLL_ADD, fd_ctx->fd, (uint64_t)fd_ctx | event);
+    sqe->poll32_events = event == READ ? POLLIN : POLLOUT;
+    commitSqe();
+}
+
+void IOManager::submitPollRemove(FdContext* fd_ctx, Event event) {
+    std::lock_guard<std::mutex> lock(m_sqMutex);
+    io_uring_sqe* sqe = getSqe();
+    prepSqe(sqe, IORING_OP_POLL_REMOVE, -1, URING_IGNORE);
+    sqe->addr = (uint64_t)fd_ctx | event;
+    commitSqe();
+}
+
+void IOManager::onPollComplete(FdContext* fd_ctx, Event event, int res) {
+    // 被delEvent/cancelEvent取消的请求，上下文已经在取消时处理过
+    if(res == -ECANCELED) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+    if(!(fd_ctx->events & event)) {
+        return;
+    }
+    // 出错时同样唤醒，由读写操作自己拿到错误
+    fd_ctx->triggerEvent(event);
+    --m_pendingEventCount;
+}
+
+template<class Prep>
+int IOManager::awaitUring(int op, int fd, Event event, Prep prep) {
+    while(true) {
+        // 共享栈协程切出后栈上的内存会被其他协程复用，完成时写回的UringOp只能放在堆上
+        UringOp stack_op;
+        std::unique_ptr<UringOp> heap_op;
+        UringOp* uop = &stack_op;
+        Fiber::ptr cur = Fiber::GetThis();
+        if(cur->isSharedStack()) {
+            heap_op.reset(new UringOp);
+            uop = heap_op.get();
+        }
+        uop->fiber = std::move(cur);
+        uop->scheduler = Scheduler::GetThis() ? Scheduler::GetThis() : this;
+        {
+            std::lock_guard<std::mutex> lock(m_sqMutex);
+            io_uring_sqe* sqe = getSqe();
+            prepSqe(sqe, op, fd, (uint64_t)uop | URING_AWAIT);
+            prep(sqe);
+            ++m_pendingEventCount;
+            commitSqe();
+        }
+        Fiber::YieldToHold();
+
+        int res = uop->res;
+        if(res >= 0) {
+            return res;
+        }
+        if(res != -EAGAIN) {
+            errno = -res;
+            return -1;
+        }
+        if(addEvent(fd, event)) {
+            return -1;
+        }
+        Fiber::YieldToHold();
+    }
+}
+
+template<class Fun>
+ssize_t IOManager::awaitReady(int fd, Event event, Fun fun) {
+    while(true) {
+        ssize_t n = 0;
+        do {
+            ++m_syscallCount;
+            n = fun();
+        } while(n < 0 && errno == EINTR);
+        if(n >= 0 || errno != EAGAIN) {
+            return n;
+        }
+        if(addEvent(fd, event)) {
+            return -1;
+        }
+        Fiber::YieldToHold();
+    }
+}
+
+ssize_t IOManager::read(int fd, void* buf, size_t len, int64_t offset) {
+    if(m_backend == URING) {
+        // 共享栈上的缓冲区在挂起期间属于其他协程，内核改为写入堆上的中转区
+        if(Fiber::OnSharedStack(buf, len)) {
+            std::unique_ptr<char[]> bounce(new char[len]);
+            ssize_t n = read(fd, bounce.get(), len, offset);
+            if(n > 0) {
+                memcpy(buf, bounce.get(), n);
+            }
+            return n;
+        }
+        return awaitUring(IORING_OP_READ, fd, READ, [&](io_uring_sqe* sqe) {
+            sqe->addr = (uint64_t)buf;
+            sqe->len = len;
+            sqe->off = offset;
+        });
+    }
+    return awaitReady(fd, READ, [&]() {
+        return offset < 0 ? read_f(fd, buf, len) : pread(fd, buf, len, offset);
+    });
+}
+
+ssize_t IOManager::write(int fd, const void* buf, size_t len, int64_t offset) {
+    if(m_backend == URING) {
+        if(Fiber::OnSharedStack(buf, len)) {
+            std::unique_ptr<char[]> bounce(new char[len]);
+            memcpy(bounce.get(), buf, len);
+            return write(fd, bounce.get(), len, offset);
+        }
+        return awaitUring(IORING_OP_WRITE, fd, WRITE, [&](io_uring_sqe* sqe) {
+            sqe->addr = (uint64_t)buf;
+            sqe->len = len;
+            sqe->off = offset;
+        });
+    }
+    return awaitReady(fd, WRITE, [&]() {
+        return offset < 0 ? write_f(fd, buf, len) : pwrite(fd, buf, len, offset);
+    });
+}
+
+ssize_t IOManager::readFixed(int fd, void* buf, size_t len, int buf_index, int64_t offset) {
+    if(m_backend == URING && !Fiber::OnSharedStack(buf, len)) {
+        return awaitUring(IORING_OP_READ_FIXED, fd, READ, [&](io_uring_sqe* sqe) {
+            sqe->addr = (uint64_t)buf;
+            sqe->len = len;
+            sqe->off = offset;
+            sqe->buf_index = buf_index;
+        });
+    }
+    return read(fd, buf, len, offset);
+}
+
+ssize_t IOManager::writeFixed(int fd, const void* buf, size_t len, int buf_index, int64_t offset) {
+    if(m_backend == URING && !Fiber::OnSharedStack(buf, len)) {
+        return awaitUring(IORING_OP_WRITE_FIXED, fd, WRITE, [&](io_uring_sqe* sqe) {
+            sqe->addr = (uint64_t)buf;
+            sqe->len = len;
+            sqe->off = offset;
+            sqe->buf_index = buf_index;
+        });
+    }
+    return write(fd, buf, len, offset);
+}
+
+// EPOLL后端返回的fd是非阻塞的，URING后端保持阻塞，由内核负责等待
+int IOManager::accept(int fd, struct sockaddr* addr, socklen_t* addrlen) {
+    if(m_backend == URING) {
+        if(addrlen && (Fiber::OnSharedStack(addrlen, sizeof(*addrlen))
+                || Fiber::OnSharedStack(addr, *addrlen))) {
+            std::unique_ptr<SockAddrBounce> bounce(new SockAddrBounce);
+            bounce->len = std::min<socklen_t>(*addrlen, sizeof(bounce->addr));
+            int rt = accept(fd, (sockaddr*)&bounce->addr, &bounce->len);
+            if(rt >= 0) {
+                if(addr) {
+                    memcpy(addr, &bounce->addr, std::min(*addrlen, bounce->len));
+                }
+                *addrlen = bounce->len;
+            }
+            return rt;
+        }
+        return awaitUring(IORING_OP_ACCEPT, fd, READ, [&](io_uring_sqe* sqe) {
+            sqe->addr = (uint64_t)addr;
+            sqe->addr2 = (uint64_t)addrlen;
+        });
+    }
+    return awaitReady(fd, READ, [&]() {
+        return accept4(fd, addr, addrlen, SOCK_NONBLOCK);
+    });
+}
+
+int IOManager::connect(int fd, const struct sockaddr* addr, socklen_t addrlen) {
+    int rt = 0;
+    if(m_backend == URING && Fiber::OnSharedStack(addr, addrlen)) {
+        std::unique_ptr<SockAddrBounce> bounce(new SockAddrBounce);
+        memcpy(&bounce->addr, addr, std::min<socklen_t>(addrlen, sizeof(bounce->addr)));
+        return connect(fd, (sockaddr*)&bounce->addr, addrlen);
+    } else if(m_backend == URING) {
+        rt = awaitUring(IORING_OP_CONNECT, fd, WRITE, [&](io_uring_sqe* sqe) {
+            sqe->addr = (uint64_t)addr;
+            sqe->off = addrlen;
+        });
+    } else {
+        ++m_syscallCount;
+        rt = connect_f(fd, addr, addrlen);
+    }
+    return finishConnect(fd, rt);
+}
+
+int IOManager::finishConnect(int fd, int rt) {
+    if(rt == 0 || (errno != EINPROGRESS && errno != EALREADY)) {
+        return rt;
+    }
+    // 非阻塞socket，连接建立时变为可写
+    if(addEvent(fd, WRITE)) {
+        return -1;
+    }
+    Fiber::YieldToHold();
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    ++m_syscallCount;
+    if(getsockopt_f(fd, SOL_SOCKET, SO_ERROR, &error, &len)) {
+        return -1;
+    }
+    if(error) {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+bool IOManager::registerBuffers(const struct iovec* iovs, size_t nr) {
+    if(m_backend != URING) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(m_sqMutex);
+    ++m_syscallCount;
+    int rt = m_ring->registerBuffers(iovs, nr);
+    if(rt) {
+        SYLAR_LOG_ERROR(g_logger) << "io_uring register buffers nr=" << nr
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool IOManager::registerFiles(const std::vector<int>& fds) {
+    if(m_backend != URING) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(m_sqMutex);
+    m_fixedFiles.clear();
+    ++m_syscallCount;
+    if(fds.empty()) {
+        m_ring->unregisterFiles();
+        return true;
+    }
+    int rt = m_ring->registerFiles(fds.data(), fds.size());
+    if(rt) {
+        SYLAR_LOG_ERROR(g_logger) << "io_uring register files nr=" << fds.size()
+            << " errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    for(size_t i = 0; i < fds.size(); ++i) {
+        if(fds[i] < 0) {
+            continue;
+        }
+        if((int)m_fixedFiles.size() <= fds[i]) {
+            m_fixedFiles.resize(fds[i] + 1, -1);
+        }
+        m_fixedFiles[fds[i]] = i;
+    }
+    return true;
+}
+
 }
@@ -3,9 +3,23 @@
 #include<functional>
 #include<time.h>
 #include<string.h>
-#include<regex>
+#include<thread>
+#include<algorithm>
+#include<charconv>
+#include<cmath>
+#include<sys/uio.h>
+#include<unistd.h>
+#include<limits.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<dirent.h>
+#include<sys/stat.h>
+#include<sys/mman.h>
+#include<stddef.h>
+#include<zlib.h>
 
 #include"config.h"
+#include"clock.h"
 #include "log.h"
 
 namespace sylar {
@@ -27,14 +41,133 @@ const char* LogLevel::ToString(LogLevel::Level level) {
     }
     return "UNKNOWN";
 }
-LogEventWrap::LogEventWrap(LogEvent::ptr e)
-    :m_event(e) {
+LogBuffer::LogBuffer()
+    :m_data(m_inline)
+    ,m_capacity(INLINE_SIZE) {
+    setp(m_data, m_data + m_capacity);
+}
+
+LogBuffer::~LogBuffer() {
+    if(m_data != m_inline) {
+        delete[] m_data;
+    }
+}
+
+void LogBuffer::clear() {
+    // 偶尔一条特别长的日志不应该让每个线程一直占着大块内存
+    if(m_capacity > KEEP_SIZE) {
+        delete[] m_data;
+        m_data = m_inline;
+        m_capacity = INLINE_SIZE;
+    }
+    setp(m_data, m_data + m_capacity);
+}
+
+char* LogBuffer::reserve(size_t n) {
+    if(available() < n) {
+        grow(n);
+    }
+    return pptr();
+}
+
+void LogBuffer::commit(size_t n) {
+    pbump((int)n);
+}
+
+void LogBuffer::grow(size_t n) {
+    size_t size = this->size();
+    size_t capacity = std::max(m_capacity * 2, size + n);
+    char* data = new char[capacity];
+    memcpy(data, m_data, size);
+    if(m_data != m_inline) {
+        delete[] m_data;
+    }
+    m_data = data;
+    m_capacity = capacity;
+    setp(m_data, m_data + m_capacity);
+    pbump((int)size);
+}
+
+LogBuffer::int_type LogBuffer::overflow(int_type ch) {
+    if(traits_type::eq_int_type(ch, traits_type::eof())) {
+        return traits_type::not_eof(ch);
+    }
+    grow(1);
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+    return ch;
+}
+
+std::streamsize LogBuffer::xsputn(const char* s, std::streamsize n) {
+    memcpy(reserve(n), s, n);
+    pbump((int)n);
+    return n;
+}
+
+LogStream::LogStream()
+    :std::ostream(nullptr) {
+    rdbuf(&m_buf);
+}
+
+void LogStream::reset() {
+    m_buf.clear();
+    clear();
+    flags(std::ios_base::skipws | std::ios_base::dec);
+    width(0);
+    precision(6);
+    fill(' ');
+}
+
+namespace {
+
+// 每个线程缓存的LogEvent，嵌套打日志(比如operator<<里又打日志)时使用下一个空闲的
+struct LogEventCache {
+    static const int SIZE = 4;
+    LogEvent events[SIZE];
+    bool busy[SIZE] = {false};
+};
+
+}
+
+static thread_local LogEventCache t_event_cache;
 
+LogEventWrap::LogEventWrap(std::shared_ptr<Logger> logger, LogLevel::Level level, const char* file, uint32_t line)
+    :m_event(nullptr) {
+    LogEventCache& cache = t_event_cache;
+    for(int i = 0; i < LogEventCache::SIZE; ++i) {
+        if(!cache.busy[i]) {
+            cache.busy[i] = true;
+            m_busy = &cache.busy[i];
+            m_event = &cache.events[i];
+            break;
+        }
+    }
+    if(!m_event) {
+        m_holder.reset(new LogEvent);
+        m_event = m_holder.get();
+    }
+    uint64_t now;
+    uint64_t monotonic;
+    Clock::Now(&now, &monotonic);
+    m_event->reset(std::move(logger), level, file, line
+                , (monotonic - Clock::StartMonotonicNS()) / 1000000, sylar::GetThreadId()
+                , sylar::GetFiberId(), now / 1000000000ull, sylar::Thread::GetName());
+    m_event->m_nsec = now % 1000000000ull;
+}
+
+LogEventWrap::LogEventWrap(LogEvent::ptr e)
+    :m_event(e.get())
+    ,m_holder(e) {
 }
 
 // 在析构时触发日志的最终提交
 LogEventWrap::~LogEventWrap() {
-    m_event->getLogger()->log(m_event->getLevel(), m_event);
+    m_event->m_logger->log(m_event->m_level, *m_event);
+    if(m_busy) {
+        // 不让缓存中的LogEvent一直持有Logger
+        m_event->m_logger.reset();
+        *m_busy = false;
+    }
 }
 
 void LogEvent::format(const char* fmt, ...) {
@@ -45,154 +178,263 @@ void LogEvent::format(const char* fmt, ...) {
 }
 
 void LogEvent::format(const char* fmt, va_list al) {
-    char* buf = nullptr;
-    int len = vasprintf(&buf, fmt, al);
-    if(len != -1) {
-        m_ss << std::string(buf, len); // 将 buf 指向的内存中前 len 个字符拷贝到新构造的 std::string 对象中。
-        free(buf);
+    // 直接格式化到内容缓冲区的剩余空间，放不下时扩容后再格式化一次
+    LogBuffer& buf = m_ss.getBuffer();
+    va_list copy;
+    va_copy(copy, al);
+    char* ptr = buf.reserve(1);
+    size_t avail = buf.available();
+    int len = vsnprintf(ptr, avail, fmt, copy);
+    va_end(copy);
+    if(len < 0) {
+        return;
+    }
+    if((size_t)len >= avail) {
+        ptr = buf.reserve(len + 1);
+        vsnprintf(ptr, len + 1, fmt, al);
     }
+    buf.commit(len);
 }
 
-std::stringstream& LogEventWrap::getSS() {
+std::ostream& LogEventWrap::getSS() {
     return m_event->getSS();
 }
 
 void LogAppender::setFormatter(LogFormatter::ptr val) {
     sylar::CASLock::Lock lock(m_mutex);
-    m_formatter = val;
-    if(m_formatter) {
-        m_hasFormatter = true;
-    } else {
-        m_hasFormatter = false;
-    }
+    m_hasFormatter = val != nullptr;
+    m_formatter.store(std::move(val), std::memory_order_release);
 }
 
-LogFormatter::ptr LogAppender::getFormatter() {
-    sylar::CASLock::Lock lock(m_mutex);
-    return m_formatter;
-}
+// 级别名和长度，格式化时不需要strlen
+static const struct {
+    const char* str;
+    size_t len;
+} s_level_names[] = {
+    {"UNKNOWN", 7},
+    {"DEBUG", 5},
+    {"INFO", 4},
+    {"WARN", 4},
+    {"ERROR", 5},
+    {"FATAL", 5}
+};
 
-class MessageFormatItem : public LogFormatter::FormatItem {
-public:
-    MessageFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getContent();
+static const char s_digits[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// 整数转十进制，每次处理两位，返回写入的长度
+static size_t u32toa(uint32_t v, char* out) {
+    char tmp[10];
+    char* p = tmp + sizeof(tmp);
+    while(v >= 100) {
+        uint32_t idx = (v % 100) * 2;
+        v /= 100;
+        *--p = s_digits[idx + 1];
+        *--p = s_digits[idx];
     }
-};
-    
-class LevelFormatItem : public LogFormatter::FormatItem {
-public:
-    LevelFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << LogLevel::ToString(level);
+    if(v >= 10) {
+        *--p = s_digits[v * 2 + 1];
+        *--p = s_digits[v * 2];
+    } else {
+        *--p = '0' + v;
     }
-};
+    size_t len = tmp + sizeof(tmp) - p;
+    memcpy(out, p, len);
+    return len;
+}
 
-class ElapseFormatItem : public LogFormatter::FormatItem {
-public:
-    ElapseFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getElapse();
+static size_t u64toa(uint64_t v, char* out) {
+    if(v <= UINT32_MAX) {
+        return u32toa(v, out);
     }
-};
-
-class NameFormatItem : public LogFormatter::FormatItem {
-public:
-    NameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getLogger()->getName();
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+    while(v >= 100) {
+        uint32_t idx = (v % 100) * 2;
+        v /= 100;
+        *--p = s_digits[idx + 1];
+        *--p = s_digits[idx];
     }
-};
-
-class ThreadIdFormatItem : public LogFormatter::FormatItem {
-public:
-    ThreadIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getThreadId();
+    if(v >= 10) {
+        *--p = s_digits[v * 2 + 1];
+        *--p = s_digits[v * 2];
+    } else {
+        *--p = '0' + v;
     }
-};
+    size_t len = tmp + sizeof(tmp) - p;
+    memcpy(out, p, len);
+    return len;
+}
 
-class FiberIdFormatItem : public LogFormatter::FormatItem {
-public:
-    FiberIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFiberId();
+static size_t i64toa(int64_t v, char* out) {
+    if(v < 0) {
+        *out = '-';
+        return 1 + u64toa(0 - (uint64_t)v, out + 1);
     }
-};
+    return u64toa(v, out);
+}
+
+/*
+    转义时每次看8个字节(SWAR)，整块都不需要转义时直接拷贝
+    has_less: 有小于n的字节(n <= 128)；has_byte: 有等于c的字节；大于等于0x80的字节(UTF-8)原样输出
+*/
+static const uint64_t SWAR_ONES = 0x0101010101010101ull;
+static const uint64_t SWAR_HIGHS = 0x8080808080808080ull;
+
+static inline uint64_t swar_has_less(uint64_t x, uint8_t n) {
+    return (x - SWAR_ONES * n) & ~x & SWAR_HIGHS;
+}
+
+static inline uint64_t swar_has_byte(uint64_t x, uint8_t c) {
+    return swar_has_less(x ^ (SWAR_ONES * c), 1);
+}
 
-class ThreadNameFormatItem : public LogFormatter::FormatItem {
-public:
-    ThreadNameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getThreadName();
+static inline char* json_escape_char(char* p, unsigned char c) {
+    static const char s_hex[] = "0123456789abcdef";
+    switch(c) {
+        case '"': *p++ = '\\'; *p++ = '"'; break;
+        case '\\': *p++ = '\\'; *p++ = '\\'; break;
+        case '\n': *p++ = '\\'; *p++ = 'n'; break;
+        case '\r': *p++ = '\\'; *p++ = 'r'; break;
+        case '\t': *p++ = '\\'; *p++ = 't'; break;
+        default:
+            if(c < 0x20) {
+                memcpy(p, "\\u00", 4);
+                p[4] = s_hex[c >> 4];
+                p[5] = s_hex[c & 15];
+                p += 6;
+            } else {
+                *p++ = c;
+            }
     }
-};
+    return p;
+}
 
-class DateTimeFormatItem : public LogFormatter::FormatItem {
-public:
-    DateTimeFormatItem(const std::string& format = "%Y-%m-%d %H:%M:%S")
-        :m_format(format) {
-        if(m_format.empty()) {
-            m_format = "%Y-%m-%d %H:%M:%S";
+// 按JSON字符串的规则转义(不含引号)，最多输出len * 6字节
+static char* json_escape(char* p, const char* str, size_t len) {
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        uint64_t x;
+        memcpy(&x, str + i, 8);
+        if(!(swar_has_less(x, 0x20) | swar_has_byte(x, '"') | swar_has_byte(x, '\\'))) {
+            memcpy(p, str + i, 8);
+            p += 8;
+            continue;
         }
+        for(size_t j = i; j < i + 8; ++j) {
+            p = json_escape_char(p, str[j]);
         }
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        struct tm tm;
-        time_t time = event->getTime();
-        localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-        os << buf;
     }
-private:
-    std::string m_format;
-};
-
-class FilenameFormatItem : public LogFormatter::FormatItem {
-public:
-    FilenameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFile();
+    for(; i < len; ++i) {
+        p = json_escape_char(p, str[i]);
     }
-};
+    return p;
+}
 
-class LineFormatItem : public LogFormatter::FormatItem {
-public:
-    LineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getLine();
+// logfmt的值：不含空白、引号、等号、反斜杠时原样输出，否则加引号并按JSON规则转义
+static char* logfmt_string(char* p, const char* str, size_t len) {
+    bool quote = len == 0;
+    size_t i = 0;
+    for(; !quote && i + 8 <= len; i += 8) {
+        uint64_t x;
+        memcpy(&x, str + i, 8);
+        quote = swar_has_less(x, 0x21) | swar_has_byte(x, '"') | swar_has_byte(x, '=') | swar_has_byte(x, '\\');
     }
-};
-
-class NewLineFormatItem : public LogFormatter::FormatItem {
-public:
-    NewLineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << std::endl;
+    for(; !quote && i < len; ++i) {
+        unsigned char c = str[i];
+        quote = c <= ' ' || c == '"' || c == '=' || c == '\\';
     }
-};
+    if(!quote) {
+        memcpy(p, str, len);
+        return p + len;
+    }
+    *p++ = '"';
+    p = json_escape(p, str, len);
+    *p++ = '"';
+    return p;
+}
 
-class TabFormatItem : public LogFormatter::FormatItem {
-public:
-    TabFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << "\t";
+// 字段的值，json为true时字符串加引号、非有限的浮点数输出null
+static char* write_field_value(char* p, const LogField& field, bool json) {
+    switch(field.type) {
+        case LogField::INT:
+            return p + i64toa(field.i, p);
+        case LogField::UINT:
+            return p + u64toa(field.u, p);
+        case LogField::DOUBLE:
+            if(json && !std::isfinite(field.d)) {
+                memcpy(p, "null", 4);
+                return p + 4;
+            }
+            return std::to_chars(p, p + 32, field.d).ptr;
+        case LogField::BOOL:
+            if(field.b) {
+                memcpy(p, "true", 4);
+                return p + 4;
+            }
+            memcpy(p, "false", 5);
+            return p + 5;
+        case LogField::STRING:
+            if(json) {
+                *p++ = '"';
+                p = json_escape(p, field.str.data(), field.str.size());
+                *p++ = '"';
+                return p;
+            }
+            return logfmt_string(p, field.str.data(), field.str.size());
     }
-private:
-    std::string m_string;
-};
+    return p;
+}
 
-class StringFormatItem : public LogFormatter::FormatItem {
-public:
-    StringFormatItem(const std::string& str)
-        : m_string(str) {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << m_string;
+// 字段最多占用的字节数
+static size_t fields_bound(const LogEvent& event) {
+    size_t n = 0;
+    for(size_t i = 0; i < event.getFieldCount(); ++i) {
+        const LogField& field = event.getFields()[i];
+        n += (field.key.size() + field.str.size()) * 6 + 48;
     }
-private:
-    std::string m_string;
+    return n;
+}
+
+static const size_t MAX_DATE_SIZE = 64;
+static const char s_second_mark[] = "\x01\x02";
+// 秒以下部分的占位符，重复位数次，strftime原样输出
+static const char s_subsecond_mark = '\x03';
+static const int MAX_SUBSECONDS = 4;
+
+namespace {
+
+// 每个线程缓存最近渲染的时间，按格式器和时间格式区分
+struct DateCache {
+    uint64_t key = 0;
+    time_t second = -1;
+    time_t minute = -1;
+    int secondPos = -1;     // 秒在buf中的位置，-1表示换秒时要完整渲染
+    int subCount = 0;       // 秒以下部分的个数、位置和位数
+    uint8_t subPos[MAX_SUBSECONDS];
+    uint8_t subWidth[MAX_SUBSECONDS];
+    size_t len = 0;
+    char buf[MAX_DATE_SIZE];
 };
 
+}
+
+static thread_local DateCache t_date_cache[8];
+static std::atomic<uint64_t> s_formatter_id = {0};
+
+
+LogEvent::LogEvent() {
+}
+
 LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
         , const char* file, uint32_t line, uint32_t elapse
         , uint32_t thread_id, uint32_t fiber_id, uint64_t time
@@ -208,26 +450,56 @@ LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
     , m_threadName(thread_name) { 
 }
 
+void LogEvent::reset(std::shared_ptr<Logger> logger, LogLevel::Level level
+        , const char* file, uint32_t line, uint32_t elapse
+        , uint32_t thread_id, uint32_t fiber_id, uint64_t time
+        , const std::string& thread_name) {
+    m_file = file;
+    m_line = line;
+    m_elapse = elapse;
+    m_threadId = thread_id;
+    m_fiberId = fiber_id;
+    m_time = time;
+    m_nsec = 0;
+    m_logger = std::move(logger);
+    m_level = level;
+    m_threadName = thread_name;
+    m_ss.reset();
+    m_fields = nullptr;
+    m_fieldCount = 0;
+}
+
 Logger::Logger(const std::string& name)
     :m_name(name)
-    , m_level(LogLevel::DEBUG) {
-        m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%T%f:%l%T%m%n")); // 默认格式
+    , m_level(LogLevel::DEBUG)
+    , m_appenders(std::make_shared<const Appenders>()) {
+        m_formatter.store(std::make_shared<LogFormatter>("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%T%f:%l%T%m%n")); // 默认格式
+}
+
+Logger::~Logger() {
+    // 地址可能被新的Logger复用
+    LogSite::Invalidate();
+}
+
+void Logger::setLevel(LogLevel::Level val) {
+    m_level = val;
+    LogSite::Invalidate();
 }
 
 void Logger::setFormatter(LogFormatter::ptr val) {
     sylar::CASLock::Lock lock(m_mutex);
-    m_formatter = val;
+    m_formatter.store(val, std::memory_order_release);
 
-    for(auto& i : m_appenders) {
-        sylar::CASLock::Lock ll(m_mutex);
+    // 没有单独设置过格式的Appender跟随Logger的格式
+    for(auto& i : *m_appenders.load(std::memory_order_acquire)) {
+        sylar::CASLock::Lock ll(i->m_mutex);
         if(!i->m_hasFormatter) {
-            i->m_formatter = m_formatter;
+            i->m_formatter.store(val, std::memory_order_release);
         }
     }
 }
 
 void Logger::setFormatter(const std::string& val) {
-    std::cout << "---" << val << std::endl;
     sylar::LogFormatter::ptr new_val(new sylar::LogFormatter(val));
     if(new_val->isError()) {
         std::cout << "Logger setFormatter name=" << m_name
@@ -238,37 +510,36 @@ void Logger::setFormatter(const std::string& val) {
     setFormatter(new_val);
 }
 
-LogFormatter::ptr Logger::getFormatter() {
-    sylar::CASLock::Lock ll(m_mutex);
-    return m_formatter;
-}
-
 void Logger::addAppender(LogAppender::ptr appender) {
     sylar::CASLock::Lock lock(m_mutex);
-    if(!appender->getFormatter()) {
-        appender->setFormatter(m_formatter);
+    {
+        sylar::CASLock::Lock ll(appender->m_mutex);
+        if(!appender->m_formatter.load(std::memory_order_relaxed)) {
+            appender->m_formatter.store(m_formatter.load(std::memory_order_relaxed), std::memory_order_release);
+        }
     }
-    m_appenders.push_back(appender);
+    auto appenders = std::make_shared<Appenders>(*m_appenders.load(std::memory_order_acquire));
+    appenders->push_back(std::move(appender));
+    m_appenders.store(std::move(appenders), std::memory_order_release);
 }
 
 void Logger::delAppender(LogAppender::ptr appender) {
     sylar::CASLock::Lock lock(m_mutex);
-    for(auto it = m_appenders.begin(); it != m_appenders.end(); it++)
-    {
-        sylar::CASLock::Lock lock(appender->m_mutex);
-        if(*it == appender) {
-            m_appenders.erase(it);
-            break;
-        }
+    auto appenders = std::make_shared<Appenders>(*m_appenders.load(std::memory_order_acquire));
+    auto it = std::find(appenders->begin(), appenders->end(), appender);
+    if(it != appenders->end()) {
+        appenders->erase(it);
+        m_appenders.store(std::move(appenders), std::memory_order_release);
     }
 }
 
-void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
+void Logger::log(LogLevel::Level level, const LogEvent& event) {
     if(level >= m_level) {
-        auto self = shared_from_this();
-        sylar::CASLock::Lock lock(m_mutex);
-        if(!m_appenders.empty()) {
-            for(auto& i : m_appenders) {
+        // 持有快照期间即使Appender被删除也能安全输出完这一条
+        std::shared_ptr<const Appenders> appenders = m_appenders.load(std::memory_order_acquire);
+        if(!appenders->empty()) {
+            auto self = shared_from_this();
+            for(auto& i : *appenders) {
                 i->log(self, level, event);
             }
         } else if(m_root) {
@@ -277,19 +548,158 @@ void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
     }
 }
 
-void Logger::debug(LogEvent::ptr event) {
+static std::atomic<LogSite*> s_log_sites = {nullptr};
+static std::atomic<uint32_t> s_log_generation = {0};
+static std::mutex s_log_sites_mutex;                // 常量初始化，静态初始化阶段的日志也可以用
+
+void LogSite::Invalidate() {
+    ++s_log_generation;
+    for(LogSite* i = s_log_sites.load(); i; i = i->m_next) {
+        uintptr_t key = i->m_key.load();
+        if(key != DYNAMIC) {
+            i->m_key.compare_exchange_strong(key, UNKNOWN);
+        }
+    }
+}
+
+bool LogSite::check(Logger* logger, LogLevel::Level level) {
+    uint32_t gen = s_log_generation.load();
+    bool enabled = logger->getLevel() <= level;
+    if(!m_registered) {
+        // 第一次执行，挂到全局链表上之后才能缓存，否则可能错过Invalidate
+        std::lock_guard<std::mutex> lock(s_log_sites_mutex);
+        if(!m_registered) {
+            m_next = s_log_sites.load();
+            s_log_sites = this;
+            m_registered = true;
+        }
+    }
+
+    uintptr_t key = m_key.load();
+    uintptr_t base = MakeKey(logger, level);
+    if(key == DYNAMIC) {
+        return enabled;
+    }
+    if(key != UNKNOWN && (key & ~(uintptr_t)1) != base) {
+        m_key = DYNAMIC;
+        return enabled;
+    }
+    uintptr_t val = base | enabled;
+    if(m_key.compare_exchange_strong(key, val) && s_log_generation.load() != gen) {
+        m_key.compare_exchange_strong(val, UNKNOWN);
+    }
+    return enabled;
+}
+
+void LogLimiter::summary(uint64_t now, const std::shared_ptr<Logger>& logger
+                , LogLevel::Level level, const char* file, uint32_t line) {
+    uint64_t next = m_nextSummary.load();
+    if(now < next || !m_nextSummary.compare_exchange_strong(next, now + SUMMARY_INTERVAL_MS)) {
+        return;
+    }
+    // 第一次被抑制时只开始计时，一个间隔之后再汇总
+    if(next == 0) {
+        return;
+    }
+    uint64_t n = m_suppressed.exchange(0);
+    if(n) {
+        LogEventWrap(logger, level, file, line).getSS() << "suppressed " << n << " similar messages";
+    }
+}
+
+// 有过抑制的调用点，后台线程定期汇总，调用点所在的日志停止之后最后一段时间被抑制的条数也能输出
+namespace {
+struct LimiterEntry {
+    LogLimiter* limiter;
+    Logger::ptr logger;
+    LogLevel::Level level;
+    const char* file;
+    uint32_t line;
+};
+
+struct LimiterFlusher {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<LimiterEntry> entries;
+    std::unique_ptr<Thread> thread;
+    bool stop = false;
+
+    static LimiterFlusher& Get() {
+        static LimiterFlusher s_flusher;
+        return s_flusher;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while(!stop) {
+            cond.wait_for(lock, std::chrono::milliseconds(LogLimiter::SUMMARY_INTERVAL_MS));
+            if(stop) {
+                break;
+            }
+            lock.unlock();
+            LogLimiter::FlushSuppressed();
+            lock.lock();
+        }
+    }
+
+    ~LimiterFlusher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cond.notify_one();
+        if(thread) {
+            thread->join();
+        }
+    }
+};
+}
+
+void LogLimiter::enroll(const std::shared_ptr<Logger>& logger, LogLevel::Level level
+                , const char* file, uint32_t line) {
+    LimiterFlusher& flusher = LimiterFlusher::Get();
+    std::lock_guard<std::mutex> lock(flusher.mutex);
+    if(m_enrolled.load(std::memory_order_relaxed) || flusher.stop) {
+        return;
+    }
+    flusher.entries.push_back({this, logger, level, file, line});
+    m_enrolled.store(true, std::memory_order_relaxed);
+    if(!flusher.thread) {
+        flusher.thread.reset(new Thread(std::bind(&LimiterFlusher::run, &flusher), "log_limiter"));
+    }
+}
+
+void LogLimiter::FlushSuppressed() {
+    LimiterFlusher& flusher = LimiterFlusher::Get();
+    std::vector<LimiterEntry> entries;
+    {
+        // 汇总时会输出日志，不能持有锁，否则Appender里的限流日志第一次登记时死锁
+        std::lock_guard<std::mutex> lock(flusher.mutex);
+        entries = flusher.entries;
+    }
+    uint64_t now = GetMonotonicCoarseMS();
+    for(auto& i : entries) {
+        LogLimiter* limiter = i.limiter;
+        if(limiter->m_suppressed.load(std::memory_order_relaxed)
+                && now >= limiter->m_nextSummary.load(std::memory_order_relaxed)) {
+            limiter->summary(now, i.logger, i.level, i.file, i.line);
+        }
+    }
+}
+
+void Logger::debug(const LogEvent& event) {
     log(LogLevel::DEBUG, event);
 }
-void Logger::info(LogEvent::ptr event) {
+void Logger::info(const LogEvent& event) {
     log(LogLevel::INFO, event);
 }
-void Logger::warn(LogEvent::ptr event) {
+void Logger::warn(const LogEvent& event) {
     log(LogLevel::WARN, event);
 }
-void Logger::error(LogEvent::ptr event) {
+void Logger::error(const LogEvent& event) {
     log(LogLevel::ERROR, event);
 }
-void Logger::fatal(LogEvent::ptr event) {
+void Logger::fatal(const LogEvent& event) {
     log(LogLevel::FATAL, event);
 }
 
@@ -297,15 +707,18 @@ FileLogAppender::FileLogAppender(const std::string& filename)
     :m_filename(filename) {
     reopen();
 }
-void FileLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
+void FileLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event) {
     if(level >= m_level) {
-        uint64_t now = time(0);
-        if(now != m_lastTime) {
-            reopen();
-            m_lastTime = now;
-        }
+        LogStream& out = getFormatter()->formatThreadLocal(logger, level, event);
         sylar::CASLock::Lock lock(m_mutex);
-        m_filestream << m_formatter->format(logger, level, event);
+        m_filestream.write(out.data(), out.size());
+    }
+}
+
+void FileLogAppender::write(const struct iovec* iov, int iovcnt) {
+    sylar::CASLock::Lock lock(m_mutex);
+    for(int i = 0; i < iovcnt; ++i) {
+        m_filestream.write((const char*)iov[i].iov_base, iov[i].iov_len);
     }
 }
 
@@ -314,7 +727,7 @@ bool FileLogAppender::reopen() {
     if(m_filestream) {
         m_filestream.close();
     }
-    m_filestream.open(m_filename);  // 追加模式（文件不存在则创建）
+    m_filestream.open(m_filename, std::ios::app);  // 追加模式（文件不存在则创建）
     if (!m_filestream) {
         SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Failed to open file: " << m_filename 
                              << ", error: " << strerror(errno);
@@ -323,97 +736,1215 @@ bool FileLogAppender::reopen() {
     return true;
 }
 
-void StdoutLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
+void StdoutLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event) {
     if(level >= m_level) {
+        LogStream& out = getFormatter()->formatThreadLocal(logger, level, event);
         sylar::CASLock::Lock lock(m_mutex);
-        m_formatter->format(std::cout, logger, level, event);
+        std::cout.write(out.data(), out.size());
+        std::cout.flush();
     }
 }
 
-LogFormatter::LogFormatter(const std::string& pattern) 
-    :m_pattern(pattern) {
-        init();
+void StdoutLogAppender::write(const struct iovec* iov, int iovcnt) {
+    sylar::CASLock::Lock lock(m_mutex);
+    // log()经过std::cout的缓冲，先刷出保证顺序
+    std::cout.flush();
+    WritevAll(STDOUT_FILENO, iov, iovcnt);
+}
+
+struct AsyncLogAppender::Buffer {
+    Buffer(size_t cap)
+        :data(new char[cap])
+        ,capacity(cap) {
+    }
+
+    void reset() {
+        size = 0;
+        records = 0;
+    }
+
+    std::unique_ptr<char[]> data;
+    size_t capacity;
+    std::atomic<size_t> size = {0};         // 已经预留的字节数
+    std::atomic<uint32_t> records = {0};
+    std::atomic<int> writers = {0};         // 正在往里拷贝的线程数
+};
+
+AsyncLogAppender::AsyncLogAppender(LogAppender::ptr appender, Policy policy
+                    ,size_t buffer_size, size_t buffer_count
+                    ,uint64_t flush_interval_ms)
+    :m_appender(appender)
+    ,m_policy(policy)
+    ,m_interval(flush_interval_ms) {
+    buffer_count = std::max<size_t>(buffer_count, 2);
+    for(size_t i = 0; i < buffer_count; ++i) {
+        m_buffers.emplace_back(new Buffer(buffer_size));
+        m_free.push_back(m_buffers.back().get());
+    }
+    m_current = m_free.back();
+    m_free.pop_back();
+    m_thread.reset(new Thread(std::bind(&AsyncLogAppender::run, this), "async_log"));
+}
+
+AsyncLogAppender::~AsyncLogAppender() {
+    stop();
+}
+
+void AsyncLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event) {
+    if(level < m_level || level < m_appender->getLevel()) {
+        return;
+    }
+    // 被包装的Appender单独设置过格式时沿用它的格式
+    LogFormatter::ptr formatter = m_appender->getFormatter();
+    if(!formatter) {
+        formatter = getFormatter();
+    }
+    LogStream& out = formatter->formatThreadLocal(logger, level, event);
+    append(out.data(), out.size(), level);
 }
 
-std::string LogFormatter::format(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-    std::stringstream ss;
-    for(auto& i : m_items) {
-        i->format(ss, logger, level, event);
+void AsyncLogAppender::write(const struct iovec* iov, int iovcnt) {
+    for(int i = 0; i < iovcnt; ++i) {
+        append((const char*)iov[i].iov_base, iov[i].iov_len, LogLevel::INFO);
     }
-    return ss.str();
 }
 
-std::ostream& LogFormatter::format(std::ostream& ofs, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) {
-    for(auto& i : m_items) {
-        i->format(ofs, logger, level, event);
+AsyncLogAppender::Buffer* AsyncLogAppender::acquire() {
+    Buffer* buf = m_current.load(std::memory_order_acquire);
+    while(buf) {
+        // 先登记再确认仍是当前缓冲区，和后台线程先换下再检查writers配对
+        buf->writers.fetch_add(1, std::memory_order_seq_cst);
+        Buffer* cur = m_current.load(std::memory_order_seq_cst);
+        if(cur == buf) {
+            return buf;
+        }
+        buf->writers.fetch_sub(1, std::memory_order_release);
+        buf = cur;
+    }
+    return nullptr;
+}
+
+void AsyncLogAppender::rotate() {
+    Buffer* cur = m_current.load(std::memory_order_relaxed);
+    if(cur) {
+        m_full.push_back(cur);
+    }
+    if(m_free.empty()) {
+        m_current.store(nullptr, std::memory_order_seq_cst);
+    } else {
+        m_current.store(m_free.back(), std::memory_order_seq_cst);
+        m_free.pop_back();
+    }
+}
+
+bool AsyncLogAppender::append(const char* data, size_t len, LogLevel::Level level) {
+    while(true) {
+        Buffer* buf = acquire();
+        if(buf) {
+            // 超过单个缓冲区的日志截断
+            len = std::min(len, buf->capacity);
+            size_t off = buf->size.load(std::memory_order_relaxed);
+            while(off + len <= buf->capacity
+                    && !buf->size.compare_exchange_weak(off, off + len, std::memory_order_relaxed));
+            if(off + len <= buf->capacity) {
+                memcpy(buf->data.get() + off, data, len);
+                ++buf->records;
+                buf->writers.fetch_sub(1, std::memory_order_release);
+                ++m_appendRecords;
+                m_appendBytes += len;
+                return true;
+            }
+            buf->writers.fetch_sub(1, std::memory_order_release);
+        }
+
+        // 慢路径：当前缓冲区满了，换一个新的并通知后台线程
+        std::unique_lock<std::mutex> lock(m_bufMutex);
+        Buffer* cur = m_current.load(std::memory_order_relaxed);
+        if(cur && cur == buf) {
+            rotate();
+            m_cond.notify_one();
+            continue;
+        }
+        if(cur && cur != buf) {
+            continue;
+        }
+        if(m_stopping || m_policy == DROP
+                || (m_policy == DROP_DEBUG && level <= LogLevel::DEBUG)) {
+            ++m_dropped;
+            return false;
+        }
+        m_cond.notify_one();
+        m_freeCond.wait(lock, [this, buf](){
+            return m_stopping || m_current.load(std::memory_order_relaxed) != buf;
+        });
+    }
+}
+
+void AsyncLogAppender::flush() {
+    std::unique_lock<std::mutex> lock(m_bufMutex);
+    if(m_stopping) {
+        return;
+    }
+    // 正在进行的一轮可能没有包含刚提交的日志，需要再等一轮
+    uint64_t target = m_round + (m_busy ? 2 : 1);
+    m_flushRequest = true;
+    m_cond.notify_one();
+    m_freeCond.wait(lock, [this, target](){
+        return m_stopping || m_round >= target;
+    });
+}
+
+void AsyncLogAppender::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_bufMutex);
+        if(m_stopping) {
+            return;
+        }
+        m_stopping = true;
+    }
+    m_cond.notify_one();
+    m_freeCond.notify_all();
+    m_thread->join();
+}
+
+void AsyncLogAppender::run() {
+    std::vector<Buffer*> bufs;
+    std::vector<struct iovec> iovs;
+    while(true) {
+        bool stopping = false;
+        {
+            std::unique_lock<std::mutex> lock(m_bufMutex);
+            if(m_full.empty() && !m_stopping && !m_flushRequest) {
+                m_cond.wait_for(lock, std::chrono::milliseconds(m_interval));
+            }
+            Buffer* cur = m_current.load(std::memory_order_relaxed);
+            if(m_stopping) {
+                // 最后一轮换下当前缓冲区后不再提供新的，之后的日志走慢路径计入丢弃
+                if(cur) {
+                    m_full.push_back(cur);
+                    m_current.store(nullptr, std::memory_order_seq_cst);
+                }
+            } else if(cur && cur->size.load(std::memory_order_relaxed) > 0) {
+                // 时间触发时当前缓冲区没有写满也换下来
+                rotate();
+            }
+            bufs.swap(m_full);
+            m_flushRequest = false;
+            m_busy = true;
+            stopping = m_stopping;
+        }
+
+        iovs.clear();
+        uint64_t records = 0;
+        uint64_t bytes = 0;
+        for(auto buf : bufs) {
+            while(buf->writers.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            size_t size = buf->size.load(std::memory_order_acquire);
+            records += buf->records.load(std::memory_order_relaxed);
+            bytes += size;
+            if(size) {
+                iovs.push_back({buf->data.get(), size});
+            }
+        }
+        if(!iovs.empty()) {
+            m_appender->write(iovs.data(), iovs.size());
+            ++m_writeCount;
+        }
+        m_writtenRecords += records;
+        m_writtenBytes += bytes;
+
+        {
+            std::lock_guard<std::mutex> lock(m_bufMutex);
+            for(auto buf : bufs) {
+                buf->reset();
+                m_free.push_back(buf);
+            }
+            if(!stopping && !m_current.load(std::memory_order_relaxed)) {
+                rotate();
+            }
+            m_busy = false;
+            ++m_round;
+        }
+        bufs.clear();
+        m_freeCond.notify_all();
+        if(stopping) {
+            break;
+        }
+    }
+}
+
+// 某一时刻所在周期的起点
+static time_t period_start(RollingFileLogAppender::Period period, time_t now) {
+    struct tm tm;
+    localtime_r(&now, &tm);
+    tm.tm_sec = 0;
+    tm.tm_min = 0;
+    if(period == RollingFileLogAppender::DAILY) {
+        tm.tm_hour = 0;
+    }
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+// 下一次按时间滚动的时刻，按本地时间对齐到整点/零点
+static time_t next_roll_time(RollingFileLogAppender::Period period, time_t now) {
+    if(period == RollingFileLogAppender::NEVER) {
+        return INT64_MAX;
+    }
+    struct tm tm;
+    time_t start = period_start(period, now);
+    localtime_r(&start, &tm);
+    if(period == RollingFileLogAppender::DAILY) {
+        ++tm.tm_mday;
+    } else {
+        ++tm.tm_hour;
     }
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+static std::string file_dir(const std::string& path) {
+    size_t pos = path.rfind('/');
+    if(pos == std::string::npos) {
+        return ".";
+    }
+    return pos == 0 ? "/" : path.substr(0, pos);
+}
+
+RollingFileLogAppender::RollingFileLogAppender(const std::string& filename, Period period
+                            ,uint64_t max_size, size_t max_files, bool compress)
+    :m_filename(filename)
+    ,m_period(period)
+    ,m_maxSize(max_size)
+    ,m_maxFiles(max_files)
+    ,m_compress(compress) {
+    File* file = new File;
+    time_t now = time(0);
+    file->fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    file->openTime = now;
+    if(file->fd < 0) {
+        std::cerr << "RollingFileLogAppender open " << m_filename
+                  << " failed, error: " << strerror(errno) << std::endl;
+    } else {
+        struct stat st;
+        if(!fstat(file->fd, &st)) {
+            m_size = st.st_size;
+            // 上次运行留下的文件属于之前的周期，启动后先滚动掉
+            if(st.st_size > 0 && period != NEVER && st.st_mtime < period_start(period, now)) {
+                file->openTime = st.st_mtime;
+                m_rollRequest = true;
+            }
+        }
+    }
+    m_file = file;
+    m_nextRoll = next_roll_time(period, now);
+    m_lastSync = sylar::GetMonotonicMS();
+    loadSegments();
+    m_thread.reset(new Thread(std::bind(&RollingFileLogAppender::run, this), "roll_log"));
+}
+
+RollingFileLogAppender::~RollingFileLogAppender() {
+    stop();
+    File* file = m_file.load();
+    if(file->fd >= 0) {
+        close(file->fd);
+    }
+    delete file;
+}
+
+void RollingFileLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event) {
+    if(level < m_level) {
+        return;
+    }
+    LogStream& out = getFormatter()->formatThreadLocal(logger, level, event);
+    struct iovec iov = {(void*)out.data(), out.size()};
+    writeData(&iov, 1, event.getTime());
+}
+
+void RollingFileLogAppender::write(const struct iovec* iov, int iovcnt) {
+    writeData(iov, iovcnt, time(0));
+}
+
+void RollingFileLogAppender::setFsync(Fsync policy, uint64_t value) {
+    m_fsyncValue = value;
+    m_fsync = policy;
+    m_cond.notify_one();
+}
+
+RollingFileLogAppender::File* RollingFileLogAppender::acquire() {
+    File* file = m_file.load(std::memory_order_acquire);
+    while(true) {
+        // 和AsyncLogAppender相同：先登记再确认，后台线程换下之后等待writers归零再关闭
+        file->writers.fetch_add(1, std::memory_order_seq_cst);
+        File* cur = m_file.load(std::memory_order_seq_cst);
+        if(cur == file) {
+            return file;
+        }
+        file->writers.fetch_sub(1, std::memory_order_release);
+        file = cur;
+    }
+}
+
+void RollingFileLogAppender::writeData(const struct iovec* iov, int iovcnt, time_t now) {
+    size_t len = 0;
+    for(int i = 0; i < iovcnt; ++i) {
+        len += iov[i].iov_len;
+    }
+    // O_APPEND保证多线程的每次writev整体追加，不需要加锁
+    File* file = acquire();
+    if(file->fd >= 0) {
+        WritevAll(file->fd, iov, iovcnt);
+    }
+    file->writers.fetch_sub(1, std::memory_order_release);
+
+    // 滚动和刷盘都只设置标志交给后台线程
+    uint64_t size = m_size.fetch_add(len, std::memory_order_relaxed) + len;
+    if((m_maxSize && size >= m_maxSize)
+            || now >= m_nextRoll.load(std::memory_order_relaxed)) {
+        notify(m_rollRequest);
+    }
+    if(m_fsync.load(std::memory_order_relaxed) == FSYNC_BYTES) {
+        uint64_t unsynced = m_unsynced.fetch_add(len, std::memory_order_relaxed) + len;
+        if(unsynced >= m_fsyncValue.load(std::memory_order_relaxed)) {
+            notify(m_syncRequest);
+        }
+    }
+}
+
+void RollingFileLogAppender::notify(std::atomic<bool>& flag) {
+    // 已经有请求在等待处理时直接返回，每次滚动只有一个线程进入这里
+    if(flag.load(std::memory_order_relaxed) || flag.exchange(true)) {
+        return;
+    }
+    // 空加锁保证后台线程要么还没检查条件，要么已经在wait里
+    { std::lock_guard<std::mutex> lock(m_bgMutex); }
+    m_cond.notify_one();
+}
+
+void RollingFileLogAppender::roll() {
+    std::unique_lock<std::mutex> lock(m_bgMutex);
+    if(m_stopping) {
+        return;
+    }
+    uint64_t target = m_rollCount + 1;
+    m_rollRequest = true;
+    m_cond.notify_one();
+    m_rollCond.wait(lock, [this, target](){
+        return m_stopping || m_rollCount >= target;
+    });
+}
+
+void RollingFileLogAppender::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_bgMutex);
+        if(m_stopping) {
+            return;
+        }
+        m_stopping = true;
+    }
+    m_cond.notify_one();
+    m_rollCond.notify_all();
+    m_thread->join();
+}
+
+void RollingFileLogAppender::run() {
+    std::deque<std::string> pending;    // 等待压缩的历史文件
+    while(true) {
+        bool stopping = false;
+        {
+            std::unique_lock<std::mutex> lock(m_bgMutex);
+            uint64_t wait_ms = 1000;
+            if(m_fsync == FSYNC_INTERVAL && m_fsyncValue) {
+                wait_ms = std::min<uint64_t>(wait_ms, m_fsyncValue);
+            }
+            if(pending.empty()) {
+                m_cond.wait_for(lock, std::chrono::milliseconds(wait_ms), [this](){
+                    return m_stopping || m_rollRequest || m_syncRequest;
+                });
+            }
+            stopping = m_stopping;
+        }
+
+        time_t now = time(0);
+        // 没有日志写入时也按时间滚动
+        if(m_rollRequest.exchange(false)
+                || (m_period != NEVER && now >= m_nextRoll && m_size > 0)) {
+            if(doRoll(now)) {
+                pending.push_back(m_segments.back());
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_bgMutex);
+                ++m_rollCount;
+            }
+            m_rollCond.notify_all();
+        }
+
+        int fsync = m_fsync;
+        if(m_syncRequest.exchange(false)
+                || (fsync == FSYNC_INTERVAL && sylar::GetMonotonicMS() - m_lastSync >= m_fsyncValue)
+                || (stopping && fsync != FSYNC_NONE)) {
+            doSync();
+        }
+
+        // 压缩和删除可能比较慢，每处理一个文件回头检查一次新的请求
+        if(!pending.empty()) {
+            std::string path = pending.front();
+            pending.pop_front();
+            if(m_compress) {
+                compress(path);
+            }
+            prune();
+        }
+        if(stopping) {
+            for(auto& i : pending) {
+                if(m_compress) {
+                    compress(i);
+                }
+            }
+            prune();
+            break;
+        }
+    }
+}
+
+bool RollingFileLogAppender::doRoll(time_t now) {
+    File* old = m_file.load(std::memory_order_relaxed);
+    m_nextRoll = next_roll_time(m_period, now);
+
+    // 历史文件以打开时间命名，同一秒多次滚动时加序号
+    char tm_buf[32];
+    struct tm tm;
+    localtime_r(&old->openTime, &tm);
+    strftime(tm_buf, sizeof(tm_buf), "%Y%m%d-%H%M%S", &tm);
+    std::string seg = m_filename + "." + tm_buf;
+    std::string name = seg;
+    struct stat st;
+    for(int i = 1; !stat(name.c_str(), &st) || !stat((name + ".gz").c_str(), &st); ++i) {
+        name = seg + "." + std::to_string(i);
+    }
+
+    // rename之后旧fd指向历史文件，日志线程在换fd之前继续写入旧文件不会丢失
+    bool renamed = !::rename(m_filename.c_str(), name.c_str());
+    int fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        std::cerr << "RollingFileLogAppender open " << m_filename
+                  << " failed, error: " << strerror(errno) << std::endl;
+        return false;
+    }
+    File* file = new File;
+    file->fd = fd;
+    file->openTime = now;
+    m_size.store(0, std::memory_order_relaxed);
+    m_file.store(file, std::memory_order_seq_cst);
+    while(old->writers.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    if(old->fd >= 0) {
+        if(m_fsync != FSYNC_NONE) {
+            fdatasync(old->fd);
+        }
+        close(old->fd);
+    }
+    delete old;
+    if(renamed) {
+        m_segments.push_back(name);
+    }
+    return renamed;
+}
+
+void RollingFileLogAppender::doSync() {
+    m_unsynced.store(0, std::memory_order_relaxed);
+    m_lastSync = sylar::GetMonotonicMS();
+    // 只有后台线程会换下并关闭文件，这里直接读取当前fd
+    File* file = m_file.load(std::memory_order_acquire);
+    if(file->fd >= 0) {
+        fdatasync(file->fd);
+        ++m_syncCount;
+    }
+}
+
+void RollingFileLogAppender::compress(const std::string& path) {
+    std::string gz_path = path + ".gz";
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return;
+    }
+    gzFile gz = gzopen(gz_path.c_str(), "wb");
+    if(!gz) {
+        close(fd);
+        return;
+    }
+    char buf[64 * 1024];
+    bool ok = true;
+    ssize_t n;
+    while((n = ::read(fd, buf, sizeof(buf))) > 0) {
+        if(gzwrite(gz, buf, n) != n) {
+            ok = false;
+            break;
+        }
+    }
+    close(fd);
+    ok = gzclose(gz) == Z_OK && ok && n == 0;
+    if(!ok) {
+        unlink(gz_path.c_str());
+        return;
+    }
+    unlink(path.c_str());
+    for(auto& i : m_segments) {
+        if(i == path) {
+            i = gz_path;
+        }
+    }
+}
+
+void RollingFileLogAppender::prune() {
+    if(!m_maxFiles) {
+        return;
+    }
+    while(m_segments.size() > m_maxFiles) {
+        unlink(m_segments.front().c_str());
+        m_segments.pop_front();
+    }
+}
+
+void RollingFileLogAppender::loadSegments() {
+    // 找出上次运行留下的历史文件，名字里的时间保证按名字排序就是按时间排序
+    std::string dir = file_dir(m_filename);
+    size_t pos = m_filename.rfind('/');
+    std::string prefix = (pos == std::string::npos ? m_filename : m_filename.substr(pos + 1)) + ".";
+    DIR* d = opendir(dir.c_str());
+    if(!d) {
+        return;
+    }
+    std::vector<std::string> names;
+    struct dirent* ent;
+    while((ent = readdir(d))) {
+        std::string name = ent->d_name;
+        if(name.size() > prefix.size() && !name.compare(0, prefix.size(), prefix)
+                && isdigit((unsigned char)name[prefix.size()])) {
+            names.push_back(name);
+        }
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    for(auto& i : names) {
+        m_segments.push_back(dir + "/" + i);
+    }
+}
+
+static const char s_mmap_log_magic[8] = {'S', 'Y', 'L', 'M', 'L', 'O', 'G', '1'};
+
+static size_t mmap_log_record_size(size_t len) {
+    return (MmapLogAppender::RECORD_HEADER_SIZE + len + 7) & ~(size_t)7;
+}
+
+MmapLogAppender::MmapLogAppender(const std::string& filename, size_t capacity)
+    :m_filename(filename) {
+    capacity = (capacity + FILE_HEADER_SIZE - 1) / FILE_HEADER_SIZE * FILE_HEADER_SIZE;
+    if(capacity < FILE_HEADER_SIZE) {
+        capacity = FILE_HEADER_SIZE;
+    }
+    m_fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(m_fd < 0) {
+        SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "MmapLogAppender open " << filename
+                    << " failed, error: " << strerror(errno);
+        return;
+    }
+    // 同样容量的旧文件接着写，否则重新初始化
+    struct stat st;
+    bool reuse = false;
+    if(!fstat(m_fd, &st) && (size_t)st.st_size == FILE_HEADER_SIZE + capacity) {
+        FileHeader old;
+        reuse = pread(m_fd, &old, offsetof(FileHeader, tail), 0) == (ssize_t)offsetof(FileHeader, tail)
+                    && !memcmp(old.magic, s_mmap_log_magic, sizeof(old.magic))
+                    && old.headerSize == FILE_HEADER_SIZE && old.capacity == capacity;
+    }
+    if(!reuse && (ftruncate(m_fd, 0) || ftruncate(m_fd, FILE_HEADER_SIZE + capacity))) {
+        SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "MmapLogAppender truncate " << filename
+                    << " failed, error: " << strerror(errno);
+        ::close(m_fd);
+        m_fd = -1;
+        return;
+    }
+    // 预先建立页表，写日志时不缺页
+    void* addr = mmap(nullptr, FILE_HEADER_SIZE + capacity, PROT_READ | PROT_WRITE
+                        , MAP_SHARED | MAP_POPULATE, m_fd, 0);
+    if(addr == MAP_FAILED) {
+        SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "MmapLogAppender mmap " << filename
+                    << " failed, error: " << strerror(errno);
+        ::close(m_fd);
+        m_fd = -1;
+        return;
+    }
+    m_header = (FileHeader*)addr;
+    if(!reuse) {
+        memcpy(m_header->magic, s_mmap_log_magic, sizeof(m_header->magic));
+        m_header->version = 1;
+        m_header->headerSize = FILE_HEADER_SIZE;
+        m_header->capacity = capacity;
+        m_header->tail.store(0);
+    }
+    m_capacity = capacity;
+    m_data = (char*)addr + FILE_HEADER_SIZE;
+}
+
+MmapLogAppender::~MmapLogAppender() {
+    if(m_header) {
+        munmap(m_header, FILE_HEADER_SIZE + m_capacity);
+    }
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+void MmapLogAppender::log(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event) {
+    if(level < m_level || !m_data) {
+        return;
+    }
+    LogStream& out = getFormatter()->formatThreadLocal(logger, level, event);
+    struct iovec iov = {(void*)out.data(), out.size()};
+    append(&iov, 1, out.size());
+}
+
+void MmapLogAppender::write(const struct iovec* iov, int iovcnt) {
+    if(!m_data) {
+        return;
+    }
+    size_t len = 0;
+    for(int i = 0; i < iovcnt; ++i) {
+        len += iov[i].iov_len;
+    }
+    append(iov, iovcnt, len);
+}
+
+void MmapLogAppender::sync() {
+    if(m_header) {
+        msync(m_header, FILE_HEADER_SIZE + m_capacity, MS_SYNC);
+    }
+}
+
+void MmapLogAppender::copyIn(uint64_t pos, const void* data, size_t len) {
+    size_t off = pos % m_capacity;
+    size_t n = std::min(len, m_capacity - off);
+    memcpy(m_data + off, data, n);
+    if(n < len) {
+        memcpy(m_data, (const char*)data + n, len - n);
+    }
+}
+
+void MmapLogAppender::append(const struct iovec* iov, int iovcnt, size_t len) {
+    size_t size = mmap_log_record_size(len);
+    if(size > m_capacity) {
+        return;
+    }
+    uint64_t pos = m_header->tail.fetch_add(size, std::memory_order_relaxed);
+    uint64_t p = pos + RECORD_HEADER_SIZE;
+    for(int i = 0; i < iovcnt; ++i) {
+        copyIn(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    uint32_t head[2] = {RECORD_MAGIC, (uint32_t)len};
+    copyIn(pos, head, sizeof(head));
+    // 位置字段最后写入，8字节对齐，不会跨过环形区的结尾
+    __atomic_store_n((uint64_t*)(m_data + (pos + 8) % m_capacity), pos, __ATOMIC_RELEASE);
+}
+
+MmapLogReader::MmapLogReader(const std::string& filename) {
+    std::ifstream ifs(filename, std::ios::binary);
+    if(!ifs) {
+        return;
+    }
+    std::string header(MmapLogAppender::FILE_HEADER_SIZE, '\0');
+    if(!ifs.read(&header[0], header.size())) {
+        return;
+    }
+    const MmapLogAppender::FileHeader* h = (const MmapLogAppender::FileHeader*)header.data();
+    if(memcmp(h->magic, s_mmap_log_magic, sizeof(h->magic))
+            || h->headerSize != MmapLogAppender::FILE_HEADER_SIZE || !h->capacity) {
+        return;
+    }
+    m_capacity = h->capacity;
+    m_tail = h->tail.load();
+    m_data.resize(m_capacity);
+    if(!ifs.read(&m_data[0], m_capacity)) {
+        return;
+    }
+    m_valid = true;
+}
+
+void MmapLogReader::copyOut(uint64_t pos, void* data, size_t len) const {
+    size_t off = pos % m_capacity;
+    size_t n = std::min(len, m_capacity - off);
+    memcpy(data, m_data.data() + off, n);
+    if(n < len) {
+        memcpy((char*)data + n, m_data.data(), len - n);
+    }
+}
+
+size_t MmapLogReader::read(std::function<void(const char* data, size_t len)> cb, size_t* skipped) {
+    if(skipped) {
+        *skipped = 0;
+    }
+    if(!m_valid) {
+        return 0;
+    }
+    // 只有最后capacity字节内的记录是完整的，从这里开始按8字节找位置字段对得上的记录
+    // 开头被覆盖了一部分的那条不算跳过，之后每一段对不上的数据算一条不完整的记录
+    uint64_t pos = m_tail > m_capacity ? ((m_tail - m_capacity + 7) & ~(uint64_t)7) : 0;
+    bool wrapped = m_tail > m_capacity;
+    bool in_gap = false;
+    size_t count = 0;
+    std::string buf;
+    while(pos + MmapLogAppender::RECORD_HEADER_SIZE <= m_tail) {
+        uint32_t head[2];
+        uint64_t rpos;
+        copyOut(pos, head, sizeof(head));
+        copyOut(pos + 8, &rpos, sizeof(rpos));
+        size_t size = mmap_log_record_size(head[1]);
+        if(head[0] != MmapLogAppender::RECORD_MAGIC || rpos != pos || pos + size > m_tail) {
+            if(!in_gap && (count || !wrapped) && skipped) {
+                ++*skipped;
+            }
+            in_gap = true;
+            pos += 8;
+            continue;
+        }
+        in_gap = false;
+        buf.resize(head[1]);
+        copyOut(pos + MmapLogAppender::RECORD_HEADER_SIZE, &buf[0], head[1]);
+        cb(buf.data(), buf.size());
+        ++count;
+        pos += size;
+    }
+    return count;
+}
+
+LogFormatter::LogFormatter(const std::string& pattern) 
+    :m_pattern(pattern)
+    ,m_id(++s_formatter_id) {
+        init();
+}
+
+std::string LogFormatter::format(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event) {
+    LogStream& out = formatThreadLocal(logger, level, event);
+    return std::string(out.data(), out.size());
+}
+
+std::ostream& LogFormatter::format(std::ostream& ofs, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event) {
+    LogStream& out = formatThreadLocal(logger, level, event);
+    ofs.write(out.data(), out.size());
     return ofs;
 }
 
-void LogFormatter::init() {
+LogStream& LogFormatter::formatThreadLocal(const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event) {
+    static thread_local LogStream t_stream;
+    t_stream.getBuffer().clear();
+    format(t_stream.getBuffer(), logger, level, event);
+    return t_stream;
+}
 
-    // 定义正则表达式：匹配 %xxx{...} 或 %xxx
-    static const std::regex pattern_regex(R"(%([a-zA-Z%])(?:\{(.*?)\})?)");
-    std::vector<std::tuple<std::string, std::string, int>> vec;  // <文本/占位符名称, 格式, 类型：0 = 普通文本，1 = 占位符>
-    std::string::const_iterator start = m_pattern.begin();
-    std::string::const_iterator end = m_pattern.end();
-    std::smatch matches;
-    std::string nstr; // 缓存普通文本
-
-    // 遍历所有匹配项
-    while (std::regex_search(start, end, matches, pattern_regex)) {
-        // 处理匹配前的普通文本
-        if (matches.prefix().length() > 0) {
-            vec.emplace_back(matches.prefix().str(), "", 0);
-        }
-
-        // 处理占位符
-        std::string placeholder = matches[1].str(); // 占位符名称
-        std::string format = matches[2].str();      // 格式块内容（如 %%Y-%%m-%%d）, 没有为空串
-        vec.emplace_back(placeholder, format, 1);
-
-        start = matches[0].second; // 继续匹配剩余部分
-    }
-
-    // 处理末尾的普通文本
-    if (start != end) {
-        vec.emplace_back(std::string(start, end), "", 0);
-    }
-
-    static std::map<std::string, std::function<FormatItem::ptr(const std::string& str)>> s_format_items = {
-#define XX(str, C) \
-            {#str, [](const std::string& fmt) { return FormatItem::ptr(new C(fmt));}}
-    XX(m, MessageFormatItem),   // m: 消息
-    XX(p, LevelFormatItem),     // p: 日志级别
-    XX(r, ElapseFormatItem),    // r: 累计毫秒数
-    XX(c, NameFormatItem),      // c: 日志名称
-    XX(t, ThreadIdFormatItem),  // t: 线程id
-    XX(n, NewLineFormatItem),   // n: 换行
-    XX(d, DateTimeFormatItem),  // d: 时间
-    XX(f, FilenameFormatItem),  // f: 文件名
-    XX(l, LineFormatItem),      // l: 行号
-    XX(T, TabFormatItem),       // T: Tab
-    XX(F, FiberIdFormatItem),   // F: 协程id
-    XX(N, ThreadNameFormatItem),// T: 线程名称
-#undef XX
+void LogFormatter::format(LogBuffer& buf, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent& event) {
+    // 先按固定部分的上限一次预留，只有长度不定的部分才需要再检查剩余空间
+    char* start = buf.reserve(m_fixedSize + event.getContentSize());
+    char* p = start;
+    char* end = start + buf.available();
+    auto ensure = [&](size_t n) {
+        if((size_t)(end - p) < n + m_fixedSize) {
+            buf.commit(p - start);
+            start = p = buf.reserve(n + m_fixedSize);
+            end = start + buf.available();
+        }
+    };
+    auto copy = [&](const char* str, size_t len) {
+        ensure(len);
+        memcpy(p, str, len);
+        p += len;
     };
 
-    for(auto& i : vec) {
-        if(std::get<2>(i) == 0) {   // 普通文本
-            m_items.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
-        } else {    // 占位符
-            auto it = s_format_items.find(std::get<0>(i));
-            if(it == s_format_items.end()) {
-                m_items.push_back(FormatItem::ptr(new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
-            } else {
-                m_items.push_back(it->second(std::get<1>(i)));
+    for(auto& op : m_ops) {
+        switch(op.code) {
+            case OP_LITERAL:
+                memcpy(p, m_literals.data() + op.offset, op.len);
+                p += op.len;
+                break;
+            case OP_MESSAGE:
+                copy(event.getContentData(), event.getContentSize());
+                if(event.getFieldCount()) {
+                    ensure(fields_bound(event));
+                    for(size_t i = 0; i < event.getFieldCount(); ++i) {
+                        const LogField& field = event.getFields()[i];
+                        *p++ = ' ';
+                        p = logfmt_string(p, field.key.data(), field.key.size());
+                        *p++ = '=';
+                        p = write_field_value(p, field, false);
+                    }
+                }
+                break;
+            case OP_LEVEL: {
+                    size_t idx = (size_t)level < sizeof(s_level_names) / sizeof(s_level_names[0]) ? level : 0;
+                    memcpy(p, s_level_names[idx].str, s_level_names[idx].len);
+                    p += s_level_names[idx].len;
+                }
+                break;
+            case OP_ELAPSE:
+                p += u32toa(event.getElapse(), p);
+                break;
+            case OP_NAME: {
+                    const std::string& name = event.getLogger()->getName();
+                    copy(name.c_str(), name.size());
+                }
+                break;
+            case OP_THREAD_ID:
+                p += u32toa(event.getThreadId(), p);
+                break;
+            case OP_FIBER_ID:
+                p += u32toa(event.getFiberId(), p);
+                break;
+            case OP_THREAD_NAME:
+                copy(event.getThreadName().c_str(), event.getThreadName().size());
+                break;
+            case OP_DATETIME:
+                p += writeDate(p, op.offset, event.getTime(), event.getNanoseconds());
+                break;
+            case OP_FILENAME: {
+                    const char* file = event.getFile();
+                    if(file) {
+                        copy(file, strlen(file));
+                    }
+                }
+                break;
+            case OP_LINE:
+                p += u32toa(event.getLine(), p);
+                break;
+            case OP_JSON:
+            case OP_LOGFMT: {
+                    const char* file = event.getFile();
+                    ensure((event.getContentSize() + event.getLogger()->getName().size()
+                                + event.getThreadName().size() + (file ? strlen(file) : 0)) * 6
+                            + fields_bound(event));
+                    p = writeRecord(p, op.code == OP_JSON, op.offset, logger, level, event);
+                }
+                break;
+        }
+    }
+    buf.commit(p - start);
+}
+
+char* LogFormatter::writeRecord(char* p, bool json, uint32_t date, const std::shared_ptr<Logger>& logger
+                                , LogLevel::Level level, const LogEvent& event) {
+    // JSON: "key":value,  logfmt: key=value 用空格分隔
+    auto key = [&](const char* name, size_t len) {
+        if(json) {
+            *p++ = '"';
+            memcpy(p, name, len);
+            p += len;
+            *p++ = '"';
+            *p++ = ':';
+        } else {
+            memcpy(p, name, len);
+            p += len;
+            *p++ = '=';
+        }
+    };
+    auto str = [&](const char* data, size_t len) {
+        if(json) {
+            *p++ = '"';
+            p = json_escape(p, data, len);
+            *p++ = '"';
+        } else {
+            p = logfmt_string(p, data, len);
+        }
+    };
+    auto sep = [&]() {
+        *p++ = json ? ',' : ' ';
+    };
+
+    if(json) {
+        *p++ = '{';
+    }
+    key("time", 4);
+    if(json) {
+        *p++ = '"';
+    }
+    p += writeDate(p, date, event.getTime(), event.getNanoseconds());
+    if(json) {
+        *p++ = '"';
+    }
+    sep();
+    key("level", 5);
+    size_t idx = (size_t)level < sizeof(s_level_names) / sizeof(s_level_names[0]) ? level : 0;
+    str(s_level_names[idx].str, s_level_names[idx].len);
+    sep();
+    key("logger", 6);
+    const std::string& name = event.getLogger()->getName();
+    str(name.c_str(), name.size());
+    sep();
+    key("thread", 6);
+    p += u32toa(event.getThreadId(), p);
+    sep();
+    key("thread_name", 11);
+    str(event.getThreadName().c_str(), event.getThreadName().size());
+    sep();
+    key("fiber", 5);
+    p += u32toa(event.getFiberId(), p);
+    sep();
+    key("file", 4);
+    const char* file = event.getFile() ? event.getFile() : "";
+    str(file, strlen(file));
+    sep();
+    key("line", 4);
+    p += u32toa(event.getLine(), p);
+    sep();
+    key("msg", 3);
+    str(event.getContentData(), event.getContentSize());
+    for(size_t i = 0; i < event.getFieldCount(); ++i) {
+        const LogField& field = event.getFields()[i];
+        sep();
+        if(json) {
+            *p++ = '"';
+            p = json_escape(p, field.key.data(), field.key.size());
+            *p++ = '"';
+            *p++ = ':';
+        } else {
+            p = logfmt_string(p, field.key.data(), field.key.size());
+            *p++ = '=';
+        }
+        p = write_field_value(p, field, json);
+    }
+    if(json) {
+        *p++ = '}';
+    }
+    return p;
+}
+
+// 在缓存的时间后面填上秒以下的部分
+static size_t write_subseconds(char* out, const DateCache& cache, uint32_t nsec) {
+    memcpy(out, cache.buf, cache.len);
+    for(int i = 0; i < cache.subCount; ++i) {
+        uint32_t v = nsec;
+        for(int j = cache.subWidth[i]; j < 9; ++j) {
+            v /= 10;
+        }
+        for(char* p = out + cache.subPos[i] + cache.subWidth[i]; p > out + cache.subPos[i]; v /= 10) {
+            *--p = '0' + v % 10;
+        }
+    }
+    return cache.len;
+}
+
+size_t LogFormatter::writeDate(char* out, uint32_t index, time_t time, uint32_t nsec) {
+    uint64_t key = m_id << 8 | index;
+    DateCache& cache = t_date_cache[(m_id + index) & 7];
+    if(cache.key == key) {
+        if(cache.second == time) {
+            return write_subseconds(out, cache, nsec);
+        }
+        // 时区偏移都是整分钟，同一分钟内只有秒在变
+        if(cache.secondPos >= 0 && time / 60 == cache.minute) {
+            int sec = time % 60;
+            cache.buf[cache.secondPos] = s_digits[sec * 2];
+            cache.buf[cache.secondPos + 1] = s_digits[sec * 2 + 1];
+            cache.second = time;
+            return write_subseconds(out, cache, nsec);
+        }
+    }
+
+    const DateFormat& date = m_dates[index];
+    struct tm tm;
+    localtime_r(&time, &tm);
+    cache.key = key;
+    cache.second = time;
+    cache.minute = time / 60;
+    cache.secondPos = -1;
+    if(!date.marked.empty()) {
+        cache.len = strftime(cache.buf, sizeof(cache.buf), date.marked.c_str(), &tm);
+        char* pos = (char*)memmem(cache.buf, cache.len, s_second_mark, 2);
+        if(pos) {
+            cache.secondPos = pos - cache.buf;
+            pos[0] = s_digits[tm.tm_sec * 2];
+            pos[1] = s_digits[tm.tm_sec * 2 + 1];
+        }
+    } else {
+        cache.len = strftime(cache.buf, sizeof(cache.buf), date.format.c_str(), &tm);
+    }
+    cache.subCount = 0;
+    for(size_t i = 0; i < cache.len && cache.subCount < MAX_SUBSECONDS; ) {
+        if(cache.buf[i] != s_subsecond_mark) {
+            ++i;
+            continue;
+        }
+        size_t j = i;
+        while(j < cache.len && j - i < 9 && cache.buf[j] == s_subsecond_mark) {
+            ++j;
+        }
+        cache.subPos[cache.subCount] = i;
+        cache.subWidth[cache.subCount] = j - i;
+        ++cache.subCount;
+        i = j;
+    }
+    return write_subseconds(out, cache, nsec);
+}
+
+void LogFormatter::addLiteral(const std::string& str) {
+    if(str.empty()) {
+        return;
+    }
+    m_ops.push_back({OP_LITERAL, (uint32_t)m_literals.size(), (uint32_t)str.size()});
+    m_literals += str;
+    m_fixedSize += str.size();
+}
+
+void LogFormatter::addOp(OpCode code, const std::string& fmt) {
+    Op op = {code, 0, 0};
+    switch(code) {
+        case OP_LEVEL:
+            m_fixedSize += 7;
+            break;
+        case OP_ELAPSE:
+        case OP_THREAD_ID:
+        case OP_FIBER_ID:
+        case OP_LINE:
+            m_fixedSize += 10;
+            break;
+        case OP_JSON:
+        case OP_LOGFMT:
+            // 除去各字符串字段之外的部分
+            m_fixedSize += 192;
+            [[fallthrough]];
+        case OP_DATETIME: {
+                DateFormat date;
+                std::string format = !fmt.empty() ? fmt
+                                : code == OP_DATETIME ? "%Y-%m-%d %H:%M:%S" : "%Y-%m-%dT%H:%M:%S.%6N%z";
+                // %N、%3N、%6N、%9N换成对应位数的占位符
+                for(size_t i = 0; i < format.size(); ++i) {
+                    if(format[i] != '%' || i + 1 >= format.size()) {
+                        date.format += format[i];
+                        continue;
+                    }
+                    size_t width = 9;
+                    size_t k = i + 1;
+                    if(format[k] >= '1' && format[k] <= '9' && k + 1 < format.size() && format[k + 1] == 'N') {
+                        width = format[k] - '0';
+                        ++k;
+                    }
+                    if(format[k] == 'N') {
+                        date.format.append(width, s_subsecond_mark);
+                    } else {
+                        date.format += format[i];
+                        date.format += format[k];
+                    }
+                    i = k;
+                }
+                // 只有一个%S并且没有其他随秒变化的转换时，换秒只改写两位数字
+                int seconds = 0;
+                bool other = false;
+                std::string marked;
+                for(size_t i = 0; i < date.format.size(); ++i) {
+                    char c = date.format[i];
+                    if(c != '%' || i + 1 >= date.format.size()) {
+                        marked += c;
+                        continue;
+                    }
+                    char k = date.format[++i];
+                    if(k == 'E' || k == 'O') {
+                        other = true;
+                        break;
+                    }
+                    if(k == 'S') {
+                        ++seconds;
+                        marked += s_second_mark;
+                        continue;
+                    }
+                    if(strchr("sTcrX+", k)) {
+                        other = true;
+                    }
+                    marked += c;
+                    marked += k;
+                }
+                if(seconds == 1 && !other) {
+                    date.marked = marked;
+                }
+                op.offset = m_dates.size();
+                m_dates.push_back(date);
+                m_fixedSize += MAX_DATE_SIZE;
+            }
+            break;
+        default:
+            break;
+    }
+    m_ops.push_back(op);
+}
+
+void LogFormatter::init() {
+    m_ops.clear();
+    m_literals.clear();
+    m_dates.clear();
+    m_fixedSize = 0;
+    m_error = false;
+
+    // 解析 %x 或 %x{...}，两个占位符之间的普通文本(包括%T、%n)合并成一段
+    std::string literal;
+    size_t i = 0;
+    size_t n = m_pattern.size();
+    while(i < n) {
+        char c = m_pattern[i];
+        if(c != '%' || i + 1 >= n) {
+            literal += c;
+            ++i;
+            continue;
+        }
+        char k = m_pattern[i + 1];
+        if(!isalpha((unsigned char)k)) {
+            literal += '%';
+            i += (k == '%') ? 2 : 1;
+            continue;
+        }
+        i += 2;
+        std::string fmt;
+        if(i < n && m_pattern[i] == '{') {
+            size_t close = m_pattern.find('}', i + 1);
+            if(close != std::string::npos) {
+                fmt = m_pattern.substr(i + 1, close - i - 1);
+                i = close + 1;
             }
         }
 
-        // std::cout << "(" << std::get<0>(i) << ") - (" << std::get<1>(i) << ") - (" << std::get<2>(i) << ")" << std::endl;
+        OpCode code;
+        switch(k) {
+            case 'T':
+                literal += '\t';
+                continue;
+            case 'n':
+                literal += '\n';
+                continue;
+            case 'm': code = OP_MESSAGE; break;         // m: 消息
+            case 'p': code = OP_LEVEL; break;           // p: 日志级别
+            case 'r': code = OP_ELAPSE; break;          // r: 累计毫秒数
+            case 'c': code = OP_NAME; break;            // c: 日志名称
+            case 't': code = OP_THREAD_ID; break;       // t: 线程id
+            case 'd': code = OP_DATETIME; break;        // d: 时间
+            case 'f': code = OP_FILENAME; break;        // f: 文件名
+            case 'l': code = OP_LINE; break;            // l: 行号
+            case 'F': code = OP_FIBER_ID; break;        // F: 协程id
+            case 'N': code = OP_THREAD_NAME; break;     // N: 线程名称
+            case 'J': code = OP_JSON; break;            // J: 整条JSON
+            case 'K': code = OP_LOGFMT; break;          // K: 整条logfmt
+            default:
+                literal += "<<error_format %";
+                literal += k;
+                literal += ">>";
+                m_error = true;
+                continue;
+        }
+        addLiteral(literal);
+        literal.clear();
+        addOp(code, fmt);
     }
-    // std::cout << m_items.size() << std::endl;
+    addLiteral(literal);
 }
+
 // %m -- 消息体
 // %p -- 日志级别
 // %r -- 启动后的时间
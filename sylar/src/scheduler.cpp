@@ -1,17 +1,100 @@
 #include "scheduler.h"
 #include "log.h"
 #include "macro.h"
+#include "hook.h"
 
 namespace sylar {
 static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
 static thread_local Scheduler* t_scheduler = nullptr;   // 存储当前线程的调度器实例
 static thread_local Fiber* t_fiber = nullptr;           // 存储当前线程的主协程
+static thread_local int t_worker = -1;                  // 当前线程在调度器m_workers中的下标
+
+// 任务节点缓存，投递和执行往往不在同一个线程，线程本地缓存为空或过多时和全局池按批交换
+static thread_local bool t_task_pool_destroyed = false;
+
+struct Scheduler::TaskPool {
+    static const size_t kBatch = 64;
+
+    IntrusiveQueue<FiberAndThread> nodes;
+
+    ~TaskPool() {
+        if(this == &Global()) {
+            while(FiberAndThread* node = nodes.pop()) {
+                delete node;
+            }
+            return;
+        }
+        t_task_pool_destroyed = true;
+        std::lock_guard<std::mutex> lock(GlobalMutex());
+        Global().nodes.append(nodes);
+    }
+
+    static TaskPool& Global() {
+        static TaskPool s_pool;
+        return s_pool;
+    }
+
+    static std::mutex& GlobalMutex() {
+        static std::mutex s_mutex;
+        return s_mutex;
+    }
+
+    static TaskPool* Local() {
+        if(t_task_pool_destroyed) {
+            return nullptr;
+        }
+        static thread_local TaskPool t_pool;
+        return &t_pool;
+    }
+
+    static FiberAndThread* Alloc(FiberAndThread&& ft) {
+        TaskPool* local = Local();
+        FiberAndThread* node = nullptr;
+        if(local) {
+            if(local->nodes.empty()) {
+                std::lock_guard<std::mutex> lock(GlobalMutex());
+                auto& global = Global().nodes;
+                for(size_t i = 0; i < kBatch && !global.empty(); ++i) {
+                    local->nodes.push(global.pop());
+                }
+            }
+            node = local->nodes.pop();
+        }
+        if(!node) {
+            return new FiberAndThread(std::move(ft));
+        }
+        *node = std::move(ft);
+        return node;
+    }
+
+    static void Free(FiberAndThread* node) {
+        node->reset();
+        TaskPool* local = Local();
+        if(local) {
+            local->nodes.push(node);
+            if(local->nodes.size() >= kBatch * 2) {
+                std::lock_guard<std::mutex> lock(GlobalMutex());
+                auto& global = Global().nodes;
+                for(size_t i = 0; i < kBatch; ++i) {
+                    global.push(local->nodes.pop());
+                }
+            }
+            return;
+        }
+        std::lock_guard<std::mutex> lock(GlobalMutex());
+        Global().nodes.push(node);
+    }
+};
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
     :m_name(name) {
     SYLAR_ASSERT(threads > 0);
 
+    for(size_t i = 0; i < threads; ++i) {
+        m_workers.emplace_back(new Worker(i + 1));
+    }
+
     if(use_caller) {                // 是否将调用线程也作为工作线程
         sylar::Fiber::GetThis();    // 创建当前线程的主协程
         --threads;                  // 使用调用线程作为工作线程，减少需要创建的线程数
@@ -19,12 +102,13 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
         SYLAR_ASSERT(GetThis() == nullptr);
         t_scheduler = this;         // 设置当前线程的调度器
 
-        m_rootFiber.reset(new Fiber(std::bind(&Scheduler::run, this))); // 创建调度器主协程，绑定run方法作为入口函数
+        m_rootFiber.reset(new Fiber(std::bind(&Scheduler::run, this), 0, true)); // 创建调度器主协程，绑定run方法作为入口函数，结束时回到线程主协程
         sylar::Thread::SetName(m_name);
 
         t_fiber = m_rootFiber.get();// 返回智能指针内部保存的原始裸指针
         m_rootThread = sylar::GetThreadId();
         m_threadIds.push_back(m_rootThread);
+        m_workers[0]->thread = m_rootThread;    // 调用线程固定使用第一个Worker
     } else {     // 调用线程不作为工作线程，m_rootThread = -1
         m_rootThread = -1;
     }
@@ -36,6 +120,20 @@ Scheduler::~Scheduler() {
     if(GetThis() == this) {
         t_scheduler = nullptr;
     }
+    // 释放没有机会执行的任务
+    for(auto& w : m_workers) {
+        FiberAndThread* ft = nullptr;
+        while(w->queue.pop(ft)) {
+            TaskPool::Free(ft);
+        }
+        w->mailbox.takeAll(w->inbox);
+        while((ft = w->inbox.pop())) {
+            TaskPool::Free(ft);
+        }
+    }
+    while(FiberAndThread* ft = m_injectQueue.pop()) {
+        TaskPool::Free(ft);
+    }
 }
 
 
@@ -58,15 +156,15 @@ void Scheduler::start() {
 
         m_threads.resize(m_threadCount);
 
+        size_t base = m_rootThread == -1 ? 0 : 1;
         for(size_t i = 0; i < m_threadCount; i++) {
-            // 创建工作线程，绑定run方法
+            // 创建工作线程，绑定run方法，工作线程在run中持有m_mutex后才查找自己的Worker
             m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
             m_threadIds.push_back(m_threads[i]->getId());
+            m_workers[base + i]->thread = m_threads[i]->getId();
         }
     }
-    if(m_rootFiber) {   // 调用线程作为工作线程，调用线程切换成工作线程开始执行任务，主线程也开始执行run
-        m_rootFiber->swapIn();
-    }
+    // 调用线程作为工作线程时不在这里切入调度协程，调用线程在stop()中才进入run执行剩余任务
 }
 
 void Scheduler::stop() {
@@ -134,88 +232,90 @@ void Scheduler::setThis() {
 // 工作线程的主协程在run里面通过GetThis创建
 void Scheduler::run() {
     setThis(); // 设置当前线程的调度器实例
+    set_hook_enable(true);  // 工作线程中的阻塞调用由hook转成协程切换
     
     // 工作线程需要初始化自己的主协程
     if (sylar::GetThreadId() != m_rootThread) {
         t_fiber = Fiber::GetThis().get();
     }
 
+    Worker* w = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        int id = sylar::GetThreadId();
+        for(size_t i = 0; i < m_workers.size(); ++i) {
+            if(m_workers[i]->thread == id) {
+                w = m_workers[i].get();
+                t_worker = i;
+                break;
+            }
+        }
+    }
+    SYLAR_ASSERT(w);
+
     // 准备空闲协程和回调协程容器
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));    // 当任务队列为空时，调度器线程会切换到这个协程
     Fiber::ptr cb_fiber;    
 
     // ==================== 主调度循环 ====================
     while (true) {
-        // ----------- 任务获取阶段（加锁临界区）-----------
-        FiberAndThread ft;
+        // ----------- 任务获取阶段（无锁，依次检查邮箱、本地队列、全局队列、窃取）-----------
         bool tickle_me = false;
-        bool is_active = false;
-        
-        {
-            std::lock_guard<std::mutex> lock(m_mutex);
-            auto it = m_fibers.begin();
-
-            // 遍历任务队列寻找可执行任务
-            while (it != m_fibers.end()) {
-                // 跳过指定到其他线程的任务
-                if (it->thread != -1 && it->thread != sylar::GetThreadId()) {
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
-
-                // 跳过正在执行的协程
-                if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    ++it;
-                    continue;
-                }
+        FiberAndThread* ft = nextTask(w, tickle_me);
 
-                // 找到有效任务
-                ft = *it;
-                m_fibers.erase(it);
-                ++m_activeThreadCount;
-                is_active = true;
-                break;
-            }
-            tickle_me |= (it != m_fibers.end()); // 检查是否有剩余任务
+        // ----------- 协作式调度通知 -----------
+        if (tickle_me && hasIdleThread()) {
+            tickle(); // 唤醒其他可能空闲的线程
         }
 
-        // ----------- 任务执行阶段（无锁环境）-----------
-        if (ft.fiber || ft.cb) {
+        // ----------- 任务执行阶段 -----------
+        if (ft) {
             // 执行协程任务
-            if (ft.fiber) {
-                // 状态检查（防御性编程）
-                if (ft.fiber->getState() != Fiber::TERM && ft.fiber->getState() != Fiber::EXCEP) {
-                    ft.fiber->swapIn(); // 切换到任务协程
+            if (ft->fiber) {
+                if (ft->fiber->getState() == Fiber::EXEC) {
+                    // 协程刚把自己加入队列，还没有在原线程上切出，放回全局队列稍后再执行
                     --m_activeThreadCount;
+                    if (pushNode(ft, true)) {
+                        tickle();
+                    }
+                    continue;
+                }
+                // 状态检查（防御性编程）
+                if (ft->fiber->getState() != Fiber::TERM && ft->fiber->getState() != Fiber::EXCEP) {
+                    ft->fiber->swapIn(); // 切换到任务协程
 
                     // 根据协程状态处理后续逻辑
-                    switch (ft.fiber->getState()) {
+                    switch (ft->fiber->getState()) {
                         case Fiber::READY:
-                            schedule(ft.fiber); // 重新调度
+                            // 重新调度，放入全局队列，避免本地队列后进先出让它一直占着线程
+                            if (scheduleTask(std::move(ft->fiber), -1, true)) {
+                                tickle();
+                            }
                             break;
                         case Fiber::TERM:
                         case Fiber::EXCEP:
-                            break; // 结束执行
+                            Fiber::Recycle(ft->fiber); // 结束执行，放回协程池
+                            break;
                         default:
-                            ft.fiber->m_state = Fiber::HOLD; // 挂起协程
+                            ft->fiber->m_state = Fiber::HOLD; // 挂起协程
                     }
                 }
             } 
             // 执行回调任务
-            else if (ft.cb) {
+            else if (ft->cb) {
                 if (cb_fiber) {
-                    cb_fiber->reset(ft.cb); // 复用协程
+                    cb_fiber->reset(std::move(ft->cb)); // 复用协程
                 } else {
-                    cb_fiber.reset(new Fiber(ft.cb)); // 新建协程
+                    cb_fiber = Fiber::Create(std::move(ft->cb)); // 优先从协程池中取
                 }
                 
                 cb_fiber->swapIn();
-                --m_activeThreadCount;
 
                 // 回调任务状态处理
                 if (cb_fiber->getState() == Fiber::READY) {
-                    schedule(cb_fiber);
+                    if (scheduleTask(std::move(cb_fiber), -1, true)) {
+                        tickle();
+                    }
                     cb_fiber.reset();
                 } else if (cb_fiber->getState() == Fiber::EXCEP || cb_fiber->getState() == Fiber::TERM) {
                     cb_fiber->reset(nullptr);
@@ -224,36 +324,162 @@ void Scheduler::run() {
                     cb_fiber.reset();
                 }
             }
-            ft.reset();
+            TaskPool::Free(ft);
+            --m_activeThreadCount;
+            continue;
         } 
-        // ----------- 空闲处理阶段 -----------
-        else {
-            if (is_active) {    // 当前线程成功从队列获取并执行了任务，
-                --m_activeThreadCount;
-                continue;
-            }
 
-            // 检查终止条件
-            if (idle_fiber->getState() == Fiber::TERM) {
-                break;
-            }
+        // ----------- 空闲处理阶段 -----------
+        // 检查终止条件
+        if (idle_fiber->getState() == Fiber::TERM) {
+            break;
+        }
 
-            // 执行空闲协程
-            ++m_idleThreadCount;
+        // 先登记为空闲再检查一次队列，和pushNode中先入队再检查空闲线程配对，保证不会漏掉唤醒
+        ++m_idleThreadCount;
+        w->sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!hasTask(w)) {
             idle_fiber->swapIn();
-            --m_idleThreadCount;
-
-            // 维护空闲协程状态
-            if (idle_fiber->getState() != Fiber::TERM && idle_fiber->getState() != Fiber::EXCEP) {
-                idle_fiber->m_state = Fiber::HOLD;
-            }
         }
+        w->sleeping = false;
+        --m_idleThreadCount;
 
-        // ----------- 协作式调度通知 -----------
-        if (tickle_me) {
-            tickle(); // 唤醒其他可能空闲的线程
+        // 维护空闲协程状态
+        if (idle_fiber->getState() != Fiber::TERM && idle_fiber->getState() != Fiber::EXCEP) {
+            idle_fiber->m_state = Fiber::HOLD;
         }
     } // end while
+    t_worker = -1;
+}
+
+bool Scheduler::pushTask(FiberAndThread&& ft, bool inject) {
+    return pushNode(TaskPool::Alloc(std::move(ft)), inject);
+}
+
+bool Scheduler::pushNode(FiberAndThread* ft, bool inject) {
+    ++m_taskCount;      // 先计数再入队，stopping()不会在任务还在队列中时返回true
+    Worker* target = nullptr;
+    if (ft->thread != -1) {
+        target = getWorker(ft->thread);
+        if (!target) {
+            SYLAR_LOG_WARN(g_logger) << "schedule to thread=" << ft->thread
+                << " which is not a worker of scheduler " << m_name;
+            ft->thread = -1;
+        }
+    }
+
+    Worker* self = currentWorker();
+    if (target) {
+        target->mailbox.push(ft);
+    } else if (self && !inject) {
+        self->queue.push(ft);
+    } else {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_injectQueue.push(ft);
+        ++m_injectSize;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return hasIdleThread();
+}
+
+Scheduler::FiberAndThread* Scheduler::nextTask(Worker* w, bool& tickle_me) {
+    FiberAndThread* ft = nullptr;
+    // 本地队列一直有任务时也要定期检查全局队列，防止全局队列中的任务饥饿
+    if (++w->tick % 61 == 0) {
+        ft = popInject();
+    }
+    if (!ft) {
+        if (w->inbox.empty() && !w->mailbox.empty()) {
+            w->mailbox.takeAll(w->inbox);
+        }
+        ft = w->inbox.pop();
+    }
+    if (!ft && !w->queue.pop(ft)) {
+        ft = nullptr;
+    }
+    if (!ft) {
+        ft = popInject();
+    }
+    if (!ft) {
+        ft = stealTask(w, tickle_me);
+    }
+    if (ft) {
+        ++m_activeThreadCount;
+        --m_taskCount;
+        // 还有剩余的可窃取任务，唤醒空闲线程来分担
+        if (!w->queue.empty() || m_injectSize > 0) {
+            tickle_me = true;
+        }
+    }
+    return ft;
+}
+
+Scheduler::FiberAndThread* Scheduler::popInject() {
+    if (m_injectSize.load(std::memory_order_relaxed) == 0) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    FiberAndThread* ft = m_injectQueue.pop();
+    if (ft) {
+        --m_injectSize;
+    }
+    return ft;
+}
+
+Scheduler::FiberAndThread* Scheduler::stealTask(Worker* w, bool& tickle_me) {
+    size_t n = m_workers.size();
+    if (n <= 1) {
+        return nullptr;
+    }
+    // xorshift32随机选择起始位置，避免所有空闲线程同时盯着同一个目标
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 17;
+    w->seed ^= w->seed << 5;
+    size_t start = w->seed % n;
+    for (size_t i = 0; i < n; ++i) {
+        Worker* victim = m_workers[(start + i) % n].get();
+        if (victim == w) {
+            continue;
+        }
+        FiberAndThread* ft = nullptr;
+        if (victim->queue.steal(ft)) {
+            return ft;
+        }
+        // 邮箱中的任务只能由目标线程执行，目标在睡眠时帮它唤醒
+        if (!victim->mailbox.empty() && victim->sleeping) {
+            tickle_me = true;
+        }
+    }
+    return nullptr;
+}
+
+bool Scheduler::hasTask(Worker* w) {
+    if (!w->inbox.empty() || !w->mailbox.empty() || !w->queue.empty() || m_injectSize > 0) {
+        return true;
+    }
+    for (auto& i : m_workers) {
+        if (i.get() != w && !i->queue.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Scheduler::Worker* Scheduler::getWorker(int thread) {
+    for (auto& i : m_workers) {
+        if (i->thread.load(std::memory_order_relaxed) == thread) {
+            return i.get();
+        }
+    }
+    return nullptr;
+}
+
+Scheduler::Worker* Scheduler::currentWorker() {
+    if (t_scheduler != this || t_worker < 0) {
+        return nullptr;
+    }
+    return m_workers[t_worker].get();
 }
 
 void Scheduler::tickle() {
@@ -261,8 +487,7 @@ void Scheduler::tickle() {
 }
 
 bool Scheduler::stopping() {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+    return m_autoStop && m_stopping && m_taskCount == 0 && m_activeThreadCount == 0;
 }
 
 void Scheduler::idle() {
@@ -288,6 +513,7 @@ std::ostream& Scheduler::dump(std::ostream& os) {
        << " size=" << m_threadCount
        << " active_count=" << m_activeThreadCount
        << " idle_count=" << m_idleThreadCount
+       << " task_count=" << m_taskCount
        << " stopping=" << m_stopping
        << " ]" << std::endl << "    ";
     for(size_t i = 0; i < m_threadIds.size(); ++i) {
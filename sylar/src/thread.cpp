@@ -12,7 +12,7 @@ namespace sylar {
         return t_thread;
     }
 
-    const std::string Thread::GetName() {
+    const std::string& Thread::GetName() {
         return t_thread_name;
     }
 
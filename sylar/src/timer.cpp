@@ -0,0 +1,211 @@
+#include "timer.h"
+#include "clock.h"
+#include <algorithm>
+
+namespace sylar {
+
+Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager)
+    :m_recurring(recurring)
+    ,m_ms(ms)
+    ,m_cb(std::move(cb))
+    ,m_manager(manager) {
+    m_next = sylar::Clock::MonotonicMS() + m_ms;
+}
+
+bool Timer::cancel() {
+    std::lock_guard<std::mutex> lock(m_manager->m_mutex);
+    if(m_index < 0) {
+        return false;
+    }
+    m_cb = nullptr;
+    m_manager->erase(this);
+    return true;
+}
+
+bool Timer::refresh() {
+    std::lock_guard<std::mutex> lock(m_manager->m_mutex);
+    if(m_index < 0) {
+        return false;
+    }
+    m_next = sylar::Clock::MonotonicMS() + m_ms;
+    m_manager->update(this);
+    return true;
+}
+
+bool Timer::reset(uint64_t ms, bool from_now) {
+    if(ms == m_ms && !from_now) {
+        return true;
+    }
+    TimerManager* manager = m_manager;
+    bool at_front = false;
+    {
+        std::lock_guard<std::mutex> lock(manager->m_mutex);
+        if(m_index < 0) {
+            return false;
+        }
+        uint64_t start = from_now ? sylar::Clock::MonotonicMS() : m_next - m_ms;
+        m_ms = ms;
+        m_next = start + m_ms;
+        manager->update(this);
+        at_front = m_index == 0 && !manager->m_tickled.exchange(true);
+    }
+    if(at_front) {
+        manager->onTimerInsertedAtFront();
+    }
+    return true;
+}
+
+TimerManager::TimerManager() {
+}
+
+TimerManager::~TimerManager() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(auto& i : m_heap) {
+        i->m_index = -1;
+    }
+    m_heap.clear();
+}
+
+Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) {
+    Timer::ptr timer(new Timer(ms, std::move(cb), recurring, this));
+    bool at_front = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        at_front = insert(timer) && !m_tickled.exchange(true);
+    }
+    if(at_front) {
+        onTimerInsertedAtFront();
+    }
+    return timer;
+}
+
+static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
+    std::shared_ptr<void> tmp = weak_cond.lock();
+    if(tmp) {
+        cb();
+    }
+}
+
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
+                                    ,std::weak_ptr<void> weak_cond, bool recurring) {
+    return addTimer(ms, std::bind(&OnTimer, weak_cond, std::move(cb)), recurring);
+}
+
+uint64_t TimerManager::getNextTimer() {
+    m_tickled = false;
+    uint64_t next = m_nextExpiry.load(std::memory_order_acquire);
+    if(next == ~0ull) {
+        return ~0ull;
+    }
+    uint64_t now = sylar::Clock::MonotonicMS();
+    return now >= next ? 0 : next - now;
+}
+
+void TimerManager::listExpiredCallbacks(std::vector<std::function<void()> >& cbs) {
+    uint64_t now = sylar::Clock::MonotonicMS();
+    // 没有到期的定时器时不加锁
+    if(m_nextExpiry.load(std::memory_order_acquire) > now) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    while(!m_heap.empty() && m_heap[0]->m_next <= now) {
+        Timer* timer = m_heap[0].get();
+        if(timer->m_recurring) {
+            cbs.push_back(timer->m_cb);
+            // 周期为0的循环定时器每轮最多触发一次
+            timer->m_next = now + (timer->m_ms ? timer->m_ms : 1);
+            timer->m_seq = ++m_seq;
+            siftDown(0);
+        } else {
+            cbs.push_back(std::move(timer->m_cb));
+            timer->m_cb = nullptr;
+            erase(timer);
+        }
+    }
+    updateNextExpiry();
+}
+
+bool TimerManager::hasTimer() {
+    return m_nextExpiry.load(std::memory_order_relaxed) != ~0ull;
+}
+
+bool TimerManager::insert(const Timer::ptr& timer) {
+    timer->m_seq = ++m_seq;
+    timer->m_index = m_heap.size();
+    m_heap.push_back(timer);
+    siftUp(timer->m_index);
+    updateNextExpiry();
+    return timer->m_index == 0;
+}
+
+void TimerManager::erase(Timer* timer) {
+    size_t index = timer->m_index;
+    timer->m_index = -1;
+    // 用最后一个元素填补空位，timer本身可能在这里被释放
+    Timer::ptr last = std::move(m_heap.back());
+    m_heap.pop_back();
+    if(index < m_heap.size()) {
+        Timer* moved = last.get();
+        place(index, std::move(last));
+        update(moved);
+    }
+    updateNextExpiry();
+}
+
+void TimerManager::update(Timer* timer) {
+    size_t index = timer->m_index;
+    if(index > 0 && Less(timer, m_heap[(index - 1) / 4].get())) {
+        siftUp(index);
+    } else {
+        siftDown(index);
+    }
+    updateNextExpiry();
+}
+
+void TimerManager::siftUp(size_t index) {
+    Timer::ptr timer = std::move(m_heap[index]);
+    while(index > 0) {
+        size_t parent = (index - 1) / 4;
+        if(!Less(timer.get(), m_heap[parent].get())) {
+            break;
+        }
+        place(index, std::move(m_heap[parent]));
+        index = parent;
+    }
+    place(index, std::move(timer));
+}
+
+void TimerManager::siftDown(size_t index) {
+    Timer::ptr timer = std::move(m_heap[index]);
+    size_t size = m_heap.size();
+    while(true) {
+        size_t child = index * 4 + 1;
+        if(child >= size) {
+            break;
+        }
+        size_t end = std::min(child + 4, size);
+        size_t best = child;
+        for(size_t i = child + 1; i < end; ++i) {
+            if(Less(m_heap[i].get(), m_heap[best].get())) {
+                best = i;
+            }
+        }
+        if(!Less(m_heap[best].get(), timer.get())) {
+            break;
+        }
+        place(index, std::move(m_heap[best]));
+        index = best;
+    }
+    place(index, std::move(timer));
+}
+
+void TimerManager::place(size_t index, Timer::ptr&& timer) {
+    timer->m_index = index;
+    m_heap[index] = std::move(timer);
+}
+
+void TimerManager::updateNextExpiry() {
+    m_nextExpiry.store(m_heap.empty() ? ~0ull : m_heap[0]->m_next, std::memory_order_release);
+}
+
+}
@@ -0,0 +1,207 @@
+#include "uring.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+namespace sylar {
+
+static int sys_io_uring_setup(unsigned entries, io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete
+                            ,unsigned flags, const void* arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+}
+
+template<class T>
+static inline T load_acquire(const T* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template<class T>
+static inline void store_release(T* p, T v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+IoUring::IoUring() {
+}
+
+IoUring::~IoUring() {
+    if(m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if(m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if(m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool IoUring::init(unsigned entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = sys_io_uring_setup(entries, &p);
+    if(fd < 0) {
+        return false;
+    }
+    // 超时等待依赖IORING_ENTER_EXT_ARG(5.11)
+    if(!(p.features & IORING_FEAT_EXT_ARG)) {
+        close(fd);
+        errno = ENOTSUP;
+        return false;
+    }
+    m_fd = fd;
+    m_features = p.features;
+
+    m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    // 新内核两个环形队列共用一次mmap
+    if(m_features & IORING_FEAT_SINGLE_MMAP) {
+        if(m_cqRingSize > m_sqRingSize) {
+            m_sqRingSize = m_cqRingSize;
+        }
+        m_cqRingSize = m_sqRingSize;
+    }
+
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE
+                    ,MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return false;
+    }
+    if(m_features & IORING_FEAT_SINGLE_MMAP) {
+        m_cqRing = m_sqRing;
+    } else {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE
+                        ,MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            return false;
+        }
+    }
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE
+                    ,MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        return false;
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (unsigned*)(sq + p.sq_off.head);
+    m_sqTail = (unsigned*)(sq + p.sq_off.tail);
+    m_sqMask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    m_sqEntries = *(unsigned*)(sq + p.sq_off.ring_entries);
+    m_sqArray = (unsigned*)(sq + p.sq_off.array);
+    m_sqeTail = *m_sqTail;
+
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (unsigned*)(cq + p.cq_off.head);
+    m_cqTail = (unsigned*)(cq + p.cq_off.tail);
+    m_cqMask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe* IoUring::getSqe() {
+    unsigned head = load_acquire(m_sqHead);
+    if(m_sqeTail - head >= m_sqEntries) {
+        return nullptr;
+    }
+    unsigned idx = m_sqeTail & m_sqMask;
+    io_uring_sqe* sqe = &m_sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[idx] = idx;
+    ++m_sqeTail;
+    return sqe;
+}
+
+void IoUring::advance() {
+    store_release(m_sqTail, m_sqeTail);
+}
+
+unsigned IoUring::pending() const {
+    return load_acquire(m_sqTail) - load_acquire(m_sqHead);
+}
+
+int IoUring::enter(unsigned wait_nr, uint64_t timeout_ms) {
+    // 内核按实际可取的提交项数量截断to_submit，不需要精确计数
+    unsigned to_submit = pending();
+    if(!wait_nr) {
+        if(!to_submit) {
+            return 0;
+        }
+        return sys_io_uring_enter(m_fd, to_submit, 0, 0, nullptr, 0);
+    }
+
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    if(timeout_ms == ~0ull) {
+        return sys_io_uring_enter(m_fd, to_submit, wait_nr, flags, nullptr, _NSIG / 8);
+    }
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = timeout_ms % 1000 * 1000000;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask = 0;
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    flags |= IORING_ENTER_EXT_ARG;
+    return sys_io_uring_enter(m_fd, to_submit, wait_nr, flags, &arg, sizeof(arg));
+}
+
+unsigned IoUring::peek(io_uring_cqe* cqes, unsigned count) {
+    unsigned head = *m_cqHead;
+    unsigned tail = load_acquire(m_cqTail);
+    unsigned n = 0;
+    while(head != tail && n < count) {
+        cqes[n++] = m_cqes[head & m_cqMask];
+        ++head;
+    }
+    if(n) {
+        store_release(m_cqHead, head);
+    }
+    return n;
+}
+
+int IoUring::registerBuffers(const struct iovec* iovs, unsigned nr) {
+    if(m_hasBuffers) {
+        unregisterBuffers();
+    }
+    int rt = sys_io_uring_register(m_fd, IORING_REGISTER_BUFFERS, iovs, nr);
+    m_hasBuffers = rt == 0;
+    return rt;
+}
+
+int IoUring::unregisterBuffers() {
+    m_hasBuffers = false;
+    return sys_io_uring_register(m_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+}
+
+int IoUring::registerFiles(const int* fds, unsigned nr) {
+    if(m_hasFiles) {
+        unregisterFiles();
+    }
+    int rt = sys_io_uring_register(m_fd, IORING_REGISTER_FILES, fds, nr);
+    m_hasFiles = rt == 0;
+    return rt;
+}
+
+int IoUring::unregisterFiles() {
+    m_hasFiles = false;
+    return sys_io_uring_register(m_fd, IORING_UNREGISTER_FILES, nullptr, 0);
+}
+
+}
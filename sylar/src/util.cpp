@@ -1,9 +1,15 @@
 #include "util.h"
+#include "clock.h"
 #include "log.h"
 #include "fiber.h"
 #include <execinfo.h>
 #include <sys/syscall.h>
 #include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <algorithm>
 namespace sylar {
 
 sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
@@ -16,6 +22,43 @@ sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
         return sylar::Fiber::GetFiberId();
     }
 
+    uint64_t GetMonotonicMS() {
+        return Clock::MonotonicMS();
+    }
+
+    uint64_t GetMonotonicCoarseMS() {
+        return Clock::CoarseMonotonicMS();
+    }
+
+    bool WritevAll(int fd, const struct iovec* iov, int iovcnt) {
+        // 大多数情况一次写完，只有部分写入时才拷贝剩余的iovec
+        std::vector<struct iovec> left;
+        struct iovec* cur = (struct iovec*)iov;
+        while(iovcnt > 0) {
+            ssize_t n = writev(fd, cur, std::min(iovcnt, IOV_MAX));
+            if(n < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            while(iovcnt > 0 && (size_t)n >= cur->iov_len) {
+                n -= cur->iov_len;
+                ++cur;
+                --iovcnt;
+            }
+            if(iovcnt > 0) {
+                if(left.empty()) {
+                    left.assign(cur, cur + iovcnt);
+                    cur = left.data();
+                }
+                cur->iov_base = (char*)cur->iov_base + n;
+                cur->iov_len -= n;
+            }
+        }
+        return true;
+    }
+
     void Backtrace(std::vector<std::string>& bt, int size, int skip) {
         void** array = (void**)malloc((sizeof(void*) * size));
         size_t s = ::backtrace(array, size);
@@ -0,0 +1,177 @@
+#include "../sylar/include/config.h"
+#include "../sylar/include/log.h"
+#include "../sylar/include/macro.h"
+#include <unistd.h>
+#include <chrono>
+#include <shared_mutex>
+#include <thread>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<std::vector<int> >::ptr g_vec =
+    sylar::Config::Lookup("bench.vec", std::vector<int>(16, 1), "bench vector");
+
+// 原来的实现：读写锁保护，按值返回
+struct LockedValue {
+    std::vector<int> getValue() {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return value;
+    }
+    void setValue(const std::vector<int>& v) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        value = v;
+    }
+    std::shared_mutex mutex;
+    std::vector<int> value = std::vector<int>(16, 1);
+};
+
+static LockedValue s_locked;
+
+static sylar::TypedConfigKey<std::vector<int> > s_vec_key = sylar::Config::Key<std::vector<int> >("bench.vec");
+
+/*
+    注册1万个配置项之后按名字查找和按句柄读取的对比
+*/
+static void bench_key() {
+    const int n = 10000;
+    std::vector<std::string> names;
+    for(int i = 0; i < n; ++i) {
+        names.push_back("bench.keys.k" + std::to_string(i));
+        sylar::Config::Lookup(names.back(), i, "bench key");
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::vector<sylar::ConfigKey> keys;
+    for(auto& i : names) {
+        keys.push_back(sylar::Config::Key(i));
+    }
+    double resolve = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    uint64_t sum = 0;
+    start = std::chrono::steady_clock::now();
+    for(int round = 0; round < 100; ++round) {
+        for(auto& i : names) {
+            sum += sylar::Config::Lookup<int>(i)->getRef();
+        }
+    }
+    double by_name = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (100 * n);
+    start = std::chrono::steady_clock::now();
+    for(int round = 0; round < 100; ++round) {
+        for(auto& i : keys) {
+            sum += static_cast<sylar::ConfigVar<int>*>(i.get())->getRef();
+        }
+    }
+    double by_key = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (100 * n);
+    SYLAR_ASSERT(sum == 2 * 100 * (uint64_t)n * (n - 1) / 2);
+    SYLAR_LOG_INFO(g_logger) << "resolve 10k keys: " << resolve << "ms, lookup by name: " << by_name
+                             << "ns, get by key: " << by_key << "ns";
+}
+
+static sylar::ConfigVar<std::map<std::string, std::vector<int> > >::ptr g_table =
+    sylar::Config::Lookup("bench.table", std::map<std::string, std::vector<int> >(), "bench table");
+static sylar::ConfigVar<std::map<std::string, std::map<std::string, std::vector<std::string> > > >::ptr g_nested =
+    sylar::Config::Lookup("bench.nested", std::map<std::string, std::map<std::string, std::vector<std::string> > >()
+                        , "bench nested");
+
+/*
+    加载1万项的配置：bench.table是1万个长度为8的数组，bench.nested是100x100个字符串数组
+    只计LoadFromYaml，不含把文本解析成节点树的时间
+*/
+static void bench_load() {
+    std::stringstream ss;
+    ss << "bench:\n  table:\n";
+    for(int i = 0; i < 10000; ++i) {
+        ss << "    k" << i << ": [";
+        for(int j = 0; j < 8; ++j) {
+            ss << (j ? ", " : "") << i + j;
+        }
+        ss << "]\n";
+    }
+    ss << "  nested:\n";
+    for(int i = 0; i < 100; ++i) {
+        ss << "    g" << i << ":\n";
+        for(int j = 0; j < 100; ++j) {
+            ss << "      s" << j << ": [a" << i << ", b" << j << "]\n";
+        }
+    }
+    YAML::Node root = YAML::Load(ss.str());
+    for(int round = 0; round < 3; ++round) {
+        auto start = std::chrono::steady_clock::now();
+        sylar::Config::LoadFromYaml(root);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        SYLAR_ASSERT(g_table->getRef().size() == 10000 && g_table->getRef().at("k9999")[7] == 10006);
+        SYLAR_ASSERT(g_nested->getRef().size() == 100 && g_nested->getRef().at("g99").at("s99")[1] == "b99");
+        SYLAR_LOG_INFO(g_logger) << "load 10k entries: " << ms << "ms";
+        // 下一轮要真正替换值
+        g_table->setValue({});
+        g_nested->setValue({});
+    }
+}
+static const int s_millis = 300;
+
+/*
+    多个线程读同一个vector类型的配置，同时一个线程每毫秒修改一次
+    每个线程的读取次数不随线程数下降才说明读之间没有争用(核数足够时总吞吐线性增长)
+*/
+template<class F>
+static void run(const std::string& name, size_t threads, F read) {
+    std::atomic<bool> stop = {false};
+    std::atomic<uint64_t> total = {0};
+    std::vector<std::thread> ths;
+    for(size_t t = 0; t < threads; ++t) {
+        ths.emplace_back([&](){
+            uint64_t n = 0;
+            uint64_t sum = 0;
+            while(!stop.load(std::memory_order_relaxed)) {
+                sum += read();
+                ++n;
+            }
+            SYLAR_ASSERT(sum >= n);
+            total += n;
+        });
+    }
+    std::thread writer([&](){
+        int i = 0;
+        while(!stop) {
+            std::vector<int> v(16, 1 + (++i & 1));
+            g_vec->setValue(v);
+            s_locked.setValue(v);
+            usleep(1000);
+        }
+    });
+    usleep(s_millis * 1000);
+    stop = true;
+    for(auto& i : ths) {
+        i.join();
+    }
+    writer.join();
+    double sec = s_millis / 1000.0;
+    SYLAR_LOG_INFO(g_logger) << name << " threads=" << threads << ": " << (uint64_t)(total / sec) << " reads/s, "
+                             << (uint64_t)(total / sec / threads) << " reads/s/thread";
+}
+
+int main(int argc, char** argv) {
+    bench_load();
+    bench_key();
+    SYLAR_LOG_INFO(g_logger) << "hardware threads=" << std::thread::hardware_concurrency();
+    for(size_t threads : {1, 2, 4, 8, 16, 32, 64}) {
+        run("locked_copy", threads, [](){
+            return (uint64_t)s_locked.getValue()[0];
+        });
+        run("getValue", threads, [](){
+            return (uint64_t)g_vec->getValue()[0];
+        });
+        run("getSnapshot", threads, [](){
+            return (uint64_t)(*g_vec->getSnapshot())[0];
+        });
+        run("getRef", threads, [](){
+            return (uint64_t)g_vec->getRef()[0];
+        });
+        run("lookup_name", threads, [](){
+            return (uint64_t)sylar::Config::Lookup<std::vector<int> >("bench.vec")->getRef()[0];
+        });
+        run("key", threads, [](){
+            return (uint64_t)s_vec_key.getRef()[0];
+        });
+    }
+    return 0;
+}
@@ -0,0 +1,193 @@
+#include "../sylar/include/sylar.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const size_t s_msg_size = 64;
+static size_t s_conns = 64;
+static size_t s_rounds = 2000;
+static size_t s_client_threads = 4;
+
+/*
+    echo服务器对比两种后端
+    1. 服务端一个工作线程，每个连接一个协程，读到多少写回多少
+    2. 客户端是不经过sylar的普通线程，每个线程负责一组连接，每轮先给所有连接发请求再逐个收回
+    3. 系统调用数取IOManager自己的计数(事件循环、事件注册和IO接口)，按请求数平均
+*/
+struct Result {
+    double seconds = 0;
+    uint64_t syscalls = 0;
+    std::vector<uint32_t> latencies;    // 纳秒
+};
+
+static void client_main(uint16_t port, size_t conns, std::vector<uint32_t>& latencies) {
+    std::vector<int> fds;
+    for(size_t i = 0; i < conns; ++i) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        SYLAR_ASSERT(!connect(fd, (sockaddr*)&addr, sizeof(addr)));
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        fds.push_back(fd);
+    }
+
+    char buf[s_msg_size];
+    memset(buf, 'x', sizeof(buf));
+    std::vector<std::chrono::steady_clock::time_point> starts(conns);
+    latencies.reserve(conns * s_rounds);
+    for(size_t r = 0; r < s_rounds; ++r) {
+        for(size_t i = 0; i < conns; ++i) {
+            starts[i] = std::chrono::steady_clock::now();
+            SYLAR_ASSERT(send(fds[i], buf, sizeof(buf), 0) == (ssize_t)sizeof(buf));
+        }
+        for(size_t i = 0; i < conns; ++i) {
+            size_t got = 0;
+            while(got < sizeof(buf)) {
+                ssize_t n = recv(fds[i], buf + got, sizeof(buf) - got, 0);
+                SYLAR_ASSERT(n > 0);
+                got += n;
+            }
+            latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - starts[i]).count());
+        }
+    }
+    for(auto fd : fds) {
+        close(fd);
+    }
+}
+
+static void echo(sylar::IOManager* iom, int fd, char* buf, int buf_index) {
+    while(true) {
+        ssize_t n = buf_index < 0 ? iom->read(fd, buf, s_msg_size)
+                                  : iom->readFixed(fd, buf, s_msg_size, buf_index);
+        if(n <= 0) {
+            break;
+        }
+        ssize_t w = buf_index < 0 ? iom->write(fd, buf, n)
+                                  : iom->writeFixed(fd, buf, n, buf_index);
+        if(w != n) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+static Result run(sylar::IOManager::Backend backend, bool fixed) {
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    SYLAR_ASSERT(!bind(lfd, (sockaddr*)&addr, sizeof(addr)));
+    SYLAR_ASSERT(!listen(lfd, 1024));
+    socklen_t len = sizeof(addr);
+    getsockname(lfd, (sockaddr*)&addr, &len);
+    fcntl(lfd, F_SETFL, O_NONBLOCK);
+    uint16_t port = ntohs(addr.sin_port);
+
+    Result result;
+    std::vector<char> buffers(s_conns * s_msg_size);
+    {
+        sylar::IOManager iom(1, false, "echo", backend);
+        SYLAR_ASSERT(iom.getBackend() == backend);
+        std::vector<iovec> iovs(s_conns);
+        for(size_t i = 0; i < s_conns; ++i) {
+            iovs[i].iov_base = &buffers[i * s_msg_size];
+            iovs[i].iov_len = s_msg_size;
+        }
+        if(fixed) {
+            SYLAR_ASSERT(iom.registerBuffers(iovs.data(), iovs.size()));
+        }
+
+        // 所有连接建立之后再注册文件，注册会替换整张表
+        iom.schedule([&iom, &buffers, lfd, fixed](){
+            std::vector<int> fds;
+            for(size_t i = 0; i < s_conns; ++i) {
+                int fd = iom.accept(lfd, nullptr, nullptr);
+                SYLAR_ASSERT(fd >= 0);
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                fds.push_back(fd);
+            }
+            if(fixed) {
+                SYLAR_ASSERT(iom.registerFiles(fds));
+            }
+            for(size_t i = 0; i < s_conns; ++i) {
+                char* buf = &buffers[i * s_msg_size];
+                int fd = fds[i];
+                iom.schedule([&iom, fd, buf, i, fixed](){
+                    echo(&iom, fd, buf, fixed ? (int)i : -1);
+                });
+            }
+        });
+
+        std::vector<std::vector<uint32_t> > latencies(s_client_threads);
+        std::vector<std::thread> clients;
+        uint64_t syscalls = iom.getSyscallCount();
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < s_client_threads; ++i) {
+            clients.emplace_back(client_main, port, s_conns / s_client_threads, std::ref(latencies[i]));
+        }
+        for(auto& i : clients) {
+            i.join();
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        iom.stop();
+        result.syscalls = iom.getSyscallCount() - syscalls;
+        for(auto& i : latencies) {
+            result.latencies.insert(result.latencies.end(), i.begin(), i.end());
+        }
+    }
+    close(lfd);
+    return result;
+}
+
+static void report(const std::string& name, Result& r) {
+    std::sort(r.latencies.begin(), r.latencies.end());
+    size_t n = r.latencies.size();
+    SYLAR_LOG_INFO(g_logger) << name << ": " << n << " requests in " << r.seconds << "s, "
+        << (uint64_t)(n / r.seconds) << " req/s, "
+        << (double)r.syscalls / n << " syscalls/req, "
+        << "p50=" << r.latencies[n / 2] / 1000.0 << "us "
+        << "p99=" << r.latencies[n * 99 / 100] / 1000.0 << "us";
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    if(argc > 1) {
+        s_conns = atoi(argv[1]);
+    }
+    if(argc > 2) {
+        s_rounds = atoi(argv[2]);
+    }
+    s_client_threads = std::min(s_client_threads, s_conns);
+    s_conns -= s_conns % s_client_threads;
+
+    Result r = run(sylar::IOManager::EPOLL, false);
+    report("epoll", r);
+
+    sylar::IOManager probe(1, false, "probe", sylar::IOManager::URING);
+    if(probe.getBackend() != sylar::IOManager::URING) {
+        SYLAR_LOG_WARN(g_logger) << "io_uring not available";
+        return 0;
+    }
+    probe.stop();
+    r = run(sylar::IOManager::URING, false);
+    report("io_uring", r);
+    r = run(sylar::IOManager::URING, true);
+    report("io_uring fixed", r);
+    return 0;
+}
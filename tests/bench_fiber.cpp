@@ -0,0 +1,146 @@
+#include "../sylar/include/sylar.h"
+#include <ucontext.h>
+#include <unistd.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const uint64_t s_rounds = 5000000;
+static const int s_parked = 10000;
+
+// 主协程call()进入子协程，子协程back()返回，每轮两次切换
+static sylar::Fiber* s_cur = nullptr;
+static bool s_stop = false;
+
+void fiber_loop() {
+    while(!s_stop) {
+        s_cur->back();
+    }
+}
+
+// 模拟挂起在IO上的连接协程，栈上有少量局部变量
+void parked_fiber() {
+    char buf[512];
+    memset(buf, 0, sizeof(buf));
+    s_cur->back();
+    buf[0] = 1;
+}
+
+// 对照组：直接使用swapcontext
+static ucontext_t s_main_ctx;
+static ucontext_t s_uc_ctx;
+
+void ucontext_loop() {
+    while(true) {
+        swapcontext(&s_uc_ctx, &s_main_ctx);
+    }
+}
+
+static long rss_bytes() {
+    std::ifstream ifs("/proc/self/statm");
+    long size = 0;
+    long resident = 0;
+    ifs >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void report(const std::string& name, uint64_t switches, std::chrono::steady_clock::duration d) {
+    double sec = std::chrono::duration<double>(d).count();
+    SYLAR_LOG_INFO(g_logger) << name << ": " << switches << " switches in " << sec << "s, "
+                             << (uint64_t)(switches / sec) << " switches/s, "
+                             << sec * 1e9 / switches << " ns/switch";
+}
+
+static const char* mode_name(bool shared) {
+    return shared ? "shared" : "dedicated";
+}
+
+void bench_fiber() {
+    sylar::Fiber::ptr fiber(new sylar::Fiber(&fiber_loop, 0, true));
+    s_cur = fiber.get();
+
+    auto begin = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < s_rounds; ++i) {
+        fiber->call();
+    }
+    auto end = std::chrono::steady_clock::now();
+    s_stop = true;
+    fiber->call();
+    s_stop = false;
+    report(std::string("fiber[") + sylar::Context::BackendName() + "]", s_rounds * 2, end - begin);
+}
+
+// 两个协程交替运行，共享栈模式下每次切入都要保存对方、恢复自己的栈内容
+void bench_pingpong(bool shared) {
+    sylar::Fiber::ptr a(new sylar::Fiber(&fiber_loop, 0, true, shared));
+    sylar::Fiber::ptr b(new sylar::Fiber(&fiber_loop, 0, true, shared));
+
+    auto begin = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < s_rounds / 2; ++i) {
+        s_cur = a.get();
+        a->call();
+        s_cur = b.get();
+        b->call();
+    }
+    auto end = std::chrono::steady_clock::now();
+    s_stop = true;
+    s_cur = a.get();
+    a->call();
+    s_cur = b.get();
+    b->call();
+    s_stop = false;
+    report(std::string("pingpong[") + mode_name(shared) + "]", s_rounds * 2, end - begin);
+}
+
+void bench_parked(bool shared) {
+    std::vector<sylar::Fiber::ptr> fibers;
+    fibers.reserve(s_parked);
+    long before = rss_bytes();
+    for(int i = 0; i < s_parked; ++i) {
+        fibers.emplace_back(new sylar::Fiber(&parked_fiber, 0, true, shared));
+        s_cur = fibers.back().get();
+        s_cur->call();
+    }
+    long after = rss_bytes();
+    size_t saved = 0;
+    for(auto& i : fibers) {
+        saved += i->getSavedStackSize();
+    }
+    SYLAR_LOG_INFO(g_logger) << "parked[" << mode_name(shared) << "]: " << s_parked << " fibers, "
+                             << (after - before) / s_parked << " bytes rss/fiber"
+                             << (shared ? ", " + std::to_string(saved / s_parked) + " bytes saved stack/fiber" : "");
+    for(auto& i : fibers) {
+        s_cur = i.get();
+        i->call();
+    }
+}
+
+void bench_ucontext() {
+    std::vector<char> stack(128 * 1024);
+    getcontext(&s_uc_ctx);
+    s_uc_ctx.uc_link = nullptr;
+    s_uc_ctx.uc_stack.ss_sp = stack.data();
+    s_uc_ctx.uc_stack.ss_size = stack.size();
+    makecontext(&s_uc_ctx, &ucontext_loop, 0);
+
+    auto begin = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < s_rounds; ++i) {
+        swapcontext(&s_main_ctx, &s_uc_ctx);
+    }
+    auto end = std::chrono::steady_clock::now();
+    report("raw swapcontext", s_rounds * 2, end - begin);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::INFO);
+    sylar::Fiber::GetThis();
+    bench_fiber();
+    bench_ucontext();
+    bench_pingpong(false);
+    bench_pingpong(true);
+    bench_parked(false);
+    bench_parked(true);
+    return 0;
+}
@@ -0,0 +1,245 @@
+#include "../sylar/include/log.h"
+#include "../sylar/include/binlog.h"
+#include "../sylar/include/clock.h"
+#include "../sylar/include/macro.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <vector>
+
+/*
+    日志吞吐量测试
+    1. 统计全局operator new的调用次数，预热之后稳定状态下每条日志的分配次数应该为0
+    2. NullLogAppender只格式化不输出，测的是日志宏、LogEvent和格式化本身的开销
+*/
+static std::atomic<uint64_t> s_allocs = {0};
+
+void* operator new(size_t size) {
+    ++s_allocs;
+    void* p = malloc(size ? size : 1);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+class NullLogAppender : public sylar::LogAppender {
+public:
+    using ptr = std::shared_ptr<NullLogAppender>;
+    void log(const sylar::Logger::ptr& logger, sylar::LogLevel::Level level, const sylar::LogEvent& event) override {
+        sylar::LogStream& out = getFormatter()->formatThreadLocal(logger, level, event);
+        m_bytes += out.size();
+    }
+    void write(const struct iovec* iov, int iovcnt) override {
+    }
+    uint64_t getBytes() const { return m_bytes;}
+private:
+    std::atomic<uint64_t> m_bytes = {0};
+};
+
+static size_t s_lines = 1000000;
+
+template<class F>
+static void run(const std::string& name, size_t threads, F fun) {
+    // 每个线程先打一些日志，让线程缓存和格式化缓冲区都准备好，之后同时开始计时
+    std::vector<std::thread> ths;
+    std::atomic<size_t> ready = {0};
+    std::atomic<bool> go = {false};
+    size_t per_thread = s_lines / threads;
+    for(size_t t = 0; t < threads; ++t) {
+        ths.emplace_back([&, t](){
+            for(int i = 0; i < 1000; ++i) {
+                fun(t, i);
+            }
+            ++ready;
+            while(!go) {
+                std::this_thread::yield();
+            }
+            for(size_t i = 0; i < per_thread; ++i) {
+                fun(t, i);
+            }
+        });
+    }
+    while(ready != threads) {
+        std::this_thread::yield();
+    }
+    uint64_t allocs = s_allocs;
+    auto start = std::chrono::steady_clock::now();
+    go = true;
+    for(auto& i : ths) {
+        i.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    allocs = s_allocs - allocs;
+    size_t total = per_thread * threads;
+    std::cout << name << " threads=" << threads << ": "
+              << (uint64_t)(total / seconds) << " lines/s, "
+              << (double)allocs / total << " allocs/line" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_lines = atoi(argv[1]);
+    }
+    NullLogAppender::ptr null(new NullLogAppender);
+    sylar::Logger::ptr logger(new sylar::Logger("bench"));
+    logger->addAppender(null);
+
+    for(size_t threads : {1, 4}) {
+        run("stream", threads, [logger](size_t t, size_t i){
+            SYLAR_LOG_INFO(logger) << "thread " << t << " line " << i << " value " << 3.14;
+        });
+        run("fmt", threads, [logger](size_t t, size_t i){
+            SYLAR_LOG_FMT_INFO(logger, "thread %zu line %zu value %f", t, i, 3.14);
+        });
+    }
+
+    // 结构化字段：值按类型存放，格式化时才转成文本
+    {
+        NullLogAppender::ptr kv_null(new NullLogAppender);
+        kv_null->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%J%n")));
+        sylar::Logger::ptr kv(new sylar::Logger("kv"));
+        kv->addAppender(kv_null);
+        for(size_t threads : {1, 4}) {
+            run("kv_json", threads, [kv](size_t t, size_t i){
+                SYLAR_LOG_KV(kv, INFO, "request done", "thread", t, "line", i, "latency_us", 3.14, "path", "/index.html");
+            });
+        }
+    }
+
+    // mmap环形缓冲区：格式化之后直接拷贝到映射的内存，没有系统调用
+    {
+        std::string path = "/tmp/bench_log_" + std::to_string(getpid()) + ".mmap";
+        sylar::Logger::ptr mlogger(new sylar::Logger("mmap"));
+        sylar::MmapLogAppender::ptr mmap_appender(new sylar::MmapLogAppender(path, 64 << 20));
+        SYLAR_ASSERT(mmap_appender->isValid());
+        mlogger->addAppender(mmap_appender);
+        for(size_t threads : {1, 4}) {
+            run("mmap", threads, [mlogger](size_t t, size_t i){
+                SYLAR_LOG_INFO(mlogger) << "thread " << t << " line " << i << " value " << 3.14;
+            });
+        }
+        unlink(path.c_str());
+    }
+
+    // 多线程争用同一个Logger：格式化并行进行，只有写文件时持有Appender自己的锁
+    sylar::Logger::ptr shared(new sylar::Logger("contention"));
+    shared->addAppender(sylar::LogAppender::ptr(new sylar::FileLogAppender("/dev/null")));
+    shared->addAppender(null);
+    for(size_t threads : {1, 2, 4, 8, 16, 32, 64}) {
+        run("contention", threads, [shared](size_t t, size_t i){
+            SYLAR_LOG_INFO(shared) << "thread " << t << " line " << i;
+        });
+    }
+
+    uint64_t bytes_before = null->getBytes();
+    // 级别不够的语句：只有调用点上的一次判断
+    sylar::Logger::ptr quiet(new sylar::Logger("quiet"));
+    quiet->addAppender(null);
+    quiet->setLevel(sylar::LogLevel::ERROR);
+    size_t saved = s_lines;
+    s_lines = 100000000;
+    run("disabled", 1, [quiet](size_t t, size_t i){
+        SYLAR_LOG_DEBUG(quiet) << "thread " << t << " line " << i;
+        // 不让编译器把判断提到循环外，和分散在各处的调用点一样每次都重新读取
+        asm volatile("" ::: "memory");
+    });
+    s_lines = saved;
+    SYLAR_ASSERT(null->getBytes() == bytes_before);
+
+    // 限流之后被抑制的语句：只有计数，不格式化
+    saved = s_lines;
+    s_lines = 10000000;
+    for(size_t threads : {1, 4}) {
+        run("every_n", threads, [logger](size_t t, size_t i){
+            SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::ERROR, 1000000) << "storm " << t << " " << i;
+        });
+        run("per_second", threads, [logger](size_t t, size_t i){
+            SYLAR_LOG_PER_SECOND(logger, sylar::LogLevel::ERROR, 1) << "storm " << t << " " << i;
+        });
+    }
+    s_lines = saved;
+
+    // 只测格式化：默认格式，同一个事件反复格式化
+    sylar::LogFormatter::ptr formatter = logger->getFormatter();
+    sylar::LogEvent event(logger, sylar::LogLevel::INFO, __FILE__, __LINE__, 0
+                , sylar::GetThreadId(), 0, time(0), sylar::Thread::GetName());
+    event.getSS() << "format benchmark message";
+    size_t bytes = 0;
+    run("format", 1, [&](size_t t, size_t i){
+        bytes += formatter->formatThreadLocal(logger, sylar::LogLevel::INFO, event).size();
+    });
+    SYLAR_ASSERT(bytes > 0);
+
+    // 二进制日志：逐条测量调用线程上的耗时，扣掉两次取时间戳本身的开销
+    {
+        std::string path = "/tmp/bench_log_" + std::to_string(getpid()) + ".binlog";
+        SYLAR_ASSERT(sylar::BinLog::Open(path));
+        size_t n = std::min<size_t>(s_lines, 1000000);
+        std::vector<uint64_t> ticks(n);
+        uint64_t overhead = ~0ull;
+        for(int i = 0; i < 1000; ++i) {
+            uint64_t t0 = sylar::BinLog::Clock();
+            uint64_t t1 = sylar::BinLog::Clock();
+            overhead = std::min(overhead, t1 - t0);
+        }
+        for(size_t i = 0; i < n; ++i) {
+            uint64_t t0 = sylar::BinLog::Clock();
+            SYLAR_BINLOG_FMT_INFO(logger, "thread %d line %zu value %f", 0, i, 3.14);
+            uint64_t t1 = sylar::BinLog::Clock();
+            ticks[i] = t1 - t0 > overhead ? t1 - t0 - overhead : 0;
+        }
+        auto start = std::chrono::steady_clock::now();
+        sylar::BinLog::Close();
+        double close_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::sort(ticks.begin(), ticks.end());
+        double tpn = sylar::BinLog::GetTicksPerNs();
+        std::cout << "binlog threads=1: p50=" << ticks[n / 2] / tpn << "ns p99=" << ticks[n * 99 / 100] / tpn
+                  << "ns p999=" << ticks[n * 999 / 1000] / tpn << "ns, close=" << close_ms << "ms" << std::endl;
+        unlink(path.c_str());
+    }
+
+    // 时钟：TSC外推和直接读系统时钟
+    {
+        const size_t n = 10000000;
+        uint64_t sum = 0;
+        auto measure = [&](const char* name, uint64_t (*fun)()) {
+            auto start = std::chrono::steady_clock::now();
+            for(size_t i = 0; i < n; ++i) {
+                sum += fun();
+            }
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / n;
+            std::cout << "clock " << name << ": " << ns << "ns/call" << std::endl;
+        };
+        measure("NowNS", sylar::Clock::NowNS);
+        measure("RealtimeNS", sylar::Clock::RealtimeNS);
+        measure("CoarseRealtimeNS", sylar::Clock::CoarseRealtimeNS);
+        SYLAR_ASSERT(sum > 0);
+    }
+
+    uint64_t before = s_allocs;
+    SYLAR_LOG_INFO(logger) << std::string(100000, 'x');
+    SYLAR_LOG_INFO(logger) << "short";
+    std::cout << "oversized line allocs=" << s_allocs - before << std::endl;
+
+    // 稳定状态不分配
+    before = s_allocs;
+    for(int i = 0; i < 1000; ++i) {
+        SYLAR_LOG_INFO(logger) << "steady " << i;
+    }
+    SYLAR_ASSERT(s_allocs == before);
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include "../sylar/include/sylar.h"
+#include <stdlib.h>
+#include <new>
+#include <chrono>
+#include <thread>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const uint64_t s_tasks = 1000000;
+static const uint64_t s_batch = 1000;     // 每批任务完成后再投递下一批，限制同时存活的协程数
+
+// 统计全局operator new的调用次数，用来确认调度路径上是否还有堆分配
+static std::atomic<uint64_t> s_allocs{0};
+
+void* operator new(size_t size) {
+    s_allocs.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+static std::atomic<uint64_t> s_done{0};
+
+// 捕获40字节左右的状态，和实际业务中捕获this、fd、几个参数的回调差不多大
+struct Payload {
+    uint64_t a, b, c, d, e;
+};
+
+static void wait_done(uint64_t target) {
+    while(s_done.load(std::memory_order_acquire) < target) {
+        std::this_thread::yield();
+    }
+}
+
+static void report(const std::string& name, uint64_t tasks, uint64_t allocs, std::chrono::steady_clock::duration d) {
+    double sec = std::chrono::duration<double>(d).count();
+    SYLAR_LOG_INFO(g_logger) << name << ": " << tasks << " tasks in " << sec << "s, "
+                             << (uint64_t)(tasks / sec) << " tasks/s, "
+                             << (double)allocs / tasks << " allocs/task";
+}
+
+// yield为true时任务中途让出一次，回调协程会被挂起再调度，结束后经过Fiber::Recycle复用
+static void run_round(sylar::Scheduler& sc, uint64_t base, bool yield, bool measure) {
+    Payload p{1, 2, 3, 4, 5};
+    uint64_t allocs = s_allocs.load();
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < s_tasks; ++i) {
+        p.a = i;
+        sc.schedule([p, yield](){
+            if(yield) {
+                sylar::Fiber::YieldToReady();
+            }
+            if(p.a + p.b + p.c + p.d + p.e) {
+                s_done.fetch_add(1, std::memory_order_release);
+            }
+        });
+        if((i + 1) % s_batch == 0) {
+            wait_done(base + i + 1);
+        }
+    }
+    auto d = std::chrono::steady_clock::now() - start;
+    if(measure) {
+        report(yield ? "yield" : "plain", s_tasks, s_allocs.load() - allocs, d);
+    }
+}
+
+// 扩展性测试：外部线程投递s_roots个根任务，每个根任务在工作线程内再派生s_fanout个叶子任务
+// 叶子任务进入派生线程的本地队列，其他线程只能通过窃取分担
+static const uint64_t s_roots = 200;
+static const uint64_t s_fanout = 1000;
+
+static void leaf_task() {
+    volatile uint64_t x = 0;
+    for(int i = 0; i < 200; ++i) {
+        x = x + i;
+    }
+    s_done.fetch_add(1, std::memory_order_release);
+}
+
+static void root_task() {
+    sylar::Scheduler* sc = sylar::Scheduler::GetThis();
+    for(uint64_t i = 0; i < s_fanout; ++i) {
+        sc->schedule(&leaf_task);
+    }
+}
+
+static void bench_scaling(size_t max_threads) {
+    double base_rate = 0;
+    for(size_t threads = 1; threads <= max_threads; threads *= 2) {
+        s_done = 0;
+        sylar::Scheduler sc(threads, false, "scale");
+        sc.start();
+        auto start = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < s_roots; ++i) {
+            sc.schedule(&root_task);
+        }
+        wait_done(s_roots * s_fanout);
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        sc.stop();
+
+        double rate = s_roots * s_fanout / sec;
+        if(threads == 1) {
+            base_rate = rate;
+        }
+        SYLAR_LOG_INFO(g_logger) << "scaling threads=" << threads << ": "
+                                 << (uint64_t)rate << " tasks/s, speedup " << rate / base_rate;
+        if(threads < max_threads && threads * 2 > max_threads) {
+            threads = max_threads / 2;  // 最后一轮使用max_threads
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::ERROR);
+    // 协程池至少要容纳一批任务，否则yield模式下多出来的协程结束后只能释放
+    sylar::Config::Lookup<uint32_t>("fiber.pool_size")->setValue(s_batch);
+
+    sylar::Scheduler sc(1, false, "bench");
+    sc.start();
+
+    uint64_t base = 0;
+    for(bool yield : {false, true}) {
+        // 第一轮预热，让链表节点、协程池和栈缓存都填满
+        run_round(sc, base, yield, false);
+        base += s_tasks;
+        run_round(sc, base, yield, true);
+        base += s_tasks;
+    }
+
+    sc.stop();
+
+    // 默认测到CPU核数，可以通过参数指定最大线程数
+    size_t max_threads = argc > 1 ? atoi(argv[1]) : std::thread::hardware_concurrency();
+    bench_scaling(std::max<size_t>(max_threads, 1));
+    return 0;
+}
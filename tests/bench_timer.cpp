@@ -0,0 +1,78 @@
+#include "../sylar/include/sylar.h"
+#include <unistd.h>
+#include <chrono>
+#include <random>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static const size_t s_timers = 1000000;
+
+// 只测堆本身，不需要唤醒任何线程
+class BenchTimerManager : public sylar::TimerManager {
+protected:
+    void onTimerInsertedAtFront() override {}
+};
+
+static void report(const std::string& name, size_t ops, std::chrono::steady_clock::duration d) {
+    double sec = std::chrono::duration<double>(d).count();
+    SYLAR_LOG_INFO(g_logger) << name << ": " << ops << " ops in " << sec << "s, "
+                             << (uint64_t)(ops / sec) << " ops/s, "
+                             << sec * 1e9 / ops << " ns/op";
+}
+
+int main(int argc, char** argv) {
+    BenchTimerManager mgr;
+    std::vector<sylar::Timer::ptr> timers;
+    timers.reserve(s_timers);
+
+    std::mt19937 rng(42);
+    std::vector<uint64_t> delays(s_timers);
+    for(auto& i : delays) {
+        i = 1000 + rng() % 60000;
+    }
+    uint64_t fired = 0;
+    auto cb = [&fired](){ ++fired; };
+
+    // 随机到期时间插入
+    auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < s_timers; ++i) {
+        timers.push_back(mgr.addTimer(delays[i], cb));
+    }
+    report("insert", s_timers, std::chrono::steady_clock::now() - start);
+
+    // 随机顺序取消，堆中的下标让取消不需要查找
+    std::shuffle(timers.begin(), timers.end(), rng);
+    start = std::chrono::steady_clock::now();
+    for(auto& i : timers) {
+        i->cancel();
+    }
+    report("cancel", s_timers, std::chrono::steady_clock::now() - start);
+    SYLAR_ASSERT(!mgr.hasTimer());
+    timers.clear();
+
+    // 全部在同一时刻到期，一次取出
+    for(size_t i = 0; i < s_timers; ++i) {
+        mgr.addTimer(rng() % 50, cb);
+    }
+    usleep(100 * 1000);
+    std::vector<std::function<void()> > cbs;
+    cbs.reserve(s_timers);
+    start = std::chrono::steady_clock::now();
+    mgr.listExpiredCallbacks(cbs);
+    for(auto& i : cbs) {
+        i();
+    }
+    report("fire", s_timers, std::chrono::steady_clock::now() - start);
+    SYLAR_ASSERT(fired == s_timers);
+
+    // 没有到期定时器时触发路径只读一个原子变量
+    mgr.addTimer(60000, cb);
+    const size_t polls = 10000000;
+    start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < polls; ++i) {
+        cbs.clear();
+        mgr.listExpiredCallbacks(cbs);
+    }
+    report("poll(empty)", polls, std::chrono::steady_clock::now() - start);
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include "../sylar/include/binlog.h"
+#include "../sylar/include/macro.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <sstream>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("binlog");
+
+static std::string s_path = "/tmp/test_binlog_" + std::to_string(getpid()) + ".bin";
+
+// 记录走文本日志时输出的内容
+class TextLogAppender : public sylar::LogAppender {
+public:
+    using ptr = std::shared_ptr<TextLogAppender>;
+    void log(const sylar::Logger::ptr& logger, sylar::LogLevel::Level level, const sylar::LogEvent& event) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_data += getFormatter()->format(logger, level, event);
+    }
+    void write(const struct iovec* iov, int iovcnt) override {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for(int i = 0; i < iovcnt; ++i) {
+            m_data.append((const char*)iov[i].iov_base, iov[i].iov_len);
+        }
+    }
+    std::string getData() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_data;
+    }
+private:
+    std::mutex m_mutex;
+    std::string m_data;
+};
+
+// 多线程写入各种类型的参数，读回来的内容和snprintf的结果一致，时间戳有序
+void test_roundtrip() {
+    SYLAR_ASSERT(sylar::BinLog::Open(s_path, 4096, 5));
+    uint64_t start = time(0);
+    const int threads = 4;
+    const int lines = 5000;
+    std::vector<std::thread> ths;
+    for(int t = 0; t < threads; ++t) {
+        ths.emplace_back([t](){
+            std::string name = "worker_" + std::to_string(t);
+            for(int i = 0; i < lines; ++i) {
+                SYLAR_BINLOG_FMT_INFO(g_logger, "%s line=%d hex=%#x u=%lu f=%.2f c=%c [%5s] %p %%",
+                        name, i, i, (unsigned long)i * 1000, i / 4.0, 'a' + t, "ab", (void*)0x1234);
+            }
+            SYLAR_BINLOG_FMT_WARN(g_logger, "done");
+        });
+    }
+    for(auto& i : ths) {
+        i.join();
+    }
+    // 负数和窄类型按参数原本的宽度输出，和printf(文本日志)一致
+    #define XX_WIDTH_ARGS -1, -1, (short)-1, -8, -1, 300, 4294967295u, -1L, -1L, (int8_t)-1
+    const char* width_fmt = "x=%x u=%u X=%X o=%o hx=%hx hhu=%hhu d=%d ld=%ld lx=%lx c8=%u";
+    SYLAR_BINLOG_FMT_ERROR(g_logger, width_fmt, XX_WIDTH_ARGS);
+    char width_expect[256];
+    snprintf(width_expect, sizeof(width_expect), width_fmt, XX_WIDTH_ARGS);
+    #undef XX_WIDTH_ARGS
+    sylar::BinLog::Flush();
+    sylar::BinLog::Close();
+    // 关闭之后退回文本日志
+    SYLAR_BINLOG_FMT_INFO(g_logger, "after close %d", 1);
+
+    sylar::BinLogReader reader(s_path);
+    SYLAR_ASSERT(reader.isValid());
+    std::vector<int> next(threads, 0);
+    size_t done = 0;
+    size_t width = 0;
+    uint64_t last = 0;
+    SYLAR_ASSERT(reader.read([&](const sylar::BinLogReader::Record& r) {
+        SYLAR_ASSERT(r.site->logger == "binlog");
+        SYLAR_ASSERT(r.time >= last);
+        SYLAR_ASSERT(r.time / 1000000000ull + 1 >= start && r.time / 1000000000ull <= (uint64_t)time(0));
+        last = r.time;
+        if(r.site->level == sylar::LogLevel::WARN) {
+            SYLAR_ASSERT(r.message == "done");
+            ++done;
+            return;
+        }
+        if(r.site->level == sylar::LogLevel::ERROR) {
+            SYLAR_ASSERT2(r.message == width_expect, r.message << " != " << width_expect);
+            ++width;
+            return;
+        }
+        // 同一个线程内的顺序不变
+        int t = r.message[7] - '0';
+        int i = next[t]++;
+        char expect[256];
+        snprintf(expect, sizeof(expect), "worker_%d line=%d hex=%#x u=%lu f=%.2f c=%c [%5s] %p %%",
+                t, i, i, (unsigned long)i * 1000, i / 4.0, 'a' + t, "ab", (void*)0x1234);
+        SYLAR_ASSERT2(r.message == expect, r.message << " != " << expect);
+    }));
+    SYLAR_ASSERT(done == threads);
+    SYLAR_ASSERT(width == 1);
+    for(int t = 0; t < threads; ++t) {
+        SYLAR_ASSERT(next[t] == lines);
+    }
+    std::cout << "roundtrip ok, records=" << threads * lines + done + width << std::endl;
+}
+
+// 重新打开到新文件，之前注册过的调用点重新写入
+void test_reopen() {
+    TextLogAppender::ptr text(new TextLogAppender);
+    text->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+    g_logger->addAppender(text);
+    for(int round = 0; round < 2; ++round) {
+        SYLAR_ASSERT(sylar::BinLog::Open(s_path));
+        for(int i = 0; i < 3; ++i) {
+            SYLAR_BINLOG_FMT_ERROR(g_logger, "round %d item %d", round, i);
+        }
+        std::string big(1 << 20, 'x');
+        SYLAR_BINLOG_FMT_DEBUG(g_logger, "%s", big.substr(0, 10));
+        // 超过线程缓冲区1/4的记录不进入二进制日志，退回文本日志
+        SYLAR_BINLOG_FMT_DEBUG(g_logger, "big %d %s", round, big.c_str());
+        sylar::BinLog::Close();
+
+        std::vector<std::string> msgs;
+        SYLAR_ASSERT(sylar::BinLogReader(s_path).read([&](const sylar::BinLogReader::Record& r) {
+            msgs.push_back(r.message);
+        }));
+        SYLAR_ASSERT(msgs.size() == 4);
+        SYLAR_ASSERT(msgs[2] == "round " + std::to_string(round) + " item 2");
+        SYLAR_ASSERT(msgs[3] == "xxxxxxxxxx");
+        std::string expect = "big " + std::to_string(round) + " " + big + "\n";
+        SYLAR_ASSERT(text->getData().find(expect) != std::string::npos);
+    }
+    g_logger->delAppender(text);
+    unlink(s_path.c_str());
+}
+
+// 还原成文本时保留纳秒时间戳和启动后的毫秒数
+void test_decode() {
+    SYLAR_ASSERT(sylar::BinLog::Open(s_path));
+    uint64_t start = sylar::Clock::ElapsedMS();
+    for(int i = 0; i < 3; ++i) {
+        SYLAR_BINLOG_FMT_INFO(g_logger, "n=%d", i);
+        usleep(1200);
+    }
+    uint64_t end = sylar::Clock::ElapsedMS();
+    sylar::BinLog::Close();
+
+    std::stringstream ss;
+    sylar::LogFormatter::ptr formatter(new sylar::LogFormatter("%d{%H:%M:%S.%6N} %r %m%n"));
+    SYLAR_ASSERT(sylar::BinLogReader(s_path).format(formatter, ss));
+    std::cout << ss.str();
+    std::string line;
+    std::vector<int64_t> us;
+    for(int i = 0; std::getline(ss, line); ++i) {
+        int h = 0, m = 0, sec = 0, frac = 0, n = -1;
+        unsigned long elapse = 0;
+        SYLAR_ASSERT2(sscanf(line.c_str(), "%d:%d:%d.%d %lu n=%d", &h, &m, &sec, &frac, &elapse, &n) == 6, line);
+        SYLAR_ASSERT(n == i);
+        SYLAR_ASSERT(elapse >= start && elapse <= end);
+        us.push_back(((h * 60 + m) * 60 + sec) * 1000000ll + frac);
+    }
+    SYLAR_ASSERT(us.size() == 3);
+    // 相邻两条相差1.2ms以上，秒以下的部分不是全0
+    for(size_t i = 1; i < us.size(); ++i) {
+        int64_t diff = us[i] - us[i - 1];
+        if(diff < 0) {
+            diff += 86400 * 1000000ll;
+        }
+        SYLAR_ASSERT2(diff >= 1200 && diff < 1000000, "diff=" << diff);
+    }
+    unlink(s_path.c_str());
+}
+
+int main(int argc, char** argv) {
+    test_roundtrip();
+    test_reopen();
+    test_decode();
+    return 0;
+}
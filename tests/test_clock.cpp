@@ -0,0 +1,87 @@
+#include "../sylar/include/clock.h"
+#include "../sylar/include/log.h"
+#include "../sylar/include/macro.h"
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static uint64_t abs_diff(uint64_t a, uint64_t b) {
+    return a > b ? a - b : b - a;
+}
+
+// 外推的时间和系统时钟的误差、单调性
+void test_now() {
+    SYLAR_LOG_INFO(g_logger) << "tsc enabled=" << sylar::Clock::IsTscEnabled()
+                             << " ticks/ns=" << sylar::Clock::TicksPerNs();
+    std::vector<std::thread> ths;
+    std::atomic<uint64_t> max_error = {0};
+    for(int t = 0; t < 4; ++t) {
+        ths.emplace_back([&max_error](){
+            uint64_t last = 0;
+            uint64_t error = 0;
+            for(int i = 0; i < 200000; ++i) {
+                uint64_t before = sylar::Clock::RealtimeNS();
+                uint64_t realtime;
+                uint64_t monotonic;
+                sylar::Clock::Now(&realtime, &monotonic);
+                uint64_t after = sylar::Clock::RealtimeNS();
+                // 同一线程内不倒退
+                SYLAR_ASSERT(monotonic >= last);
+                last = monotonic;
+                if(realtime < before) {
+                    error = std::max(error, before - realtime);
+                } else if(realtime > after) {
+                    error = std::max(error, realtime - after);
+                }
+                if(i % 50000 == 0) {
+                    usleep(1000);
+                }
+            }
+            uint64_t cur = max_error;
+            while(error > cur && !max_error.compare_exchange_weak(cur, error));
+        });
+    }
+    for(auto& i : ths) {
+        i.join();
+    }
+    SYLAR_LOG_INFO(g_logger) << "max error=" << max_error << "ns";
+    // 一个同步间隔内的频率误差加上调度延迟，远小于1ms
+    SYLAR_ASSERT(max_error < 1000000);
+    SYLAR_ASSERT(abs_diff(sylar::Clock::NowMonotonicNS(), sylar::Clock::MonotonicNS()) < 1000000);
+}
+
+void test_elapsed() {
+    uint64_t start = sylar::Clock::ElapsedMS();
+    usleep(50 * 1000);
+    uint64_t elapsed = sylar::Clock::ElapsedMS() - start;
+    SYLAR_ASSERT(elapsed >= 49 && elapsed < 1000);
+    SYLAR_ASSERT(sylar::Clock::MonotonicNS() > sylar::Clock::StartMonotonicNS());
+    SYLAR_ASSERT(abs_diff(sylar::Clock::CoarseRealtimeNS(), sylar::Clock::RealtimeNS()) < 100000000);
+    SYLAR_ASSERT(abs_diff(sylar::Clock::CoarseMonotonicMS(), sylar::Clock::MonotonicMS()) < 100);
+}
+
+// 日志事件带纳秒时间戳和启动后的毫秒数
+void test_log_event() {
+    sylar::Logger::ptr logger(new sylar::Logger("clock"));
+    uint64_t before = sylar::Clock::RealtimeNS();
+    uint64_t time_ns = 0;
+    uint32_t elapse = 0;
+    {
+        sylar::LogEventWrap wrap(logger, sylar::LogLevel::INFO, __FILE__, __LINE__);
+        time_ns = wrap.getEvent().getTimeNS();
+        elapse = wrap.getEvent().getElapse();
+    }
+    uint64_t after = sylar::Clock::RealtimeNS();
+    SYLAR_ASSERT(time_ns + 1000000 >= before && time_ns <= after + 1000000);
+    SYLAR_ASSERT(abs_diff(elapse, sylar::Clock::ElapsedMS()) <= 1);
+}
+
+int main(int argc, char** argv) {
+    test_now();
+    test_elapsed();
+    test_log_event();
+    return 0;
+}
@@ -1,6 +1,9 @@
 #include "../sylar/include/config.h"
 #include "../sylar/include/log.h"
+#include "../sylar/include/macro.h"
 #include <yaml-cpp/yaml.h>
+#include <atomic>
+#include <thread>
 
 sylar::ConfigVar<int>::ptr g_int_value_config = 
     sylar::Config::Lookup("system.port", (int)8080, "system port");
@@ -179,8 +182,224 @@ void test_class() {
     XX_PM(g_person_map, "class.map after");
     SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "after: " << g_person_vec_map->toString();
 }
+// 快照读：引用跟随修改，持有的快照不变，并发读到的总是某一次完整写入的值
+void test_rcu() {
+    auto var = sylar::Config::Lookup("test.rcu", std::vector<int>(8, 0), "rcu");
+    SYLAR_ASSERT(var->getRef() == std::vector<int>(8, 0));
+    auto snapshot = var->getSnapshot();
+    int old_first = -1;
+    int new_first = -1;
+    uint64_t id = var->addListener([&](const std::vector<int>& old_value, const std::vector<int>& new_value){
+        old_first = old_value[0];
+        new_first = new_value[0];
+    });
+    var->setValue(std::vector<int>(8, 1));
+    SYLAR_ASSERT(old_first == 0 && new_first == 1);
+    SYLAR_ASSERT(var->getRef() == std::vector<int>(8, 1));
+    SYLAR_ASSERT(var->getValue() == std::vector<int>(8, 1));
+    SYLAR_ASSERT(*snapshot == std::vector<int>(8, 0));
+    var->delListener(id);
+    // 值没变不通知
+    old_first = -1;
+    var->setValue(std::vector<int>(8, 1));
+    SYLAR_ASSERT(old_first == -1);
+    SYLAR_ASSERT(var->fromString("[5, 5, 5, 5, 5, 5, 5, 5]") && var->getRef()[0] == 5);
+    SYLAR_ASSERT(!var->fromString("[x"));
+    SYLAR_ASSERT(var->toString().find('5') != std::string::npos);
+
+    std::atomic<bool> stop = {false};
+    std::vector<std::thread> readers;
+    for(int t = 0; t < 4; ++t) {
+        readers.emplace_back([&](){
+            int last = 0;
+            while(!stop) {
+                const std::vector<int>& v = var->getRef();
+                for(int i : v) {
+                    SYLAR_ASSERT(i == v[0]);
+                }
+                SYLAR_ASSERT(v[0] >= last);
+                last = v[0];
+            }
+        });
+    }
+    for(int i = 6; i < 2000; ++i) {
+        var->setValue(std::vector<int>(8, i));
+    }
+    stop = true;
+    for(auto& i : readers) {
+        i.join();
+    }
+    SYLAR_ASSERT(var->getRef()[0] == 1999);
+}
+
+// 节点树直接转换：和按字符串解析的结果一致，往返不变，嵌套的自定义类型走LexicalCast
+void test_yaml_cast() {
+    const char* text =
+        "yaml_cast:\n"
+        "  strs: [\"a: b\", \"#c\", plain, \"\"]\n"
+        "  nested:\n"
+        "    x: [[1, 2], [3]]\n"
+        "    y: []\n"
+        "  people:\n"
+        "    team:\n"
+        "      - {name: tom, age: 20, sex: true}\n"
+        "      - {name: \"j: r\", age: 30, sex: false}\n";
+    auto strs = sylar::Config::Lookup("yaml_cast.strs", std::vector<std::string>(), "strs");
+    auto nested = sylar::Config::Lookup("yaml_cast.nested", std::map<std::string, std::vector<std::vector<int> > >(), "nested");
+    auto people = sylar::Config::Lookup("yaml_cast.people", std::map<std::string, std::vector<Person> >(), "people");
+    sylar::Config::LoadFromYaml(YAML::Load(text));
+
+    SYLAR_ASSERT(strs->getRef() == std::vector<std::string>({"a: b", "#c", "plain", ""}));
+    SYLAR_ASSERT(nested->getRef().at("x") == std::vector<std::vector<int> >({{1, 2}, {3}}));
+    SYLAR_ASSERT(nested->getRef().at("y").empty());
+    const auto& team = people->getRef().at("team");
+    SYLAR_ASSERT(team.size() == 2 && team[0].m_name == "tom" && team[0].m_age == 20 && team[0].m_sex);
+    SYLAR_ASSERT(team[1].m_name == "j: r" && team[1].m_age == 30 && !team[1].m_sex);
+
+    // 往返：toString再fromString得到相同的值
+    auto strs2 = sylar::Config::Lookup("yaml_cast.strs2", std::vector<std::string>(), "strs2");
+    SYLAR_ASSERT(strs2->fromString(strs->toString()) && strs2->getRef() == strs->getRef());
+    auto people2 = sylar::Config::Lookup("yaml_cast.people2", std::map<std::string, std::vector<Person> >(), "people2");
+    SYLAR_ASSERT(people2->fromString(people->toString()) && people2->getRef() == people->getRef());
+    YAML::Node node = sylar::YamlCast<std::map<std::string, std::vector<std::vector<int> > >, YAML::Node>()(nested->getRef());
+    SYLAR_ASSERT(node["x"][1][0].as<int>() == 3);
+    SYLAR_ASSERT((sylar::YamlCast<YAML::Node, std::map<std::string, std::vector<std::vector<int> > > >()(node) == nested->getRef()));
+
+    // 类型不对时保留原值
+    SYLAR_ASSERT(!nested->fromYaml(YAML::Load("{x: [[a]]}")));
+    SYLAR_ASSERT(nested->getRef().at("x").size() == 2);
+}
+
+// 批量加载：整批生效或整批不生效，回调中看到的是整批生效后的配置，并发读到的总是同一批次的值
+void test_batch() {
+    auto a = sylar::Config::Lookup("batch.a", 0, "a");
+    auto b = sylar::Config::Lookup("batch.b", 0, "b");
+    auto list = sylar::Config::Lookup("batch.list", std::vector<int>(), "list");
+    int a_changes = 0;
+    int b_in_a = -1;
+    a->addListener([&](const int& old_value, const int& new_value){
+        ++a_changes;
+        b_in_a = b->getValue();
+    });
+    std::vector<std::string> changed;
+    int batches = 0;
+    uint64_t id = sylar::Config::AddBatchListener([&](const std::vector<sylar::ConfigVarBase::ptr>& vars){
+        ++batches;
+        changed.clear();
+        for(auto& i : vars) {
+            changed.push_back(i->getName());
+        }
+    });
+
+    SYLAR_ASSERT(sylar::Config::LoadFromYaml(YAML::Load("batch: {a: 1, b: 2, list: [1]}")));
+    SYLAR_ASSERT(a->getValue() == 1 && b->getValue() == 2 && list->getRef() == std::vector<int>({1}));
+    SYLAR_ASSERT(a_changes == 1 && b_in_a == 2);
+    SYLAR_ASSERT(batches == 1 && changed == std::vector<std::string>({"batch.a", "batch.b", "batch.list"}));
+
+    // 只有变化的配置项通知，没有变化的批次不调用批量回调
+    SYLAR_ASSERT(sylar::Config::LoadFromYaml(YAML::Load("batch: {a: 1, b: 3, list: [1]}")));
+    SYLAR_ASSERT(a_changes == 1 && batches == 2 && changed == std::vector<std::string>({"batch.b"}));
+    SYLAR_ASSERT(sylar::Config::LoadFromYaml(YAML::Load("batch: {a: 1, b: 3}")));
+    SYLAR_ASSERT(batches == 2);
+
+    // 一项转换失败，其他项都不生效也不通知
+    SYLAR_ASSERT(!sylar::Config::LoadFromYaml(YAML::Load("batch: {a: 5, b: 6, list: [x]}")));
+    SYLAR_ASSERT(a->getValue() == 1 && b->getValue() == 3 && list->getRef() == std::vector<int>({1}));
+    SYLAR_ASSERT(a_changes == 1 && batches == 2);
+
+    // 非法的名字跳过整棵子树，不影响其他项
+    SYLAR_ASSERT(sylar::Config::LoadFromYaml(YAML::Load("Batch: {a: 7}\nbatch: {b: 8}")));
+    SYLAR_ASSERT(a->getValue() == 1 && b->getValue() == 8);
+    sylar::Config::DelBatchListener(id);
+
+    // 读线程启动前a和b先取相等的值，之后每次批量加载都同时修改两项
+    SYLAR_ASSERT(sylar::Config::LoadFromYaml(YAML::Load("batch: {a: 9, b: 9}")));
+    SYLAR_ASSERT(a->getValue() == 9 && b->getValue() == 9);
+    std::atomic<bool> stop = {false};
+    std::vector<std::thread> readers;
+    for(int t = 0; t < 4; ++t) {
+        readers.emplace_back([&](){
+            while(!stop) {
+                int x = 0;
+                int y = 0;
+                sylar::Config::ReadConsistent([&](){
+                    x = a->getValue();
+                    y = b->getValue();
+                });
+                SYLAR_ASSERT(x == y);
+            }
+        });
+    }
+    for(int i = 10; i < 2000; ++i) {
+        std::string n = std::to_string(i);
+        sylar::Config::LoadFromYaml(YAML::Load("batch: {a: " + n + ", b: " + n + "}"));
+    }
+    stop = true;
+    for(auto& i : readers) {
+        i.join();
+    }
+    SYLAR_ASSERT(a->getValue() == 1999 && b->getValue() == 1999);
+}
+
+// 句柄：注册前解析的句柄在注册后生效，带类型的句柄检查类型，并发注册时按句柄读取不受影响
+void test_key() {
+    sylar::ConfigKey early = sylar::Config::Key("key.early");
+    SYLAR_ASSERT(early.isValid() && early.get() == nullptr);
+    SYLAR_ASSERT(!sylar::Config::Key("Key.Bad").isValid());
+    SYLAR_ASSERT(!sylar::Config::Key<int>("key.early").isValid());
+    SYLAR_ASSERT(!sylar::ConfigKey().isValid() && sylar::ConfigKey().get() == nullptr);
+
+    auto var = sylar::Config::Lookup("key.early", 5, "early");
+    SYLAR_ASSERT(early.get() == var.get());
+    SYLAR_ASSERT(sylar::Config::Key("key.early").getIndex() == early.getIndex());
+    SYLAR_ASSERT(sylar::Config::LookupBase("key.early") == var);
+    SYLAR_ASSERT(sylar::Config::Lookup<int>("key.early") == var);
+    SYLAR_ASSERT(!sylar::Config::Lookup<std::string>("key.early"));
+
+    sylar::TypedConfigKey<int> typed = sylar::Config::Key<int>("key.early");
+    SYLAR_ASSERT(typed.isValid() && typed.get() == var.get() && typed.getRef() == 5);
+    SYLAR_ASSERT(!sylar::Config::Key<std::string>("key.early").isValid());
+    sylar::Config::LoadFromYaml(YAML::Load("key: {early: 6}"));
+    SYLAR_ASSERT(typed->getRef() == 6);
+
+    // 注册表跨越多个分段，读者持有的句柄一直有效
+    std::vector<sylar::ConfigVar<int>::ptr> vars;
+    std::vector<sylar::ConfigKey> keys;
+    for(int i = 0; i < 100; ++i) {
+        std::string name = "key.many.k" + std::to_string(i);
+        vars.push_back(sylar::Config::Lookup(name, i, "many"));
+        keys.push_back(sylar::Config::Key(name));
+    }
+    std::atomic<bool> stop = {false};
+    std::thread reader([&](){
+        while(!stop) {
+            for(int i = 0; i < 100; ++i) {
+                SYLAR_ASSERT(keys[i].get() == vars[i].get());
+            }
+        }
+    });
+    for(int i = 0; i < 3000; ++i) {
+        sylar::Config::Lookup("key.more.k" + std::to_string(i), i, "more");
+    }
+    stop = true;
+    reader.join();
+    SYLAR_ASSERT(sylar::Config::Key<int>("key.more.k2999").getRef() == 2999);
+
+    // 按注册顺序遍历
+    std::vector<std::string> names;
+    sylar::Config::Visit([&](sylar::ConfigVarBase::ptr v){
+        if(v->getName().compare(0, 9, "key.many.") == 0) {
+            names.push_back(v->getName());
+        }
+    });
+    SYLAR_ASSERT(names.size() == 100 && names[0] == "key.many.k0" && names[99] == "key.many.k99");
+}
+
 int main(int argc, char** argv) {
-    
+    test_rcu();
+    test_yaml_cast();
+    test_batch();
+    test_key();
     test_class();
 
     sylar::Config::Visit([](sylar::ConfigVarBase::ptr var){
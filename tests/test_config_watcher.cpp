@@ -0,0 +1,127 @@
+#include "../sylar/include/sylar.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <fstream>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static sylar::ConfigVar<int>::ptr g_level =
+    sylar::Config::Lookup("watch.level", 0, "watch level");
+static sylar::ConfigVar<std::vector<int> >::ptr g_list =
+    sylar::Config::Lookup("watch.list", std::vector<int>(), "watch list");
+static sylar::ConfigVar<std::string>::ptr g_name =
+    sylar::Config::Lookup("other.name", std::string(), "other name");
+
+static std::atomic<int> s_level_changes = {0};
+static std::atomic<int> s_list_changes = {0};
+static std::atomic<int> s_name_changes = {0};
+
+static void write_file(const std::string& path, const std::string& content) {
+    std::ofstream ofs(path, std::ios::trunc);
+    ofs << content;
+}
+
+// 写临时文件再rename，和多数编辑器保存的方式一样
+static void replace_file(const std::string& path, const std::string& content) {
+    write_file(path + ".tmp", content);
+    SYLAR_ASSERT(!rename((path + ".tmp").c_str(), path.c_str()));
+}
+
+// 等到加载次数达到n，再多等一个防抖间隔确认没有多余的加载
+static void wait_reload(sylar::ConfigWatcher::ptr watcher, uint64_t n) {
+    for(int i = 0; i < 200 && watcher->getReloadCount() < n; ++i) {
+        usleep(10 * 1000);
+    }
+    usleep(150 * 1000);
+    SYLAR_ASSERT(watcher->getReloadCount() == n);
+}
+
+void test_watch() {
+    char tmpl[] = "/tmp/test_config_watcher_XXXXXX";
+    std::string dir = mkdtemp(tmpl);
+    std::string a = dir + "/a.yml";
+    std::string b = dir + "/b.yml";
+    write_file(a, "watch:\n  level: 1\n  list: [1, 2]\n");
+    write_file(b, "other:\n  name: x\n");
+
+    g_level->addListener([](const int& old_value, const int& new_value){
+        ++s_level_changes;
+    });
+    g_list->addListener([](const std::vector<int>& old_value, const std::vector<int>& new_value){
+        ++s_list_changes;
+    });
+    g_name->addListener([](const std::string& old_value, const std::string& new_value){
+        ++s_name_changes;
+    });
+
+    sylar::IOManager iom(1, false, "watch");
+    sylar::ConfigWatcher::ptr watcher(new sylar::ConfigWatcher(&iom, 50));
+    SYLAR_ASSERT(watcher->isValid());
+    // 添加时立即加载
+    SYLAR_ASSERT(watcher->addFile(a));
+    SYLAR_ASSERT(watcher->addFile(b));
+    SYLAR_ASSERT(watcher->start());
+    SYLAR_ASSERT(g_level->getValue() == 1 && g_list->getValue() == std::vector<int>({1, 2}));
+    SYLAR_ASSERT(g_name->getValue() == "x");
+    SYLAR_ASSERT(s_level_changes == 1 && s_list_changes == 1 && s_name_changes == 1);
+
+    // 一连串写入合并成一次加载，只有最后的值生效，只通知一次
+    for(int i = 2; i <= 6; ++i) {
+        write_file(a, "watch:\n  level: " + std::to_string(i) + "\n  list: [1, 2]\n");
+        usleep(5 * 1000);
+    }
+    wait_reload(watcher, 3);
+    SYLAR_ASSERT(g_level->getValue() == 6);
+    SYLAR_ASSERT(s_level_changes == 2 && s_list_changes == 1 && s_name_changes == 1);
+
+    // 只改一项，另一项和另一个文件都不受影响
+    replace_file(a, "watch:\n  level: 6\n  list: [3]\n");
+    wait_reload(watcher, 4);
+    SYLAR_ASSERT(g_list->getValue() == std::vector<int>({3}));
+    SYLAR_ASSERT(s_level_changes == 2 && s_list_changes == 2 && s_name_changes == 1);
+
+    // 内容不变：重新加载但没有通知
+    write_file(a, "watch:\n  level: 6\n  list: [3]\n");
+    wait_reload(watcher, 5);
+    SYLAR_ASSERT(s_level_changes == 2 && s_list_changes == 2);
+
+    // 同目录下没有监视的文件不触发加载
+    write_file(dir + "/c.yml", "watch:\n  level: 100\n");
+    wait_reload(watcher, 5);
+    SYLAR_ASSERT(g_level->getValue() == 6);
+
+    // 格式错误时保留原值，改好之后正常加载
+    write_file(a, "watch: [\n");
+    usleep(200 * 1000);
+    SYLAR_ASSERT(g_level->getValue() == 6 && g_list->getValue() == std::vector<int>({3}));
+    // 有一项转换失败时整个文件都不生效
+    write_file(a, "watch:\n  level: abc\n  list: [4]\n");
+    usleep(200 * 1000);
+    SYLAR_ASSERT(watcher->getReloadCount() == 5);
+    SYLAR_ASSERT(g_level->getValue() == 6 && g_list->getValue() == std::vector<int>({3}));
+    SYLAR_ASSERT(s_level_changes == 2 && s_list_changes == 2);
+    write_file(a, "watch:\n  level: 7\n  list: [3]\n");
+    wait_reload(watcher, 6);
+    SYLAR_ASSERT(g_level->getValue() == 7 && s_level_changes == 3 && s_list_changes == 2);
+
+    replace_file(b, "other:\n  name: y\n");
+    wait_reload(watcher, 7);
+    SYLAR_ASSERT(g_name->getValue() == "y" && s_name_changes == 2);
+
+    // 停止之后不再加载，IOManager没有挂着的事件可以正常退出
+    watcher->stop();
+    write_file(a, "watch:\n  level: 8\n");
+    usleep(200 * 1000);
+    SYLAR_ASSERT(g_level->getValue() == 7);
+    SYLAR_LOG_INFO(g_logger) << "reloads=" << watcher->getReloadCount();
+
+    std::string cmd = "rm -rf " + dir;
+    SYLAR_ASSERT(!system(cmd.c_str()));
+}
+
+int main(int argc, char** argv) {
+    test_watch();
+    return 0;
+}
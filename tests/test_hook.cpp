@@ -0,0 +1,147 @@
+#include "../sylar/include/sylar.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 两个协程各sleep一段时间，hook后只挂起协程，单线程上总耗时取最长的一个
+void test_sleep() {
+    sylar::IOManager iom(1, false, "sleep");
+    std::atomic<int> done{0};
+    uint64_t start = sylar::GetMonotonicMS();
+    iom.schedule([&done](){
+        sleep(1);
+        ++done;
+    });
+    iom.schedule([&done](){
+        usleep(500 * 1000);
+        ++done;
+    });
+    iom.schedule([&done](){
+        struct timespec ts = {0, 800 * 1000 * 1000};
+        nanosleep(&ts, nullptr);
+        ++done;
+    });
+    iom.stop();
+    uint64_t elapsed = sylar::GetMonotonicMS() - start;
+    SYLAR_LOG_INFO(g_logger) << "sleep done=" << done << " elapsed=" << elapsed << "ms";
+    SYLAR_ASSERT(done == 3);
+    SYLAR_ASSERT(elapsed >= 1000 && elapsed < 1500);
+}
+
+static int listen_local(uint16_t& port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    SYLAR_ASSERT(fd >= 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    SYLAR_ASSERT(!bind(fd, (sockaddr*)&addr, sizeof(addr)));
+    SYLAR_ASSERT(!listen(fd, 16));
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr*)&addr, &len);
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// 阻塞风格的accept/connect/recv/send，在同一个线程的多个协程之间交替执行
+void test_socket() {
+    sylar::IOManager iom(1, false, "socket");
+    std::atomic<int> done{0};
+    uint16_t port = 0;
+    int lfd = -1;
+
+    iom.schedule([&](){
+        lfd = listen_local(port);
+        iom.schedule([&](){
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(port);
+            int rt = connect(fd, (sockaddr*)&addr, sizeof(addr));
+            SYLAR_ASSERT(!rt);
+            // 先让服务端的recv挂起，再发送
+            usleep(50 * 1000);
+            rt = send(fd, "ping", 4, 0);
+            SYLAR_ASSERT(rt == 4);
+            char buf[16] = {0};
+            rt = recv(fd, buf, sizeof(buf), 0);
+            SYLAR_LOG_INFO(g_logger) << "client recv rt=" << rt << " data=" << buf;
+            SYLAR_ASSERT(rt == 4 && !strcmp(buf, "pong"));
+            close(fd);
+            ++done;
+        });
+
+        int fd = accept(lfd, nullptr, nullptr);
+        SYLAR_ASSERT(fd >= 0);
+        // 用户视角下socket仍然是阻塞的
+        SYLAR_ASSERT(!(fcntl(fd, F_GETFL) & O_NONBLOCK));
+        char buf[16] = {0};
+        int rt = recv(fd, buf, sizeof(buf), 0);
+        SYLAR_LOG_INFO(g_logger) << "server recv rt=" << rt << " data=" << buf;
+        SYLAR_ASSERT(rt == 4 && !strcmp(buf, "ping"));
+        rt = send(fd, "pong", 4, 0);
+        SYLAR_ASSERT(rt == 4);
+        close(fd);
+        close(lfd);
+        ++done;
+    });
+    iom.stop();
+    SYLAR_ASSERT(done == 2);
+}
+
+// SO_RCVTIMEO由定时器实现，超时返回-1，errno为ETIMEDOUT
+void test_timeout() {
+    sylar::IOManager iom(1, false, "timeout");
+    std::atomic<int> done{0};
+    iom.schedule([&done](){
+        int fds[2];
+        SYLAR_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+        sylar::FdMgr::GetInstance()->get(fds[0], true);
+        timeval tv = {0, 200 * 1000};
+        setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        char buf[16];
+        uint64_t start = sylar::GetMonotonicMS();
+        int rt = recv(fds[0], buf, sizeof(buf), 0);
+        uint64_t elapsed = sylar::GetMonotonicMS() - start;
+        SYLAR_LOG_INFO(g_logger) << "recv timeout rt=" << rt << " errno=" << errno
+                                 << " elapsed=" << elapsed << "ms";
+        SYLAR_ASSERT(rt == -1 && errno == ETIMEDOUT);
+        SYLAR_ASSERT(elapsed >= 200 && elapsed < 400);
+        close(fds[0]);
+        close(fds[1]);
+        ++done;
+    });
+    iom.stop();
+    SYLAR_ASSERT(done == 1);
+}
+
+// 没有开启hook的线程直接调用原函数
+void test_no_hook() {
+    SYLAR_ASSERT(!sylar::is_hook_enable());
+    uint64_t start = sylar::GetMonotonicMS();
+    usleep(100 * 1000);
+    SYLAR_ASSERT(sylar::GetMonotonicMS() - start >= 100);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    test_no_hook();
+    // hook建立在addEvent和定时器上，两种后端都要覆盖
+    for(auto& backend : {"epoll", "io_uring"}) {
+        sylar::Config::Lookup<std::string>("iomanager.backend")->setValue(backend);
+        test_sleep();
+        test_socket();
+        test_timeout();
+    }
+    SYLAR_LOG_INFO(g_logger) << "over";
+    return 0;
+}
@@ -0,0 +1,257 @@
+#include "../sylar/include/sylar.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <chrono>
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+static int s_pipe[2];
+static std::atomic<int> s_events{0};
+
+// 协程在读端注册READ事件后挂起，写端写入数据后由idle中的epoll_wait唤醒
+void test_read_fiber() {
+    sylar::IOManager::GetThis()->addEvent(s_pipe[0], sylar::IOManager::READ);
+    sylar::Fiber::YieldToHold();
+
+    char buf[64] = {0};
+    int rt = read(s_pipe[0], buf, sizeof(buf) - 1);
+    SYLAR_LOG_INFO(g_logger) << "read fiber wakeup rt=" << rt << " data=" << buf;
+    SYLAR_ASSERT(rt == 5);
+    ++s_events;
+}
+
+void test_write_fiber() {
+    usleep(100 * 1000);
+    // 管道可写，WRITE事件的回调立即触发
+    sylar::IOManager::GetThis()->addEvent(s_pipe[1], sylar::IOManager::WRITE, [](){
+        int rt = write(s_pipe[1], "hello", 5);
+        SYLAR_LOG_INFO(g_logger) << "write callback rt=" << rt;
+        ++s_events;
+    });
+}
+
+void test_event() {
+    int rt = pipe(s_pipe);
+    SYLAR_ASSERT(!rt);
+    fcntl(s_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(s_pipe[1], F_SETFL, O_NONBLOCK);
+
+    {
+        sylar::IOManager iom(2, false, "event");
+        iom.schedule(&test_read_fiber);
+        iom.schedule(&test_write_fiber);
+    }
+    SYLAR_ASSERT(s_events == 2);
+
+    // 取消事件时也会触发一次回调
+    {
+        sylar::IOManager iom(1, false, "cancel");
+        iom.addEvent(s_pipe[0], sylar::IOManager::READ, [](){
+            SYLAR_LOG_INFO(g_logger) << "cancel callback";
+            ++s_events;
+        });
+        SYLAR_ASSERT(iom.cancelAll(s_pipe[0]));
+        SYLAR_ASSERT(!iom.cancelAll(s_pipe[0]));
+    }
+    SYLAR_ASSERT(s_events == 3);
+
+    // 调用线程作为工作线程，任务在析构调用stop()时由调用线程执行
+    {
+        sylar::IOManager iom(1, true, "caller");
+        iom.schedule(&test_read_fiber);
+        iom.schedule(&test_write_fiber);
+    }
+    SYLAR_ASSERT(s_events == 5);
+    close(s_pipe[0]);
+    close(s_pipe[1]);
+}
+
+// 一次性、循环和条件定时器
+void test_timer() {
+    sylar::IOManager iom(2, false, "timer");
+
+    std::atomic<int> once{0};
+    uint64_t start = sylar::GetMonotonicMS();
+    std::atomic<uint64_t> elapsed{0};
+    iom.addTimer(100, [&once, &elapsed, start](){
+        elapsed = sylar::GetMonotonicMS() - start;
+        ++once;
+    });
+
+    std::atomic<int> recurring{0};
+    sylar::Timer::ptr timer;
+    timer = iom.addTimer(20, [&recurring, &timer](){
+        if(++recurring == 3) {
+            timer->cancel();
+        }
+    }, true);
+
+    std::atomic<int> cond{0};
+    {
+        std::shared_ptr<int> alive(new int(0));
+        iom.addConditionTimer(10, [&cond](){ ++cond; }, alive);
+    }
+    std::shared_ptr<int> alive2(new int(0));
+    iom.addConditionTimer(10, [&cond](){ cond += 10; }, alive2);
+
+    // 重置到更早的时间后成为堆顶
+    std::atomic<int> reset{0};
+    sylar::Timer::ptr late = iom.addTimer(5000, [&reset](){ ++reset; });
+    SYLAR_ASSERT(late->reset(50, true));
+
+    sleep(1);
+    SYLAR_LOG_INFO(g_logger) << "timer once=" << once << " elapsed=" << elapsed
+                             << "ms recurring=" << recurring << " cond=" << cond
+                             << " reset=" << reset;
+    SYLAR_ASSERT(once == 1 && elapsed >= 100 && elapsed < 150);
+    SYLAR_ASSERT(recurring == 3);
+    SYLAR_ASSERT(cond == 10);
+    SYLAR_ASSERT(reset == 1);
+    SYLAR_ASSERT(!late->cancel());
+}
+
+static double cpu_seconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// 空闲时工作线程阻塞在epoll_wait中不消耗CPU，投递任务后通过tickle立即唤醒
+void test_idle() {
+    sylar::IOManager iom(4, false, "idle");
+    sleep(1);
+
+    double cpu = cpu_seconds();
+    sleep(1);
+    cpu = cpu_seconds() - cpu;
+    SYLAR_LOG_INFO(g_logger) << "idle cpu usage: " << cpu * 100 << "%";
+    SYLAR_ASSERT(cpu < 0.05);
+
+    const int rounds = 1000;
+    std::atomic<int64_t> total{0};
+    for(int i = 0; i < rounds; ++i) {
+        std::atomic<bool> done{false};
+        auto start = std::chrono::steady_clock::now();
+        iom.schedule([&total, &done, start](){
+            total += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+            done = true;
+        });
+        while(!done) {
+            usleep(10);
+        }
+        usleep(100);
+    }
+    SYLAR_LOG_INFO(g_logger) << "wakeup latency: " << total / rounds / 1000.0 << "us";
+}
+
+// 协程直接等待accept/connect/read/write完成，以及固定缓冲区和注册文件
+void test_await() {
+    sylar::IOManager iom(2, false, "await");
+    std::atomic<int> done{0};
+
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    SYLAR_ASSERT(!bind(lfd, (sockaddr*)&addr, sizeof(addr)));
+    SYLAR_ASSERT(!listen(lfd, 16));
+    socklen_t len = sizeof(addr);
+    getsockname(lfd, (sockaddr*)&addr, &len);
+    fcntl(lfd, F_SETFL, O_NONBLOCK);
+
+    static char s_fixed[2][64];
+    iovec iovs[2] = {{s_fixed[0], 64}, {s_fixed[1], 64}};
+    SYLAR_ASSERT(iom.registerBuffers(iovs, 2));
+
+    iom.schedule([&](){
+        int fd = iom.accept(lfd, nullptr, nullptr);
+        SYLAR_ASSERT(fd >= 0);
+        SYLAR_ASSERT(iom.registerFiles({fd}));
+        ssize_t n = iom.readFixed(fd, s_fixed[0], 64, 0);
+        SYLAR_LOG_INFO(g_logger) << "server read n=" << n;
+        SYLAR_ASSERT(n == 5 && !memcmp(s_fixed[0], "hello", 5));
+        SYLAR_ASSERT(iom.writeFixed(fd, s_fixed[0], n, 0) == n);
+        SYLAR_ASSERT(iom.registerFiles({}));
+        close(fd);
+        ++done;
+    });
+    iom.schedule([&](){
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        SYLAR_ASSERT(!iom.connect(fd, (sockaddr*)&addr, sizeof(addr)));
+        // 先让服务端挂起在读上
+        usleep(50 * 1000);
+        SYLAR_ASSERT(iom.write(fd, "hello", 5) == 5);
+        char buf[64] = {0};
+        ssize_t n = iom.read(fd, buf, sizeof(buf));
+        SYLAR_LOG_INFO(g_logger) << "client read n=" << n << " data=" << buf;
+        SYLAR_ASSERT(n == 5 && !strcmp(buf, "hello"));
+        // 对端关闭后读到EOF
+        n = iom.read(fd, buf, sizeof(buf));
+        SYLAR_ASSERT(n == 0);
+        close(fd);
+        ++done;
+    });
+    iom.stop();
+    SYLAR_ASSERT(done == 2);
+    close(lfd);
+}
+
+// 共享栈协程把栈上的缓冲区交给读写接口，挂起期间同一线程的其他共享栈协程覆盖了这块栈
+void test_shared_stack() {
+    sylar::IOManager iom(1, false, "shared");
+    int fds[2];
+    SYLAR_ASSERT(!pipe2(fds, O_NONBLOCK));
+    std::atomic<int> done{0};
+
+    iom.schedule(sylar::Fiber::ptr(new sylar::Fiber([&](){
+        char buf[64];
+        memset(buf, 'r', sizeof(buf));
+        ssize_t n = iom.read(fds[0], buf, sizeof(buf));
+        SYLAR_LOG_INFO(g_logger) << "shared stack read n=" << n;
+        SYLAR_ASSERT(n == 5 && !memcmp(buf, "hello", 5) && buf[5] == 'r');
+        ++done;
+    }, 0, false, true)));
+    iom.schedule(sylar::Fiber::ptr(new sylar::Fiber([&](){
+        char junk[8192];
+        memset(junk, 'x', sizeof(junk));
+        char msg[] = "hello";
+        SYLAR_ASSERT(iom.write(fds[1], msg, 5) == 5);
+        // 写完立即清掉，对端读到的只能是提交时的内容
+        memset(msg, 0, sizeof(msg));
+        SYLAR_ASSERT(junk[0] == 'x' && junk[sizeof(junk) - 1] == 'x');
+        ++done;
+    }, 0, false, true)));
+    iom.stop();
+    SYLAR_ASSERT(done == 2);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(int argc, char** argv) {
+    SYLAR_LOG_NAME("system")->setLevel(sylar::LogLevel::WARN);
+    // 两种后端跑同一组用例，后端由配置选择
+    for(auto& backend : {"epoll", "io_uring"}) {
+        sylar::Config::Lookup<std::string>("iomanager.backend")->setValue(backend);
+        s_events = 0;
+        test_event();
+        test_timer();
+        test_await();
+        test_shared_stack();
+        test_idle();
+        {
+            sylar::IOManager iom(1, false);
+            SYLAR_LOG_INFO(g_logger) << "backend " << backend << ": "
+                << (iom.getBackend() == sylar::IOManager::URING ? "io_uring" : "epoll");
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "over";
+    return 0;
+}
@@ -1,8 +1,592 @@
 #include<iostream>
+#include<fstream>
+#include<algorithm>
 #include<thread>
+#include<vector>
+#include<atomic>
+#include<unistd.h>
+#include<sys/uio.h>
+#include<sys/wait.h>
+#include<dirent.h>
+#include<zlib.h>
+#include<cmath>
 #include "../sylar/include/log.h"
 #include "../sylar/include/util.h"
+#include "../sylar/include/macro.h"
+
+// 记录后台线程写出的内容，可以模拟慢速的输出
+class MemoryLogAppender : public sylar::LogAppender {
+public:
+    using ptr = std::shared_ptr<MemoryLogAppender>;
+    MemoryLogAppender(uint64_t delay_us = 0) : m_delay(delay_us) {}
+
+    void log(const sylar::Logger::ptr& logger, sylar::LogLevel::Level level, const sylar::LogEvent& event) override {
+        m_data += getFormatter()->format(logger, level, event);
+    }
+    void write(const struct iovec* iov, int iovcnt) override {
+        for(int i = 0; i < iovcnt; ++i) {
+            m_data.append((const char*)iov[i].iov_base, iov[i].iov_len);
+        }
+        if(m_delay) {
+            usleep(m_delay);
+        }
+    }
+    size_t lines() const { return std::count(m_data.begin(), m_data.end(), '\n');}
+    const std::string& getData() const { return m_data;}
+private:
+    uint64_t m_delay;
+    std::string m_data;
+};
+
+// 只统计条数，可以多线程调用
+class CountLogAppender : public sylar::LogAppender {
+public:
+    using ptr = std::shared_ptr<CountLogAppender>;
+    void log(const sylar::Logger::ptr& logger, sylar::LogLevel::Level level, const sylar::LogEvent& event) override {
+        m_bytes += getFormatter()->formatThreadLocal(logger, level, event).size();
+        ++m_count;
+    }
+    void write(const struct iovec* iov, int iovcnt) override {
+    }
+    uint64_t getCount() const { return m_count;}
+private:
+    std::atomic<uint64_t> m_count = {0};
+    std::atomic<uint64_t> m_bytes = {0};
+};
+
+// 输出时不加锁：其他线程写日志的同时增删Appender、替换格式器
+void test_snapshot() {
+    sylar::Logger::ptr logger(new sylar::Logger("snapshot"));
+    CountLogAppender::ptr stable(new CountLogAppender);
+    MemoryLogAppender::ptr own(new MemoryLogAppender);
+    own->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("own:%m%n")));
+    logger->addAppender(stable);
+    logger->addAppender(own);
+    // Appender跟随Logger的格式，单独设置过的不受影响
+    logger->setFormatter("%p|%m%n");
+    SYLAR_ASSERT(stable->getFormatter() == logger->getFormatter());
+    SYLAR_ASSERT(own->getFormatter() != logger->getFormatter());
+    logger->delAppender(own);
+
+    const int threads = 4;
+    const int lines = 20000;
+    std::atomic<int> running = {threads};
+    std::vector<std::thread> ths;
+    for(int i = 0; i < threads; ++i) {
+        ths.emplace_back([logger, &running](){
+            for(int j = 0; j < lines; ++j) {
+                SYLAR_LOG_INFO(logger) << "line " << j;
+            }
+            --running;
+        });
+    }
+    uint64_t swaps = 0;
+    while(running) {
+        CountLogAppender::ptr tmp(new CountLogAppender);
+        logger->addAppender(tmp);
+        logger->setFormatter(swaps % 2 ? "%m%n" : "%p %m%n");
+        logger->delAppender(tmp);
+        ++swaps;
+    }
+    for(auto& i : ths) {
+        i.join();
+    }
+    std::cout << "snapshot swaps=" << swaps << " count=" << stable->getCount() << std::endl;
+    SYLAR_ASSERT(stable->getCount() == (uint64_t)threads * lines);
+}
+
+static void log_debug(sylar::Logger::ptr logger, int i) {
+    SYLAR_LOG_DEBUG(logger) << "debug " << i;
+}
+
+static void log_level(sylar::Logger::ptr logger, sylar::LogLevel::Level level) {
+    SYLAR_LOG_LEVEL(logger, level) << "level " << level;
+}
+
+// 调用点缓存的判断结果在级别修改、Logger更换时失效
+void test_site() {
+#if SYLAR_MIN_LOG_LEVEL > 1
+    // DEBUG语句在编译期已经去掉
+    return;
+#endif
+    CountLogAppender::ptr count(new CountLogAppender);
+    sylar::Logger::ptr logger(new sylar::Logger("site"));
+    logger->addAppender(count);
+    logger->setLevel(sylar::LogLevel::WARN);
+    for(int i = 0; i < 10; ++i) {
+        log_debug(logger, i);
+    }
+    SYLAR_ASSERT(count->getCount() == 0);
+    logger->setLevel(sylar::LogLevel::DEBUG);
+    log_debug(logger, 0);
+    SYLAR_ASSERT(count->getCount() == 1);
+    logger->setLevel(sylar::LogLevel::INFO);
+    log_debug(logger, 0);
+    SYLAR_ASSERT(count->getCount() == 1);
+
+    // 同一个调用点交替使用两个级别不同的Logger
+    sylar::Logger::ptr other(new sylar::Logger("site2"));
+    other->addAppender(count);
+    for(int i = 0; i < 10; ++i) {
+        log_debug(logger, i);
+        log_debug(other, i);
+    }
+    SYLAR_ASSERT(count->getCount() == 11);
+
+    // 同一个调用点使用不同的级别
+    log_level(logger, sylar::LogLevel::DEBUG);
+    log_level(logger, sylar::LogLevel::ERROR);
+    log_level(logger, sylar::LogLevel::DEBUG);
+    SYLAR_ASSERT(count->getCount() == 12);
+
+    // Logger析构之后新的Logger可能复用同一个地址
+    for(int i = 0; i < 10; ++i) {
+        sylar::Logger::ptr tmp(new sylar::Logger("tmp"));
+        tmp->addAppender(count);
+        tmp->setLevel(i % 2 ? sylar::LogLevel::DEBUG : sylar::LogLevel::ERROR);
+        log_level(tmp, sylar::LogLevel::INFO);
+    }
+    SYLAR_ASSERT(count->getCount() == 17);
+}
+
+// 限流：三种方式的输出条数，多线程下计数准确，被抑制的条数汇总输出
+void test_limiter() {
+    CountLogAppender::ptr count(new CountLogAppender);
+    sylar::Logger::ptr logger(new sylar::Logger("limiter"));
+    logger->addAppender(count);
+    for(int i = 0; i < 100; ++i) {
+        SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::INFO, 10) << "every " << i;
+    }
+    SYLAR_ASSERT(count->getCount() == 10);
+    for(int i = 0; i < 100; ++i) {
+        SYLAR_LOG_FIRST_N(logger, sylar::LogLevel::INFO, 5) << "first " << i;
+    }
+    SYLAR_ASSERT(count->getCount() == 15);
+    // 级别不够的语句不计数
+    logger->setLevel(sylar::LogLevel::ERROR);
+    for(int i = 0; i < 100; ++i) {
+        SYLAR_LOG_FIRST_N(logger, sylar::LogLevel::INFO, 5) << "first " << i;
+    }
+    SYLAR_ASSERT(count->getCount() == 15);
+    logger->setLevel(sylar::LogLevel::DEBUG);
+
+    const int threads = 4;
+    const int lines = 10000;
+    std::vector<std::thread> ths;
+    for(int i = 0; i < threads; ++i) {
+        ths.emplace_back([logger](){
+            for(int j = 0; j < lines; ++j) {
+                SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::INFO, 100) << "storm " << j;
+            }
+        });
+    }
+    for(auto& i : ths) {
+        i.join();
+    }
+    SYLAR_ASSERT(count->getCount() == 15 + threads * lines / 100);
+
+    // 每秒最多3条，下一秒恢复输出并汇总上一秒被抑制的条数
+    MemoryLogAppender::ptr mem(new MemoryLogAppender);
+    sylar::Logger::ptr rate(new sylar::Logger("rate"));
+    rate->setFormatter("%m%n");
+    rate->addAppender(mem);
+    auto storm = [rate](int n) {
+        for(int i = 0; i < n; ++i) {
+            SYLAR_LOG_PER_SECOND(rate, sylar::LogLevel::ERROR, 3) << "error " << i;
+        }
+    };
+    // 对齐到秒的开头，避免跨秒
+    uint64_t now = sylar::GetMonotonicCoarseMS();
+    usleep((1000 - now % 1000 + 50) * 1000);
+    storm(100);
+    SYLAR_ASSERT(mem->lines() == 3);
+    usleep(1100 * 1000);
+    storm(1);
+    std::cout << "limiter per_second=" << mem->lines() << std::endl;
+    SYLAR_ASSERT(mem->lines() == 5);
+    SYLAR_ASSERT(mem->getData().find("suppressed 97 similar messages\nerror 0\n") != std::string::npos);
+
+    // 风暴结束后调用点不再执行，最后被抑制的条数由后台线程汇总
+    storm(100);
+    SYLAR_ASSERT(mem->lines() == 7);
+    usleep(2500 * 1000);
+    std::cout << "limiter flushed=" << mem->lines() << std::endl;
+    SYLAR_ASSERT(mem->lines() == 8);
+    SYLAR_ASSERT(mem->getData().find("error 1\nsuppressed 98 similar messages\n") != std::string::npos);
+}
+
+// mmap环形日志：子进程写完直接退出不做任何清理，父进程仍能读出所有日志；写满之后覆盖最旧的记录
+void test_mmap() {
+    std::string filename = "/tmp/sylar_mmap_" + std::to_string(getpid()) + ".log";
+    unlink(filename.c_str());
+    pid_t pid = fork();
+    if(pid == 0) {
+        sylar::MmapLogAppender::ptr mmap_appender(new sylar::MmapLogAppender(filename, 1 << 20));
+        sylar::Logger::ptr logger(new sylar::Logger("mmap"));
+        logger->setFormatter("%m%n");
+        logger->addAppender(mmap_appender);
+        for(int i = 0; i < 1000; ++i) {
+            SYLAR_LOG_INFO(logger) << "line " << i;
+        }
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    std::vector<std::string> records;
+    auto collect = [&records](const char* data, size_t len) {
+        records.push_back(std::string(data, len));
+    };
+    size_t skipped = 0;
+    sylar::MmapLogReader reader(filename);
+    SYLAR_ASSERT(reader.isValid());
+    SYLAR_ASSERT(reader.read(collect, &skipped) == 1000);
+    SYLAR_ASSERT(skipped == 0);
+    for(int i = 0; i < 1000; ++i) {
+        SYLAR_ASSERT(records[i] == "line " + std::to_string(i) + "\n");
+    }
+
+    // 容量不同，重新初始化；多线程写满多圈
+    sylar::MmapLogAppender::ptr ring(new sylar::MmapLogAppender(filename, 8192));
+    SYLAR_ASSERT(ring->isValid() && ring->getTail() == 0);
+    sylar::Logger::ptr logger(new sylar::Logger("mmap"));
+    logger->setFormatter("%m%n");
+    logger->addAppender(ring);
+    const int threads = 4;
+    const int lines = 2000;
+    std::vector<std::thread> ths;
+    for(int i = 0; i < threads; ++i) {
+        ths.emplace_back([logger, i](){
+            for(int j = 0; j < lines; ++j) {
+                SYLAR_LOG_INFO(logger) << i << " " << j;
+            }
+        });
+    }
+    for(auto& i : ths) {
+        i.join();
+    }
+    uint64_t tail = ring->getTail();
+    logger.reset();
+    ring.reset();
+
+    records.clear();
+    size_t count = sylar::MmapLogReader(filename).read(collect, &skipped);
+    std::cout << "mmap records=" << count << " skipped=" << skipped << " tail=" << tail << std::endl;
+    SYLAR_ASSERT(count > 0 && count < (size_t)threads * lines);
+    SYLAR_ASSERT(skipped == 0);
+    // 每个线程的记录顺序不变，最后一条是最后结束的线程的最后一行，读出的数据接近整个容量
+    std::vector<int> last(threads, -1);
+    size_t bytes = 0;
+    for(auto& r : records) {
+        int t = 0, j = 0;
+        SYLAR_ASSERT(sscanf(r.c_str(), "%d %d", &t, &j) == 2);
+        SYLAR_ASSERT(j > last[t]);
+        last[t] = j;
+        bytes += r.size();
+    }
+    SYLAR_ASSERT(records.back().find(" " + std::to_string(lines - 1) + "\n") != std::string::npos);
+    SYLAR_ASSERT(bytes + count * sylar::MmapLogAppender::RECORD_HEADER_SIZE > 8192 / 2);
+
+    // 同样容量的文件接着原来的位置写
+    ring.reset(new sylar::MmapLogAppender(filename, 8192));
+    SYLAR_ASSERT(ring->getTail() == tail);
+    ring.reset();
+    unlink(filename.c_str());
+}
+
+// 多线程写入异步Appender，flush之后所有日志都已经写出
+void test_async() {
+    MemoryLogAppender::ptr mem(new MemoryLogAppender);
+    sylar::AsyncLogAppender::ptr async(new sylar::AsyncLogAppender(mem, sylar::AsyncLogAppender::BLOCK, 4096, 2));
+    sylar::Logger::ptr logger(new sylar::Logger("async"));
+    logger->setFormatter("%p%T%m%n");
+    logger->addAppender(async);
+
+    const int threads = 4;
+    const int lines = 10000;
+    std::vector<std::thread> ths;
+    for(int i = 0; i < threads; ++i) {
+        ths.emplace_back([logger, i](){
+            for(int j = 0; j < lines; ++j) {
+                SYLAR_LOG_INFO(logger) << "thread " << i << " line " << j;
+            }
+        });
+    }
+    for(auto& i : ths) {
+        i.join();
+    }
+    async->flush();
+    std::cout << "async written=" << mem->lines() << " writes=" << async->getWriteCount()
+              << " pending=" << async->getPendingRecords() << " dropped=" << async->getDropped() << std::endl;
+    SYLAR_ASSERT(mem->lines() == (size_t)threads * lines);
+    SYLAR_ASSERT(async->getPendingRecords() == 0);
+    SYLAR_ASSERT(async->getDropped() == 0);
+    // 小缓冲区下多条日志合并成一次写出
+    SYLAR_ASSERT(async->getWriteCount() < (uint64_t)threads * lines / 10);
+
+    // 输出跟不上时DROP策略丢弃，DROP_DEBUG只丢弃DEBUG
+    MemoryLogAppender::ptr slow(new MemoryLogAppender(20 * 1000));
+    sylar::AsyncLogAppender::ptr drop(new sylar::AsyncLogAppender(slow, sylar::AsyncLogAppender::DROP_DEBUG, 1024, 2));
+    logger->delAppender(async);
+    logger->addAppender(drop);
+    for(int i = 0; i < 2000; ++i) {
+        SYLAR_LOG_DEBUG(logger) << "debug " << i;
+    }
+    uint64_t dropped = drop->getDropped();
+    for(int i = 0; i < 200; ++i) {
+        SYLAR_LOG_ERROR(logger) << "error " << i;
+    }
+    drop->stop();
+    std::cout << "drop_debug dropped=" << dropped << " written=" << slow->lines() << std::endl;
+    SYLAR_ASSERT(dropped > 0);
+    SYLAR_ASSERT(drop->getDropped() == dropped);
+    SYLAR_ASSERT(slow->lines() == 2000 - dropped + 200);
+
+    // 停止之后仍持有该Appender的Logger写入的日志计入丢弃
+    SYLAR_LOG_ERROR(logger) << "after stop";
+    SYLAR_ASSERT(drop->getDropped() == dropped + 1);
+    SYLAR_ASSERT(drop->getPendingRecords() == 0);
+    SYLAR_ASSERT(slow->lines() == 2000 - dropped + 200);
+}
+
+// 按大小滚动：历史文件被压缩，只保留max_files个，滚动期间没有丢失日志
+void test_rolling() {
+    std::string dir = "/tmp/sylar_rolling_" + std::to_string(getpid());
+    std::string cmd = "rm -rf " + dir + " && mkdir -p " + dir;
+    SYLAR_ASSERT(!system(cmd.c_str()));
+    std::string filename = dir + "/roll.log";
+
+    sylar::RollingFileLogAppender::ptr roll(new sylar::RollingFileLogAppender(filename
+                , sylar::RollingFileLogAppender::NEVER, 64 * 1024, 1000, true));
+    roll->setFsync(sylar::RollingFileLogAppender::FSYNC_BYTES, 256 * 1024);
+    sylar::Logger::ptr logger(new sylar::Logger("rolling"));
+    logger->setFormatter("%p%T%m%n");
+    logger->addAppender(roll);
+
+    const int threads = 4;
+    const int lines = 5000;
+    std::vector<std::thread> ths;
+    for(int i = 0; i < threads; ++i) {
+        ths.emplace_back([logger, i](){
+            for(int j = 0; j < lines; ++j) {
+                SYLAR_LOG_INFO(logger) << "thread " << i << " line " << j;
+            }
+        });
+    }
+    for(auto& i : ths) {
+        i.join();
+    }
+    roll->roll();
+    roll->stop();
+
+    // 所有文件解压后的行数等于写入的行数
+    size_t total = 0;
+    size_t gz_files = 0;
+    std::vector<std::string> names;
+    DIR* d = opendir(dir.c_str());
+    while(struct dirent* ent = readdir(d)) {
+        std::string name = ent->d_name;
+        if(name[0] != '.') {
+            names.push_back(name);
+        }
+    }
+    closedir(d);
+    for(auto& name : names) {
+        gzFile gz = gzopen((dir + "/" + name).c_str(), "rb");
+        SYLAR_ASSERT(gz);
+        char buf[4096];
+        int n;
+        while((n = gzread(gz, buf, sizeof(buf))) > 0) {
+            total += std::count(buf, buf + n, '\n');
+        }
+        gzclose(gz);
+        if(name.size() > 3 && name.substr(name.size() - 3) == ".gz") {
+            ++gz_files;
+        }
+    }
+    std::cout << "rolling rolls=" << roll->getRollCount() << " syncs=" << roll->getSyncCount()
+              << " files=" << names.size() << " gz=" << gz_files << " lines=" << total << std::endl;
+    SYLAR_ASSERT(total == (size_t)threads * lines);
+    SYLAR_ASSERT(roll->getRollCount() > 1);
+    SYLAR_ASSERT(roll->getSyncCount() > 0);
+    SYLAR_ASSERT(gz_files + 1 == names.size());
+
+    // 重新打开时加载已有的历史文件并按数量删除
+    roll.reset(new sylar::RollingFileLogAppender(filename, sylar::RollingFileLogAppender::NEVER, 0, 2, true));
+    roll->roll();
+    roll->stop();
+    names.clear();
+    d = opendir(dir.c_str());
+    while(struct dirent* ent = readdir(d)) {
+        if(ent->d_name[0] != '.') {
+            names.push_back(ent->d_name);
+        }
+    }
+    closedir(d);
+    SYLAR_ASSERT(names.size() == 3);
+    cmd = "rm -rf " + dir;
+    SYLAR_ASSERT(!system(cmd.c_str()));
+}
+
+// 编译后的格式器和strftime逐秒对比，包括只改写秒的缓存路径
+void test_formatter() {
+    sylar::Logger::ptr logger(new sylar::Logger("fmt"));
+    sylar::LogFormatter::ptr fmt(new sylar::LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T[%p]%T[%c]%T%t %F %N%T%f:%l%T%m %% %n"));
+    sylar::LogFormatter::ptr fmt2(new sylar::LogFormatter("%d{%H:%M:%S %s}|%d|%d{%b}"));
+    SYLAR_ASSERT(!fmt->isError() && !fmt2->isError());
+    SYLAR_ASSERT(sylar::LogFormatter("%x %m").isError());
+
+    time_t start = time(0) - 3600;
+    for(time_t t = start; t < start + 200; t += (t % 7 == 0 ? 61 : 1)) {
+        sylar::LogEvent event(logger, sylar::LogLevel::WARN, "file.cpp", 123, 0, 4567, 89, t, "worker");
+        event.getSS() << "hello " << 42;
+        char date[64];
+        char secs[64];
+        char mon[64];
+        struct tm tm;
+        localtime_r(&t, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+        strftime(secs, sizeof(secs), "%H:%M:%S %s", &tm);
+        strftime(mon, sizeof(mon), "%b", &tm);
+        std::string expect = std::string(date) + "\t[WARN]\t[fmt]\t4567 89 worker\tfile.cpp:123\thello 42 % \n";
+        SYLAR_ASSERT(fmt->format(logger, sylar::LogLevel::WARN, event) == expect);
+        expect = std::string(secs) + "|" + date + "|" + mon;
+        SYLAR_ASSERT(fmt2->format(logger, sylar::LogLevel::WARN, event) == expect);
+    }
+
+    // 秒以下的部分：换秒走缓存和完整渲染两条路径，每条日志都重新填写
+    sylar::LogFormatter::ptr sub(new sylar::LogFormatter("%d{%S.%3N|%6N|%N|%1N|%%N}"));
+    for(time_t t = start; t < start + 70; t += 3) {
+        sylar::LogEvent event(logger, sylar::LogLevel::INFO, "file.cpp", 1, 0, 1, 1, 0, "worker");
+        uint32_t nsec = (t * 7919) % 1000000000;
+        event.setTimeNS(t * 1000000000ull + nsec);
+        SYLAR_ASSERT(event.getTime() == (uint64_t)t && event.getNanoseconds() == nsec);
+        char expect[64];
+        snprintf(expect, sizeof(expect), "%02d.%03u|%06u|%09u|%u|%%N", (int)(t % 60)
+                , nsec / 1000000, nsec / 1000, nsec, nsec / 100000000);
+        SYLAR_ASSERT(sub->format(logger, sylar::LogLevel::INFO, event) == expect);
+    }
+}
+
+// 参照实现：逐字节转义
+static std::string json_escape_ref(const std::string& s) {
+    std::string out;
+    char buf[8];
+    for(unsigned char c : s) {
+        if(c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if(c == '\n') {
+            out += "\\n";
+        } else if(c == '\r') {
+            out += "\\r";
+        } else if(c == '\t') {
+            out += "\\t";
+        } else if(c < 0x20) {
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+// 结构化字段：JSON和logfmt的精确输出、转义，以及%m后面追加字段
+void test_kv() {
+    sylar::Logger::ptr logger(new sylar::Logger("kv"));
+    // 日期格式里没有转换符，输出固定
+    sylar::LogFormatter::ptr json(new sylar::LogFormatter("%J{T}%n"));
+    sylar::LogFormatter::ptr logfmt(new sylar::LogFormatter("%K{T}%n"));
+    sylar::LogFormatter::ptr plain(new sylar::LogFormatter("[%p] %m%n"));
+    SYLAR_ASSERT(!json->isError() && !logfmt->isError() && !plain->isError());
+
+    sylar::LogEvent event(logger, sylar::LogLevel::INFO, "a.cpp", 7, 0, 12, 3, time(0), "main");
+    event.getSS() << "request done";
+    sylar::LogField fields[7];
+    sylar::SetLogField(fields[0], -42);
+    fields[0].key = "latency_us";
+    sylar::SetLogField(fields[1], 18446744073709551615ull);
+    fields[1].key = "big";
+    sylar::SetLogField(fields[2], 1.5);
+    fields[2].key = "ratio";
+    sylar::SetLogField(fields[3], true);
+    fields[3].key = "ok";
+    sylar::SetLogField(fields[4], "GET /a b");
+    fields[4].key = "path";
+    sylar::SetLogField(fields[5], std::string_view("x\"y"));
+    fields[5].key = "q";
+    sylar::SetLogField(fields[6], std::nan(""));
+    fields[6].key = "nan";
+    event.setFields(fields, 7);
+
+    std::string expect = "{\"time\":\"T\",\"level\":\"INFO\",\"logger\":\"kv\",\"thread\":12,\"thread_name\":\"main\""
+                         ",\"fiber\":3,\"file\":\"a.cpp\",\"line\":7,\"msg\":\"request done\",\"latency_us\":-42"
+                         ",\"big\":18446744073709551615,\"ratio\":1.5,\"ok\":true,\"path\":\"GET /a b\",\"q\":\"x\\\"y\""
+                         ",\"nan\":null}\n";
+    SYLAR_ASSERT(json->format(logger, sylar::LogLevel::INFO, event) == expect);
+    expect = "time=T level=INFO logger=kv thread=12 thread_name=main fiber=3 file=a.cpp line=7 msg=\"request done\""
+             " latency_us=-42 big=18446744073709551615 ratio=1.5 ok=true path=\"GET /a b\" q=\"x\\\"y\" nan=nan\n";
+    SYLAR_ASSERT(logfmt->format(logger, sylar::LogLevel::INFO, event) == expect);
+    expect = "[INFO] request done latency_us=-42 big=18446744073709551615 ratio=1.5 ok=true path=\"GET /a b\""
+             " q=\"x\\\"y\" nan=nan\n";
+    SYLAR_ASSERT(plain->format(logger, sylar::LogLevel::INFO, event) == expect);
+
+    // 通过宏：值可以是临时对象，输出时它们还活着
+    MemoryLogAppender::ptr mem(new MemoryLogAppender);
+    mem->setFormatter(json);
+    logger->addAppender(mem);
+    int fd = 5;
+    const char* null_str = nullptr;
+    SYLAR_LOG_KV(logger, INFO, "accept", "fd", fd, "peer", std::string("10.0.0.1:80"), "user", null_str);
+    SYLAR_LOG_KV(logger, DEBUG, "no fields");
+    logger->setLevel(sylar::LogLevel::WARN);
+    SYLAR_LOG_KV(logger, INFO, "filtered", "fd", fd);
+    logger->setLevel(sylar::LogLevel::DEBUG);
+    std::string data = mem->getData();
+    SYLAR_ASSERT(mem->lines() == 2);
+    SYLAR_ASSERT(data.find("\"msg\":\"accept\",\"fd\":5,\"peer\":\"10.0.0.1:80\",\"user\":\"(null)\"}\n") != std::string::npos);
+    SYLAR_ASSERT(data.find("\"level\":\"DEBUG\"") != std::string::npos);
+    SYLAR_ASSERT(data.find("\"msg\":\"no fields\"}\n") != std::string::npos);
+    SYLAR_ASSERT(data.find("filtered") == std::string::npos);
+    logger->delAppender(mem);
+
+    // 随机字符串(含控制字符、引号、反斜杠和UTF-8)和逐字节的参照实现对比，覆盖8字节整块和尾部
+    sylar::LogFormatter::ptr msg_only(new sylar::LogFormatter("%J{T}"));
+    std::string prefix = "{\"time\":\"T\",\"level\":\"INFO\",\"logger\":\"kv\",\"thread\":12,\"thread_name\":\"main\""
+                         ",\"fiber\":3,\"file\":\"a.cpp\",\"line\":7,\"msg\":\"\",\"s\":\"";
+    const char alphabet[] = "ab\"\\\n\r\t\x01\x1f =\xe4\xbd\xa0\x7f";
+    srand(1);
+    for(int i = 0; i < 2000; ++i) {
+        std::string str;
+        size_t len = rand() % 40;
+        for(size_t j = 0; j < len; ++j) {
+            str += rand() % 3 ? 'a' + rand() % 26 : alphabet[rand() % (sizeof(alphabet) - 1)];
+        }
+        sylar::LogEvent ev(logger, sylar::LogLevel::INFO, "a.cpp", 7, 0, 12, 3, time(0), "main");
+        sylar::LogField field;
+        sylar::SetLogField(field, str);
+        field.key = "s";
+        ev.setFields(&field, 1);
+        SYLAR_ASSERT(msg_only->format(logger, sylar::LogLevel::INFO, ev) == prefix + json_escape_ref(str) + "\"}");
+
+        // logfmt只在需要时加引号
+        bool bare = !str.empty() && str.find_first_of(std::string(" \"=\\\x01\x1f\n\r\t", 9)) == std::string::npos;
+        std::string value = bare ? str : "\"" + json_escape_ref(str) + "\"";
+        sylar::LogFormatter::ptr kv_only(new sylar::LogFormatter("%m"));
+        SYLAR_ASSERT(kv_only->format(logger, sylar::LogLevel::INFO, ev) == " s=" + value);
+    }
+}
+
 int main(int argc, char** argv) {
+    test_formatter();
+    test_kv();
+    test_snapshot();
+    test_site();
+    test_limiter();
+    test_mmap();
+    test_async();
+    test_rolling();
+
     sylar::Logger::ptr logger(new sylar::Logger);   // new logger -> new formatter -> init()
     logger->addAppender(sylar::LogAppender::ptr(new sylar::StdoutLogAppender)); // 添加控制台输出地
     sylar::FileLogAppender::ptr file_appender(new sylar::FileLogAppender("../log.txt"));
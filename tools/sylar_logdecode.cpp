@@ -0,0 +1,36 @@
+#include "../sylar/include/binlog.h"
+#include <iostream>
+
+/*
+    把BinLog写出的二进制日志还原成文本
+    sylar_logdecode <file> [pattern]
+    pattern和LogFormatter相同，默认和Logger的默认格式一致
+*/
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <file> [pattern]" << std::endl;
+        return 1;
+    }
+    std::string pattern = "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%T%f:%l%T%m%n";
+    if(argc > 2) {
+        pattern = argv[2];
+    }
+    sylar::LogFormatter::ptr formatter(new sylar::LogFormatter(pattern));
+    if(formatter->isError()) {
+        std::cerr << "invalid pattern: " << pattern << std::endl;
+        return 1;
+    }
+    sylar::BinLogReader reader(argv[1]);
+    if(!reader.isValid()) {
+        std::cerr << argv[1] << " is not a binlog file" << std::endl;
+        return 1;
+    }
+
+    bool ok = reader.format(formatter, std::cout);
+    std::cout.flush();
+    if(!ok) {
+        std::cerr << argv[1] << ": truncated or corrupted" << std::endl;
+        return 2;
+    }
+    return 0;
+}
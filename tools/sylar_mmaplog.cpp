@@ -0,0 +1,27 @@
+#include "../sylar/include/log.h"
+#include <iostream>
+
+/*
+    读出MmapLogAppender文件中的日志，按写入顺序输出到标准输出
+    sylar_mmaplog <file>
+    进程崩溃之后也可以读，写到一半的记录会被跳过并在标准错误中提示
+*/
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        std::cerr << "usage: " << argv[0] << " <file>" << std::endl;
+        return 1;
+    }
+    sylar::MmapLogReader reader(argv[1]);
+    if(!reader.isValid()) {
+        std::cerr << argv[1] << " is not a mmap log file" << std::endl;
+        return 1;
+    }
+    size_t skipped = 0;
+    size_t count = reader.read([](const char* data, size_t len) {
+        std::cout.write(data, len);
+    }, &skipped);
+    std::cout.flush();
+    std::cerr << argv[1] << ": " << count << " records, " << skipped << " incomplete"
+              << ", capacity=" << reader.getCapacity() << " written=" << reader.getTail() << std::endl;
+    return 0;
+}